@@ -44,9 +44,29 @@
 //------------------------------------------------------------------------------
 #include "chai3d.h"
 #include "UsartDevice.h"
+#include "DeviceManager.h"
+#include "LaunchProfile.h"
+#include "HapticToolPool.h"
+#include "GuardedWorld.h"
+#include "ShaftTool.h"
+#include "BroadphaseGroup.h"
+#include "LocalContactModel.h"
+#include "DeformableTissue.h"
+#include "Trace.h"
+#include "SceneSnapshot.h"
+#include "ViewRecorder.h"
+#include "VideoTexture.h"
+#include "SessionRecorder.h"
+#include "SessionAnalytics.h"
+#include "PoseBroadcast.h"
+#include "AllocationGuard.h"
+#include "SimulationClock.h"
 //------------------------------------------------------------------------------
 #include <GLFW/glfw3.h>
 //------------------------------------------------------------------------------
+#include <atomic>
+#include <future>
+//------------------------------------------------------------------------------
 using namespace chai3d;
 using namespace std;
 //------------------------------------------------------------------------------
@@ -76,23 +96,63 @@ cDirectionalLight *light;
 // a few mesh objects
 cMesh* heart;
 
-// a virtual object
+// the anatomy the tools can touch, behind a broadphase index
+BroadphaseGroup* anatomy;
+
+// the solver of the heart tissue, when it is deformable
+DeformableTissue* tissue = NULL;
+
+// the rendered copy of a deformable heart; the heart itself is only touched by the proxies
+cMesh* heartSkin = NULL;
+
+// footage played on the heart instead of its still texture, when the profile gives one
+VideoTexture* video = NULL;
+
+// what the graphics thread shows of the tools, captured by the haptics thread
+SceneSnapshot* sceneView;
+
+// a virtual object, the tool image; holds the scope model and its camera
 cMultiMesh* scope;
 
+// the scope model, attached to the scope once loaded
+cMultiMesh* scopeModel = NULL;
+
 // a haptic device handler
 //RONNY: cHapticDeviceHandler* handler;
 
 // a pointer to the current haptic device
 cGenericHapticDevicePtr hapticDevice;
 
+// the same device, to change its parameters while the simulation runs
+UsartDevicePtr usartDevice;
+
 // a label to display the position [m] of the haptic device
 cLabel* labelHapticDevicePosition;
 
 // a global variable to store the position [m] of the haptic device
 cVector3d hapticDevicePosition;
 
-// a virtual tool representing the haptic device in the scene
-cToolCursor* tool;
+// a virtual tool representing the haptic device in the scene: a cursor, or a shaft (ShaftTool)
+cGenericTool* tool;
+
+// the same tool when it is a shaft, NULL otherwise
+ShaftTool* shaft = NULL;
+
+// workers computing the points of the shaft, when the tools are not already computed in parallel
+SpinWorkerPool shaftWorkers;
+
+// two-rate mode: collisions of the tool in their own thread, forces rendered from a local contact model
+LocalContactModel* contactModel = NULL;
+
+// more instruments (bimanual training), with their tools
+vector<UsartDevicePtr> extraDevices;
+vector<cToolCursor*> extraTools;
+
+// reads the ports of the extra instruments, all in one thread
+DeviceManager deviceManager;
+
+// runs the tools of all instruments each haptic tick
+HapticToolPool toolPool;
 
 // a colored background
 cBackground* background;
@@ -134,6 +194,43 @@ int swapInterval = 1;
 // root resource path
 string resourceRoot;
 
+// timeline of the threads, see Trace.h
+const char* TRACE_FILE = "18-endoscope.trace.json";
+
+// recordings of the endoscope view, see ViewRecorder.h; numbered from 1 in each run
+const char* RECORD_FILE = "18-endoscope.view";
+ViewRecorder recorder;
+int recordings = 0;
+
+// the processed state of every haptic tick, see SessionRecorder.h
+const char* SESSION_FILE = "18-endoscope.session";
+SessionRecorder* session = NULL;
+
+// a recorded session played back as the device input; a replay records its own session to the second file
+SessionReplay* replay = NULL;
+const char* REPLAY_SESSION_FILE = "18-endoscope.replay.session";
+
+// the pose of the first device, published to observer processes, see PoseBroadcast.h
+const char* POSE_BROADCAST_NAME = "18-endoscope.pose";
+PoseBroadcaster broadcaster;
+
+// time of the simulation: the wall clock, or fixed steps in a headless run, see SimulationClock.h
+SimulationClock simulationClock;
+
+// startup settings (launch profile and command line)
+LaunchProfile profile;
+
+// a clock started at launch, to report the startup times
+cPrecisionClock startupClock;
+
+// assets loaded by worker threads while the device is opened and the windows are up
+std::future<cTexture2dPtr> heartTextureLoad;
+std::future<cMultiMesh*> scopeModelLoad;
+std::future<cBackground*> frontgroundLoad;
+
+// set by the main loop once all assets are in the scene; the haptic loop waits for it
+std::atomic<bool> sceneReady(false);
+
 
 //------------------------------------------------------------------------------
 // DECLARED MACROS
@@ -168,9 +265,27 @@ void updateGraphics1(void);
 // this function contains the main haptics simulation loop
 void updateHaptics(void);
 
+// this function attaches the assets that finished loading to the scene
+void updateAssets(void);
+
+// this function brings the heart to the newest shape of the tissue solver
+void applyTissue(void* context);
+
+// this function writes the trace of the threads
+void writeTrace(void);
+
+// this function starts recording the endoscope view, or stops and closes the recording
+void toggleRecording(void);
+
+// this function opens the two windows and their display contexts
+bool createWindows(void);
+
 // this function closes the application
 void close(void);
 
+// this function runs the checks of test.cpp and returns the number that failed
+int runSelfTests(void);
+
 
 //==============================================================================
 /*
@@ -201,129 +316,283 @@ int main(int argc, char* argv[])
 	cout << "3- Wait until the blue LED stops blinking on the ring" << endl;
 	cout << "4- See the red LED is blinking on the serial device connected to computer"<< endl;
 	cout << "-----------------------------------" << endl << endl << endl;
-
-
-    // parse first arg to try and locate resources
-    resourceRoot = string(argv[0]).substr(0,string(argv[0]).find_last_of("/\\")+1);
-
-
-    //--------------------------------------------------------------------------
-    // OPEN GL - WINDOW DISPLAY
-    //--------------------------------------------------------------------------
-    
-    // initialize GLFW library
-    if (!glfwInit())
+	cout << "Keyboard Options:" << endl << endl;
+	cout << "[up/down]    - Angle scale (rotations slower/faster)" << endl;
+	cout << "[right/left] - Zoom scale (zoom slower/faster)" << endl;
+	cout << "[p] - Invert polarity of translations" << endl;
+	cout << "[z] - Invert polarity of zoom" << endl;
+	cout << "[t] - Start/stop tracing the threads (written to " << TRACE_FILE << ")" << endl;
+	cout << "[v] - Start/stop recording the endoscope view (to " << RECORD_FILE << "<n>.y4m)" << endl;
+	cout << "[q] - Exit application" << endl;
+	cout << endl << endl;
+
+
+    // read the launch profile and the command line overrides
+    for (int i = 1; i < argc; i++)
     {
-        cout << "failed initialization" << endl;
+        if ((string(argv[i]) == "--help") || (string(argv[i]) == "-h"))
+        {
+            LaunchProfile::printUsage();
+            return 0;
+        }
+    }
+    if (!profile.parseArguments(argc, argv))
+    {
+        cout << endl;
+        LaunchProfile::printUsage();
         cSleepMs(1000);
         return 1;
     }
+    cout << "Settings:" << endl;
+    profile.print();
+    cout << endl;
 
-    // set error callback
-    glfwSetErrorCallback(errorCallback);
+    // grade recorded sessions instead of starting the simulation
+    if (!profile.analyze.empty())
+    {
+        vector<string> sessions;
+        size_t begin = 0;
+        while (begin <= profile.analyze.size())
+        {
+            size_t end = profile.analyze.find(',', begin);
+            if (end == string::npos)
+            {
+                end = profile.analyze.size();
+            }
+            if (end > begin)
+            {
+                sessions.push_back(profile.analyze.substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+        SessionAnalytics analytics(profile.getDeviceConfig());
+        analytics.run(sessions, profile.analyze_threads);
+        analytics.printMetrics();
+        analytics.printStatistics();
+        return 0;
+    }
 
-    // compute desired size of window
-    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
-    int space = 10;
-    int w = 0.5 * mode->height;
-    int h = 0.5 * mode->height;
-    int x0 = 0.5 * mode->width - w - space;
-    int y0 = 0.5 * (mode->height - h);
-    int x1 = 0.5 * mode->width + space;
-    int y1 = 0.5 * (mode->height - h);
+    // print the poses of a running simulation instead of starting one
+    if (profile.observe)
+    {
+        PoseObserver observer;
+        if (!observer.open(POSE_BROADCAST_NAME))
+        {
+            cout << "Error - no simulation publishes its poses (broadcast = true)" << endl;
+            cSleepMs(1000);
+            return 1;
+        }
+        cout << "time,angle_x,angle_y,angle_z,position_x,position_y,position_z" << endl;
+        unsigned long long poses = 0, skipped = 0;
+        cPrecisionClock observeClock;
+        observeClock.start(true);
+        bool writing = true;
+        while (writing && ((profile.run_time <= 0.0) || (observeClock.getCurrentTimeSeconds() < profile.run_time)))
+        {
+            writing = observer.isWriting();  // before the last poses are read, so none is missed at the end
+            UsartPose pose;
+            while (observer.next(pose, skipped))
+            {
+                cout << cStr(pose.time, 6) << "," << cStr(pose.angle.x(), 6) << "," << cStr(pose.angle.y(), 6) << "," << cStr(pose.angle.z(), 6)
+                    << "," << cStr(pose.position.x(), 6) << "," << cStr(pose.position.y(), 6) << "," << cStr(pose.position.z(), 6) << "\n";
+                poses++;
+            }
+            cSleepMs(1);
+        }
+        cout << "> " << poses << " poses, " << skipped << " skipped" << endl;
+        return 0;
+    }
 
-    // set OpenGL version
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    // run the checks instead of starting the simulation
+    if (profile.self_test)
+    {
+        return (runSelfTests() == 0) ? 0 : 1;
+    }
 
+    // a headless run plays a session back in fixed steps; what needs a person or a screen is left out
+    if (profile.headless)
+    {
+        if (profile.replay.empty())
+        {
+            cout << "Error - headless: a replay is needed as the device input" << endl;
+            return 1;
+        }
+        if (profile.two_rate)
+        {
+            cout << "> Headless: two_rate is off (its collision thread does not keep time with the ticks)" << endl;
+            profile.two_rate = false;
+        }
+        profile.video.clear();
+        profile.record = false;
+    }
 
-    ////////////////////////////////////////////////////////////////////////////
-    // SETUP WINDOW 0
-    ////////////////////////////////////////////////////////////////////////////
+    // parse first arg to try and locate resources
+    resourceRoot = string(argv[0]).substr(0,string(argv[0]).find_last_of("/\\")+1);
 
-    // create display context
-    window0 = glfwCreateWindow(w, h, "CHAI3D", NULL, NULL);
-    if (!window0)
+    // start the startup clock
+    startupClock.start(true);
+
+    // trace from the start if asked to; [t] toggles it
+    Trace::nameThread("graphics");
+    if (profile.trace)
     {
-        cout << "failed to create window" << endl;
-        cSleepMs(1000);
-        glfwTerminate();
-        return 1;
+        Trace::clear();
+        Trace::setEnabled(true);
     }
 
-    // get width and height of window
-    glfwGetWindowSize(window0, &width0, &height0);
-
-    // set position of window
-    glfwSetWindowPos(window0, x0, y0);
 
-    // set key callback
-    glfwSetKeyCallback(window0, keyCallback);
+    //--------------------------------------------------------------------------
+    // ASSETS
+    //--------------------------------------------------------------------------
 
-    // set resize callback
-    glfwSetWindowSizeCallback(window0, windowSizeCallback0);
+    // decode the image and model files on worker threads; they are attached to the
+    // scene by updateAssets() as soon as they are ready. The workers only touch the
+    // objects they create, no OpenGL calls are made until the objects are rendered.
+    string root = resourceRoot;
+    string videoFile = profile.video;
+    if (!videoFile.empty())
+    {
+        video = new VideoTexture();
+    }
 
-    // set current display context
-    glfwMakeContextCurrent(window0);
+    heartTextureLoad = std::async(std::launch::async, [root, videoFile]() -> cTexture2dPtr
+    {
+        Trace::nameThread("asset loader");
+        TRACE_SCOPE("load heart texture");
+        if (video != NULL)
+        {
+            if (video->open(videoFile))
+            {
+                return video->getTexture();
+            }
+            cout << "> Showing the still image instead" << endl;
+        }
+        cTexture2dPtr texture = cTexture2d::create();
+        if (!texture->loadFromFile(root + "../resources/images/endoscope.jpg"))
+        {
+            return nullptr;
+        }
+        return texture;
+    });
+
+    scopeModelLoad = std::async(std::launch::async, [root]() -> cMultiMesh*
+    {
+        Trace::nameThread("asset loader");
+        TRACE_SCOPE("load scope model");
+        cMultiMesh* model = new cMultiMesh();
+        bool fileload = model->loadFromFile(root + "../resources/models/endoscope/endoscope.3ds");
+        if (!fileload)
+        {
+#if defined(_MSVC)
+            fileload = model->loadFromFile("../../../bin/resources/models/endoscope/endoscope.3ds");
+#endif
+        }
+        if (!fileload)
+        {
+            delete model;
+            return NULL;
+        }
 
-    // sets the swap interval for the current display context
-    glfwSwapInterval(swapInterval);
+        // disable culling so that faces are rendered on both sides
+        model->setUseCulling(false);
 
+        // scale model
+        model->scale(0.02);
 
-    ////////////////////////////////////////////////////////////////////////////
-    // SETUP WINDOW 1
-    ////////////////////////////////////////////////////////////////////////////
+        // use display list for faster rendering
+        model->setUseDisplayList(true);
+        return model;
+    });
 
-    // create display context and share GPU data with window 0
-    window1 = glfwCreateWindow(w, h, "CHAI3D", NULL, window0);
-    if (!window1)
+    frontgroundLoad = std::async(std::launch::async, [root]() -> cBackground*
     {
-        cout << "failed to create window" << endl;
-        cSleepMs(1000);
-        glfwTerminate();
-        return 1;
-    }
+        Trace::nameThread("asset loader");
+        TRACE_SCOPE("load frontground");
+        cBackground* frontground = new cBackground();
+        bool fileload = frontground->loadFromFile(root + "../resources/images/scope.png");
+        if (!fileload)
+        {
+#if defined(_MSVC)
+            fileload = frontground->loadFromFile("../../../bin/resources/images/scope.png");
+#endif
+        }
+        if (!fileload)
+        {
+            delete frontground;
+            return NULL;
+        }
+        return frontground;
+    });
 
-    // get width and height of window
-    glfwGetWindowSize(window1, &width1, &height1);
 
-    // set position of window
-    glfwSetWindowPos(window1, x1, y1);
+    //--------------------------------------------------------------------------
+    // HAPTIC DEVICE
+    //--------------------------------------------------------------------------
 
-    // set key callback
-    glfwSetKeyCallback(window1, keyCallback);
+    // create a haptic device handler
+    //RONNY: handler = new cHapticDeviceHandler();
 
-    // set resize callback
-    glfwSetWindowSizeCallback(window1, windowSizeCallback1);
+    // get access to the first available haptic device found
+    //RONNY: handler->getDevice(hapticDevice, 0);
+	UsartDevicePtr temp = UsartDevice::create(profile.com_port);
+	hapticDevice = temp;
+	usartDevice = temp;
 
-    // set current display context
-    glfwMakeContextCurrent(window1);
+	// device parameters and watchdog bounds (the profile gives the timeouts in ms)
+	usartDevice->setConfig(profile.getDeviceConfig());
+	usartDevice->setTimeouts(0.001 * profile.read_timeout, 0.001 * profile.stall_timeout);
+	usartDevice->setClock(&simulationClock);
 
-    // sets the swap interval for the current display context
-    glfwSwapInterval(swapInterval);
+	// observer processes follow the scope through shared memory
+	if (profile.broadcast && broadcaster.open(POSE_BROADCAST_NAME))
+	{
+		usartDevice->setBroadcaster(&broadcaster);
+		cout << "> Publishing the poses to " << POSE_BROADCAST_NAME << endl;
+	}
 
+	// the ring streams over Wi-Fi rather than the COM port
+	if (profile.udp_port != 0)
+	{
+		usartDevice->setUdpPort((unsigned short)profile.udp_port);
+	}
 
-    ////////////////////////////////////////////////////////////////////////////
-    // GLEW
-    ////////////////////////////////////////////////////////////////////////////
+	// play a recorded session back instead of reading the COM port
+	if (!profile.replay.empty())
+	{
+		replay = new SessionReplay();
+		if (!replay->open(profile.replay))
+		{
+			cSleepMs(1000);
+			return 1;
+		}
+		usartDevice->setReplay(replay);
+		cout << "> Replaying " << profile.replay << " (" << cStr(replay->getDuration(), 1) << " s)" << endl;
+	}
 
-    // initialize GLEW library
-#ifdef GLEW_VERSION
-    if (glewInit() != GLEW_OK)
+	// a headless run takes fixed steps, as fast as the CPU allows
+	if (profile.headless)
+	{
+		simulationClock.setFixedStep(0.001 * profile.haptic_step);
+	}
+
+
+    //--------------------------------------------------------------------------
+    // OPEN GL - WINDOW DISPLAY
+    //--------------------------------------------------------------------------
+    
+    // a headless run has no windows
+    if (!profile.headless && !createWindows())
     {
-        cout << "failed to initialize GLEW library" << endl;
-        glfwTerminate();
         return 1;
     }
-#endif
 
 
     //--------------------------------------------------------------------------
     // WORLD - CAMERA - LIGHTING
     //--------------------------------------------------------------------------
 
-    // create a new world.
-    world = new cWorld();
+    // create a new world; its tools may compute their forces on several threads (see GuardedWorld.h)
+    world = new GuardedWorld();
 
     // set the background color of the environment
     world->m_backgroundColor.setBlack();
@@ -363,77 +632,26 @@ int main(int argc, char* argv[])
     // HAPTIC DEVICES / TOOLS
     //--------------------------------------------------------------------------
 
-    // create a haptic device handler
-    //RONNY: handler = new cHapticDeviceHandler();
-
-    // get access to the first available haptic device found
-    //RONNY: handler->getDevice(hapticDevice, 0);
-	int com_port = 9;
-	int wait_key = 0;
-	//std::cout << "Enter the COM Port:" << std::endl;
-	//std::cin >> com_port;
-	//hapticDevice = UsartDevice::create(com_port);//RONNY
-
-	std::cout << "Press 1 when it is ready" << std::endl << std::endl;
-	std::cin >> wait_key;
-	std::cout << std::endl << std::endl;
-	std::cout << "In this simulation, the surgeon is allowed to arrange some parameters for his comfort" << std::endl << std::endl;
-	std::cout << "Before start, please enter the COM PORT which you checked from the Device Manager" << std::endl;
-	std::cout << "COM Port:" << std::endl;
-	std::cin >> com_port;
-	UsartDevicePtr temp = UsartDevice::create(com_port);
-	hapticDevice = temp;
-
-	double angle_limit = 45.0;
-	double zoom_limit = 0.04;
-	double angle_scale = 15.0;
-	double zoom_scale = 10000.0;
-	double filter_resolution = 20000.0;
-	int polarity_angle = -1;
-	int polarity_zoom = -1;
-
-
-	double angle_limit_user = 45.0;
-	double zoom_limit_user = 0.04;
-	double angle_scale_user = 15.0;
-	double zoom_scale_user = 1000.0;
-	double filter_resolution_user = 10000.0;
-
-	std::cout << "Enter the scaling factor for zoom in/out." << std::endl;
-	std::cout << "FAST << <<  100 << << SLOW" << std::endl;
-	std::cout << "Zoom Scale: " << std::endl;
-	std::cin >> zoom_scale;
-	zoom_scale = 100 * zoom_scale;
-
-	std::cout << "Enter the polarity option for zoom. Press 1 for positive, press -1 for negative choice " << std::endl;
-	std::cout << "Polarity for zoom: " << std::endl;
-	std::cin >> polarity_zoom;
-
-	std::cout << "Enter the scaling factor for angles. " << std::endl;
-	std::cout << "FAST << <<  15 << << SLOW" << std::endl;
-	std::cout << "Angle Scale: " << std::endl;
-	std::cin >> angle_scale;
-
-	std::cout << "Enter the polarity option for translations. Press 1 for positive, press -1 for negative choice " << std::endl;
-	std::cout << "Polarity for translations: " << std::endl;
-	std::cin >> polarity_angle;
-	polarity_angle = -polarity_angle;
-
-
-	((UsartDevicePtr)temp)->config(angle_limit, zoom_limit, angle_scale, zoom_scale, filter_resolution, polarity_angle, polarity_zoom);
-
     // retrieve information about the current haptic device
     cHapticDeviceInfo hapticDeviceInfo = hapticDevice->getSpecifications();
 
-    // create a tool (cursor) and insert into the world
-    tool = new cToolCursor(world);
+    // create a tool (cursor, or a shaft made of several points) and insert into the world
+    if (profile.shaft_points > 1)
+    {
+        shaft = new ShaftTool(world, profile.shaft_points, profile.shaft_length);
+        tool = shaft;
+    }
+    else
+    {
+        tool = new cToolCursor(world);
+    }
     world->addChild(tool);
 
     // connect the haptic device to the virtual tool
     tool->setHapticDevice(hapticDevice);
 
     // define the radius of the tool (sphere)
-    double toolRadius = 0.01;
+    double toolRadius = profile.tool_radius;
 
     // define a radius for the tool
     tool->setRadius(toolRadius);
@@ -442,18 +660,56 @@ int main(int argc, char* argv[])
     tool->setShowContactPoints(false, false);  //true,true yap tasirken gzlemle
 
     // create a white cursor
-    tool->m_hapticPoint->m_sphereProxy->m_material->setWhite();
+    for (int i = 0; i < tool->getNumHapticPoints(); i++)
+    {
+        tool->getHapticPoint(i)->m_sphereProxy->m_material->setWhite();
+    }
 
     // map the physical workspace of the haptic device to a larger virtual workspace.
-    tool->setWorkspaceRadius(1.0);
+    tool->setWorkspaceRadius(profile.workspace_radius);
 
     // haptic forces are enabled only if small forces are first sent to the device;
     // this mode avoids the force spike that occurs when the application starts when 
     // the tool is located inside an object for instance. 
-    tool->setWaitForSmallForce(true);
+    tool->setWaitForSmallForce(profile.wait_for_small_force);
 
-    // start the haptic tool
-    tool->start();
+    // in two-rate mode the forces of the tool are rendered from a local contact model,
+    // computed by a collision thread of its own
+    if (profile.two_rate)
+    {
+        contactModel = new LocalContactModel(world, tool->getNumHapticPoints(), (shaft != NULL) ? shaft->getLength() : 0.0, toolRadius);
+        contactModel->setMaxStaleness(0.001 * profile.max_model_age);
+    }
+
+    // the haptic tool is started (and the device opened) by the haptics thread,
+    // so that the windows are up while the device link comes up
+    toolPool.add(tool, usartDevice, contactModel);
+
+    // more instruments, each with its own tool
+    int extraPorts[] = { profile.com_port_2, profile.com_port_3, profile.com_port_4 };
+    for (int i = 0; i < 3; i++)
+    {
+        if (extraPorts[i] == 0) continue;
+
+        UsartDevicePtr device = UsartDevice::create(extraPorts[i]);
+        device->setConfig(profile.getDeviceConfig());
+        device->setTimeouts(0.001 * profile.read_timeout, 0.001 * profile.stall_timeout);
+        device->setClock(&simulationClock);
+        device->setManager(&deviceManager, deviceManager.add(extraPorts[i], profile.getDeviceConfig()));
+        extraDevices.push_back(device);
+
+        cToolCursor* extraTool = new cToolCursor(world);
+        world->addChild(extraTool);
+        extraTool->setHapticDevice(device);
+        extraTool->setRadius(toolRadius);
+        extraTool->setShowContactPoints(false, false);
+        extraTool->m_hapticPoint->m_sphereProxy->m_material->setWhite();
+        extraTool->setWorkspaceRadius(profile.workspace_radius);
+        extraTool->setWaitForSmallForce(profile.wait_for_small_force);
+        extraTools.push_back(extraTool);
+
+        toolPool.add(extraTool, device);
+    }
 
 
     //--------------------------------------------------------------------------
@@ -475,48 +731,82 @@ int main(int argc, char* argv[])
 	// create a mesh
 	heart = new cMesh();
 
-	// create plane
-	cCreatePlane(heart, 0.3, 0.3);
+	// create plane; a deformable one is a grid fine enough to bend
+	if (profile.deformable)
+	{
+		createTissueGrid(heart, 0.3, 0.3, profile.tissue_resolution);
+	}
+	else
+	{
+		cCreatePlane(heart, 0.3, 0.3);
+	}
 
-	// add object to world
-	world->addChild(heart);
+	// the anatomy group: its objects are only tested when a tool comes near them
+	anatomy = new BroadphaseGroup();
+	world->addChild(anatomy);
 
-	// create file name
-	string filename = "endoscope.jpg";
+	// add object to the anatomy
+	anatomy->addChild(heart);
 
-	// load an object file
+	// the texture (endoscope.jpg) is loaded by a worker thread, see updateAssets()
 	//bool fileload;
 	//fileload = heart->loadFromFile(RESOURCE_PATH("../resources/images/"+filename));
 
-	bool fileload;
-	heart->m_texture = cTexture2d::create();
-	fileload = heart->m_texture->loadFromFile(RESOURCE_PATH("../resources/images/" + filename));
-
-
-	if (!fileload)
-	{
-		cout << "Error - 3D Model failed to load correctly." << endl;
-		close();
-		return (-1);
-	}
-
 	// scale model
-	heart->scale(0.6);
+	heart->scale(profile.heart_scale);
 
 	// compute collision detection algorithm
 	heart->createAABBCollisionDetector(toolRadius);
 
+	// the shaft only runs its proxies near the heart
+	if (shaft != NULL)
+	{
+		shaft->addContactObject(heart);
+		shaft->setContactMargin(2.0 * toolRadius + 0.01);
+	}
+	if (contactModel != NULL)
+	{
+		contactModel->addContactObject(heart);
+		contactModel->setSceneRoot(anatomy);
+	}
+
 	// define a default stiffness for the object
-	heart->setStiffness(0.1 * maxStiffness, true);
+	heart->setStiffness(profile.heart_stiffness * maxStiffness, true);
 
-	// use display list for faster rendering
-	heart->setUseDisplayList(true);
+	// use display list for faster rendering (not for a deformable heart, its vertices change all the time)
+	heart->setUseDisplayList(!profile.deformable);
 
 	// position and orient object in scene
 	heart->setLocalPos(-0.1, 0.0, 0.0);
 	//heart->rotateExtrinsicEulerAnglesDeg(0, 0, 90, C_EULER_ORDER_YZX);
 	heart->rotateExtrinsicEulerAnglesDeg(90, 0, 0, C_EULER_ORDER_YZX);
 
+	// the tissue solver starts from the placed heart; the heart can then leave its box by about the size of the tool
+	if (profile.deformable)
+	{
+		tissue = new DeformableTissue(heart);
+		anatomy->setObjectMargin(4.0 * toolRadius);
+
+		// the graphics render a copy of the heart, outside the anatomy, shaped by the solver as well
+		heartSkin = new cMesh();
+		createTissueGrid(heartSkin, 0.3, 0.3, profile.tissue_resolution);
+		heartSkin->scale(profile.heart_scale);
+		heartSkin->setLocalPos(-0.1, 0.0, 0.0);
+		heartSkin->rotateExtrinsicEulerAnglesDeg(90, 0, 0, C_EULER_ORDER_YZX);
+		heartSkin->setHapticEnabled(false);
+		heartSkin->setUseDisplayList(false);
+		heartSkin->m_material->setWhite();
+		world->addChild(heartSkin);
+		heart->setShowEnabled(false);
+		if (contactModel != NULL)
+		{
+			contactModel->setSceneCallback(applyTissue, NULL);
+		}
+	}
+
+	// index the anatomy now that its objects are in place
+	anatomy->rebuild();
+
 	cMaterial mat;
 	mat.setHapticTriangleSides(true, true);
 	//heart->setMaterial(mat);
@@ -526,41 +816,21 @@ int main(int argc, char* argv[])
     // OBJECT "SCOPE"
     /////////////////////////////////////////////////////////////////////////
 
-    // create a virtual mesh
+    // create a virtual mesh; the model (endoscope.3ds) is loaded by a worker thread
+    // and added to it by updateAssets()
     scope = new cMultiMesh();
 
-    // attach scope to tool
-    tool->m_image = scope;
-
-    // load an object file
-    fileload = scope->loadFromFile(RESOURCE_PATH("../resources/models/endoscope/endoscope.3ds"));
-
-    if (!fileload)
+    // the scope follows the tool, and white spheres its proxies (the contact model's in two-rate mode), as captured by the haptics thread
+    sceneView = new SceneSnapshot(world);
+    sceneView->addTool(tool, scope, toolRadius, contactModel);
+    for (size_t i = 0; i < extraTools.size(); i++)
     {
-#if defined(_MSVC)
-        fileload = scope->loadFromFile("../../../bin/resources/models/endoscope/endoscope.3ds");
-#endif
+        sceneView->addTool(extraTools[i], NULL, toolRadius);
     }
-    if (!fileload)
-    {
-        cout << "Error - 3D Model failed to load correctly." << endl;
-        close();
-        return (-1);
-    }    
 
-    // disable culling so that faces are rendered on both sides
-    scope->setUseCulling(false);
-
-	// enable texture mapping
-	heart->setUseTexture(true);
+	// set the color of the heart; its texture is enabled once loaded
 	heart->m_material->setWhite();
 
-    // scale model
-    scope->scale(0.02);
-
-    // use display list for faster rendering
-    scope->setUseDisplayList(true);
-
     // position object in scene
     scope->rotateExtrinsicEulerAnglesDeg(0, 0, 0, C_EULER_ORDER_XYZ);
 
@@ -606,30 +876,49 @@ int main(int argc, char* argv[])
                                 cColorf(0.9f, 0.9f, 0.9f),
                                 cColorf(0.9f, 0.9f, 0.9f));
 
-    // create a frontground for the endoscope
-    cBackground* frontground = new cBackground();
-    cameraScope->m_frontLayer->addChild(frontground);
+    // the frontground of the endoscope (scope.png) is loaded by a worker thread
+    // and added to the front layer of the scope camera by updateAssets()
 
-    // load an texture map
-    fileload = frontground->loadFromFile(RESOURCE_PATH("../resources/images/scope.png"));
-    if (!fileload)
+
+    //--------------------------------------------------------------------------
+    // START SIMULATION
+    //--------------------------------------------------------------------------
+
+    // global positions of the whole scene; from now on the haptics thread only updates the anatomy
+    world->computeGlobalPositions(true);
+
+    // record the session, if asked to (not over the session being replayed)
+    if (profile.session)
     {
-#if defined(_MSVC)
-        fileload = frontground->loadFromFile("../../../bin/resources/images/scope.png");
-#endif
+        const char* sessionFile = (replay != NULL) ? REPLAY_SESSION_FILE : SESSION_FILE;
+        session = new SessionRecorder();
+        session->setLossless(profile.headless);
+        if (session->start(sessionFile))
+        {
+            cout << "> Recording the session to " << sessionFile << endl;
+        }
+        else
+        {
+            cout << "Error - failed to create " << sessionFile << endl;
+            delete session;
+            session = NULL;
+        }
     }
-    if (!fileload)
+
+    // headless: the haptic loop runs on this thread until the replay ends, then the program exits
+    if (profile.headless)
     {
-        cout << "Error - Image failed to load correctly." << endl;
+        sceneReady = true;
+        cPrecisionClock runClock;
+        runClock.start(true);
+        updateHaptics();
+        double runTime = runClock.stop();
+        cout << "> Replayed " << simulationClock.getTicks() << " ticks (" << cStr(simulationClock.now(), 3) << " s) in "
+             << cStr(runTime, 3) << " s, " << cStr(simulationClock.now() / runTime, 1) << " times real time" << endl;
         close();
-        return (-1);
+        return (AllocationGuard::getViolations() > 0) ? 1 : 0;
     }
 
-
-    //--------------------------------------------------------------------------
-    // START SIMULATION
-    //--------------------------------------------------------------------------
-
     // create a thread which starts the main haptics rendering loop
     hapticsThread = new cThread();
     hapticsThread->start(updateHaptics, CTHREAD_PRIORITY_HAPTICS);
@@ -647,8 +936,25 @@ int main(int argc, char* argv[])
     windowSizeCallback1(window1, width1, height1);
 
     // main graphic loop
+    bool firstFrame = true;
     while ((!glfwWindowShouldClose(window0)) && (!glfwWindowShouldClose(window1)))
     {
+        // attach the assets that finished loading
+        updateAssets();
+
+        // pose the tools as of the last haptic tick, and the heart as of the last tissue step; both windows show the same
+        sceneView->update();
+        if (tissue != NULL)
+        {
+            tissue->applyRender(heartSkin);
+        }
+
+        // next frame of the footage on the heart
+        if ((video != NULL) && sceneReady)
+        {
+            video->update();
+        }
+
         ////////////////////////////////////////////////////////////////////////
         // RENDER WINDOW 0
         ////////////////////////////////////////////////////////////////////////
@@ -663,7 +969,10 @@ int main(int argc, char* argv[])
         updateGraphics0();
 
         // swap buffers
-        glfwSwapBuffers(window0);
+        {
+            TRACE_SCOPE("swap window 0");
+            glfwSwapBuffers(window0);
+        }
 
 
         ////////////////////////////////////////////////////////////////////////
@@ -680,7 +989,10 @@ int main(int argc, char* argv[])
         updateGraphics1();
 
         // swap buffers
-        glfwSwapBuffers(window1);
+        {
+            TRACE_SCOPE("swap window 1");
+            glfwSwapBuffers(window1);
+        }
 
 
         ////////////////////////////////////////////////////////////////////////
@@ -692,6 +1004,34 @@ int main(int argc, char* argv[])
 
         // signal frequency counter
         freqCounterGraphics.signal(1);
+
+        if (firstFrame)
+        {
+            cout << "> Time to first frame: " << cStr(startupClock.getCurrentTimeSeconds(), 3) << " s" << endl;
+            firstFrame = false;
+
+            // record from the start if asked to; [v] toggles it
+            if (profile.record)
+            {
+                toggleRecording();
+            }
+        }
+
+        // timed runs end by themselves, and so do replays
+        if ((profile.run_time > 0.0) && (startupClock.getCurrentTimeSeconds() > profile.run_time))
+        {
+            glfwSetWindowShouldClose(window0, GLFW_TRUE);
+        }
+        if ((replay != NULL) && replay->isFinished())
+        {
+            glfwSetWindowShouldClose(window0, GLFW_TRUE);
+        }
+    }
+
+    // write the last frames of the recording while the display context is still there
+    if (recorder.isRecording())
+    {
+        toggleRecording();
     }
 
     // close windows
@@ -701,8 +1041,124 @@ int main(int argc, char* argv[])
     // terminate GLFW library
     glfwTerminate();
 
-    // exit
-    return 0;
+    // exit; a test build fails if the haptic loop allocated once warmed up
+    return (AllocationGuard::getViolations() > 0) ? 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool createWindows(void)
+{
+    // initialize GLFW library
+    if (!glfwInit())
+    {
+        cout << "failed initialization" << endl;
+        cSleepMs(1000);
+        return false;
+    }
+
+    // set error callback
+    glfwSetErrorCallback(errorCallback);
+
+    // compute desired size of window
+    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    int space = 10;
+    int w = profile.window_size * mode->height;
+    int h = profile.window_size * mode->height;
+    int x0 = 0.5 * mode->width - w - space;
+    int y0 = 0.5 * (mode->height - h);
+    int x1 = 0.5 * mode->width + space;
+    int y1 = 0.5 * (mode->height - h);
+
+    // set OpenGL version
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+
+
+    ////////////////////////////////////////////////////////////////////////////
+    // SETUP WINDOW 0
+    ////////////////////////////////////////////////////////////////////////////
+
+    // create display context
+    window0 = glfwCreateWindow(w, h, "CHAI3D", NULL, NULL);
+    if (!window0)
+    {
+        cout << "failed to create window" << endl;
+        cSleepMs(1000);
+        glfwTerminate();
+        return false;
+    }
+
+    // get width and height of window
+    glfwGetWindowSize(window0, &width0, &height0);
+
+    // set position of window
+    glfwSetWindowPos(window0, x0, y0);
+
+    // set key callback
+    glfwSetKeyCallback(window0, keyCallback);
+
+    // set resize callback
+    glfwSetWindowSizeCallback(window0, windowSizeCallback0);
+
+    // set current display context
+    glfwMakeContextCurrent(window0);
+
+    // sets the swap interval for the display contexts
+    swapInterval = profile.swap_interval;
+
+    // sets the swap interval for the current display context
+    glfwSwapInterval(swapInterval);
+
+
+    ////////////////////////////////////////////////////////////////////////////
+    // SETUP WINDOW 1
+    ////////////////////////////////////////////////////////////////////////////
+
+    // create display context and share GPU data with window 0
+    window1 = glfwCreateWindow(w, h, "CHAI3D", NULL, window0);
+    if (!window1)
+    {
+        cout << "failed to create window" << endl;
+        cSleepMs(1000);
+        glfwTerminate();
+        return false;
+    }
+
+    // get width and height of window
+    glfwGetWindowSize(window1, &width1, &height1);
+
+    // set position of window
+    glfwSetWindowPos(window1, x1, y1);
+
+    // set key callback
+    glfwSetKeyCallback(window1, keyCallback);
+
+    // set resize callback
+    glfwSetWindowSizeCallback(window1, windowSizeCallback1);
+
+    // set current display context
+    glfwMakeContextCurrent(window1);
+
+    // sets the swap interval for the current display context
+    glfwSwapInterval(swapInterval);
+
+
+    ////////////////////////////////////////////////////////////////////////////
+    // GLEW
+    ////////////////////////////////////////////////////////////////////////////
+
+    // initialize GLEW library
+#ifdef GLEW_VERSION
+    if (glewInit() != GLEW_OK)
+    {
+        cout << "failed to initialize GLEW library" << endl;
+        glfwTerminate();
+        return false;
+    }
+#endif
+
+    return true;
 }
 
 //------------------------------------------------------------------------------
@@ -745,6 +1201,165 @@ void keyCallback(GLFWwindow* a_window, int a_key, int a_scancode, int a_action,
     {
         glfwSetWindowShouldClose(a_window, GLFW_TRUE);
     }
+
+    // option - start tracing, or stop and write the trace
+    else if (a_key == GLFW_KEY_T)
+    {
+        if (!Trace::isEnabled())
+        {
+            Trace::clear();
+            Trace::setEnabled(true);
+            cout << "> Tracing...                                                            \r";
+        }
+        else
+        {
+            Trace::setEnabled(false);
+            writeTrace();
+        }
+    }
+
+    // option - start recording the endoscope view, or stop and close the recording
+    else if (a_key == GLFW_KEY_V)
+    {
+        toggleRecording();
+    }
+
+    // option - change the sensitivity of the device; the haptic thread picks up the new values at its next tick
+    else if ((a_key == GLFW_KEY_UP) || (a_key == GLFW_KEY_DOWN) ||
+             (a_key == GLFW_KEY_RIGHT) || (a_key == GLFW_KEY_LEFT) ||
+             (a_key == GLFW_KEY_P) || (a_key == GLFW_KEY_Z))
+    {
+        RuntimeConfig config = usartDevice->getConfig();
+
+        if (a_key == GLFW_KEY_UP)    { config.angle_scale *= 1.1; }
+        if (a_key == GLFW_KEY_DOWN)  { config.angle_scale /= 1.1; }
+        if (a_key == GLFW_KEY_RIGHT) { config.zoom_scale *= 1.1; }
+        if (a_key == GLFW_KEY_LEFT)  { config.zoom_scale /= 1.1; }
+        if (a_key == GLFW_KEY_P)     { config.polarity_angle = -config.polarity_angle; }
+        if (a_key == GLFW_KEY_Z)     { config.polarity_zoom = -config.polarity_zoom; }
+
+        usartDevice->setConfig(config);
+
+        cout << "> Angle scale: " << cStr(config.angle_scale, 2) << "  Zoom scale: " << cStr(config.zoom_scale, 0)
+             << "  Polarity (translations/zoom): " << -config.polarity_angle << "/" << config.polarity_zoom << "    \r";
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void updateAssets(void)
+{
+    if (sceneReady)
+    {
+        return;
+    }
+    TRACE_SCOPE("attach assets");
+
+    // heart texture
+    if (heartTextureLoad.valid() &&
+        (heartTextureLoad.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+    {
+        cTexture2dPtr texture = heartTextureLoad.get();
+        if (texture == nullptr)
+        {
+            cout << "Error - 3D Model failed to load correctly." << endl;
+            glfwSetWindowShouldClose(window0, GLFW_TRUE);
+            return;
+        }
+
+        // enable texture mapping
+        heart->m_texture = texture;
+        heart->setUseTexture(true);
+        if (heartSkin != NULL)
+        {
+            heartSkin->m_texture = texture;
+            heartSkin->setUseTexture(true);
+        }
+        cout << "> Heart texture loaded in " << cStr(startupClock.getCurrentTimeSeconds(), 3) << " s" << endl;
+    }
+
+    // scope model
+    if (scopeModelLoad.valid() &&
+        (scopeModelLoad.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+    {
+        scopeModel = scopeModelLoad.get();
+        if (scopeModel == NULL)
+        {
+            cout << "Error - 3D Model failed to load correctly." << endl;
+            glfwSetWindowShouldClose(window0, GLFW_TRUE);
+            return;
+        }
+        scope->addChild(scopeModel);
+        cout << "> Scope model loaded in " << cStr(startupClock.getCurrentTimeSeconds(), 3) << " s" << endl;
+    }
+
+    // frontground of the endoscope
+    if (frontgroundLoad.valid() &&
+        (frontgroundLoad.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+    {
+        cBackground* frontground = frontgroundLoad.get();
+        if (frontground == NULL)
+        {
+            cout << "Error - Image failed to load correctly." << endl;
+            glfwSetWindowShouldClose(window0, GLFW_TRUE);
+            return;
+        }
+        cameraScope->m_frontLayer->addChild(frontground);
+        cout << "> Scope image loaded in " << cStr(startupClock.getCurrentTimeSeconds(), 3) << " s" << endl;
+    }
+
+    // the scene is complete once every asset was taken
+    if (!heartTextureLoad.valid() && !scopeModelLoad.valid() && !frontgroundLoad.valid())
+    {
+        sceneReady = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void applyTissue(void* context)
+{
+    if (tissue != NULL)
+    {
+        tissue->apply();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void writeTrace(void)
+{
+    if (Trace::write(TRACE_FILE))
+    {
+        cout << "> Trace written to " << TRACE_FILE << " (open it in chrome://tracing or ui.perfetto.dev)" << endl;
+    }
+    else
+    {
+        cout << "Error - failed to write " << TRACE_FILE << endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void toggleRecording(void)
+{
+    if (!recorder.isRecording())
+    {
+        string filename = RECORD_FILE + cStr(++recordings) + ".y4m";
+        if (recorder.start(filename, width1, height1, profile.record_rate))
+        {
+            cout << "> Recording the endoscope view to " << filename << "...                      \r";
+        }
+        else
+        {
+            cout << "Error - failed to create " << filename << endl;
+        }
+    }
+    else
+    {
+        recorder.stop();
+        recorder.printStatistics();
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -757,11 +1372,69 @@ void close(void)
     // wait for graphics and haptics loops to terminate
     while (!simulationFinished) { cSleepMs(100); }
 
-    // close haptic device
+    // write the trace still being recorded
+    if (Trace::isEnabled())
+    {
+        Trace::setEnabled(false);
+        writeTrace();
+    }
+
+    // stop the tool workers
+    toolPool.stop();
+    shaftWorkers.stop();
+
+    // in a test build: did the haptic loop allocate once warmed up
+    AllocationGuard::printStatistics();
+
+    // stop the collision thread
+    if (contactModel != NULL)
+    {
+        contactModel->stop();
+        contactModel->printStatistics();
+        delete contactModel;
+    }
+
+    // stop the tissue solver
+    if (tissue != NULL)
+    {
+        tissue->stop();
+        tissue->printStatistics();
+        delete tissue;
+    }
+
+    // write the end of the session
+    if (session != NULL)
+    {
+        session->stop();
+        session->printStatistics();
+        delete session;
+    }
+
+    // stop the video decoder
+    if (video != NULL)
+    {
+        video->close();
+        video->printStatistics();
+        delete video;
+    }
+
+    // close haptic devices
     hapticDevice->close();
+    for (unsigned int i = 0; i < extraDevices.size(); i++)
+    {
+        extraDevices[i]->close();
+    }
+    if (deviceManager.isRunning())
+    {
+        deviceManager.printStatistics();
+        deviceManager.stop();
+    }
+    delete replay;
+    broadcaster.close();
 
     // delete resources
     delete hapticsThread;
+    delete sceneView;
     delete world;
     //RONNY: delete handler;
 }
@@ -770,13 +1443,27 @@ void close(void)
 
 void updateGraphics0(void)
 {
+    TRACE_SCOPE("render window 0");
+
     /////////////////////////////////////////////////////////////////////
     // UPDATE WIDGETS
     /////////////////////////////////////////////////////////////////////
 
     // update haptic and graphic rate data
-    labelRates->setText(cStr(freqCounterGraphics.getFrequency(), 0) + " Hz / " +
-        cStr(freqCounterHaptics.getFrequency(), 0) + " Hz");
+    string text = cStr(freqCounterGraphics.getFrequency(), 0) + " Hz / " +
+        cStr(freqCounterHaptics.getFrequency(), 0) + " Hz";
+
+    // report device stalls
+    const DeviceWatchdog& watchdog = usartDevice->getWatchdog();
+    if (watchdog.isStalled())
+    {
+        text += " - DEVICE STALLED " + cStr(watchdog.getCurrentStall(simulationClock.now()), 1) + " s";
+    }
+    else if (watchdog.getStallCount() > 0)
+    {
+        text += " - stalls: " + cStr((int)watchdog.getStallCount()) + " (longest " + cStr(watchdog.getLongestStall(), 2) + " s)";
+    }
+    labelRates->setText(text);
 
     // update position of label
     labelRates->setLocalPos((int)(0.5 * (width0 - labelRates->getWidth())), 15);
@@ -804,6 +1491,8 @@ void updateGraphics0(void)
 
 void updateGraphics1(void)
 {
+    TRACE_SCOPE("render window 1");
+
     /////////////////////////////////////////////////////////////////////
     // RENDER SCENE
     /////////////////////////////////////////////////////////////////////
@@ -814,8 +1503,14 @@ void updateGraphics1(void)
     // render world
     cameraScope->renderView(width1, height1);
 
-    // wait until all GL commands are completed
-    glFinish();
+    // queue the readback of the frame, if the view is being recorded
+    recorder.capture(width1, height1);
+
+    // wait until all GL commands are completed; not while recording, it would wait for the readback just queued
+    if (!recorder.isRecording())
+    {
+        glFinish();
+    }
 
     // check for any OpenGL errors
     GLenum err = glGetError();
@@ -830,10 +1525,61 @@ void updateHaptics(void)
     // simulation in now running
     simulationRunning  = true;
     simulationFinished = false;
+    Trace::nameThread("haptics");
+
+    // open the devices and start the haptic tools; the assets keep loading meanwhile
+    tool->start();
+    if (deviceManager.getNumDevices() > 0)
+    {
+        deviceManager.start();
+    }
+    for (unsigned int i = 0; i < extraTools.size(); i++)
+    {
+        extraTools[i]->start();
+    }
+
+    // start the tool workers, if there are several tools
+    toolPool.start(profile.parallel_tools);
+
+    // otherwise the workers can compute the points of the shaft
+    if ((shaft != NULL) && profile.parallel_tools && !toolPool.isParallel())
+    {
+        shaftWorkers.start(3);
+        shaft->setWorkerPool(&shaftWorkers);
+    }
+
+    // the scene graph is only changed by the main thread until all assets are in
+    while (simulationRunning && !sceneReady)
+    {
+        cSleepMs(1);
+    }
+
+    // bounding boxes of the objects the shaft can touch (they don't move)
+    if (shaft != NULL)
+    {
+        anatomy->computeGlobalPositions(true);
+        shaft->updateContactBounds();
+    }
+
+    // start the tissue solver, now that the heart is in place
+    if (tissue != NULL)
+    {
+        tissue->start(profile.tissue_rate, profile.tissue_threads, !simulationClock.isFixedStep());
+    }
+
+    // start the collision thread of the two-rate mode
+    if (contactModel != NULL)
+    {
+        contactModel->start(tool);
+    }
 
     // main haptic simulation loop
+    bool firstTick = true;
+    unsigned long long tissueSteps = 0;
     while(simulationRunning)
     {
+        TRACE_SCOPE("haptic tick");
+        HAPTIC_TICK_SCOPE();
 
 		/////////////////////////////////////////////////////////////////////
 		// READ USART DEVICE
@@ -865,17 +1611,65 @@ void updateHaptics(void)
         // signal frequency counter
         freqCounterHaptics.signal(1);
 
-        // compute global reference frames for each object
-        world->computeGlobalPositions(true);
-
-        // update position and orientation of tool
-        tool->updateFromDevice();
-
-        // compute interaction forces
-        tool->computeInteractionForces();
-
-        // send forces to haptic device
-        tool->applyToDevice();  
+        // the tool deforms the tissue; the tissue takes its new shape in the thread that runs the proxies
+        if (tissue != NULL)
+        {
+            tissue->setContactSpheres(tool, profile.tool_radius, (shaft != NULL) ? shaft->getLength() : 0.0);
+        }
+
+        // in fixed steps the solver keeps time with the ticks instead of running in its own thread
+        if ((tissue != NULL) && simulationClock.isFixedStep())
+        {
+            while (tissueSteps <= simulationClock.now() * profile.tissue_rate)
+            {
+                tissue->advance();
+                tissueSteps++;
+            }
+        }
+
+        // compute global reference frames of the anatomy (in two-rate mode the collision thread does); the rest of the
+        // scene belongs to the graphics thread
+        if (contactModel == NULL)
+        {
+            TRACE_SCOPE("scene update");
+            applyTissue(NULL);
+            anatomy->computeGlobalPositions(true);
+        }
+
+        // update position and orientation of the tools, compute their interaction forces
+        // and send them to the devices (see HapticToolPool::processTool)
+        {
+            TRACE_SCOPE("tools");
+            toolPool.update();
+        }
+
+        // hand the new poses of the tools to the graphics thread
+        sceneView->capture();
+
+        // record the processed state of the tick
+        if (session != NULL)
+        {
+            UsartPose pose;
+            if (usartDevice->getLatestPose(pose))
+            {
+                unsigned int contacts = (contactModel != NULL) ? contactModel->getContacts() : SessionRecorder::getContacts(tool);
+                cVector3d proxy = (contactModel != NULL) ? contactModel->getProxy(0) : tool->getHapticPoint(0)->getGlobalPosProxy();
+                session->record(simulationClock.now(), pose, tool, proxy, contacts);
+            }
+        }
+
+        if (firstTick)
+        {
+            cout << "> Time to first haptic tick: " << cStr(startupClock.getCurrentTimeSeconds(), 3) << " s" << endl;
+            firstTick = false;
+        }
+
+        // one step of simulated time per tick in fixed-step mode; a headless replay ends with its session
+        simulationClock.tick();
+        if (profile.headless && replay->isFinished())
+        {
+            simulationRunning = false;
+        }
     }
     
     // exit haptics thread
@@ -0,0 +1,56 @@
+# 18-endoscope launch profile; start with: 18-endoscope --profile=18-endoscope.profile
+# Any setting can also be given on the command line, e.g. --com_port=4
+# The values below are the defaults.
+
+# device
+com_port = 9
+angle_limit = 45                # [deg]
+zoom_limit = 0.04               # [m]
+angle_scale = 15                # FAST << 15 << SLOW
+zoom_scale = 100                # FAST << 100 << SLOW
+filter_resolution = 20000
+polarity_translations = 1       # 1 or -1
+polarity_zoom = -1              # 1 or -1
+read_timeout = 0.5              # longest wait for device data per haptic tick [ms]
+stall_timeout = 250             # no packets for this long: device stalled [ms]
+com_port_2 = 0                  # more instruments, each with its own tool; 0: none
+com_port_3 = 0
+com_port_4 = 0
+udp_port = 0                    # the first ring streams over Wi-Fi to this UDP port instead of com_port; 0: none
+
+# scene
+tool_radius = 0.01              # [m]
+shaft_points = 1                # haptic points along the scope, e.g. 32; 1: a single sphere at the tip
+shaft_length = 0.1              # [m]
+workspace_radius = 1.0          # [m]
+heart_scale = 0.6
+heart_stiffness = 0.1           # fraction of the device max stiffness
+deformable = false              # deformable heart tissue instead of a rigid plane
+tissue_resolution = 32          # deformable: cells per side of the tissue grid
+tissue_rate = 500               # deformable: solver steps per second [Hz]
+tissue_threads = 2              # deformable: more threads for the solver, 0 for none
+video =                         # footage played on the heart (YUV4MPEG2 .y4m), none: the still image
+
+# rendering / haptics
+swap_interval = 1               # 0: no vertical synchronization
+window_size = 0.5               # window height, fraction of the screen height
+wait_for_small_force = true
+parallel_tools = true           # compute several tools in parallel
+two_rate = false                # collisions in their own thread, forces from a local contact model
+max_model_age = 50              # two_rate: older contact models are not rendered [ms]
+run_time = 0                    # close after this many seconds, 0: run until closed
+trace = false                   # trace the threads from the start, [t] toggles it
+record = false                  # record the endoscope view from the start, [v] toggles it
+record_rate = 30                # recorded frames per second, at most
+session = false                 # record the state of every haptic tick to 18-endoscope.session
+broadcast = false               # publish the scope pose to observer processes (shared memory 18-endoscope.pose)
+replay =                        # play this session back as the device input instead of the COM port
+                                # (session: recorded to 18-endoscope.replay.session)
+headless = false                # no windows: replay in fixed steps as fast as possible, then exit
+haptic_step = 1                 # headless: simulated time per haptic tick [ms]
+
+# offline
+analyze =                       # grade these sessions (comma separated) and exit, with the device settings above
+analyze_threads = 0             # threads grading them, 0: one per hardware thread
+observe = false                 # print the poses a running simulation broadcasts, as CSV, and exit when it stops
+self_test = false               # run the checks of test.cpp and exit, with status 1 if one fails
@@ -0,0 +1,134 @@
+#include "AllocationGuard.h"
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#if defined(HAPTIC_ALLOCATION_CHECK) && defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+#define ALLOCATION_CHECK_CRT_HOOK
+#endif
+
+namespace chai3d {
+
+	static std::atomic<unsigned long long> ticks(0);  // haptic ticks finished
+	static std::atomic<unsigned long long> violations(0);
+	static std::atomic<unsigned long long> allocations(0);
+
+	/* plain thread locals: the hooks may run while a thread starts or ends */
+	static thread_local int depth = 0;  // scopes the thread is in
+	static thread_local unsigned long long threadAllocations = 0;  // inside scopes
+	static thread_local size_t lastSize = 0;
+
+	/*==================================================================*/
+	unsigned long long AllocationGuard::getViolations() {
+		return violations.load(std::memory_order_relaxed);
+	}
+
+	/*==================================================================*/
+	unsigned long long AllocationGuard::getAllocations() {
+		return allocations.load(std::memory_order_relaxed);
+	}
+
+	/*==================================================================*/
+	unsigned long long AllocationGuard::getTicks() {
+		return ticks.load(std::memory_order_relaxed);
+	}
+
+	/*==================================================================*/
+	bool AllocationGuard::isEnabled() {
+#if defined(HAPTIC_ALLOCATION_CHECK)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/*==================================================================*/
+	void AllocationGuard::enter(bool tick, unsigned long long& start) {
+		depth++;
+		start = threadAllocations;
+	}
+
+	/*==================================================================*/
+	void AllocationGuard::leave(bool tick, unsigned long long start) {
+		depth--;
+		unsigned long long tickIndex = tick ? ticks.fetch_add(1, std::memory_order_relaxed) : ticks.load(std::memory_order_relaxed);
+		/* the outermost scope of the thread reports, so that a part of the tick run by the haptic thread itself counts once */
+		if ((depth > 0) || (tickIndex < WARM_UP_TICKS) || (threadAllocations == start)) {
+			return;
+		}
+		if (violations.fetch_add(1, std::memory_order_relaxed) == 0) {
+			/* outside any scope now: this output is not counted */
+			std::cout << "Allocation check - tick " << tickIndex << " allocated " << (threadAllocations - start)
+				<< " times on the heap (last: " << lastSize << " bytes)" << std::endl;
+		}
+	}
+
+	/*==================================================================*/
+	void AllocationGuard::count(size_t size) {
+		if (depth == 0) {
+			return;
+		}
+		threadAllocations++;
+		lastSize = size;
+		if (ticks.load(std::memory_order_relaxed) >= WARM_UP_TICKS) {
+			allocations.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	/*==================================================================*/
+	void AllocationGuard::printStatistics() {
+		if (!isEnabled()) {
+			return;
+		}
+		std::cout << "Allocation check: " << getTicks() << " ticks, " << getViolations() << " allocated after the first "
+			<< WARM_UP_TICKS << " (" << getAllocations() << " allocations)" << std::endl;
+	}
+
+#if defined(ALLOCATION_CHECK_CRT_HOOK)
+	/*==================================================================*/
+	/* Debug CRT: every malloc(), realloc() and operator new goes through here */
+	static int __cdecl allocationHook(int type, void* data, size_t size, int blockType, long request, const unsigned char* file, int line) {
+		if (((type == _HOOK_ALLOC) || (type == _HOOK_REALLOC)) && (blockType != _CRT_BLOCK)) {
+			AllocationGuard::count(size);
+		}
+		return TRUE;
+	}
+
+	static struct AllocationHookInstaller {
+		AllocationHookInstaller() { _CrtSetAllocHook(allocationHook); }
+	} allocationHookInstaller;
+#endif
+}
+
+#if defined(HAPTIC_ALLOCATION_CHECK) && !defined(ALLOCATION_CHECK_CRT_HOOK)
+/*==================================================================*/
+/* Elsewhere only C++ allocations are seen: replacements of the global operator new/delete */
+void* operator new(std::size_t size) {
+	chai3d::AllocationGuard::count(size);
+	void* p = std::malloc((size > 0) ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size) {
+	return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	chai3d::AllocationGuard::count(size);
+	return std::malloc((size > 0) ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept {
+	return ::operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+namespace chai3d {
+	/*
+	Checks that the haptic loop no longer touches the heap once it is warmed up: an allocation can take far longer than
+	a tick, and the force the user feels jitters with it.
+
+	Only in builds with HAPTIC_ALLOCATION_CHECK defined (the Debug configuration): the allocations of threads inside an
+	AllocationScope are counted, through the CRT allocation hook in Windows debug builds (malloc() and operator new
+	alike) and through replacements of the global operator new/delete elsewhere. After the first WARM_UP_TICKS ticks,
+	a tick in which the haptic thread or one of its tool workers allocated is a violation; the first one is printed with
+	the size of its first allocation, and main() returns 1 at the end of the run. Without HAPTIC_ALLOCATION_CHECK the
+	scopes are empty and nothing is replaced.
+
+		while (running) {
+			HAPTIC_TICK_SCOPE();  // haptic thread, the whole tick
+			...
+		}
+		...worker thread, its share of the tick:  HAPTIC_ALLOCATION_SCOPE();
+	*/
+	class AllocationGuard {
+	public:
+		static const unsigned long long WARM_UP_TICKS = 1000;
+
+		/* Ticks past the warm-up that allocated, and their allocations */
+		static unsigned long long getViolations();
+		static unsigned long long getAllocations();
+		static unsigned long long getTicks();
+		static bool isEnabled();
+		static void printStatistics();
+
+		/* AllocationScope and the allocation hooks */
+		static void enter(bool tick, unsigned long long& allocations);
+		static void leave(bool tick, unsigned long long allocations);
+		static void count(size_t size);
+	};
+
+	/* The haptic tick (tick = true) or a part of it on another thread: allocations in its lifetime are violations */
+	class AllocationScope {
+	private:
+		bool tick;
+		unsigned long long allocations;  // of this thread when the scope started
+
+	public:
+		explicit AllocationScope(bool a_tick) : tick(a_tick), allocations(0) { AllocationGuard::enter(this->tick, this->allocations); }
+		~AllocationScope() { AllocationGuard::leave(this->tick, this->allocations); }
+	};
+}
+
+#if defined(HAPTIC_ALLOCATION_CHECK)
+#define HAPTIC_TICK_SCOPE() chai3d::AllocationScope hapticTickScope(true)
+#define HAPTIC_ALLOCATION_SCOPE() chai3d::AllocationScope hapticAllocationScope(false)
+#else
+#define HAPTIC_TICK_SCOPE() ((void)0)
+#define HAPTIC_ALLOCATION_SCOPE() ((void)0)
+#endif
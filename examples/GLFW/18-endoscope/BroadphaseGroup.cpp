@@ -0,0 +1,241 @@
+#include "BroadphaseGroup.h"
+#include <algorithm>
+
+namespace chai3d {
+
+	/* objects per leaf of the tree */
+	static const int LEAF_SIZE = 2;
+
+	/* depth of the traversal stack; the tree is balanced, this is enough for any scene */
+	static const int STACK_SIZE = 64;
+
+	/*==================================================================*/
+	BroadphaseGroup::BroadphaseGroup()
+		: interactionRange(0.05),
+		objectMargin(0.0)
+	{
+	}
+
+	/*==================================================================*/
+	/* Box of one child in the frame of the group, from its own box and pose */
+	void BroadphaseGroup::computeObjectBox(int index) {
+		cGenericObject* object = this->objects[index];
+		cVector3d localMin = object->getBoundaryMin();
+		cVector3d localMax = object->getBoundaryMax();
+		cVector3d position = object->getLocalPos();
+		cMatrix3d rotation = object->getLocalRot();
+
+		double* min = &this->objectMin[3 * index];
+		double* max = &this->objectMax[3 * index];
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] = 1.0e300;
+			max[axis] = -1.0e300;
+		}
+		for (int corner = 0; corner < 8; corner++) {
+			cVector3d local((corner & 1) ? localMax.x() : localMin.x(),
+							(corner & 2) ? localMax.y() : localMin.y(),
+							(corner & 4) ? localMax.z() : localMin.z());
+			cVector3d p = position + rotation * local;
+			for (int axis = 0; axis < 3; axis++) {
+				if (p(axis) < min[axis]) min[axis] = p(axis);
+				if (p(axis) > max[axis]) max[axis] = p(axis);
+			}
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] -= this->objectMargin;
+			max[axis] += this->objectMargin;
+		}
+	}
+
+	/*==================================================================*/
+	/* Build the subtree over order[first .. first+count-1]; returns its node. Nodes are stored
+	before their children, so update() can refit them in reverse order */
+	int BroadphaseGroup::build(int first, int count) {
+		int index = (int)this->nodes.size();
+		this->nodes.push_back(Node());
+
+		Node node;
+		node.left = node.right = -1;
+		node.first = first;
+		node.count = count;
+		if (count > LEAF_SIZE) {
+			/* split at the median of the box centers along the longest axis */
+			double centerMin[3] = { 1.0e300, 1.0e300, 1.0e300 };
+			double centerMax[3] = { -1.0e300, -1.0e300, -1.0e300 };
+			for (int i = first; i < first + count; i++) {
+				for (int axis = 0; axis < 3; axis++) {
+					double c = this->objectMin[3 * this->order[i] + axis] + this->objectMax[3 * this->order[i] + axis];
+					centerMin[axis] = std::min(centerMin[axis], c);
+					centerMax[axis] = std::max(centerMax[axis], c);
+				}
+			}
+			int split = 0;
+			for (int axis = 1; axis < 3; axis++) {
+				if (centerMax[axis] - centerMin[axis] > centerMax[split] - centerMin[split]) {
+					split = axis;
+				}
+			}
+			const std::vector<double>& min = this->objectMin;
+			const std::vector<double>& max = this->objectMax;
+			int half = count / 2;
+			std::nth_element(this->order.begin() + first, this->order.begin() + first + half, this->order.begin() + first + count,
+				[&min, &max, split](int a, int b) { return min[3 * a + split] + max[3 * a + split] < min[3 * b + split] + max[3 * b + split]; });
+
+			node.left = this->build(first, half);
+			node.right = this->build(first + half, count - half);
+		}
+		this->nodes[index] = node;
+		return index;
+	}
+
+	/*==================================================================*/
+	void BroadphaseGroup::rebuild() {
+		int n = this->getNumChildren();
+		this->objects.resize(n);
+		this->objectMin.resize(3 * n);
+		this->objectMax.resize(3 * n);
+		this->order.resize(n);
+		for (int i = 0; i < n; i++) {
+			this->objects[i] = this->getChild(i);
+			this->objects[i]->computeBoundaryBox(true);
+			this->order[i] = i;
+			this->computeObjectBox(i);
+		}
+
+		this->nodes.clear();
+		if (n > 0) {
+			this->build(0, n);
+			this->update();
+		}
+	}
+
+	/*==================================================================*/
+	void BroadphaseGroup::update() {
+		for (int i = 0; i < (int)this->objects.size(); i++) {
+			this->computeObjectBox(i);
+		}
+		for (int k = (int)this->nodes.size() - 1; k >= 0; k--) {
+			Node& node = this->nodes[k];
+			for (int axis = 0; axis < 3; axis++) {
+				node.min[axis] = 1.0e300;
+				node.max[axis] = -1.0e300;
+			}
+			if (node.left < 0) {
+				for (int i = node.first; i < node.first + node.count; i++) {
+					for (int axis = 0; axis < 3; axis++) {
+						node.min[axis] = std::min(node.min[axis], this->objectMin[3 * this->order[i] + axis]);
+						node.max[axis] = std::max(node.max[axis], this->objectMax[3 * this->order[i] + axis]);
+					}
+				}
+			}
+			else {
+				const Node& left = this->nodes[node.left];
+				const Node& right = this->nodes[node.right];
+				for (int axis = 0; axis < 3; axis++) {
+					node.min[axis] = std::min(left.min[axis], right.min[axis]);
+					node.max[axis] = std::max(left.max[axis], right.max[axis]);
+				}
+			}
+		}
+	}
+
+	/*==================================================================*/
+	/* The index is valid as long as the children are the ones it was built with */
+	bool BroadphaseGroup::isIndexed() const {
+		return !this->nodes.empty() && ((int)this->objects.size() == const_cast<BroadphaseGroup*>(this)->getNumChildren());
+	}
+
+	/*==================================================================*/
+	/* Collisions of a segment (the motion of a proxy) with the children near it */
+	bool BroadphaseGroup::computeCollisionDetection(const cVector3d& a_segmentPointA, const cVector3d& a_segmentPointB,
+		cCollisionRecorder& a_recorder, cCollisionSettings& a_settings) {
+		if (!this->isIndexed()) {
+			return cGenericObject::computeCollisionDetection(a_segmentPointA, a_segmentPointB, a_recorder, a_settings);
+		}
+		if (m_ghostEnabled) {
+			return false;
+		}
+
+		/* segment in the frame of the group, and its box */
+		cMatrix3d rotationT = this->getLocalRot().getTranspose();
+		cVector3d a = rotationT * (a_segmentPointA - this->getLocalPos());
+		cVector3d b = rotationT * (a_segmentPointB - this->getLocalPos());
+		double r = a_settings.m_collisionRadius;
+		double min[3], max[3];
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] = std::min(a(axis), b(axis)) - r;
+			max[axis] = std::max(a(axis), b(axis)) + r;
+		}
+
+		bool hit = false;
+		int stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node& node = this->nodes[stack[--top]];
+			if (node.min[0] > max[0] || node.max[0] < min[0] ||
+				node.min[1] > max[1] || node.max[1] < min[1] ||
+				node.min[2] > max[2] || node.max[2] < min[2]) {
+				continue;
+			}
+			if (node.left >= 0) {
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+				continue;
+			}
+			for (int i = node.first; i < node.first + node.count; i++) {
+				int k = this->order[i];
+				const double* objectMin = &this->objectMin[3 * k];
+				const double* objectMax = &this->objectMax[3 * k];
+				if (objectMin[0] > max[0] || objectMax[0] < min[0] ||
+					objectMin[1] > max[1] || objectMax[1] < min[1] ||
+					objectMin[2] > max[2] || objectMax[2] < min[2]) {
+					continue;
+				}
+				hit = this->objects[k]->computeCollisionDetection(a, b, a_recorder, a_settings) || hit;
+			}
+		}
+		return hit;
+	}
+
+	/*==================================================================*/
+	/* Interactions (haptic effects) of the tool with the children within the interaction range */
+	cVector3d BroadphaseGroup::computeInteractions(const cVector3d& a_toolPos, const cVector3d& a_toolVel,
+		const unsigned int a_IDN, cInteractionRecorder& a_interactions) {
+		if (!this->isIndexed()) {
+			return cGenericObject::computeInteractions(a_toolPos, a_toolVel, a_IDN, a_interactions);
+		}
+
+		cMatrix3d rotation = this->getLocalRot();
+		cMatrix3d rotationT = rotation.getTranspose();
+		cVector3d position = rotationT * (a_toolPos - this->getLocalPos());
+		cVector3d velocity = rotationT * a_toolVel;
+		double min[3], max[3];
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] = position(axis) - this->interactionRange;
+			max[axis] = position(axis) + this->interactionRange;
+		}
+
+		cVector3d force(0.0, 0.0, 0.0);
+		int stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node& node = this->nodes[stack[--top]];
+			if (node.min[0] > max[0] || node.max[0] < min[0] ||
+				node.min[1] > max[1] || node.max[1] < min[1] ||
+				node.min[2] > max[2] || node.max[2] < min[2]) {
+				continue;
+			}
+			if (node.left >= 0) {
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+				continue;
+			}
+			for (int i = node.first; i < node.first + node.count; i++) {
+				force += this->objects[this->order[i]]->computeInteractions(position, velocity, a_IDN, a_interactions);
+			}
+		}
+		return rotation * force;
+	}
+}
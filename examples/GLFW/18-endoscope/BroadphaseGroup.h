@@ -0,0 +1,65 @@
+#pragma once
+#include "chai3d.h"
+#include <vector>
+
+namespace chai3d {
+	/*
+	Scene node for many anatomical objects, with a broadphase in front of their collision detectors.
+
+	CHAI3D's proxy algorithms test every object of the world, every haptic point, every tick. The objects added
+	to this group are indexed by their bounding boxes in a bounding volume tree; when a tool asks the group for
+	collisions (or interactions), the tree hands the query only to the objects whose box it touches, so the cost
+	depends on how many objects are near the tool rather than on how many are in the scene.
+
+		BroadphaseGroup* anatomy = new BroadphaseGroup();
+		world->addChild(anatomy);
+		anatomy->addChild(heart); anatomy->addChild(liver); ...
+		anatomy->rebuild();        // once the objects are placed
+		...
+		anatomy->update();         // haptic thread, before the tools, when objects of the group have moved
+
+	Rendering is unchanged. rebuild() must be called after children are added or removed (until then the group
+	tests all its children, like any object); queries from several tools or threads at once are fine.
+	*/
+	class BroadphaseGroup : public cGenericObject {
+	private:
+		struct Node {
+			double min[3];
+			double max[3];
+			int left;  // children nodes, -1 for a leaf
+			int right;
+			int first;  // leaf: objects order[first .. first+count-1]
+			int count;
+		};
+
+		std::vector<cGenericObject*> objects;
+		std::vector<double> objectMin;  // 3 per object, in the frame of the group
+		std::vector<double> objectMax;
+		std::vector<int> order;
+		std::vector<Node> nodes;
+		double interactionRange;
+		double objectMargin;
+
+		void computeObjectBox(int index);
+		int build(int first, int count);
+		bool isIndexed() const;
+
+	public:
+		BroadphaseGroup();
+
+		/* Index the children; call after adding or removing children */
+		void rebuild();
+		/* Refit the tree to the current poses of the children; call when they have moved */
+		void update();
+
+		/* Interactions (haptic effects) are only computed for the objects whose box is within this distance of the tool [m] */
+		void setInteractionRange(double range) { this->interactionRange = range; }
+		/* The boxes of the children are enlarged by this much [m]: how far a deformable child can leave its rest shape */
+		void setObjectMargin(double margin) { this->objectMargin = margin; }
+
+		virtual bool computeCollisionDetection(const cVector3d& a_segmentPointA, const cVector3d& a_segmentPointB,
+			cCollisionRecorder& a_recorder, cCollisionSettings& a_settings);
+		virtual cVector3d computeInteractions(const cVector3d& a_toolPos, const cVector3d& a_toolVel,
+			const unsigned int a_IDN, cInteractionRecorder& a_interactions);
+	};
+}
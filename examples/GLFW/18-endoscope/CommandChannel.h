@@ -0,0 +1,255 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace chai3d {
+	/*
+	Commands from the simulation to the microcontroller: force feedback, vibration and LED.
+
+	Frame sent over the link, same layout as the packets the device sends us:
+		preamble 0x55 0x55, one channel byte, then three doubles (24 bytes)       = 27 bytes
+
+		COMMAND_FORCE       force on the scope in device coordinates [N]: X, Y, Z
+		COMMAND_VIBRATION   amplitude [0..1], frequency [Hz], unused
+		COMMAND_LED         red, green, blue [0..1]
+	*/
+	enum DeviceChannel {
+		COMMAND_FORCE = 0,
+		COMMAND_VIBRATION = 1,
+		COMMAND_LED = 2,
+		COMMAND_CHANNELS = 3
+	};
+
+	struct DeviceCommand {
+		int channel;
+		double value[3];
+	};
+
+	/*==================================================================*/
+	/* Bounded queue between one producer thread and one consumer thread, without locks.
+	push() fails instead of waiting when the queue is full.
+	The padding keeps the two counters a cache line apart from each other and from the items, whatever the alignment of
+	the queue: it lives inside heap objects (UsartDevice, SessionRecorder), and new does not honour alignas(64) before
+	C++17 (see PoseHistory.h) */
+	template <class T, unsigned CAPACITY>
+	class SpscQueue {
+	private:
+		static_assert((CAPACITY & (CAPACITY - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+		T items[CAPACITY];
+		char padding0[64];
+		std::atomic<unsigned int> head;  // next item to pop, written by the consumer
+		char padding1[64];
+		std::atomic<unsigned int> tail;  // next free slot, written by the producer
+		char padding2[64];
+
+	public:
+		SpscQueue() : head(0), tail(0) {}
+
+		/* Producer */
+		bool push(const T& item) {
+			unsigned int t = this->tail.load(std::memory_order_relaxed);
+			if (t - this->head.load(std::memory_order_acquire) == CAPACITY) {
+				return false;
+			}
+			this->items[t & (CAPACITY - 1)] = item;
+			this->tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		/* Consumer */
+		bool pop(T& item) {
+			unsigned int h = this->head.load(std::memory_order_relaxed);
+			if (h == this->tail.load(std::memory_order_acquire)) {
+				return false;
+			}
+			item = this->items[h & (CAPACITY - 1)];
+			this->head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		/* Any thread; approximate while the other threads work */
+		unsigned int size() const {
+			return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+		}
+	};
+
+	/*==================================================================*/
+	struct CommandStatistics {
+		unsigned int depth;  // commands waiting in the queue
+		unsigned long long queued;  // commands accepted by send()
+		unsigned long long sent;  // frames written to the link
+		unsigned long long coalesced;  // commands replaced by a newer one of the same channel, or equal to the value already sent
+		unsigned long long dropped;  // commands refused because the queue was full, or frames the link failed to take
+	};
+
+	/*
+	Outbound channel: the haptic thread calls send(), which never blocks; a writer thread drains the queue and
+	writes the commands to the transport (which needs int write(int nBytes, const char buffer[])).
+
+	The link is far slower than the haptic loop (a frame takes ~28 ms at 9600 baud, the haptic loop sends a force
+	every ms), so the writer only keeps the newest command of each channel and skips values the device already has.
+	*/
+	template <class Transport>
+	class CommandChannel {
+	public:
+		static const int frame_length = 27;
+
+	private:
+		Transport* transport;
+		SpscQueue<DeviceCommand, 256> queue;
+		std::thread writer;
+		std::atomic<bool> running;
+
+		/* writer thread only */
+		DeviceCommand latest[COMMAND_CHANNELS];  // newest command of each channel
+		bool pending[COMMAND_CHANNELS];  // latest[] not written yet
+		bool known[COMMAND_CHANNELS];  // the device got a value on this channel
+		DeviceCommand last[COMMAND_CHANNELS];  // last value written
+
+		std::atomic<unsigned long long> queued;
+		std::atomic<unsigned long long> sent;
+		std::atomic<unsigned long long> coalesced;
+		std::atomic<unsigned long long> dropped;
+
+		static void encode(const DeviceCommand& command, char frame[frame_length]) {
+			frame[0] = (char)0x55;
+			frame[1] = (char)0x55;
+			frame[2] = (char)command.channel;
+			memcpy(frame + 3, command.value, 24);
+		}
+
+		static bool equal(const DeviceCommand& a, const DeviceCommand& b) {
+			return a.value[0] == b.value[0] && a.value[1] == b.value[1] && a.value[2] == b.value[2];
+		}
+
+		static void increment(std::atomic<unsigned long long>& counter) {
+			counter.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		/* Take everything queued; returns false if the queue was empty */
+		bool drain() {
+			DeviceCommand command;
+			bool any = false;
+			while (this->queue.pop(command)) {
+				any = true;
+				if (this->pending[command.channel]) {
+					increment(this->coalesced);
+				}
+				this->latest[command.channel] = command;
+				this->pending[command.channel] = true;
+			}
+			return any;
+		}
+
+		/* Write one frame; a frame the link does not take completely is dropped */
+		void write(const DeviceCommand& command) {
+			char frame[frame_length];
+			encode(command, frame);
+			int written = 0;
+			while (written < frame_length) {
+				int n = this->transport->write(frame_length - written, frame + written);
+				if (n <= 0) {
+					increment(this->dropped);
+					return;
+				}
+				written += n;
+			}
+			this->last[command.channel] = command;
+			this->known[command.channel] = true;
+			increment(this->sent);
+		}
+
+		void run() {
+			while (true) {
+				bool stopping = !this->running.load(std::memory_order_acquire);
+				bool any = this->drain();
+				for (int channel = 0; channel < COMMAND_CHANNELS; channel++) {
+					if (!this->pending[channel]) {
+						continue;
+					}
+					this->pending[channel] = false;
+					if (this->known[channel] && equal(this->latest[channel], this->last[channel])) {
+						increment(this->coalesced);  // the device already has this value
+						continue;
+					}
+					this->write(this->latest[channel]);
+				}
+				if (stopping) {
+					return;  // what was queued before stop() has been written
+				}
+				if (!any) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+			}
+		}
+
+	public:
+		explicit CommandChannel(Transport& transport)
+			: transport(&transport), running(false), queued(0), sent(0), coalesced(0), dropped(0)
+		{
+			for (int channel = 0; channel < COMMAND_CHANNELS; channel++) {
+				this->pending[channel] = false;
+				this->known[channel] = false;
+			}
+		}
+
+		~CommandChannel() {
+			this->stop();
+		}
+
+		/* Write to another transport, e.g. a port that another thread reads (see DeviceManager::getTransport()). Call before start() */
+		void setTransport(Transport& a_transport) {
+			this->transport = &a_transport;
+		}
+
+		/* Start the writer thread, once the transport is open */
+		void start() {
+			if (this->writer.joinable()) {
+				return;
+			}
+			for (int channel = 0; channel < COMMAND_CHANNELS; channel++) {
+				this->known[channel] = false;  // after a reconnection the device has no values yet
+			}
+			this->running.store(true, std::memory_order_release);
+			this->writer = std::thread(&CommandChannel::run, this);
+		}
+
+		/* Write what is queued and stop the writer thread; call before closing the transport */
+		void stop() {
+			if (!this->writer.joinable()) {
+				return;
+			}
+			this->running.store(false, std::memory_order_release);
+			this->writer.join();
+		}
+
+		/* Producer thread (the haptic thread). Never blocks; returns false if the command was dropped */
+		bool send(int channel, double value0, double value1, double value2) {
+			DeviceCommand command;
+			command.channel = channel;
+			command.value[0] = value0;
+			command.value[1] = value1;
+			command.value[2] = value2;
+			if (!this->queue.push(command)) {
+				increment(this->dropped);
+				return false;
+			}
+			increment(this->queued);
+			return true;
+		}
+
+		/* Any thread */
+		CommandStatistics getStatistics() const {
+			CommandStatistics statistics;
+			statistics.depth = this->queue.size();
+			statistics.queued = this->queued.load(std::memory_order_relaxed);
+			statistics.sent = this->sent.load(std::memory_order_relaxed);
+			statistics.coalesced = this->coalesced.load(std::memory_order_relaxed);
+			statistics.dropped = this->dropped.load(std::memory_order_relaxed);
+			return statistics;
+		}
+	};
+}
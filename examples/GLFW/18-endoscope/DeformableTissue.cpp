@@ -0,0 +1,467 @@
+#include "DeformableTissue.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace chai3d {
+
+	/* vertices or edges per task of the worker pool */
+	static const int CHUNK = 512;
+
+	/* edge colors tracked per vertex; edges that find no free color are projected serially */
+	static const int MAX_COLORS = 64;
+
+	static int numChunks(int count) {
+		return (count + CHUNK - 1) / CHUNK;
+	}
+
+	/*==================================================================*/
+	DeformableTissue::DeformableTissue(cMesh* a_mesh)
+		: serialColors(0),
+		stepSpheres(NULL),
+		mesh(a_mesh),
+		stiffness(0.8),
+		tether(0.02),
+		damping(20.0),
+		contactStiffness(0.5),
+		iterations(8),
+		running(false),
+		period(0.002),
+		currentColor(0),
+		keep(1.0),
+		rate(0.0),
+		meanStepTime(0.0),
+		maxStepTime(0.0),
+		overruns(0)
+	{
+		int n = a_mesh->getNumVertices();
+		this->x.resize(n); this->y.resize(n); this->z.resize(n);
+		this->rx.resize(n); this->ry.resize(n); this->rz.resize(n);
+		this->nx.resize(n); this->ny.resize(n); this->nz.resize(n);
+		this->w.resize(n, 1.0);
+		for (int i = 0; i < n; i++) {
+			cVector3d position = a_mesh->m_vertices->getLocalPos(i);
+			this->x[i] = this->rx[i] = position.x();
+			this->y[i] = this->ry[i] = position.y();
+			this->z[i] = this->rz[i] = position.z();
+		}
+		this->ox = this->x; this->oy = this->y; this->oz = this->z;
+
+		/* edges of the triangles, each once; an edge of a single triangle is on the border */
+		int numTriangles = a_mesh->getNumTriangles();
+		this->triangles.resize(3 * numTriangles);
+		std::vector<long long> keys;
+		keys.reserve(3 * numTriangles);
+		for (int t = 0; t < numTriangles; t++) {
+			int v[3] = { (int)a_mesh->m_triangles->getVertexIndex0(t), (int)a_mesh->m_triangles->getVertexIndex1(t), (int)a_mesh->m_triangles->getVertexIndex2(t) };
+			for (int k = 0; k < 3; k++) {
+				this->triangles[3 * t + k] = v[k];
+				int a = std::min(v[k], v[(k + 1) % 3]);
+				int b = std::max(v[k], v[(k + 1) % 3]);
+				keys.push_back((long long)a * n + b);
+			}
+		}
+		std::sort(keys.begin(), keys.end());
+
+		std::vector<int> a, b;
+		for (size_t k = 0; k < keys.size(); ) {
+			size_t uses = 1;
+			while (k + uses < keys.size() && keys[k + uses] == keys[k]) {
+				uses++;
+			}
+			int va = (int)(keys[k] / n), vb = (int)(keys[k] % n);
+			a.push_back(va);
+			b.push_back(vb);
+			if (uses == 1) {
+				this->w[va] = 0.0;
+				this->w[vb] = 0.0;
+			}
+			k += uses;
+		}
+		this->colorEdges(a, b);
+		this->computeNormals();
+
+		/* an empty shape until the first step */
+		TissueFrame frame;
+		this->frames.reset(frame);
+		this->renderFrames.reset(frame);
+		ContactSpheres none;
+		none.count = 0;
+		none.radius = 0.0;
+		this->spheres.reset(none);
+	}
+
+	DeformableTissue::~DeformableTissue() {
+		this->stop();
+		this->workers.stop();
+	}
+
+	/*==================================================================*/
+	/* Greedy edge coloring: each edge takes the first color free at both of its vertices */
+	void DeformableTissue::colorEdges(const std::vector<int>& a, const std::vector<int>& b) {
+		int numEdges = (int)a.size();
+		std::vector<unsigned long long> used(this->x.size(), 0);
+		std::vector<int> color(numEdges);
+		int numColors = 0;
+		bool overflow = false;
+		for (int e = 0; e < numEdges; e++) {
+			unsigned long long taken = used[a[e]] | used[b[e]];
+			int c = 0;
+			while (c < MAX_COLORS && (taken & (1ULL << c))) {
+				c++;
+			}
+			if (c < MAX_COLORS) {
+				used[a[e]] |= 1ULL << c;
+				used[b[e]] |= 1ULL << c;
+				numColors = std::max(numColors, c + 1);
+			}
+			else {
+				overflow = true;
+			}
+			color[e] = c;
+		}
+		this->serialColors = overflow ? 1 : 0;
+		int total = numColors + this->serialColors;
+
+		/* counting sort of the edges by color */
+		this->colorStart.assign(total + 1, 0);
+		for (int e = 0; e < numEdges; e++) {
+			this->colorStart[std::min(color[e], numColors) + 1]++;
+		}
+		for (int c = 0; c < total; c++) {
+			this->colorStart[c + 1] += this->colorStart[c];
+		}
+		std::vector<int> fill(this->colorStart.begin(), this->colorStart.end() - 1);
+		this->edgeA.resize(numEdges);
+		this->edgeB.resize(numEdges);
+		this->restLength.resize(numEdges);
+		for (int e = 0; e < numEdges; e++) {
+			int slot = fill[std::min(color[e], numColors)]++;
+			this->edgeA[slot] = a[e];
+			this->edgeB[slot] = b[e];
+			double dx = this->x[b[e]] - this->x[a[e]], dy = this->y[b[e]] - this->y[a[e]], dz = this->z[b[e]] - this->z[a[e]];
+			this->restLength[slot] = std::sqrt(dx * dx + dy * dy + dz * dz);
+		}
+	}
+
+	/*==================================================================*/
+	/* Move the vertices by their velocity */
+	void DeformableTissue::predictChunk(void* context, int index) {
+		DeformableTissue* tissue = (DeformableTissue*)context;
+		int begin = index * CHUNK;
+		int end = std::min(begin + CHUNK, tissue->getNumVertices());
+		double* x = tissue->x.data(); double* y = tissue->y.data(); double* z = tissue->z.data();
+		double* ox = tissue->ox.data(); double* oy = tissue->oy.data(); double* oz = tissue->oz.data();
+		double keep = tissue->keep;
+		for (int i = begin; i < end; i++) {
+			double vx = keep * (x[i] - ox[i]), vy = keep * (y[i] - oy[i]), vz = keep * (z[i] - oz[i]);
+			ox[i] = x[i]; oy[i] = y[i]; oz[i] = z[i];
+			x[i] += vx; y[i] += vy; z[i] += vz;
+		}
+	}
+
+	/*==================================================================*/
+	/* Edge lengths, for the edges of the current color: no two of them share a vertex */
+	void DeformableTissue::projectEdgesChunk(void* context, int index) {
+		DeformableTissue* tissue = (DeformableTissue*)context;
+		int begin = tissue->colorStart[tissue->currentColor] + index * CHUNK;
+		int end = std::min(begin + CHUNK, tissue->colorStart[tissue->currentColor + 1]);
+		double* x = tissue->x.data(); double* y = tissue->y.data(); double* z = tissue->z.data();
+		const double* w = tissue->w.data();
+		double stiffness = tissue->stiffness;
+		for (int e = begin; e < end; e++) {
+			int a = tissue->edgeA[e], b = tissue->edgeB[e];
+			double dx = x[b] - x[a], dy = y[b] - y[a], dz = z[b] - z[a];
+			double length = std::sqrt(dx * dx + dy * dy + dz * dz);
+			double weight = w[a] + w[b];
+			if (length < 1.0e-12 || weight == 0.0) {
+				continue;
+			}
+			double s = stiffness * (length - tissue->restLength[e]) / (length * weight);
+			x[a] += w[a] * s * dx; y[a] += w[a] * s * dy; z[a] += w[a] * s * dz;
+			x[b] -= w[b] * s * dx; y[b] -= w[b] * s * dy; z[b] -= w[b] * s * dz;
+		}
+	}
+
+	/*==================================================================*/
+	/* Pull towards the rest shape, push out of the tool */
+	void DeformableTissue::projectVerticesChunk(void* context, int index) {
+		DeformableTissue* tissue = (DeformableTissue*)context;
+		int begin = index * CHUNK;
+		int end = std::min(begin + CHUNK, tissue->getNumVertices());
+		double* x = tissue->x.data(); double* y = tissue->y.data(); double* z = tissue->z.data();
+		const double* rx = tissue->rx.data(); const double* ry = tissue->ry.data(); const double* rz = tissue->rz.data();
+		const double* w = tissue->w.data();
+		double tether = tissue->tether;
+		for (int i = begin; i < end; i++) {
+			x[i] += tether * (rx[i] - x[i]);
+			y[i] += tether * (ry[i] - y[i]);
+			z[i] += tether * (rz[i] - z[i]);
+		}
+
+		const ContactSpheres& spheres = *tissue->stepSpheres;
+		double r = spheres.radius;
+		for (int k = 0; k < spheres.count; k++) {
+			double cx = spheres.x[k], cy = spheres.y[k], cz = spheres.z[k];
+			for (int i = begin; i < end; i++) {
+				double dx = x[i] - cx, dy = y[i] - cy, dz = z[i] - cz;
+				double d2 = dx * dx + dy * dy + dz * dz;
+				if (d2 >= r * r || d2 < 1.0e-18 || w[i] == 0.0) {
+					continue;
+				}
+				double d = std::sqrt(d2);
+				double s = tissue->contactStiffness * (r - d) / d;
+				x[i] += s * dx; y[i] += s * dy; z[i] += s * dz;
+			}
+		}
+	}
+
+	/*==================================================================*/
+	/* Vertex normals: sum of the normals of the triangles around, weighted by their area */
+	void DeformableTissue::computeNormals() {
+		int n = this->getNumVertices();
+		std::fill(this->nx.begin(), this->nx.end(), 0.0);
+		std::fill(this->ny.begin(), this->ny.end(), 0.0);
+		std::fill(this->nz.begin(), this->nz.end(), 0.0);
+		int numTriangles = (int)this->triangles.size() / 3;
+		for (int t = 0; t < numTriangles; t++) {
+			int a = this->triangles[3 * t], b = this->triangles[3 * t + 1], c = this->triangles[3 * t + 2];
+			double ux = this->x[b] - this->x[a], uy = this->y[b] - this->y[a], uz = this->z[b] - this->z[a];
+			double vx = this->x[c] - this->x[a], vy = this->y[c] - this->y[a], vz = this->z[c] - this->z[a];
+			double cx = uy * vz - uz * vy, cy = uz * vx - ux * vz, cz = ux * vy - uy * vx;
+			this->nx[a] += cx; this->ny[a] += cy; this->nz[a] += cz;
+			this->nx[b] += cx; this->ny[b] += cy; this->nz[b] += cz;
+			this->nx[c] += cx; this->ny[c] += cy; this->nz[c] += cz;
+		}
+		for (int i = 0; i < n; i++) {
+			double length = std::sqrt(this->nx[i] * this->nx[i] + this->ny[i] * this->ny[i] + this->nz[i] * this->nz[i]);
+			double scale = (length > 0.0) ? 1.0 / length : 0.0;
+			this->nx[i] *= scale; this->ny[i] *= scale; this->nz[i] *= scale;
+		}
+	}
+
+	/*==================================================================*/
+	void DeformableTissue::step(double dt) {
+		TRACE_SCOPE("tissue step");
+		this->spheres.update();
+		this->stepSpheres = &this->spheres.read();
+		this->keep = std::exp(-this->damping * dt);
+
+		int n = this->getNumVertices();
+		this->workers.run(numChunks(n), &DeformableTissue::predictChunk, this);
+		int numColors = this->getNumColors();
+		for (int iteration = 0; iteration < this->iterations; iteration++) {
+			for (int c = 0; c < numColors; c++) {
+				this->currentColor = c;
+				int count = numChunks(this->colorStart[c + 1] - this->colorStart[c]);
+				if (c >= numColors - this->serialColors) {
+					for (int k = 0; k < count; k++) {
+						projectEdgesChunk(this, k);
+					}
+				}
+				else {
+					this->workers.run(count, &DeformableTissue::projectEdgesChunk, this);
+				}
+			}
+			this->workers.run(numChunks(n), &DeformableTissue::projectVerticesChunk, this);
+		}
+		this->computeNormals();
+	}
+
+	/*==================================================================*/
+	/* Solver thread: hand the shape of this step to apply() or applyRender() */
+	void DeformableTissue::publish(TripleBuffer<TissueFrame>& buffer) {
+		int n = this->getNumVertices();
+		TissueFrame& frame = buffer.write();
+		frame.positions.resize(3 * n);
+		frame.normals.resize(3 * n);
+		for (int i = 0; i < n; i++) {
+			frame.positions[3 * i] = (float)this->x[i];
+			frame.positions[3 * i + 1] = (float)this->y[i];
+			frame.positions[3 * i + 2] = (float)this->z[i];
+			frame.normals[3 * i] = (float)this->nx[i];
+			frame.normals[3 * i + 1] = (float)this->ny[i];
+			frame.normals[3 * i + 2] = (float)this->nz[i];
+		}
+		buffer.publish();
+	}
+
+	/*==================================================================*/
+	bool DeformableTissue::apply() {
+		if (!this->frames.update()) {
+			return false;
+		}
+		TRACE_SCOPE("apply tissue");
+		const TissueFrame& frame = this->frames.read();
+		int n = (int)frame.positions.size() / 3;
+		for (int i = 0; i < n; i++) {
+			this->mesh->m_vertices->setLocalPos(i, frame.positions[3 * i], frame.positions[3 * i + 1], frame.positions[3 * i + 2]);
+			this->mesh->m_vertices->setNormal(i, frame.normals[3 * i], frame.normals[3 * i + 1], frame.normals[3 * i + 2]);
+		}
+		if (this->mesh->m_collisionDetector != NULL) {
+			this->mesh->m_collisionDetector->update();
+		}
+		return true;
+	}
+
+	/*==================================================================*/
+	bool DeformableTissue::applyRender(cMesh* a_mesh) {
+		if (!this->renderFrames.update()) {
+			return false;
+		}
+		TRACE_SCOPE("apply tissue render");
+		const TissueFrame& frame = this->renderFrames.read();
+		int n = (int)frame.positions.size() / 3;
+		for (int i = 0; i < n; i++) {
+			a_mesh->m_vertices->setLocalPos(i, frame.positions[3 * i], frame.positions[3 * i + 1], frame.positions[3 * i + 2]);
+			a_mesh->m_vertices->setNormal(i, frame.normals[3 * i], frame.normals[3 * i + 1], frame.normals[3 * i + 2]);
+		}
+		return true;
+	}
+
+	/*==================================================================*/
+	void DeformableTissue::setContactSpheres(cGenericTool* tool, double radius, double length) {
+		ContactSpheres& contact = this->spheres.write();
+		cMatrix3d rotationT = this->meshRotation.getTranspose();
+		int n = tool->getNumHapticPoints();
+		double spacing = (n > 1) ? length / (n - 1) : 0.0;
+		cVector3d tip = tool->getDeviceGlobalPos();
+		cVector3d axis = tool->getDeviceGlobalRot().getCol0();
+		contact.count = std::min(n, MAX_SPHERES);
+		contact.radius = radius;
+		for (int k = 0; k < contact.count; k++) {
+			cVector3d local = rotationT * (tip + (k * spacing) * axis - this->meshPosition);
+			contact.x[k] = local.x();
+			contact.y[k] = local.y();
+			contact.z[k] = local.z();
+		}
+		this->spheres.publish();
+	}
+
+	/*==================================================================*/
+	void DeformableTissue::setNumWorkers(int numWorkers) {
+		this->workers.stop();
+		this->workers.start(numWorkers);
+	}
+
+	/*==================================================================*/
+	void DeformableTissue::start(double stepRate, int numWorkers, bool threaded) {
+		if (this->running) {
+			return;
+		}
+		this->meshPosition = this->mesh->getGlobalPos();
+		this->meshRotation = this->mesh->getGlobalRot();
+		this->period = 1.0 / stepRate;
+		this->setNumWorkers(numWorkers);
+		if (!threaded) {
+			return;
+		}
+		this->running = true;
+		this->thread = std::thread(&DeformableTissue::run, this);
+	}
+
+	/*==================================================================*/
+	void DeformableTissue::stop() {
+		if (!this->running) {
+			return;
+		}
+		this->running = false;
+		this->thread.join();
+	}
+
+	/*==================================================================*/
+	void DeformableTissue::advance() {
+		this->step(this->period);
+		this->publish(this->frames);
+		this->publish(this->renderFrames);
+	}
+
+	/*==================================================================*/
+	/* Solver thread: fixed steps; a late step is not made up for, the next one starts a period after it */
+	void DeformableTissue::run() {
+		Trace::nameThread("tissue solver");
+		double windowStart = cPrecisionClock::getCPUTimeSeconds();
+		unsigned long long windowSteps = 0;
+		double stepTimeSum = 0.0;
+		double stepTimeMax = 0.0;
+
+		double next = windowStart;
+		while (this->running.load(std::memory_order_relaxed)) {
+			next += this->period;
+			double begin = cPrecisionClock::getCPUTimeSeconds();
+			this->step(this->period);
+			this->publish(this->frames);
+			this->publish(this->renderFrames);
+			double end = cPrecisionClock::getCPUTimeSeconds();
+
+			windowSteps++;
+			stepTimeSum += end - begin;
+			stepTimeMax = std::max(stepTimeMax, end - begin);
+			if (end - windowStart >= 1.0) {
+				this->rate.store(windowSteps / (end - windowStart), std::memory_order_relaxed);
+				this->meanStepTime.store(stepTimeSum / windowSteps, std::memory_order_relaxed);
+				this->maxStepTime.store(stepTimeMax, std::memory_order_relaxed);
+				windowStart = end;
+				windowSteps = 0;
+				stepTimeSum = 0.0;
+				stepTimeMax = 0.0;
+			}
+
+			if (end > next) {
+				this->overruns.store(this->overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);  // single writer
+				next = end;
+				continue;
+			}
+			double now;
+			while (((now = cPrecisionClock::getCPUTimeSeconds()) < next) && this->running.load(std::memory_order_relaxed)) {
+				if (next - now > 0.002) {
+					cSleepMs(1);
+				}
+				else {
+					std::this_thread::yield();
+				}
+			}
+		}
+	}
+
+	/*==================================================================*/
+	TissueStatistics DeformableTissue::getStatistics() const {
+		TissueStatistics statistics;
+		statistics.rate = this->rate.load(std::memory_order_relaxed);
+		statistics.meanStepTime = this->meanStepTime.load(std::memory_order_relaxed);
+		statistics.maxStepTime = this->maxStepTime.load(std::memory_order_relaxed);
+		statistics.overruns = this->overruns.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+	/*==================================================================*/
+	void DeformableTissue::printStatistics() const {
+		TissueStatistics statistics = this->getStatistics();
+		std::cout << "Tissue: " << this->getNumVertices() << " vertices, " << this->getNumColors() << " edge colors, "
+			<< statistics.rate << " steps/s, step " << statistics.meanStepTime * 1000.0 << " ms (max "
+			<< statistics.maxStepTime * 1000.0 << " ms), " << statistics.overruns << " overruns" << std::endl;
+	}
+
+	/*==================================================================*/
+	void createTissueGrid(cMesh* a_mesh, double lengthX, double lengthY, int cells) {
+		a_mesh->clear();
+		for (int j = 0; j <= cells; j++) {
+			for (int i = 0; i <= cells; i++) {
+				unsigned int vertex = a_mesh->newVertex(lengthX * ((double)i / cells - 0.5), lengthY * ((double)j / cells - 0.5), 0.0);
+				a_mesh->m_vertices->setNormal(vertex, 0.0, 0.0, 1.0);
+				a_mesh->m_vertices->setTexCoord(vertex, (double)i / cells, (double)j / cells);
+			}
+		}
+		for (int j = 0; j < cells; j++) {
+			for (int i = 0; i < cells; i++) {
+				unsigned int v00 = j * (cells + 1) + i;
+				unsigned int v10 = v00 + 1;
+				unsigned int v01 = v00 + cells + 1;
+				unsigned int v11 = v01 + 1;
+				a_mesh->newTriangle(v00, v10, v11);
+				a_mesh->newTriangle(v00, v11, v01);
+			}
+		}
+	}
+}
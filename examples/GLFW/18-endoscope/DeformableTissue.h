@@ -0,0 +1,157 @@
+#pragma once
+#include "chai3d.h"
+#include "SpinWorkerPool.h"
+#include "TripleBuffer.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace chai3d {
+	/* Step time of the tissue solver, over the last second */
+	struct TissueStatistics {
+		double rate;  // steps per second
+		double meanStepTime;  // [s]
+		double maxStepTime;  // [s]
+		unsigned long long overruns;  // steps that started late because the previous one took too long, since start()
+	};
+
+	/*
+	Deformable tissue for a cMesh, by position based dynamics: the edges of the mesh keep their rest length, every vertex
+	is pulled back towards its rest position (the tissue is attached behind), the border of the mesh is fixed, and the
+	vertices are pushed out of the spheres of the tool. The tissue gives way under the tool; the tool meets the deformed
+	surface and feels the force of what is left of the penetration, so a stiffer tissue deforms less and pushes back more.
+
+	The solver runs on its own thread at a fixed step, on a structure of arrays copy of the vertices (x, y, z apart, in
+	the frame of the mesh) so the per vertex loops vectorize. The edges are colored so that no two edges of one color
+	share a vertex: the edges of a color are projected in parallel by the workers of a SpinWorkerPool, without locks.
+	Each step publishes the vertex positions and normals; the thread that runs the proxies takes the newest ones with
+	apply(), which updates the mesh and its collision tree, and the graphics render the same mesh.
+
+		createTissueGrid(heart, 0.3, 0.3, 32);   // a plane fine enough to bend
+		DeformableTissue tissue(heart);
+		tissue.start(500.0, 2);
+		...haptic thread: tissue.setContactSpheres(tool, radius, shaftLength); tissue.apply(); ...proxies...
+	*/
+	class DeformableTissue {
+	public:
+		static const int MAX_SPHERES = 16;
+
+	private:
+		/* vertices, structure of arrays */
+		std::vector<double> x, y, z;  // positions
+		std::vector<double> ox, oy, oz;  // positions of the previous step
+		std::vector<double> rx, ry, rz;  // rest positions
+		std::vector<double> w;  // inverse mass; 0 for the fixed border
+		std::vector<double> nx, ny, nz;  // normals
+
+		/* edges, sorted by color */
+		std::vector<int> edgeA, edgeB;
+		std::vector<double> restLength;
+		std::vector<int> colorStart;  // edges of color c: colorStart[c] .. colorStart[c+1]-1
+		int serialColors;  // the last colors are not independent (vertices of very high degree) and are projected serially
+
+		std::vector<int> triangles;  // 3 per triangle
+
+		/* tool spheres in the frame of the mesh */
+		struct ContactSpheres {
+			int count;
+			double x[MAX_SPHERES], y[MAX_SPHERES], z[MAX_SPHERES];
+			double radius;
+		};
+		TripleBuffer<ContactSpheres> spheres;
+		const ContactSpheres* stepSpheres;  // the spheres of the current step
+
+		/* solver output */
+		struct TissueFrame {
+			std::vector<float> positions;  // x, y, z per vertex
+			std::vector<float> normals;
+		};
+		TripleBuffer<TissueFrame> frames;  // to apply()
+		TripleBuffer<TissueFrame> renderFrames;  // to applyRender()
+
+		cMesh* mesh;
+		cVector3d meshPosition;
+		cMatrix3d meshRotation;
+
+		double stiffness;
+		double tether;
+		double damping;
+		double contactStiffness;
+		int iterations;
+
+		SpinWorkerPool workers;
+		std::thread thread;
+		std::atomic<bool> running;
+		double period;
+
+		/* solver thread: current color being projected */
+		int currentColor;
+		double keep;  // fraction of the velocity kept this step
+
+		/* statistics, published once per second by the solver thread */
+		std::atomic<double> rate;
+		std::atomic<double> meanStepTime;
+		std::atomic<double> maxStepTime;
+		std::atomic<unsigned long long> overruns;
+
+		void colorEdges(const std::vector<int>& a, const std::vector<int>& b);
+		void computeNormals();
+		void publish(TripleBuffer<TissueFrame>& buffer);
+		void run();
+
+		static void predictChunk(void* context, int index);
+		static void projectEdgesChunk(void* context, int index);
+		static void projectVerticesChunk(void* context, int index);
+
+	public:
+		/* The tissue of this mesh, at its current shape (rest shape) */
+		DeformableTissue(cMesh* a_mesh);
+		~DeformableTissue();
+
+		/* 0..1 per iteration: how firmly the edges keep their length */
+		void setStiffness(double value) { this->stiffness = value; }
+		/* 0..1 per iteration: how firmly the vertices are pulled back to their rest position */
+		void setTether(double value) { this->tether = value; }
+		/* Velocity damping [1/s] */
+		void setDamping(double value) { this->damping = value; }
+		/* 0..1 per iteration: how far the tool pushes the vertices out of its spheres; lower is softer */
+		void setContactStiffness(double value) { this->contactStiffness = value; }
+		void setIterations(int value) { this->iterations = value; }
+
+		/* Start the solver thread at the given rate [Hz], with up to numWorkers more threads for the projections.
+		The mesh must be in place (its global pose is taken here). Without a thread of its own ('threaded' false) the
+		solver only steps when the caller calls advance(), e.g. in time with a fixed-step simulation clock */
+		void start(double stepRate, int numWorkers, bool threaded = true);
+		void stop();
+		/* Caller driven solver: one step of the period given to start(), handed to apply() and applyRender() */
+		void advance();
+
+		/* Haptic thread: the spheres of the tool, of the given radius [m]: its haptic points spread from the device position
+		over a shaft of the given length [m] (see ShaftTool; 0 for a single point). Taken from the device pose, since the
+		haptic points are not updated when a LocalContactModel renders the tool */
+		void setContactSpheres(cGenericTool* tool, double radius, double length = 0.0);
+		/* Thread that runs the proxies: copy the newest shape into the mesh and its collision tree. Returns false if there is none */
+		bool apply();
+		/* Graphics thread: copy the newest shape into a mesh that is only rendered (a copy of the tissue mesh), so that
+		the graphics never read the mesh the proxies are touching. Returns false if there is none */
+		bool applyRender(cMesh* a_mesh);
+
+		/* Up to numWorkers more threads for the projections (fewer if the machine has fewer spare cores); start() sets it */
+		void setNumWorkers(int numWorkers);
+		int getNumWorkers() const { return this->workers.getNumWorkers(); }
+
+		/* One step of the solver (the solver thread calls it; benchmarks can call it directly, without start()) */
+		void step(double dt);
+
+		int getNumVertices() const { return (int)this->x.size(); }
+		int getNumEdges() const { return (int)this->edgeA.size(); }
+		int getNumColors() const { return (int)this->colorStart.size() - 1; }
+
+		TissueStatistics getStatistics() const;
+		void printStatistics() const;
+	};
+
+	/* Replace the content of the mesh with a grid of cells x cells quads in its XY plane, centered on its origin,
+	with texture coordinates over the whole grid; cCreatePlane() makes a single quad, which can't bend */
+	void createTissueGrid(cMesh* a_mesh, double lengthX, double lengthY, int cells);
+}
@@ -0,0 +1,256 @@
+#include "DeviceManager.h"
+#include "timers/CPrecisionClock.h"
+#include <iostream>
+
+namespace chai3d {
+
+	/* how often the rates are updated, also when no device sends anything [ms] */
+	static const DWORD STATISTICS_PERIOD_MS = 100;
+
+	/*==================================================================*/
+	DeviceManager::ManagedDevice::ManagedDevice(int port, const RuntimeConfig& config)
+		: pipeline(port),
+		packets(0), rate(0.0), meanLatency(0.0), maxLatency(0.0), failed(false),
+		windowPackets(0), windowStart(0.0), latencySum(0.0), latencyMax(0.0)
+	{
+		this->pipeline.configure(config);
+		this->pipeline.transport.setDeadline(0.0);  // never wait: the manager reads only what the port signaled
+		this->pipeline.transport.getSerial().setOverlapped(true);
+	}
+
+	/*==================================================================*/
+	DeviceManager::DeviceManager()
+		: stopEvent(NULL), running(false)
+	{
+	}
+
+	DeviceManager::~DeviceManager() {
+		this->stop();
+		for (size_t i = 0; i < this->devices.size(); i++) {
+			delete this->devices[i];
+		}
+	}
+
+	/*==================================================================*/
+	int DeviceManager::add(int port, const RuntimeConfig& config) {
+		this->devices.push_back(new ManagedDevice(port, config));
+		return (int)this->devices.size() - 1;
+	}
+
+	/*==================================================================*/
+	/* Open the ports (in parallel: each open may wait for its device to send) and start the threads. A port that does not
+	open is reported failed and the others are served anyway */
+	bool DeviceManager::start() {
+		if (this->running) {
+			return true;
+		}
+
+		std::vector<std::thread> openers;
+		std::vector<char> opened(this->devices.size(), 0);
+		for (size_t i = 0; i < this->devices.size(); i++) {
+			openers.push_back(std::thread([this, i, &opened]() {
+				opened[i] = this->devices[i]->pipeline.transport.open();
+			}));
+		}
+		size_t numOpened = 0;
+		for (size_t i = 0; i < openers.size(); i++) {
+			openers[i].join();
+			if (opened[i]) {
+				numOpened++;
+			}
+			else {
+				std::cout << "Failed to open device on COM" << this->devices[i]->pipeline.transport.getPort() << "!" << std::endl;
+			}
+			this->devices[i]->failed.store(!opened[i], std::memory_order_relaxed);
+		}
+		if (numOpened == 0) {
+			return false;
+		}
+
+		double now = cPrecisionClock::getCPUTimeSeconds();
+		for (size_t i = 0; i < this->devices.size(); i++) {
+			this->devices[i]->windowStart = now;
+		}
+
+		this->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		this->running = true;
+		for (size_t first = 0; first < this->devices.size(); first += DEVICES_PER_THREAD) {
+			size_t count = this->devices.size() - first;
+			if (count > (size_t)DEVICES_PER_THREAD) {
+				count = DEVICES_PER_THREAD;
+			}
+			this->threads.push_back(std::thread(&DeviceManager::run, this, first, count));
+			this->threadHandles.push_back((HANDLE)this->threads.back().native_handle());
+		}
+		return numOpened == this->devices.size();
+	}
+
+	/*==================================================================*/
+	void DeviceManager::stop() {
+		if (!this->running) {
+			return;
+		}
+		SetEvent(this->stopEvent);
+		for (size_t i = 0; i < this->threads.size(); i++) {
+			this->threads[i].join();
+		}
+		this->threads.clear();
+		this->threadHandles.clear();
+		for (size_t i = 0; i < this->devices.size(); i++) {
+			this->devices[i]->pipeline.transport.close();
+		}
+		CloseHandle(this->stopEvent);
+		this->stopEvent = NULL;
+		this->running = false;
+	}
+
+	/*==================================================================*/
+	/* Manager thread: wait until any of its ports has data, and serve it */
+	void DeviceManager::run(size_t first, size_t count) {
+		/* handles[k + 1] is the receive event of served[k]; a device whose port fails is taken out */
+		HANDLE handles[DEVICES_PER_THREAD + 1];
+		ManagedDevice* served[DEVICES_PER_THREAD];
+		size_t numServed = 0;
+		handles[0] = this->stopEvent;
+
+		double start = cPrecisionClock::getCPUTimeSeconds();
+		for (size_t i = 0; i < count; i++) {
+			ManagedDevice& device = *this->devices[first + i];
+			if (!device.failed.load(std::memory_order_relaxed) && this->arm(device, start)) {
+				served[numServed] = &device;
+				handles[numServed + 1] = device.pipeline.transport.getSerial().getReceiveEvent();
+				numServed++;
+			}
+		}
+
+		while (true) {
+			DWORD result = WaitForMultipleObjects((DWORD)numServed + 1, handles, FALSE, STATISTICS_PERIOD_MS);
+			double now = cPrecisionClock::getCPUTimeSeconds();
+			if (result == WAIT_OBJECT_0) {
+				return;
+			}
+			if (result == WAIT_FAILED) {
+				std::cout << "Error - the device manager can't wait on its ports" << std::endl;
+				return;
+			}
+
+			if (result != WAIT_TIMEOUT) {
+				/* WaitForMultipleObjects() reports the first signaled port only; serve all that are signaled,
+				so that a busy port can't starve the ones after it */
+				size_t kept = 0;
+				for (size_t i = 0; i < numServed; i++) {
+					if (WaitForSingleObject(handles[i + 1], 0) == WAIT_OBJECT_0) {
+						this->service(*served[i], now);
+						if (!this->arm(*served[i], now)) {
+							continue;
+						}
+					}
+					served[kept] = served[i];
+					handles[kept + 1] = handles[i + 1];
+					kept++;
+				}
+				numServed = kept;
+			}
+
+			for (size_t i = 0; i < count; i++) {
+				this->updateStatistics(*this->devices[first + i], now);
+			}
+		}
+	}
+
+	/*==================================================================*/
+	/* Manager thread: wait for more data on the port, serving what it already has. Returns false if the port failed:
+	the device is then reported and no longer served (its last poses stay in its history) */
+	bool DeviceManager::arm(ManagedDevice& device, double now) {
+		while (true) {
+			Serial::ReceiveState state = device.pipeline.transport.getSerial().armReceiveEvent();
+			if (state == Serial::RECEIVE_WAITING) {
+				return true;
+			}
+			if (state == Serial::RECEIVE_FAILED) {
+				std::cout << "Error - COM" << device.pipeline.transport.getPort() << " failed; its device is no longer served" << std::endl;
+				device.failed.store(true, std::memory_order_relaxed);
+				return false;
+			}
+			this->service(device, now);
+		}
+	}
+
+	/*==================================================================*/
+	/* Manager thread: decode every complete packet received and publish the poses */
+	void DeviceManager::service(ManagedDevice& device, double signaled) {
+		while (device.pipeline.read()) {
+			device.pipeline.update();
+
+			UsartPose pose;
+			pose.time = cPrecisionClock::getCPUTimeSeconds();
+			pose.angle = device.pipeline.angle;
+			pose.position = device.pipeline.position;
+			device.pipeline.getRotation(pose.rotation);
+			device.history.push(pose);
+
+			double latency = pose.time - signaled;
+			device.latencySum += latency;
+			if (latency > device.latencyMax) {
+				device.latencyMax = latency;
+			}
+			device.windowPackets++;
+			device.packets.store(device.packets.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);  // single writer
+		}
+	}
+
+	/*==================================================================*/
+	/* Manager thread: publish the rate and latencies once per second */
+	void DeviceManager::updateStatistics(ManagedDevice& device, double time) {
+		double elapsed = time - device.windowStart;
+		if (elapsed < 1.0) {
+			return;
+		}
+		device.rate.store(device.windowPackets / elapsed, std::memory_order_relaxed);
+		device.meanLatency.store(device.windowPackets > 0 ? device.latencySum / device.windowPackets : 0.0, std::memory_order_relaxed);
+		device.maxLatency.store(device.latencyMax, std::memory_order_relaxed);
+		device.windowPackets = 0;
+		device.windowStart = time;
+		device.latencySum = 0.0;
+		device.latencyMax = 0.0;
+	}
+
+	/*==================================================================*/
+	DeviceStatistics DeviceManager::getStatistics(int device) const {
+		const ManagedDevice& managed = *this->devices[device];
+		DeviceStatistics statistics;
+		statistics.packets = managed.packets.load(std::memory_order_relaxed);
+		statistics.rate = managed.rate.load(std::memory_order_relaxed);
+		statistics.meanLatency = managed.meanLatency.load(std::memory_order_relaxed);
+		statistics.maxLatency = managed.maxLatency.load(std::memory_order_relaxed);
+		statistics.failed = managed.failed.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+	/*==================================================================*/
+	double DeviceManager::getCpuTime() const {
+		double seconds = 0.0;
+		for (size_t i = 0; i < this->threadHandles.size(); i++) {
+			FILETIME creation, exit, kernel, user;
+			if (GetThreadTimes(this->threadHandles[i], &creation, &exit, &kernel, &user)) {
+				/* 100 ns units */
+				unsigned long long ticks = (((unsigned long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+					(((unsigned long long)user.dwHighDateTime << 32) | user.dwLowDateTime);
+				seconds += 1.0e-7 * ticks;
+			}
+		}
+		return seconds;
+	}
+
+	/*==================================================================*/
+	void DeviceManager::printStatistics() const {
+		for (int i = 0; i < this->getNumDevices(); i++) {
+			DeviceStatistics statistics = this->getStatistics(i);
+			std::cout << "COM" << this->devices[i]->pipeline.transport.getPort() << ": "
+				<< statistics.packets << " packets, " << statistics.rate << " Hz, latency "
+				<< statistics.meanLatency * 1000.0 << " ms (max " << statistics.maxLatency * 1000.0 << " ms)"
+				<< (statistics.failed ? ", failed" : "") << std::endl;
+		}
+		std::cout << "Device manager: " << this->threads.size() << " threads, " << this->getCpuTime() << " s of CPU" << std::endl;
+	}
+}
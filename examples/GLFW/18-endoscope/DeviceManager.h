@@ -0,0 +1,103 @@
+#pragma once
+#include "PoseHistory.h"
+#include "UsartPipeline.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace chai3d {
+	/* Rate and latency of one managed device, over the last second */
+	struct DeviceStatistics {
+		unsigned long long packets;  // packets decoded since start()
+		double rate;  // packets per second
+		double meanLatency;  // from the port signaling received data to the pose being published [s]
+		double maxLatency;  // [s]
+		bool failed;  // the port failed: the device is no longer served
+	};
+
+	/*
+	Several USART instruments (e.g. two scopes and a foot pedal) served by one thread instead of one blocking reader each.
+
+	The ports are opened for overlapped I/O; the manager thread waits on all of them at once with WaitForMultipleObjects()
+	(the Windows counterpart of an epoll loop), and when a port signals received characters it decodes them with the
+	device pipeline (see UsartPipeline.h) and publishes the new pose in the device's PoseHistory. Readers in any thread
+	take the latest pose, or the pose at a given time, without locks. An idle device costs nothing: the thread sleeps
+	until one of the ports has data. A thread waits on at most DEVICES_PER_THREAD ports, more devices get more threads.
+	A port that fails is reported and no longer served; the others go on.
+
+		DeviceManager manager;
+		int left = manager.add(4), right = manager.add(5, rightConfig), pedal = manager.add(6);
+		manager.start();
+		...
+		UsartPose pose;
+		if (manager.getLatestPose(left, pose)) { ... }
+
+	18-endoscope reads the extra instruments this way: their UsartDevice takes the poses from the manager (see
+	UsartDevice::setManager()) instead of reading its port in the haptic tick.
+	*/
+	class DeviceManager {
+	public:
+		static const int DEVICES_PER_THREAD = 63;  // WaitForMultipleObjects() takes 64 handles, one is the stop event
+
+	private:
+		struct ManagedDevice {
+			RuntimeUsartPipeline pipeline;
+			PoseHistory<256> history;
+
+			std::atomic<unsigned long long> packets;
+			std::atomic<double> rate;
+			std::atomic<double> meanLatency;
+			std::atomic<double> maxLatency;
+			std::atomic<bool> failed;
+
+			/* manager thread only */
+			unsigned long long windowPackets;
+			double windowStart;
+			double latencySum;
+			double latencyMax;
+
+			ManagedDevice(int port, const RuntimeConfig& config);
+		};
+
+		std::vector<ManagedDevice*> devices;
+		std::vector<std::thread> threads;
+		std::vector<HANDLE> threadHandles;  // for their CPU time
+		HANDLE stopEvent;
+		bool running;
+
+		void run(size_t first, size_t count);
+		bool arm(ManagedDevice& device, double now);
+		void service(ManagedDevice& device, double signaled);
+		void updateStatistics(ManagedDevice& device, double time);
+
+	public:
+		DeviceManager();
+		~DeviceManager();
+
+		/* Add the device on the given COM port; returns its index. Call before start() */
+		int add(int port, const RuntimeConfig& config = RuntimeConfig());
+		int getNumDevices() const { return (int)this->devices.size(); }
+
+		/* Open the ports and start serving them. Returns false if a port could not be opened: that device is reported
+		failed and the others are served */
+		bool start();
+		/* Stop the threads and close the ports */
+		void stop();
+		bool isRunning() const { return this->running; }
+		/* The device is served: the manager runs, its port opened and has not failed since */
+		bool isServed(int device) const { return this->running && !this->devices[device]->failed.load(std::memory_order_relaxed); }
+
+		/* The link of a device, e.g. for the commands to it: its port is opened for overlapped I/O, so a write from
+		another thread does not wait for the manager's reads */
+		LinkTransport& getTransport(int device) { return this->devices[device]->pipeline.transport; }
+
+		/* Any thread; time is in seconds, wall time (cPrecisionClock::getCPUTimeSeconds()): the manager thread stamps the
+		poses as it decodes them, whatever the clock of the simulation */
+		bool getLatestPose(int device, UsartPose& pose) const { return this->devices[device]->history.latest(pose); }
+		bool getPoseAt(int device, double time, UsartPose& pose) const { return this->devices[device]->history.sample(time, pose); }
+		DeviceStatistics getStatistics(int device) const;
+		/* CPU time the manager threads used since start() [s]; 0 once stopped */
+		double getCpuTime() const;
+		void printStatistics() const;
+	};
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+
+namespace chai3d {
+	/*
+	Watchdog of the device link, fed by the haptic thread.
+
+	Each tick the haptic thread waits at most 'readTimeout' for device data. Most ticks get no complete packet,
+	which is normal (the ring sends packets much slower than the haptic rate). When no packet arrives for longer
+	than 'stallTimeout', the device is considered stalled: the simulation holds the last pose and sends no force
+	until packets come back.
+
+	Times are in seconds, in the time of the device's SimulationClock (the wall clock unless it runs in fixed steps).
+	The statistics are atomics so the graphics thread can display them while the haptic thread updates them.
+	*/
+	class DeviceWatchdog {
+	private:
+		double readTimeout;
+		double stallTimeout;
+		double lastPacket;  // haptic thread only
+		std::atomic<bool> stalled;
+		std::atomic<unsigned int> stallCount;
+		std::atomic<double> stallStart;
+		std::atomic<double> longestStall;
+		std::atomic<double> totalStallTime;
+
+		void endStall(double time) {
+			double duration = time - this->stallStart.load(std::memory_order_relaxed);
+			this->totalStallTime.store(this->totalStallTime.load(std::memory_order_relaxed) + duration, std::memory_order_relaxed);
+			if (duration > this->longestStall.load(std::memory_order_relaxed)) {
+				this->longestStall.store(duration, std::memory_order_relaxed);
+			}
+			this->stalled.store(false, std::memory_order_release);
+		}
+
+	public:
+		DeviceWatchdog(double readTimeout = 0.0005, double stallTimeout = 0.25)
+			: readTimeout(readTimeout), stallTimeout(stallTimeout), lastPacket(0.0),
+			stalled(false), stallCount(0), stallStart(0.0), longestStall(0.0), totalStallTime(0.0) {}
+
+		/* Set the bounds; call before the haptic thread starts */
+		void setTimeouts(double _readTimeout, double _stallTimeout) {
+			this->readTimeout = _readTimeout;
+			this->stallTimeout = _stallTimeout;
+		}
+		double getReadTimeout() const { return this->readTimeout; }
+		double getStallTimeout() const { return this->stallTimeout; }
+
+		/* Haptic thread: the link was (re)opened at the given time */
+		void start(double time) {
+			this->lastPacket = time;
+			if (this->stalled.load(std::memory_order_relaxed)) {
+				this->endStall(time);
+			}
+		}
+
+		/* Haptic thread: a complete packet arrived */
+		void feed(double time) {
+			this->lastPacket = time;
+			if (this->stalled.load(std::memory_order_relaxed)) {
+				this->endStall(time);
+			}
+		}
+
+		/* Haptic thread: no packet this tick; returns true if the device is stalled */
+		bool check(double time) {
+			if (!this->stalled.load(std::memory_order_relaxed) && (time - this->lastPacket > this->stallTimeout)) {
+				this->stallStart.store(this->lastPacket, std::memory_order_relaxed);
+				this->stallCount.store(this->stallCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				this->stalled.store(true, std::memory_order_release);
+			}
+			return this->stalled.load(std::memory_order_relaxed);
+		}
+
+		/* Statistics, from any thread */
+		bool isStalled() const { return this->stalled.load(std::memory_order_acquire); }
+		unsigned int getStallCount() const { return this->stallCount.load(std::memory_order_relaxed); }
+		double getLongestStall() const { return this->longestStall.load(std::memory_order_relaxed); }
+		double getTotalStallTime() const { return this->totalStallTime.load(std::memory_order_relaxed); }
+		/* Duration of the current stall, 0 if the device is fine */
+		double getCurrentStall(double time) const {
+			return this->isStalled() ? time - this->stallStart.load(std::memory_order_relaxed) : 0.0;
+		}
+	};
+}
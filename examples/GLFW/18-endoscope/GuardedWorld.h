@@ -0,0 +1,33 @@
+#pragma once
+#include "chai3d.h"
+#include <atomic>
+
+namespace chai3d {
+	/*
+	A world whose tools may compute their forces on several threads at once (HapticToolPool, the points of a
+	ShaftTool, the probe of a LocalContactModel).
+
+	A haptic point runs two passes over the scene. The proxy algorithm only reads it (collision detection against the
+	collision trees), and is the costly part. The effect pass, cGenericObject::computeInteractions(), stores the tool's
+	interaction in every haptic object it visits (computeLocalInteraction(): interaction point, normal, inside) and
+	the object's effects read it back; every object with a stiffness has a surface effect. Two threads in that pass
+	would overwrite each other's state, so here it takes a lock: the effect passes run one at a time, the proxy
+	algorithms stay in parallel. The lock spins, like the workers, since the pass is short.
+	*/
+	class GuardedWorld : public cWorld {
+	private:
+		std::atomic_flag busy;
+
+	public:
+		GuardedWorld() { this->busy.clear(); }
+
+		virtual cVector3d computeInteractions(const cVector3d& a_toolPos, const cVector3d& a_toolVel,
+			const unsigned int a_IDN, cInteractionRecorder& a_interactions) {
+			while (this->busy.test_and_set(std::memory_order_acquire)) {
+			}
+			cVector3d force = cWorld::computeInteractions(a_toolPos, a_toolVel, a_IDN, a_interactions);
+			this->busy.clear(std::memory_order_release);
+			return force;
+		}
+	};
+}
@@ -0,0 +1,47 @@
+#include "HapticToolPool.h"
+#include "AllocationGuard.h"
+#include "Trace.h"
+
+namespace chai3d {
+
+	/*==================================================================*/
+	void HapticToolPool::add(cGenericTool* tool, UsartDevicePtr device, LocalContactModel* contactModel) {
+		PooledTool pooled;
+		pooled.tool = tool;
+		pooled.device = device;
+		pooled.contactModel = contactModel;
+		this->tools.push_back(pooled);
+	}
+
+	/*==================================================================*/
+	void HapticToolPool::start(bool parallel) {
+		if (parallel) {
+			this->workers.start(this->getNumTools() - 1);
+		}
+	}
+
+	/*==================================================================*/
+	/* One tool, one tick */
+	void HapticToolPool::processTool(void* context, int index) {
+		TRACE_SCOPE("tool");
+		HAPTIC_ALLOCATION_SCOPE();
+		PooledTool& pooled = ((HapticToolPool*)context)->tools[index];
+
+		// update position and orientation of tool
+		pooled.tool->updateFromDevice();
+
+		// compute interaction forces; while the device is stalled the tool holds its last pose and we send no force
+		if (pooled.device != nullptr && pooled.device->isStalled()) {
+			pooled.tool->setDeviceGlobalForce(0.0, 0.0, 0.0);
+		}
+		else if (pooled.contactModel != NULL && pooled.contactModel->isRunning()) {
+			pooled.contactModel->render(pooled.tool);
+		}
+		else {
+			pooled.tool->computeInteractionForces();
+		}
+
+		// send forces to haptic device
+		pooled.tool->applyToDevice();
+	}
+}
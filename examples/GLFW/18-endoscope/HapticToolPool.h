@@ -0,0 +1,50 @@
+#pragma once
+#include "chai3d.h"
+#include "SpinWorkerPool.h"
+#include "UsartDevice.h"
+#include "LocalContactModel.h"
+#include <vector>
+
+namespace chai3d {
+	/*
+	Runs the per tick work of several tools (updateFromDevice, computeInteractionForces, applyToDevice) in parallel,
+	for bimanual setups with 2-4 instruments in one world.
+
+	The haptic thread and the workers (see SpinWorkerPool.h) take the tools one by one until all are done, so the tick
+	takes about as long as the slowest tool instead of the sum of all tools. The haptic thread calls
+	world->computeGlobalPositions() before update(), and nothing changes the scene while the tools run: the collision
+	trees are only read. Each tool writes only its own proxy and forces.
+
+	CHAI3D also stores each tool's interaction in the objects while it computes their haptic effects
+	(cGenericObject::computeLocalInteraction), and every object with a stiffness has an effect: the world of parallel
+	tools must be a GuardedWorld, which runs those passes one at a time.
+	*/
+	class HapticToolPool {
+	private:
+		struct PooledTool {
+			cGenericTool* tool;
+			UsartDevicePtr device;  // while this device is stalled the tool holds its pose and sends no force
+			LocalContactModel* contactModel;  // renders the forces of the tool when set (two-rate mode)
+		};
+
+		std::vector<PooledTool> tools;
+		SpinWorkerPool workers;
+
+		static void processTool(void* context, int index);
+
+	public:
+		/* Add a tool; call before start(). With a contact model, the forces are rendered from the model
+		instead of tool->computeInteractionForces() */
+		void add(cGenericTool* tool, UsartDevicePtr device, LocalContactModel* contactModel = NULL);
+		int getNumTools() const { return (int)this->tools.size(); }
+
+		/* Start the workers: one less than the number of tools (the haptic thread takes part), at most one less than
+		the number of cores. 'parallel' false runs the tools one after another in the haptic thread */
+		void start(bool parallel);
+		void stop() { this->workers.stop(); }
+		bool isParallel() const { return this->workers.getNumWorkers() > 0; }
+
+		/* Haptic thread: process all the tools for this tick and return when they are done */
+		void update() { this->workers.run(this->getNumTools(), &HapticToolPool::processTool, this); }
+	};
+}
@@ -0,0 +1,254 @@
+#include "LaunchProfile.h"
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+namespace chai3d {
+
+	/* The settings, their type and valid range. Exactly one of the member pointers is set */
+	struct ProfileSetting {
+		const char* key;
+		double LaunchProfile::* realValue;
+		int LaunchProfile::* intValue;
+		bool LaunchProfile::* boolValue;
+		double min;
+		double max;
+		std::string LaunchProfile::* textValue;  // any text, no range
+	};
+
+	static const ProfileSetting settings[] = {
+		{ "com_port",              NULL, &LaunchProfile::com_port,              NULL, 1, 255 },
+		{ "angle_limit",           &LaunchProfile::angle_limit, NULL,           NULL, 1.0, 90.0 },
+		{ "zoom_limit",            &LaunchProfile::zoom_limit, NULL,            NULL, 0.001, 1.0 },
+		{ "angle_scale",           &LaunchProfile::angle_scale, NULL,           NULL, 0.01, 1.0e6 },
+		{ "zoom_scale",            &LaunchProfile::zoom_scale, NULL,            NULL, 0.01, 1.0e6 },
+		{ "filter_resolution",     &LaunchProfile::filter_resolution, NULL,     NULL, 1.0, 1.0e9 },
+		{ "polarity_translations", NULL, &LaunchProfile::polarity_translations, NULL, -1, 1 },
+		{ "polarity_zoom",         NULL, &LaunchProfile::polarity_zoom,         NULL, -1, 1 },
+		{ "read_timeout",          &LaunchProfile::read_timeout, NULL,          NULL, 0.0, 100.0 },
+		{ "stall_timeout",         &LaunchProfile::stall_timeout, NULL,         NULL, 1.0, 60000.0 },
+		{ "com_port_2",            NULL, &LaunchProfile::com_port_2,            NULL, 0, 255 },
+		{ "com_port_3",            NULL, &LaunchProfile::com_port_3,            NULL, 0, 255 },
+		{ "com_port_4",            NULL, &LaunchProfile::com_port_4,            NULL, 0, 255 },
+		{ "udp_port",              NULL, &LaunchProfile::udp_port,              NULL, 0, 65535 },
+		{ "tool_radius",           &LaunchProfile::tool_radius, NULL,           NULL, 0.0001, 1.0 },
+		{ "shaft_points",          NULL, &LaunchProfile::shaft_points,          NULL, 1, 256 },
+		{ "shaft_length",          &LaunchProfile::shaft_length, NULL,          NULL, 0.0, 1.0 },
+		{ "workspace_radius",      &LaunchProfile::workspace_radius, NULL,      NULL, 0.01, 100.0 },
+		{ "heart_scale",           &LaunchProfile::heart_scale, NULL,           NULL, 0.01, 100.0 },
+		{ "heart_stiffness",       &LaunchProfile::heart_stiffness, NULL,       NULL, 0.0, 1.0 },
+		{ "deformable",            NULL, NULL, &LaunchProfile::deformable,           0, 1 },
+		{ "tissue_resolution",     NULL, &LaunchProfile::tissue_resolution,     NULL, 2, 256 },
+		{ "tissue_rate",           &LaunchProfile::tissue_rate, NULL,           NULL, 10.0, 10000.0 },
+		{ "tissue_threads",        NULL, &LaunchProfile::tissue_threads,        NULL, 0, 16 },
+		{ "video",                 NULL, NULL, NULL, 0, 0, &LaunchProfile::video },
+		{ "swap_interval",         NULL, &LaunchProfile::swap_interval,         NULL, 0, 4 },
+		{ "window_size",           &LaunchProfile::window_size, NULL,           NULL, 0.1, 1.0 },
+		{ "wait_for_small_force",  NULL, NULL, &LaunchProfile::wait_for_small_force, 0, 1 },
+		{ "parallel_tools",        NULL, NULL, &LaunchProfile::parallel_tools,       0, 1 },
+		{ "two_rate",              NULL, NULL, &LaunchProfile::two_rate,             0, 1 },
+		{ "max_model_age",         &LaunchProfile::max_model_age, NULL,         NULL, 1.0, 10000.0 },
+		{ "run_time",              &LaunchProfile::run_time, NULL,              NULL, 0.0, 1.0e6 },
+		{ "trace",                 NULL, NULL, &LaunchProfile::trace,                0, 1 },
+		{ "record",                NULL, NULL, &LaunchProfile::record,               0, 1 },
+		{ "record_rate",           &LaunchProfile::record_rate, NULL,           NULL, 1.0, 240.0 },
+		{ "session",               NULL, NULL, &LaunchProfile::session,              0, 1 },
+		{ "broadcast",             NULL, NULL, &LaunchProfile::broadcast,            0, 1 },
+		{ "replay",                NULL, NULL, NULL, 0, 0, &LaunchProfile::replay },
+		{ "headless",              NULL, NULL, &LaunchProfile::headless,             0, 1 },
+		{ "haptic_step",           &LaunchProfile::haptic_step, NULL,           NULL, 0.01, 100.0 },
+		{ "analyze",               NULL, NULL, NULL, 0, 0, &LaunchProfile::analyze },
+		{ "analyze_threads",       NULL, &LaunchProfile::analyze_threads,       NULL, 0, 256 },
+		{ "observe",               NULL, NULL, &LaunchProfile::observe,              0, 1 },
+		{ "self_test",             NULL, NULL, &LaunchProfile::self_test,            0, 1 },
+	};
+
+	static const int numSettings = sizeof(settings) / sizeof(settings[0]);
+
+	/* Remove leading and trailing blanks */
+	static std::string trim(const std::string& text) {
+		size_t begin = text.find_first_not_of(" \t\r\n");
+		if (begin == std::string::npos) {
+			return "";
+		}
+		size_t end = text.find_last_not_of(" \t\r\n");
+		return text.substr(begin, end - begin + 1);
+	}
+
+	/*==================================================================*/
+	/* Set one value from its text form */
+	bool LaunchProfile::set(const std::string& key, const std::string& value) {
+		for (int i = 0; i < numSettings; i++) {
+			const ProfileSetting& setting = settings[i];
+			if (key != setting.key) {
+				continue;
+			}
+
+			if (setting.textValue != NULL) {
+				this->*setting.textValue = value;
+				return true;
+			}
+
+			if (setting.boolValue != NULL) {
+				if (value == "1" || value == "true" || value == "yes" || value == "on") {
+					this->*setting.boolValue = true;
+				}
+				else if (value == "0" || value == "false" || value == "no" || value == "off") {
+					this->*setting.boolValue = false;
+				}
+				else {
+					std::cout << "Error - " << key << ": expected true or false, got '" << value << "'" << std::endl;
+					return false;
+				}
+				return true;
+			}
+
+			char* end = NULL;
+			double number = strtod(value.c_str(), &end);
+			/* strtod also takes "nan" and "inf": NaN would pass the range check below, since every comparison with it is false */
+			if (value.empty() || *end != '\0' || !std::isfinite(number)) {
+				std::cout << "Error - " << key << ": expected a number, got '" << value << "'" << std::endl;
+				return false;
+			}
+			/* the range first, so that an integer setting is only converted once it fits in an int */
+			if (number < setting.min || number > setting.max) {
+				std::cout << "Error - " << key << ": " << value << " is out of range [" << setting.min << ", " << setting.max << "]" << std::endl;
+				return false;
+			}
+			if (setting.intValue != NULL && number != std::floor(number)) {
+				std::cout << "Error - " << key << ": expected an integer, got '" << value << "'" << std::endl;
+				return false;
+			}
+			if ((setting.intValue == &LaunchProfile::polarity_translations || setting.intValue == &LaunchProfile::polarity_zoom) && number == 0) {
+				std::cout << "Error - " << key << ": polarity is 1 or -1" << std::endl;
+				return false;
+			}
+
+			if (setting.intValue != NULL) {
+				this->*setting.intValue = (int)number;
+			}
+			else {
+				this->*setting.realValue = number;
+			}
+			return true;
+		}
+
+		std::cout << "Error - unknown setting '" << key << "'" << std::endl;
+		return false;
+	}
+
+	/*==================================================================*/
+	/* Read a profile file */
+	bool LaunchProfile::load(const std::string& filename) {
+		std::ifstream file(filename.c_str());
+		if (!file) {
+			std::cout << "Error - failed to open profile " << filename << std::endl;
+			return false;
+		}
+
+		std::string line;
+		int lineNumber = 0;
+		bool valid = true;
+		while (std::getline(file, line)) {
+			lineNumber++;
+
+			size_t comment = line.find('#');
+			if (comment != std::string::npos) {
+				line.erase(comment);
+			}
+			line = trim(line);
+			if (line.empty()) {
+				continue;
+			}
+
+			size_t equal = line.find('=');
+			if (equal == std::string::npos) {
+				std::cout << "Error - " << filename << ":" << lineNumber << ": expected 'key = value'" << std::endl;
+				valid = false;
+				continue;
+			}
+			if (!this->set(trim(line.substr(0, equal)), trim(line.substr(equal + 1)))) {
+				std::cout << "        in " << filename << ":" << lineNumber << std::endl;
+				valid = false;  // keep going, so that all errors are reported at once
+			}
+		}
+		return valid;
+	}
+
+	/*==================================================================*/
+	/* Apply the command line */
+	bool LaunchProfile::parseArguments(int argc, char* argv[]) {
+		const std::string profileOption = "--profile=";
+
+		/* the profile first, so that the other arguments override it wherever they are */
+		for (int i = 1; i < argc; i++) {
+			std::string argument = argv[i];
+			if (argument.compare(0, profileOption.size(), profileOption) == 0) {
+				if (!this->load(argument.substr(profileOption.size()))) {
+					return false;
+				}
+			}
+		}
+
+		bool valid = true;
+		for (int i = 1; i < argc; i++) {
+			std::string argument = argv[i];
+			if (argument.compare(0, profileOption.size(), profileOption) == 0) {
+				continue;
+			}
+			size_t equal = argument.find('=');
+			if (argument.compare(0, 2, "--") != 0 || equal == std::string::npos) {
+				std::cout << "Error - unexpected argument '" << argument << "'" << std::endl;
+				valid = false;
+				continue;
+			}
+			if (!this->set(argument.substr(2, equal - 2), argument.substr(equal + 1))) {
+				valid = false;
+			}
+		}
+		return valid;
+	}
+
+	/*==================================================================*/
+	/* Device parameters */
+	RuntimeConfig LaunchProfile::getDeviceConfig() const {
+		RuntimeConfig config;
+		config.angle_limit = this->angle_limit;
+		config.zoom_limit = this->zoom_limit;
+		config.angle_scale = this->angle_scale;
+		config.zoom_scale = 100 * this->zoom_scale;
+		config.filter_resolution = this->filter_resolution;
+		config.polarity_angle = -this->polarity_translations;
+		config.polarity_zoom = this->polarity_zoom;
+		return config;
+	}
+
+	/*==================================================================*/
+	void LaunchProfile::print() const {
+		for (int i = 0; i < numSettings; i++) {
+			const ProfileSetting& setting = settings[i];
+			std::cout << "  " << setting.key << " = ";
+			if (setting.textValue != NULL) {
+				std::cout << this->*setting.textValue;
+			}
+			else if (setting.boolValue != NULL) {
+				std::cout << (this->*setting.boolValue ? "true" : "false");
+			}
+			else if (setting.intValue != NULL) {
+				std::cout << this->*setting.intValue;
+			}
+			else {
+				std::cout << this->*setting.realValue;
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	/*==================================================================*/
+	void LaunchProfile::printUsage() {
+		std::cout << "Usage: 18-endoscope [--profile=<file>] [--<key>=<value> ...]" << std::endl;
+		std::cout << "Settings and their defaults:" << std::endl;
+		LaunchProfile().print();
+	}
+}
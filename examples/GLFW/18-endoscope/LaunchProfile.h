@@ -0,0 +1,90 @@
+#pragma once
+#include "UsartPipeline.h"
+#include <string>
+
+namespace chai3d {
+	/*
+	Everything 18-endoscope used to ask on the console at startup, plus the scene and rendering settings,
+	so that a station can start straight into the simulation.
+
+	A profile is a text file of 'key = value' lines ('#' starts a comment), e.g.
+
+		# station 2, left handed surgeon
+		com_port = 4
+		zoom_scale = 80
+		polarity_translations = -1
+		run_time = 600
+
+	Command line:  18-endoscope [--profile=<file>] [--<key>=<value> ...]
+	e.g. 18-endoscope --profile=station2.profile --analyze=monday.session,tuesday.session  grades two sessions and exits
+	The profile is read first, then the other arguments override it, in order. Unknown keys and out of range
+	values are errors: the program reports them and does not start, rather than running with a setting nobody asked for.
+	*/
+	class LaunchProfile {
+	public:
+		/* Device */
+		int com_port = 9;
+		double angle_limit = 45.0;  // [deg]
+		double zoom_limit = 0.04;  // [m]
+		double angle_scale = 15.0;  // larger is slower
+		double zoom_scale = 100.0;  // larger is slower; as entered at the former prompt, the device uses 100 times this value
+		double filter_resolution = 20000.0;
+		int polarity_translations = 1;  // 1 or -1
+		int polarity_zoom = -1;  // 1 or -1
+		double read_timeout = 0.5;  // longest wait for device data per haptic tick [ms]
+		double stall_timeout = 250.0;  // time without packets before the device is reported stalled [ms]
+		int com_port_2 = 0;  // more instruments, each with its own tool; 0 for none
+		int com_port_3 = 0;
+		int com_port_4 = 0;
+		int udp_port = 0;  // the first device streams over Wi-Fi: its datagrams are received on this port instead of com_port; 0 for none
+
+		/* Scene */
+		double tool_radius = 0.01;  // [m]
+		int shaft_points = 1;  // haptic points along the scope; 1 is a single sphere at the tip
+		double shaft_length = 0.1;  // [m]
+		double workspace_radius = 1.0;  // [m]
+		double heart_scale = 0.6;
+		double heart_stiffness = 0.1;  // fraction of the device max stiffness
+		bool deformable = false;  // deformable heart tissue instead of a rigid plane
+		int tissue_resolution = 32;  // deformable: cells per side of the tissue grid
+		double tissue_rate = 500.0;  // deformable: solver steps per second [Hz]
+		int tissue_threads = 2;  // deformable: more threads for the solver, 0 for none
+		std::string video;  // footage played on the heart instead of its still image (a YUV4MPEG2 file, see VideoTexture.h); empty for none
+
+		/* Rendering / haptics */
+		int swap_interval = 1;  // 0: no vertical synchronization
+		double window_size = 0.5;  // window height as a fraction of the screen height
+		bool wait_for_small_force = true;
+		bool parallel_tools = true;  // compute the tools in parallel when there are several
+		bool two_rate = false;  // collisions in their own thread, forces rendered from a local contact model
+		double max_model_age = 50.0;  // two_rate: older contact models are not rendered [ms]
+		double run_time = 0.0;  // close the simulation after this many seconds; 0 runs until closed
+		bool trace = false;  // trace the threads from the start (see Trace.h); [t] toggles it while running
+		bool record = false;  // record the endoscope view from the start (see ViewRecorder.h); [v] toggles it while running
+		double record_rate = 30.0;  // frames recorded per second, at most [Hz]
+		bool session = false;  // record the processed state of every haptic tick (see SessionRecorder.h)
+		bool broadcast = false;  // publish the pose of the first device to observer processes (see PoseBroadcast.h)
+		std::string replay;  // recorded session played back as the input of the first device, instead of its COM port
+		bool headless = false;  // no windows; a replay runs in fixed steps as fast as the CPU allows, then the program exits
+		double haptic_step = 1.0;  // headless: simulated time per haptic tick [ms]
+
+		/* Offline */
+		std::string analyze;  // sessions to grade, separated by commas (see SessionAnalytics.h); the simulation does not start
+		int analyze_threads = 0;  // threads grading them, 0: one per hardware thread
+		bool observe = false;  // print the poses a running simulation broadcasts, until it stops (or for run_time); the simulation does not start
+		bool self_test = false;  // run the checks of test.cpp and exit with their result; the simulation does not start
+
+		/* Read a profile file. Returns false (and prints why) if the file can't be read or holds an invalid setting */
+		bool load(const std::string& filename);
+		/* Apply the command line (--profile=<file> first, then the --<key>=<value> overrides) */
+		bool parseArguments(int argc, char* argv[]);
+		/* Set one value from its text form */
+		bool set(const std::string& key, const std::string& value);
+
+		/* Device parameters, as UsartDevice::setConfig() takes them */
+		RuntimeConfig getDeviceConfig() const;
+
+		void print() const;
+		static void printUsage();
+	};
+}
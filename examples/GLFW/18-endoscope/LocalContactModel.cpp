@@ -0,0 +1,318 @@
+#include "LocalContactModel.h"
+#include "Trace.h"
+#include <iostream>
+
+namespace chai3d {
+
+	/* the model of a free point looks this many collision periods ahead */
+	static const double LOOKAHEAD_PERIODS = 3.0;
+
+	/* passes of the local proxy over its planes; 3 planes meeting at a corner need a few */
+	static const int PROJECTION_PASSES = 4;
+
+	/*==================================================================*/
+	LocalContactModel::LocalContactModel(cWorld* a_world, int numPoints, double length, double radius)
+		: world(a_world),
+		sceneRoot(a_world),
+		sceneCallback(NULL),
+		sceneContext(NULL),
+		length(length),
+		radius(radius),
+		maxStaleness(0.05),
+		running(false),
+		hasFrame(false),
+		contacts(0),
+		hapticWindowStart(0.0),
+		hapticWindowTicks(0),
+		stalenessSum(0.0),
+		stalenessMax(0.0),
+		collisionWindowStart(0.0),
+		collisionWindowUpdates(0),
+		collisionTimeMax(0.0),
+		collisionPeriod(0.001),
+		hapticRate(0.0),
+		collisionRate(0.0),
+		maxCollisionTime(0.0),
+		meanStaleness(0.0),
+		maxStalenessSeen(0.0),
+		expiredTicks(0),
+		predictedPlanes(0)
+	{
+		this->probe = new ShaftTool(a_world, numPoints, length);
+		this->probe->setRadius(radius);
+		this->proxies.resize(this->probe->getNumHapticPoints());
+	}
+
+	LocalContactModel::~LocalContactModel() {
+		this->stop();
+		delete this->probe;
+	}
+
+	/*==================================================================*/
+	void LocalContactModel::start(cGenericTool* tool) {
+		if (this->running) {
+			return;
+		}
+
+		ModelPose pose;
+		pose.time = cPrecisionClock::getCPUTimeSeconds();
+		pose.position = tool->getDeviceGlobalPos();
+		pose.rotation = tool->getDeviceGlobalRot();
+		pose.velocity.zero();
+		this->poses.reset(pose);
+
+		/* no contact until the first model arrives */
+		ModelFrame frame;
+		frame.poseTime = pose.time;
+		frame.points.resize(this->probe->getNumHapticPoints());
+		for (size_t i = 0; i < frame.points.size(); i++) {
+			frame.points[i].numPlanes = 0;
+		}
+		this->frames.reset(frame);
+		this->hasFrame = false;
+		double spacing = (frame.points.size() > 1) ? this->length / (frame.points.size() - 1) : 0.0;
+		for (size_t i = 0; i < this->proxies.size(); i++) {
+			this->proxies[i] = pose.position + (i * spacing) * pose.rotation.getCol0();
+		}
+
+		this->sceneRoot->computeGlobalPositions(true);
+		this->probe->updateContactBounds();
+		this->probe->setDeviceGlobalPose(pose.position, pose.rotation);
+		this->probe->initialize();
+
+		this->hapticWindowStart = this->collisionWindowStart = pose.time;
+		this->running = true;
+		this->thread = std::thread(&LocalContactModel::run, this);
+	}
+
+	/*==================================================================*/
+	void LocalContactModel::stop() {
+		if (!this->running) {
+			return;
+		}
+		this->running = false;
+		this->thread.join();
+	}
+
+	/*==================================================================*/
+	/* Collision thread: one model per new device pose */
+	void LocalContactModel::run() {
+		Trace::nameThread("collision");
+		double lastUpdate = cPrecisionClock::getCPUTimeSeconds();
+		while (this->running.load(std::memory_order_relaxed)) {
+			if (!this->poses.update()) {
+				std::this_thread::yield();
+				continue;
+			}
+
+			double begin = cPrecisionClock::getCPUTimeSeconds();
+			this->computeModel(this->poses.read(), this->frames.write());
+			this->frames.publish();
+			double end = cPrecisionClock::getCPUTimeSeconds();
+
+			this->collisionPeriod = end - lastUpdate;
+			lastUpdate = end;
+			if (end - begin > this->collisionTimeMax) {
+				this->collisionTimeMax = end - begin;
+			}
+			this->collisionWindowUpdates++;
+			double elapsed = end - this->collisionWindowStart;
+			if (elapsed >= 1.0) {
+				this->collisionRate.store(this->collisionWindowUpdates / elapsed, std::memory_order_relaxed);
+				this->maxCollisionTime.store(this->collisionTimeMax, std::memory_order_relaxed);
+				this->collisionWindowStart = end;
+				this->collisionWindowUpdates = 0;
+				this->collisionTimeMax = 0.0;
+			}
+		}
+	}
+
+	/*==================================================================*/
+	/* Collision thread: run the proxies at the given pose and keep the planes they rest on */
+	void LocalContactModel::computeModel(const ModelPose& pose, ModelFrame& frame) {
+		TRACE_SCOPE("contact model");
+		if (this->sceneCallback != NULL) {
+			this->sceneCallback(this->sceneContext);
+		}
+		this->sceneRoot->computeGlobalPositions(true);
+		this->probe->setDeviceGlobalPose(pose.position, pose.rotation);
+		this->probe->computeInteractionForces();
+
+		int n = (int)frame.points.size();
+		double spacing = (n > 1) ? this->length / (n - 1) : 0.0;
+		for (int i = 0; i < n; i++) {
+			PointContact& contact = frame.points[i];
+			contact.numPlanes = 0;
+
+			cHapticPoint* point = this->probe->getHapticPoint(i);
+			cAlgorithmFingerProxy* proxy = point->m_algorithmFingerProxy;
+			cVector3d proxyPosition = point->getGlobalPosProxy();
+			int numEvents = proxy->getNumCollisionEvents();
+			for (int j = 0; j < numEvents && j < MAX_PLANES; j++) {
+				cCollisionEvent* event = proxy->m_collisionEvents[j];
+				cVector3d normal = event->m_globalNormal;
+				if (normal.dot(proxyPosition - event->m_globalPos) < 0.0) {
+					normal.negate();  // triangles can be touched from both sides
+				}
+				normal.normalize();
+
+				ContactPlane& plane = contact.planes[contact.numPlanes++];
+				plane.point = proxyPosition;
+				plane.normal = normal;
+				plane.stiffness = event->m_object->m_material->getStiffness();
+			}
+
+			if (contact.numPlanes == 0) {
+				cVector3d position = pose.position + (i * spacing) * pose.rotation.getCol0();
+				if (this->addPredictivePlane(position, pose.velocity, contact)) {
+					this->predictedPlanes.store(this->predictedPlanes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);  // single writer
+				}
+			}
+		}
+		frame.poseTime = pose.time;
+	}
+
+	/*==================================================================*/
+	/* Collision thread: the surface a free point will meet before the next models, if any. Returns true if there is one */
+	bool LocalContactModel::addPredictivePlane(const cVector3d& position, const cVector3d& velocity, PointContact& contact) {
+		double speed = velocity.length();
+		if (speed < 1.0e-6) {
+			return false;  // a point at rest is caught by its proxy on the next model
+		}
+
+		cVector3d direction = velocity / speed;
+		double reach = speed * LOOKAHEAD_PERIODS * this->collisionPeriod + this->radius;
+
+		cCollisionRecorder recorder;
+		cCollisionSettings settings;
+		settings.m_checkForNearestCollisionOnly = true;
+		settings.m_checkHapticObjects = true;
+		settings.m_checkVisibleObjects = false;
+		settings.m_collisionRadius = 0.0;
+		if (!this->world->computeCollisionDetection(position, position + reach * direction, recorder, settings)) {
+			return false;
+		}
+
+		const cCollisionEvent& hit = recorder.m_nearestCollision;
+		cVector3d normal = hit.m_globalNormal;
+		if (normal.dot(direction) > 0.0) {
+			normal.negate();
+		}
+		normal.normalize();
+
+		ContactPlane& plane = contact.planes[contact.numPlanes++];
+		plane.point = hit.m_globalPos + this->radius * normal;  // where the center of the point stops
+		plane.normal = normal;
+		plane.stiffness = hit.m_object->m_material->getStiffness();
+		return true;
+	}
+
+	/*==================================================================*/
+	/* Haptic thread */
+	void LocalContactModel::render(cGenericTool* tool) {
+		TRACE_SCOPE("render contact model");
+		double now = cPrecisionClock::getCPUTimeSeconds();
+		cVector3d tip = tool->getDeviceGlobalPos();
+		cMatrix3d rotation = tool->getDeviceGlobalRot();
+
+		ModelPose& pose = this->poses.write();
+		pose.time = now;
+		pose.position = tip;
+		pose.rotation = rotation;
+		pose.velocity = tool->getDeviceGlobalLinVel();
+		this->poses.publish();
+
+		if (this->frames.update()) {
+			this->hasFrame = true;
+		}
+		const ModelFrame& frame = this->frames.read();
+		double staleness = now - frame.poseTime;
+
+		cVector3d force(0.0, 0.0, 0.0);
+		cVector3d torque(0.0, 0.0, 0.0);
+		this->contacts = 0;
+		int n = (int)frame.points.size();
+		double spacing = (n > 1) ? this->length / (n - 1) : 0.0;
+		cVector3d axis = rotation.getCol0();
+		bool expired = this->hasFrame && (staleness > this->maxStaleness);
+		if (expired) {
+			this->expiredTicks.store(this->expiredTicks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);  // single writer
+		}
+		if (!this->hasFrame || expired) {
+			/* no force: the proxies are where the points are */
+			for (int i = 0; i < n; i++) {
+				this->proxies[i] = tip + (i * spacing) * axis;
+			}
+		}
+		else {
+			for (int i = 0; i < n; i++) {
+				const PointContact& contact = frame.points[i];
+				cVector3d position = tip + (i * spacing) * axis;
+
+				/* the local proxy: the point, pushed out of every plane it is behind */
+				cVector3d proxy = position;
+				double stiffness = 0.0;
+				for (int pass = 0; pass < PROJECTION_PASSES && contact.numPlanes > 0; pass++) {
+					for (int j = 0; j < contact.numPlanes; j++) {
+						const ContactPlane& plane = contact.planes[j];
+						double depth = plane.normal.dot(plane.point - proxy);
+						if (depth > 0.0) {
+							proxy += depth * plane.normal;
+							if (plane.stiffness > stiffness) {
+								stiffness = plane.stiffness;
+							}
+						}
+					}
+				}
+
+				if ((stiffness > 0.0) && (i < 32)) {
+					this->contacts |= 1u << i;
+				}
+				cVector3d pointForce = stiffness * (proxy - position);
+				force += pointForce;
+				torque += (position - tip).cross(pointForce);
+				this->proxies[i] = proxy;
+			}
+		}
+		tool->setDeviceGlobalForce(force);
+		tool->setDeviceGlobalTorque(torque);
+
+		this->hapticWindowTicks++;
+		this->stalenessSum += staleness;
+		if (staleness > this->stalenessMax) {
+			this->stalenessMax = staleness;
+		}
+		double elapsed = now - this->hapticWindowStart;
+		if (elapsed >= 1.0) {
+			this->hapticRate.store(this->hapticWindowTicks / elapsed, std::memory_order_relaxed);
+			this->meanStaleness.store(this->stalenessSum / this->hapticWindowTicks, std::memory_order_relaxed);
+			this->maxStalenessSeen.store(this->stalenessMax, std::memory_order_relaxed);
+			this->hapticWindowStart = now;
+			this->hapticWindowTicks = 0;
+			this->stalenessSum = 0.0;
+			this->stalenessMax = 0.0;
+		}
+	}
+
+	/*==================================================================*/
+	ContactModelStatistics LocalContactModel::getStatistics() const {
+		ContactModelStatistics statistics;
+		statistics.hapticRate = this->hapticRate.load(std::memory_order_relaxed);
+		statistics.collisionRate = this->collisionRate.load(std::memory_order_relaxed);
+		statistics.maxCollisionTime = this->maxCollisionTime.load(std::memory_order_relaxed);
+		statistics.meanStaleness = this->meanStaleness.load(std::memory_order_relaxed);
+		statistics.maxStaleness = this->maxStalenessSeen.load(std::memory_order_relaxed);
+		statistics.expiredTicks = this->expiredTicks.load(std::memory_order_relaxed);
+		statistics.predictedPlanes = this->predictedPlanes.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+	/*==================================================================*/
+	void LocalContactModel::printStatistics() const {
+		ContactModelStatistics statistics = this->getStatistics();
+		std::cout << "Contact model: haptics " << statistics.hapticRate << " Hz, collisions " << statistics.collisionRate
+			<< " Hz (max " << statistics.maxCollisionTime * 1000.0 << " ms), model age " << statistics.meanStaleness * 1000.0
+			<< " ms (max " << statistics.maxStaleness * 1000.0 << " ms), " << statistics.expiredTicks << " ticks expired, "
+			<< statistics.predictedPlanes << " planes predicted" << std::endl;
+	}
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include "chai3d.h"
+#include "ShaftTool.h"
+#include "TripleBuffer.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace chai3d {
+	/* Update rates and age of the local contact model, over the last second */
+	struct ContactModelStatistics {
+		double hapticRate;  // ticks rendered per second
+		double collisionRate;  // models computed per second
+		double maxCollisionTime;  // longest model computation [s]
+		double meanStaleness;  // age of the model at render time: from the device pose it was computed for, to now [s]
+		double maxStaleness;  // [s]
+		unsigned long long expiredTicks;  // ticks rendered without force because the model was older than the limit, since start()
+		unsigned long long predictedPlanes;  // planes predicted along the velocity of free points, since start()
+	};
+
+	/*
+	Two-rate haptic rendering: the proxy algorithm against the full scene runs in a collision thread, at whatever rate
+	the scene allows, and the haptic thread renders the force at its own rate against a small local model of the contact.
+
+	The collision thread takes the latest device pose, runs the proxy of every point of the tool (a ShaftTool of the same
+	shape as the rendered tool, see ShaftTool.h) and turns the result into a few planes per point:
+	- a point in contact gets the planes of its proxy constraints (up to 3: face, edge, corner), through the proxy,
+	  with the stiffness of the touched object;
+	- a free point gets the surface it is heading for, if any: the scene is probed along its velocity over the next few
+	  collision periods, so that a fast motion meets a plane before the next model arrives.
+	The haptic thread projects each point out of its planes (a proxy against at most 3 planes, a few multiply-adds) and
+	renders the spring between the point and its local proxy. The cost of a haptic tick no longer depends on the scene;
+	when the collision cost spikes, the haptic thread keeps rendering the same surfaces, just with an older model.
+	The velocity of the points is the device's (cGenericHapticDevice::getLinearVelocity(), see UsartDevice).
+
+		LocalContactModel model(world, tool->getNumHapticPoints(), shaftLength, toolRadius);
+		model.addContactObject(heart);
+		model.start(tool);
+		...haptic thread: tool->updateFromDevice(); model.render(tool); tool->applyToDevice();
+
+	A model older than setMaxStaleness() (the collision thread stalled) is not rendered. The collision thread owns the proxy
+	computations; the haptic thread does not touch the world at all while the model is running, nor the haptic points of
+	the tool: the local proxies stay in the model (getProxy(), for display and recording).
+	*/
+	class LocalContactModel {
+	public:
+		static const int MAX_PLANES = 3;
+
+	private:
+		struct ContactPlane {
+			cVector3d point;
+			cVector3d normal;  // out of the surface
+			double stiffness;
+		};
+
+		struct PointContact {
+			int numPlanes;
+			ContactPlane planes[MAX_PLANES];
+		};
+
+		/* haptic thread -> collision thread */
+		struct ModelPose {
+			double time;
+			cVector3d position;
+			cMatrix3d rotation;
+			cVector3d velocity;
+		};
+
+		/* collision thread -> haptic thread */
+		struct ModelFrame {
+			double poseTime;  // time of the pose the model was computed for
+			std::vector<PointContact> points;
+		};
+
+		cWorld* world;
+		cGenericObject* sceneRoot;  // subtree whose global positions are refreshed before each model
+		void (*sceneCallback)(void* context);
+		void* sceneContext;
+		ShaftTool* probe;  // runs the proxy algorithm against the scene, collision thread only
+		double length;
+		double radius;
+		double maxStaleness;
+
+		TripleBuffer<ModelPose> poses;
+		TripleBuffer<ModelFrame> frames;
+		std::thread thread;
+		std::atomic<bool> running;
+
+		/* haptic thread only */
+		bool hasFrame;
+		unsigned int contacts;  // points pushed out by a plane at the last render(), as bits
+		std::vector<cVector3d> proxies;  // local proxies of the points at the last render(), global
+		double hapticWindowStart;
+		unsigned long long hapticWindowTicks;
+		double stalenessSum;
+		double stalenessMax;
+
+		/* collision thread only */
+		double collisionWindowStart;
+		unsigned long long collisionWindowUpdates;
+		double collisionTimeMax;
+		double collisionPeriod;
+
+		/* statistics, published once per second */
+		std::atomic<double> hapticRate;
+		std::atomic<double> collisionRate;
+		std::atomic<double> maxCollisionTime;
+		std::atomic<double> meanStaleness;
+		std::atomic<double> maxStalenessSeen;
+		std::atomic<unsigned long long> expiredTicks;
+		std::atomic<unsigned long long> predictedPlanes;
+
+		void run();
+		void computeModel(const ModelPose& pose, ModelFrame& frame);
+		bool addPredictivePlane(const cVector3d& position, const cVector3d& velocity, PointContact& contact);
+
+	public:
+		/* The model of a tool with numPoints haptic points over a shaft of the given length [m] (see ShaftTool), of the given radius [m] */
+		LocalContactModel(cWorld* a_world, int numPoints, double length, double radius);
+		~LocalContactModel();
+
+		/* Objects the tool can touch (see ShaftTool::addContactObject()); call before start() */
+		void addContactObject(cGenericObject* object) { this->probe->addContactObject(object); }
+		/* Part of the scene the tool can touch (default: the whole world); the collision thread refreshes its global
+		positions before each model, and leaves the rest of the scene to the graphics thread */
+		void setSceneRoot(cGenericObject* root) { this->sceneRoot = root; }
+		/* Called by the collision thread before each model, e.g. to bring deformed objects up to date; call before start() */
+		void setSceneCallback(void (*callback)(void* context), void* context) { this->sceneCallback = callback; this->sceneContext = context; }
+		/* Older models are not rendered [s] */
+		void setMaxStaleness(double seconds) { this->maxStaleness = seconds; }
+
+		/* Start the collision thread from the current pose of the tool; the scene must be complete */
+		void start(cGenericTool* tool);
+		void stop();
+		bool isRunning() const { return this->running.load(std::memory_order_relaxed); }
+
+		/* Haptic thread, in place of tool->computeInteractionForces(): hand the device pose to the collision thread
+		and set the force and torque of the tool from the latest model */
+		void render(cGenericTool* tool);
+		/* Haptic thread: points of the tool the last render() pushed out of a surface, as bits (the first 32 points) */
+		unsigned int getContacts() const { return this->contacts; }
+		/* Haptic thread: local proxy of a point at the last render(), where the point is when free */
+		int getNumPoints() const { return (int)this->proxies.size(); }
+		const cVector3d& getProxy(int i) const { return this->proxies[i]; }
+
+		ContactModelStatistics getStatistics() const;
+		void printStatistics() const;
+	};
+}
@@ -0,0 +1,264 @@
+#include "PoseBroadcast.h"
+#include <iostream>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace chai3d {
+
+	/* the other process sees the counters through the mapping: they must not hide a lock */
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shared memory needs lock-free atomics");
+
+	/* Name of the block for the system: session-local on Windows, a POSIX shared memory object elsewhere */
+	static std::string systemName(const std::string& name) {
+#if defined(_WIN32)
+		return "Local\\" + name;
+#else
+		return "/" + name;
+#endif
+	}
+
+	/*==================================================================*/
+	bool PoseBroadcaster::open(const std::string& a_name) {
+		this->close();
+		const size_t size = sizeof(PoseBroadcastLayout);
+#if defined(_WIN32)
+		HANDLE handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, systemName(a_name).c_str());
+		void* view = (handle != NULL) ? MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size) : NULL;
+		if (view == NULL) {
+			if (handle != NULL) {
+				CloseHandle(handle);
+			}
+			std::cout << "Error - failed to create the shared memory " << a_name << std::endl;
+			return false;
+		}
+		this->mapping = handle;
+#else
+		int descriptor = shm_open(systemName(a_name).c_str(), O_CREAT | O_RDWR, 0644);
+		void* view = MAP_FAILED;
+		if ((descriptor >= 0) && (ftruncate(descriptor, (off_t)size) == 0)) {
+			view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+		}
+		if (descriptor >= 0) {
+			::close(descriptor);  // the mapping keeps the object
+		}
+		if (view == MAP_FAILED) {
+			std::cout << "Error - failed to create the shared memory " << a_name << std::endl;
+			return false;
+		}
+#endif
+		/* a new block is zeroed; an existing one (an earlier run, observers still attached) starts over with a new epoch */
+		PoseBroadcastLayout* shared = (PoseBroadcastLayout*)view;
+		bool reused = (shared->magic == PoseBroadcastLayout::MAGIC) && (shared->capacity == PoseBroadcastLayout::CAPACITY) &&
+			(shared->slotSize == sizeof(PoseBroadcastLayout::Slot));
+		if (reused && (shared->writing.load(std::memory_order_acquire) != 0)) {
+			std::cout << "Warning - another device process published to " << a_name << "; taking it over" << std::endl;
+		}
+		shared->count.store(0, std::memory_order_relaxed);
+		for (unsigned int i = 0; i < PoseBroadcastLayout::CAPACITY; i++) {
+			shared->slots[i].seq.store(0, std::memory_order_relaxed);
+		}
+		shared->capacity = PoseBroadcastLayout::CAPACITY;
+		shared->slotSize = sizeof(PoseBroadcastLayout::Slot);
+		shared->epoch.store((reused ? shared->epoch.load(std::memory_order_relaxed) : 0) + 1, std::memory_order_release);
+		shared->writing.store(1, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_release);
+		shared->magic = PoseBroadcastLayout::MAGIC;
+		this->layout = shared;
+		return true;
+	}
+
+	/*==================================================================*/
+	void PoseBroadcaster::close() {
+		if (this->layout == NULL) {
+			return;
+		}
+		/* the block itself stays: observers keep their mapping and see that nobody writes any more */
+		this->layout->writing.store(0, std::memory_order_release);
+#if defined(_WIN32)
+		UnmapViewOfFile(this->layout);
+		CloseHandle((HANDLE)this->mapping);
+		this->mapping = NULL;
+#else
+		munmap(this->layout, sizeof(PoseBroadcastLayout));
+#endif
+		this->layout = NULL;
+	}
+
+	/*==================================================================*/
+	void PoseBroadcaster::publish(const UsartPose& pose) {
+		if (this->layout == NULL) {
+			return;
+		}
+		unsigned long long index = this->layout->count.load(std::memory_order_relaxed);
+		PoseBroadcastLayout::Slot& slot = this->layout->slots[index % PoseBroadcastLayout::CAPACITY];
+
+		slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		cQuaternion q;
+		q.fromRotMat(pose.rotation);
+		slot.time = pose.time;
+		slot.angle[0] = pose.angle.x();
+		slot.angle[1] = pose.angle.y();
+		slot.angle[2] = pose.angle.z();
+		slot.position[0] = pose.position.x();
+		slot.position[1] = pose.position.y();
+		slot.position[2] = pose.position.z();
+		slot.quaternion[0] = q.w;
+		slot.quaternion[1] = q.x;
+		slot.quaternion[2] = q.y;
+		slot.quaternion[3] = q.z;
+
+		slot.seq.store(2 * index + 2, std::memory_order_release);
+		this->layout->count.store(index + 1, std::memory_order_release);
+	}
+
+	/*==================================================================*/
+	unsigned long long PoseBroadcaster::getPublished() const {
+		return (this->layout != NULL) ? this->layout->count.load(std::memory_order_relaxed) : 0;
+	}
+
+	/*==================================================================*/
+	bool PoseObserver::open(const std::string& name) {
+		this->close();
+		const size_t size = sizeof(PoseBroadcastLayout);
+#if defined(_WIN32)
+		HANDLE handle = OpenFileMappingA(FILE_MAP_READ, FALSE, systemName(name).c_str());
+		const void* view = (handle != NULL) ? MapViewOfFile(handle, FILE_MAP_READ, 0, 0, size) : NULL;
+		if (view == NULL) {
+			if (handle != NULL) {
+				CloseHandle(handle);
+			}
+			return false;
+		}
+		this->mapping = handle;
+#else
+		int descriptor = shm_open(systemName(name).c_str(), O_RDONLY, 0);
+		struct stat status;
+		void* view = MAP_FAILED;
+		if ((descriptor >= 0) && (fstat(descriptor, &status) == 0) && ((size_t)status.st_size >= size)) {
+			view = mmap(NULL, size, PROT_READ, MAP_SHARED, descriptor, 0);
+		}
+		if (descriptor >= 0) {
+			::close(descriptor);
+		}
+		if (view == MAP_FAILED) {
+			return false;
+		}
+#endif
+		this->layout = (const PoseBroadcastLayout*)view;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if ((this->layout->magic != PoseBroadcastLayout::MAGIC) || (this->layout->capacity != PoseBroadcastLayout::CAPACITY) ||
+			(this->layout->slotSize != sizeof(PoseBroadcastLayout::Slot))) {
+			std::cout << "Error - " << name << " was not set up by this version of the device process" << std::endl;
+			this->close();
+			return false;
+		}
+		/* next() starts with the poses published from now on; the ones before are not counted as skipped */
+		this->epoch = this->layout->epoch.load(std::memory_order_acquire);
+		this->cursor = this->layout->count.load(std::memory_order_acquire);
+		return true;
+	}
+
+	/*==================================================================*/
+	void PoseObserver::close() {
+		if (this->layout == NULL) {
+			return;
+		}
+#if defined(_WIN32)
+		UnmapViewOfFile(this->layout);
+		CloseHandle((HANDLE)this->mapping);
+		this->mapping = NULL;
+#else
+		munmap((void*)this->layout, sizeof(PoseBroadcastLayout));
+#endif
+		this->layout = NULL;
+	}
+
+	/*==================================================================*/
+	bool PoseObserver::isWriting() const {
+		return (this->layout != NULL) && (this->layout->writing.load(std::memory_order_acquire) != 0);
+	}
+
+	/*==================================================================*/
+	/* Copy the pose with the given index. Returns false if it has already been overwritten */
+	bool PoseObserver::read(unsigned long long index, UsartPose& pose) const {
+		const PoseBroadcastLayout::Slot& slot = this->layout->slots[index % PoseBroadcastLayout::CAPACITY];
+		const unsigned long long expected = 2 * index + 2;
+		while (true) {
+			unsigned long long seq1 = slot.seq.load(std::memory_order_acquire);
+			if (seq1 > expected) {
+				return false;  // recycled by a newer pose
+			}
+			if (seq1 != expected) {
+				if (seq1 < 2 * index) {
+					return false;  // a new device process started over
+				}
+				continue;  // the writer is filling this slot right now
+			}
+			double time = slot.time;
+			double a[3] = { slot.angle[0], slot.angle[1], slot.angle[2] };
+			double p[3] = { slot.position[0], slot.position[1], slot.position[2] };
+			double q[4] = { slot.quaternion[0], slot.quaternion[1], slot.quaternion[2], slot.quaternion[3] };
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.seq.load(std::memory_order_relaxed) == seq1) {
+				pose.time = time;
+				pose.angle.set(a[0], a[1], a[2]);
+				pose.position.set(p[0], p[1], p[2]);
+				cQuaternion(q[0], q[1], q[2], q[3]).toRotMat(pose.rotation);
+				return true;
+			}
+		}
+	}
+
+	/*==================================================================*/
+	bool PoseObserver::latest(UsartPose& pose) const {
+		if (this->layout == NULL) {
+			return false;
+		}
+		while (true) {
+			unsigned long long n = this->layout->count.load(std::memory_order_acquire);
+			if (n == 0) {
+				return false;
+			}
+			if (this->read(n - 1, pose)) {
+				return true;
+			}
+		}
+	}
+
+	/*==================================================================*/
+	bool PoseObserver::next(UsartPose& pose, unsigned long long& skipped) {
+		if (this->layout == NULL) {
+			return false;
+		}
+		while (true) {
+			unsigned long long epoch = this->layout->epoch.load(std::memory_order_acquire);
+			unsigned long long n = this->layout->count.load(std::memory_order_acquire);
+			if ((epoch != this->epoch) || (n < this->cursor)) {
+				/* a new device process: its poses from the start */
+				this->epoch = epoch;
+				this->cursor = 0;
+			}
+			if (this->cursor >= n) {
+				return false;
+			}
+			if (n - this->cursor > PoseBroadcastLayout::CAPACITY) {
+				skipped += n - PoseBroadcastLayout::CAPACITY - this->cursor;
+				this->cursor = n - PoseBroadcastLayout::CAPACITY;
+			}
+			bool valid = this->read(this->cursor, pose);
+			this->cursor++;
+			if (valid) {
+				return true;
+			}
+			skipped++;  // overwritten while we got to it
+		}
+	}
+}
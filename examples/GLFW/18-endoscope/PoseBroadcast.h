@@ -0,0 +1,94 @@
+#pragma once
+#include "PoseHistory.h"
+#include <atomic>
+#include <string>
+
+namespace chai3d {
+	/*
+	Live poses of the scope for other processes on the same machine (an instructor station, a data logger...).
+
+	The device process maps a named block of shared memory and publishes every pose into a ring of slots there, each
+	protected by a sequence counter, as in PoseHistory: the writer never waits and never makes a system call, and the
+	readers only load from the mapping (it is mapped read-only on their side), so their number does not change the
+	writer's work. A reader copies a slot out and retries if the writer touched it meanwhile.
+
+	The pose times are the time of the device's SimulationClock in the device process. By default that is the wall clock,
+	cPrecisionClock::getCPUTimeSeconds(), which on Windows is QueryPerformanceCounter(), the same in every process; a
+	fixed-step run publishes its simulated time.
+
+		device process:                          observer process:
+		PoseBroadcaster broadcaster;             PoseObserver observer;
+		broadcaster.open("18-endoscope.pose");   observer.open("18-endoscope.pose");
+		...haptic thread: broadcaster.publish(pose);
+		                                         ...observer.latest(pose);  or  while (observer.next(pose, skipped)) {...}
+	*/
+
+	/* The shared memory, as both sides see it */
+	struct PoseBroadcastLayout {
+		static const unsigned int MAGIC = 0x31425050;  // "PPB1"
+		static const unsigned int CAPACITY = 1024;  // poses, about a second at the haptic rate
+
+		/* Plain storage of one pose, the same as a PoseHistory slot */
+		struct alignas(64) Slot {
+			std::atomic<unsigned long long> seq;  // 2 * index + 1 while written, 2 * index + 2 when complete
+			double time;
+			double angle[3];
+			double position[3];
+			double quaternion[4];  // w, x, y, z
+		};
+
+		unsigned int magic;  // written last when the block is set up
+		unsigned int capacity;
+		unsigned int slotSize;
+		std::atomic<unsigned int> writing;  // 1 while a device process publishes
+		std::atomic<unsigned long long> epoch;  // counts the device processes that opened the block
+		alignas(64) std::atomic<unsigned long long> count;  // poses published in this epoch
+		Slot slots[CAPACITY];
+	};
+
+	/* Device process: the only writer */
+	class PoseBroadcaster {
+	private:
+		PoseBroadcastLayout* layout;
+		void* mapping;  // HANDLE of the mapping on Windows
+
+	public:
+		PoseBroadcaster() : layout(NULL), mapping(NULL) {}
+		~PoseBroadcaster() { this->close(); }
+
+		bool open(const std::string& a_name);
+		void close();
+		bool isOpen() const { return this->layout != NULL; }
+
+		/* Publish a pose. Timestamps must be increasing. Only one thread may call this */
+		void publish(const UsartPose& pose);
+		unsigned long long getPublished() const;
+	};
+
+	/* Observer process: any number of them */
+	class PoseObserver {
+	private:
+		const PoseBroadcastLayout* layout;
+		void* mapping;
+		unsigned long long epoch;  // of the writer the cursor belongs to
+		unsigned long long cursor;  // next pose next() returns
+
+		bool read(unsigned long long index, UsartPose& pose) const;
+
+	public:
+		PoseObserver() : layout(NULL), mapping(NULL), epoch(0), cursor(0) {}
+		~PoseObserver() { this->close(); }
+
+		/* Fails if no device process has opened the block yet */
+		bool open(const std::string& name);
+		void close();
+
+		/* A device process is publishing */
+		bool isWriting() const;
+		/* Most recent pose; false if none was published yet */
+		bool latest(UsartPose& pose) const;
+		/* Every pose in order from open() on, for a logger: the next one not returned yet, false if there is none yet.
+		skipped counts the poses that were overwritten before this observer read them; a new device process starts over */
+		bool next(UsartPose& pose, unsigned long long& skipped);
+	};
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include "math/CMaths.h"
+#include "math/CQuaternion.h"
+#include <atomic>
+
+namespace chai3d {
+	/*
+	Time-indexed history of the poses computed by UsartDevice.
+
+	The device thread is the only writer: it pushes one pose per update, in increasing time order.
+	Any number of other threads (graphics, recorder, haptics...) can read at the same time without locks.
+	Each slot is protected by a sequence counter (seqlock): a reader copies the slot and retries if the
+	writer touched it meanwhile, so a reader never blocks the writer and never sees a half written pose.
+
+	The sequence counter of a slot also tells which write it holds (2 * index + 2 when complete),
+	so a reader can detect that a slot has been recycled by a newer pose.
+	*/
+
+	/* One timestamped pose of the endoscope */
+	struct UsartPose {
+		double time;  // time of acquisition in seconds: time of the device's SimulationClock (wall time in a DeviceManager)
+		cVector3d angle;  // accumulated, clamped and scaled gyroscope angles
+		cVector3d position;  // position of the device (same as UsartDevice::origin)
+		cMatrix3d rotation;  // orientation of the device
+	};
+
+	template <unsigned int CAPACITY = 1024>
+	class PoseHistory {
+	private:
+		/* Plain storage of one pose; the rotation is kept as a quaternion so we can slerp between samples.
+		The padding keeps the data of two neighbouring slots at least a cache line apart, whatever the alignment of
+		the history: it lives inside heap objects (UsartDevice), and new does not honour alignas(64) before C++17 */
+		struct Slot {
+			std::atomic<unsigned long long> seq;
+			double time;
+			double angle[3];
+			double position[3];
+			double quaternion[4];  // w, x, y, z
+			char padding[64];
+		};
+
+		Slot slots[CAPACITY];
+		std::atomic<unsigned long long> count;  // number of poses pushed so far; written only by the device thread
+
+		/* Copy the pose with the given write index. Returns false if it has already been overwritten */
+		bool read(unsigned long long index, double& time, double angle[3], double position[3], double quaternion[4]) const {
+			const Slot& slot = this->slots[index % CAPACITY];
+			const unsigned long long expected = 2 * index + 2;
+			while (true) {
+				unsigned long long seq1 = slot.seq.load(std::memory_order_acquire);
+				if (seq1 > expected) {
+					return false;  // recycled by a newer pose
+				}
+				if (seq1 != expected) {
+					continue;  // the writer is filling this slot right now
+				}
+				time = slot.time;
+				for (int i = 0; i < 3; i++) {
+					angle[i] = slot.angle[i];
+					position[i] = slot.position[i];
+				}
+				for (int i = 0; i < 4; i++) {
+					quaternion[i] = slot.quaternion[i];
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.seq.load(std::memory_order_relaxed) == seq1) {
+					return true;
+				}
+			}
+		}
+
+		/* Time stamp of the pose with the given write index, or false if it has been overwritten */
+		bool readTime(unsigned long long index, double& time) const {
+			double angle[3], position[3], quaternion[4];
+			return this->read(index, time, angle, position, quaternion);
+		}
+
+	public:
+		PoseHistory() : count(0) {
+			for (unsigned int i = 0; i < CAPACITY; i++) {
+				this->slots[i].seq.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		/* Number of poses that can be queried */
+		unsigned int size() const {
+			unsigned long long n = this->count.load(std::memory_order_acquire);
+			return (unsigned int)(n < CAPACITY ? n : CAPACITY);
+		}
+
+		/* Append a pose. Timestamps must be increasing. Only one thread may call this */
+		void push(const UsartPose& pose) {
+			unsigned long long index = this->count.load(std::memory_order_relaxed);
+			Slot& slot = this->slots[index % CAPACITY];
+
+			slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			cQuaternion q;
+			q.fromRotMat(pose.rotation);
+			slot.time = pose.time;
+			slot.angle[0] = pose.angle.x();
+			slot.angle[1] = pose.angle.y();
+			slot.angle[2] = pose.angle.z();
+			slot.position[0] = pose.position.x();
+			slot.position[1] = pose.position.y();
+			slot.position[2] = pose.position.z();
+			slot.quaternion[0] = q.w;
+			slot.quaternion[1] = q.x;
+			slot.quaternion[2] = q.y;
+			slot.quaternion[3] = q.z;
+
+			slot.seq.store(2 * index + 2, std::memory_order_release);
+			this->count.store(index + 1, std::memory_order_release);
+		}
+
+		/* Most recent pose */
+		bool latest(UsartPose& pose) const {
+			while (true) {
+				unsigned long long n = this->count.load(std::memory_order_acquire);
+				if (n == 0) {
+					return false;
+				}
+				double a[3], p[3], q[4];
+				if (this->read(n - 1, pose.time, a, p, q)) {
+					pose.angle.set(a[0], a[1], a[2]);
+					pose.position.set(p[0], p[1], p[2]);
+					cQuaternion(q[0], q[1], q[2], q[3]).toRotMat(pose.rotation);
+					return true;
+				}
+			}
+		}
+
+		/* Pose at an arbitrary time, linearly interpolated between the two closest samples (slerp for the rotation).
+		A time newer than the latest sample returns the latest pose (no extrapolation).
+		Returns false if the history is empty or the time is older than the oldest pose still stored. */
+		bool sample(double time, UsartPose& pose) const {
+			while (true) {
+				unsigned long long n = this->count.load(std::memory_order_acquire);
+				if (n == 0) {
+					return false;
+				}
+				unsigned long long newest = n - 1;
+				unsigned long long oldest = (n > CAPACITY) ? n - CAPACITY : 0;
+
+				double t;
+				if (!this->readTime(oldest, t)) {
+					continue;  // the writer lapped us, start again with a fresh range
+				}
+				if (time < t) {
+					return false;
+				}
+
+				/* binary search for the last pose with a time stamp <= time */
+				unsigned long long lo = oldest, hi = newest;
+				bool lapped = false;
+				while (lo < hi) {
+					unsigned long long mid = lo + (hi - lo + 1) / 2;
+					if (!this->readTime(mid, t)) {
+						lapped = true;
+						break;
+					}
+					if (t <= time)
+						lo = mid;
+					else
+						hi = mid - 1;
+				}
+				if (lapped) {
+					continue;
+				}
+
+				double t0, a0[3], p0[3], q0[4];
+				if (!this->read(lo, t0, a0, p0, q0)) {
+					continue;
+				}
+
+				double t1, a1[3], p1[3], q1[4];
+				if (lo == newest || !this->read(lo + 1, t1, a1, p1, q1) || t1 <= t0) {
+					/* no later sample: hold the pose */
+					pose.time = t0;
+					pose.angle.set(a0[0], a0[1], a0[2]);
+					pose.position.set(p0[0], p0[1], p0[2]);
+					cQuaternion(q0[0], q0[1], q0[2], q0[3]).toRotMat(pose.rotation);
+					return true;
+				}
+
+				/* take the shortest path between the two orientations */
+				if (q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] + q0[3] * q1[3] < 0.0) {
+					for (int i = 0; i < 4; i++) {
+						q1[i] = -q1[i];
+					}
+				}
+
+				double level = (time - t0) / (t1 - t0);
+				pose.time = time;
+				pose.angle.set(a0[0] + level * (a1[0] - a0[0]),
+							   a0[1] + level * (a1[1] - a0[1]),
+							   a0[2] + level * (a1[2] - a0[2]));
+				pose.position.set(p0[0] + level * (p1[0] - p0[0]),
+								  p0[1] + level * (p1[1] - p0[1]),
+								  p0[2] + level * (p1[2] - p0[2]));
+				cQuaternion q;
+				q.slerp(level, cQuaternion(q0[0], q0[1], q0[2], q0[3]), cQuaternion(q1[0], q1[1], q1[2], q1[3]));
+				q.toRotMat(pose.rotation);
+				return true;
+			}
+		}
+	};
+}
@@ -0,0 +1,90 @@
+#include "SceneSnapshot.h"
+#include "LocalContactModel.h"
+#include <algorithm>
+
+namespace chai3d {
+
+	/*==================================================================*/
+	SceneSnapshot::SceneSnapshot(cWorld* a_world)
+		: world(a_world)
+	{
+		Snapshot empty;
+		empty.numTools = 0;
+		this->snapshots.reset(empty);
+	}
+
+	/*==================================================================*/
+	void SceneSnapshot::addTool(cGenericTool* tool, cGenericObject* image, double radius, const LocalContactModel* model) {
+		if ((int)this->tools.size() >= MAX_TOOLS) {
+			return;
+		}
+
+		/* the tool itself is no longer rendered, nor moves its image */
+		tool->setShowEnabled(false);
+		tool->m_image = NULL;
+
+		ViewedTool viewed;
+		viewed.tool = tool;
+		viewed.image = image;
+		viewed.model = model;
+		if (image != NULL) {
+			this->world->addChild(image);
+		}
+		int numPoints = std::min(tool->getNumHapticPoints(), MAX_POINTS);
+		for (int i = 0; i < numPoints; i++) {
+			cShapeSphere* sphere = new cShapeSphere(radius);
+			sphere->m_material->setWhite();
+			sphere->setHapticEnabled(false);
+			this->world->addChild(sphere);
+			viewed.spheres.push_back(sphere);
+		}
+		this->tools.push_back(viewed);
+	}
+
+	/*==================================================================*/
+	void SceneSnapshot::capture() {
+		Snapshot& snapshot = this->snapshots.write();
+		snapshot.numTools = (int)this->tools.size();
+		for (int k = 0; k < snapshot.numTools; k++) {
+			cGenericTool* tool = this->tools[k].tool;
+			const LocalContactModel* model = this->tools[k].model;
+			ToolState& state = snapshot.tools[k];
+			state.position = tool->getDeviceGlobalPos();
+			state.rotation = tool->getDeviceGlobalRot();
+			state.numPoints = (int)this->tools[k].spheres.size();
+			if ((model != NULL) && model->isRunning()) {
+				/* the model renders the tool and keeps the proxies; the tool's haptic points are not computed */
+				state.numPoints = std::min(state.numPoints, model->getNumPoints());
+				for (int i = 0; i < state.numPoints; i++) {
+					state.proxies[i] = model->getProxy(i);
+				}
+			}
+			else {
+				for (int i = 0; i < state.numPoints; i++) {
+					state.proxies[i] = tool->getHapticPoint(i)->getGlobalPosProxy();
+				}
+			}
+		}
+		this->snapshots.publish();
+	}
+
+	/*==================================================================*/
+	bool SceneSnapshot::update() {
+		if (!this->snapshots.update()) {
+			return false;
+		}
+		const Snapshot& snapshot = this->snapshots.read();
+		for (int k = 0; k < snapshot.numTools; k++) {
+			const ToolState& state = snapshot.tools[k];
+			ViewedTool& viewed = this->tools[k];
+			if (viewed.image != NULL) {
+				viewed.image->setLocalPos(state.position);
+				viewed.image->setLocalRot(state.rotation);
+			}
+			for (int i = 0; i < state.numPoints; i++) {
+				viewed.spheres[i]->setLocalPos(state.proxies[i]);
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "chai3d.h"
+#include "TripleBuffer.h"
+#include <vector>
+
+namespace chai3d {
+	class LocalContactModel;
+
+	/*
+	The part of the scene that the haptic thread moves (tool poses and proxies), handed to the graphics thread as a whole.
+
+	Left to itself, a tool moves its image (cGenericTool::updateToolImagePosition()) and its proxy spheres from the haptic
+	thread while the graphics thread renders them: a frame can show the pose of one tick and the proxies of another, and
+	the nodes bounce between the caches of the two cores. Instead, the tools registered here are not rendered; once per
+	tick the haptic thread captures their poses and proxies into a snapshot (a few hundred bytes, in a triple buffer), and
+	once per frame the graphics thread takes the newest complete snapshot and poses the image and spheres it owns. Neither
+	thread waits for the other, and both windows of a frame show the same tick.
+
+		SceneSnapshot view;
+		view.addTool(tool, scope, toolRadius);   // scope: graphics object that follows the tool (e.g. holds a camera)
+		view.addTool(tool, scope, toolRadius, &model);   // a tool rendered by a LocalContactModel shows the model's proxies
+		...haptic thread, after the tools:  view.capture();
+		...graphics thread, before rendering:  view.update();
+	*/
+	class SceneSnapshot {
+	public:
+		static const int MAX_TOOLS = 4;
+		static const int MAX_POINTS = 64;  // haptic points shown per tool
+
+	private:
+		struct ToolState {
+			cVector3d position;  // device pose, global
+			cMatrix3d rotation;
+			int numPoints;
+			cVector3d proxies[MAX_POINTS];  // global
+		};
+
+		struct Snapshot {
+			int numTools;
+			ToolState tools[MAX_TOOLS];
+		};
+
+		struct ViewedTool {
+			cGenericTool* tool;
+			cGenericObject* image;  // may be NULL
+			const LocalContactModel* model;  // proxies of the tool while it runs, may be NULL
+			std::vector<cShapeSphere*> spheres;
+		};
+
+		cWorld* world;
+		std::vector<ViewedTool> tools;
+		TripleBuffer<Snapshot> snapshots;
+
+	public:
+		SceneSnapshot(cWorld* a_world);
+
+		/* Show the tool through this view: its image (given here instead of tool->m_image; may be NULL) follows the device,
+		and a sphere of the given radius [m] shows each proxy. The proxies are the tool's haptic points', or those of the
+		contact model that renders the tool while the model runs. Call before the haptic thread starts */
+		void addTool(cGenericTool* tool, cGenericObject* image, double radius, const LocalContactModel* model = NULL);
+
+		/* Haptic thread: capture the poses and proxies of the tools at the end of a tick */
+		void capture();
+		/* Graphics thread: pose the images and spheres from the newest snapshot. Returns false if there is no new one */
+		bool update();
+	};
+}
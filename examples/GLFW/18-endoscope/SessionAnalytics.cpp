@@ -0,0 +1,384 @@
+#include "SessionAnalytics.h"
+#include "Trace.h"
+#include "UsartKinematicsBatch.h"
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace chai3d {
+
+	/*==================================================================*/
+	/* A file mapped read only; the pages are read from disk (or the file cache) as the threads touch them */
+	class MappedFile {
+	private:
+#if defined(_WIN32)
+		HANDLE file;
+		HANDLE mapping;
+#else
+		int descriptor;
+#endif
+		const unsigned char* data;
+		size_t size;
+
+	public:
+#if defined(_WIN32)
+		MappedFile() : file(INVALID_HANDLE_VALUE), mapping(NULL), data(NULL), size(0) {}
+#else
+		MappedFile() : descriptor(-1), data(NULL), size(0) {}
+#endif
+		~MappedFile() { this->close(); }
+
+		bool open(const std::string& filename) {
+			this->close();
+#if defined(_WIN32)
+			this->file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			LARGE_INTEGER length;
+			if ((this->file == INVALID_HANDLE_VALUE) || !GetFileSizeEx(this->file, &length) || (length.QuadPart == 0)) {
+				this->close();
+				return false;
+			}
+			this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+			this->data = (this->mapping != NULL) ? (const unsigned char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+			this->size = (size_t)length.QuadPart;
+#else
+			this->descriptor = ::open(filename.c_str(), O_RDONLY);
+			struct stat status;
+			if ((this->descriptor < 0) || (fstat(this->descriptor, &status) != 0) || (status.st_size == 0)) {
+				this->close();
+				return false;
+			}
+			void* view = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, this->descriptor, 0);
+			this->data = (view != MAP_FAILED) ? (const unsigned char*)view : NULL;
+			this->size = (size_t)status.st_size;
+#endif
+			if (this->data == NULL) {
+				this->close();
+				return false;
+			}
+			return true;
+		}
+
+		void close() {
+#if defined(_WIN32)
+			if (this->data != NULL) {
+				UnmapViewOfFile(this->data);
+			}
+			if (this->mapping != NULL) {
+				CloseHandle(this->mapping);
+				this->mapping = NULL;
+			}
+			if (this->file != INVALID_HANDLE_VALUE) {
+				CloseHandle(this->file);
+				this->file = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (this->data != NULL) {
+				munmap((void*)this->data, this->size);
+			}
+			if (this->descriptor >= 0) {
+				::close(this->descriptor);
+				this->descriptor = -1;
+			}
+#endif
+			this->data = NULL;
+			this->size = 0;
+		}
+
+		const unsigned char* getData() const { return this->data; }
+		size_t getSize() const { return this->size; }
+	};
+
+	/*==================================================================*/
+	/* The metrics of one block, with its first and last ticks so that the blocks of a session can be joined */
+	struct BlockMetrics {
+		bool valid;
+		unsigned long long ticks;
+		double pathLength;
+		double contactTime;
+		double peakForce;
+		unsigned int collisions;
+		double maxPositionError;
+		double firstTime;
+		double lastTime;
+		double firstPosition[3];
+		double lastPosition[3];
+		unsigned int firstContacts;
+		unsigned int lastContacts;
+	};
+
+	struct AnalyticsSession {
+		MappedFile file;
+		std::vector<SessionBlock> blocks;
+		std::vector<BlockMetrics> partials;
+	};
+
+	struct AnalyticsItem {
+		int session;
+		int block;
+	};
+
+	/* What the threads share; each takes the next item until none is left */
+	struct AnalyticsWork {
+		PivotParams params;
+		double zoomScale;
+		int polarityAngle;
+		int polarityZoom;
+		std::vector<AnalyticsSession*> sessions;
+		std::vector<AnalyticsItem> items;
+		std::atomic<size_t> next;
+		std::atomic<double> busyTime;
+	};
+
+	/* Buffers of one thread, reused from block to block */
+	struct AnalyticsBuffers {
+		std::vector<SessionRecord> records;
+		std::vector<double> theta1, theta2, zoom, x, y, z;
+	};
+
+	static double distance(const double a[3], const double b[3]) {
+		double dx = a[0] - b[0];
+		double dy = a[1] - b[1];
+		double dz = a[2] - b[2];
+		return std::sqrt(dx * dx + dy * dy + dz * dz);
+	}
+
+	/*==================================================================*/
+	/* Decode one block from the mapping and reduce it */
+	static void analyzeBlock(const AnalyticsWork& work, const AnalyticsItem& item, AnalyticsBuffers& buffers) {
+		TRACE_SCOPE("analyze session block");
+		AnalyticsSession& session = *work.sessions[item.session];
+		BlockMetrics& metrics = session.partials[item.block];
+		memset(&metrics, 0, sizeof(metrics));
+		const SessionBlock& block = session.blocks[item.block];
+		if (!SessionReader::decodeBlock(session.file.getData() + block.offset, session.file.getSize() - (size_t)block.offset, buffers.records) ||
+			buffers.records.empty()) {
+			return;
+		}
+
+		/* scope positions from the angles, as UsartDevice::updateDevice() computes them (see UsartKinematicsBatch.h) */
+		const std::vector<SessionRecord>& records = buffers.records;
+		size_t n = records.size();
+		buffers.theta1.resize(n);
+		buffers.theta2.resize(n);
+		buffers.zoom.resize(n);
+		buffers.x.resize(n);
+		buffers.y.resize(n);
+		buffers.z.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			buffers.theta1[i] = records[i].angle[0] * work.polarityAngle;
+			buffers.theta2[i] = -records[i].angle[2] * work.polarityAngle;
+			buffers.zoom[i] = records[i].angle[1] / work.zoomScale * work.polarityZoom;
+		}
+		computePivotPositions(work.params, &buffers.theta1[0], &buffers.theta2[0], &buffers.zoom[0],
+			&buffers.x[0], &buffers.y[0], &buffers.z[0], n, 1);
+
+		double previous[3] = { buffers.x[0], buffers.y[0], buffers.z[0] };
+		metrics.firstPosition[0] = previous[0];
+		metrics.firstPosition[1] = previous[1];
+		metrics.firstPosition[2] = previous[2];
+		for (size_t i = 0; i < n; i++) {
+			const SessionRecord& record = records[i];
+			double position[3] = { buffers.x[i], buffers.y[i], buffers.z[i] };
+			metrics.maxPositionError = cMax(metrics.maxPositionError, distance(position, record.origin));
+			metrics.peakForce = cMax(metrics.peakForce, std::sqrt(record.force[0] * record.force[0] +
+				record.force[1] * record.force[1] + record.force[2] * record.force[2]));
+			if (i > 0) {
+				const SessionRecord& last = records[i - 1];
+				metrics.pathLength += distance(position, previous);
+				if (last.contacts != 0) {
+					metrics.contactTime += record.time - last.time;
+				}
+				else if (record.contacts != 0) {
+					metrics.collisions++;
+				}
+			}
+			previous[0] = position[0];
+			previous[1] = position[1];
+			previous[2] = position[2];
+		}
+
+		metrics.ticks = n;
+		metrics.firstTime = records.front().time;
+		metrics.lastTime = records.back().time;
+		metrics.lastPosition[0] = previous[0];
+		metrics.lastPosition[1] = previous[1];
+		metrics.lastPosition[2] = previous[2];
+		metrics.firstContacts = records.front().contacts;
+		metrics.lastContacts = records.back().contacts;
+		metrics.valid = true;
+	}
+
+	/*==================================================================*/
+	static void analyze(AnalyticsWork* work) {
+		Trace::nameThread("session analytics");
+		AnalyticsBuffers buffers;
+		double start = cPrecisionClock::getCPUTimeSeconds();
+		size_t i;
+		while ((i = work->next.fetch_add(1, std::memory_order_relaxed)) < work->items.size()) {
+			analyzeBlock(*work, work->items[i], buffers);
+		}
+		double busy = cPrecisionClock::getCPUTimeSeconds() - start;
+		double sum = work->busyTime.load(std::memory_order_relaxed);
+		while (!work->busyTime.compare_exchange_weak(sum, sum + busy, std::memory_order_relaxed)) {
+		}
+	}
+
+	/*==================================================================*/
+	SessionAnalytics::SessionAnalytics(const RuntimeConfig& a_config)
+		: config(a_config)
+	{
+		memset(&this->statistics, 0, sizeof(this->statistics));
+	}
+
+	/*==================================================================*/
+	void SessionAnalytics::run(const std::vector<std::string>& filenames, unsigned int threads) {
+		if (threads == 0) {
+			threads = std::thread::hardware_concurrency();
+		}
+		if (threads == 0) {
+			threads = 1;
+		}
+		double start = cPrecisionClock::getCPUTimeSeconds();
+
+		/* map the files and read their index; a block of any session is a work item */
+		AnalyticsWork work;
+		work.params.pivotOffset = this->config.pivotOffset;
+		work.params.zoomLimit = this->config.zoom_limit;
+		work.params.filterResolution = this->config.filter_resolution;
+		work.zoomScale = this->config.zoom_scale;
+		work.polarityAngle = this->config.polarity_angle;
+		work.polarityZoom = this->config.polarity_zoom;
+		work.next.store(0, std::memory_order_relaxed);
+		work.busyTime.store(0.0, std::memory_order_relaxed);
+
+		unsigned long long bytes = 0;
+		for (size_t s = 0; s < filenames.size(); s++) {
+			AnalyticsSession* session = new AnalyticsSession();
+			work.sessions.push_back(session);
+			if (!session->file.open(filenames[s])) {
+				std::cout << "Error - failed to map session " << filenames[s] << std::endl;
+				continue;
+			}
+			if (!SessionReader::readIndex(session->file.getData(), session->file.getSize(), session->blocks)) {
+				std::cout << "Error - " << filenames[s] << " is not a complete session of this version" << std::endl;
+				session->file.close();
+				continue;
+			}
+			bytes += session->file.getSize();
+			session->partials.resize(session->blocks.size());
+			for (size_t b = 0; b < session->blocks.size(); b++) {
+				AnalyticsItem item = { (int)s, (int)b };
+				work.items.push_back(item);
+			}
+		}
+
+		/* the calling thread is one of the threads */
+		if (threads > work.items.size()) {
+			threads = (work.items.size() > 0) ? (unsigned int)work.items.size() : 1;
+		}
+		std::vector<std::thread> workers;
+		for (unsigned int t = 0; t + 1 < threads; t++) {
+			workers.push_back(std::thread(analyze, &work));
+		}
+		analyze(&work);
+		for (size_t t = 0; t < workers.size(); t++) {
+			workers[t].join();
+		}
+
+		/* join the blocks of each session in order */
+		this->metrics.clear();
+		unsigned long long ticks = 0;
+		for (size_t s = 0; s < work.sessions.size(); s++) {
+			AnalyticsSession& session = *work.sessions[s];
+			SessionMetrics result;
+			result.filename = filenames[s];
+			result.valid = !session.partials.empty();
+			result.ticks = 0;
+			result.duration = 0.0;
+			result.pathLength = 0.0;
+			result.contactTime = 0.0;
+			result.peakForce = 0.0;
+			result.collisions = 0;
+			result.maxPositionError = 0.0;
+			for (size_t b = 0; result.valid && (b < session.partials.size()); b++) {
+				const BlockMetrics& block = session.partials[b];
+				if (!block.valid) {
+					std::cout << "Error - block " << b << " of " << filenames[s] << " can't be decoded" << std::endl;
+					result.valid = false;
+					break;
+				}
+				if (b > 0) {
+					const BlockMetrics& last = session.partials[b - 1];
+					result.pathLength += distance(block.firstPosition, last.lastPosition);
+					if (last.lastContacts != 0) {
+						result.contactTime += block.firstTime - last.lastTime;
+					}
+					else if (block.firstContacts != 0) {
+						result.collisions++;
+					}
+				}
+				result.ticks += block.ticks;
+				result.pathLength += block.pathLength;
+				result.contactTime += block.contactTime;
+				result.peakForce = cMax(result.peakForce, block.peakForce);
+				result.collisions += block.collisions;
+				result.maxPositionError = cMax(result.maxPositionError, block.maxPositionError);
+			}
+			if (result.valid) {
+				result.duration = session.partials.back().lastTime - session.partials.front().firstTime;
+				ticks += result.ticks;
+			}
+			else {
+				result.ticks = 0;
+				result.pathLength = 0.0;
+				result.contactTime = 0.0;
+				result.peakForce = 0.0;
+				result.collisions = 0;
+				result.maxPositionError = 0.0;
+			}
+			this->metrics.push_back(result);
+			delete work.sessions[s];
+		}
+
+		double wallTime = cPrecisionClock::getCPUTimeSeconds() - start;
+		double busyTime = work.busyTime.load(std::memory_order_relaxed);
+		this->statistics.sessions = (int)filenames.size();
+		this->statistics.ticks = ticks;
+		this->statistics.bytes = bytes;
+		this->statistics.threads = threads;
+		this->statistics.wallTime = wallTime;
+		this->statistics.ticksPerSecond = (wallTime > 0.0) ? ticks / wallTime : 0.0;
+		this->statistics.ticksPerSecondPerCore = (busyTime > 0.0) ? ticks / busyTime : 0.0;
+	}
+
+	/*==================================================================*/
+	void SessionAnalytics::printMetrics() const {
+		std::cout << "session,ticks,duration_s,path_length_m,contact_time_s,peak_force_n,collisions,max_position_error_m" << std::endl;
+		for (size_t s = 0; s < this->metrics.size(); s++) {
+			const SessionMetrics& m = this->metrics[s];
+			if (!m.valid) {
+				std::cout << m.filename << ",invalid" << std::endl;
+				continue;
+			}
+			std::cout << m.filename << "," << m.ticks << "," << m.duration << "," << m.pathLength << "," << m.contactTime << ","
+				<< m.peakForce << "," << m.collisions << "," << m.maxPositionError << std::endl;
+		}
+	}
+
+	/*==================================================================*/
+	void SessionAnalytics::printStatistics() const {
+		const AnalyticsStatistics& s = this->statistics;
+		std::cout << "Analytics: " << s.sessions << " sessions, " << s.ticks << " ticks, " << s.bytes / (1024 * 1024) << " MB in "
+			<< s.wallTime << " s on " << s.threads << " threads: " << s.ticksPerSecond << " ticks/s, "
+			<< s.ticksPerSecondPerCore << " ticks/s per core" << std::endl;
+	}
+}
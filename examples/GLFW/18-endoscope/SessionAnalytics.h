@@ -0,0 +1,65 @@
+#pragma once
+#include "SessionRecorder.h"
+#include "UsartPipeline.h"
+#include <string>
+#include <vector>
+
+namespace chai3d {
+	/* The grading metrics of one session */
+	struct SessionMetrics {
+		std::string filename;
+		bool valid;  // false: the file could not be mapped or decoded, the other fields are 0
+		unsigned long long ticks;
+		double duration;  // [s]
+		double pathLength;  // of the scope position recomputed from the recorded angles [m]
+		double contactTime;  // time with at least one haptic point in contact [s]
+		double peakForce;  // largest force on the device [N]
+		unsigned int collisions;  // contact onsets: ticks where the tool touches after a tick without contact
+		double maxPositionError;  // recomputed vs recorded scope position; above the filter quantum, the config differs [m]
+	};
+
+	struct AnalyticsStatistics {
+		int sessions;
+		unsigned long long ticks;
+		unsigned long long bytes;  // of the mapped files
+		unsigned int threads;
+		double wallTime;  // [s]
+		double ticksPerSecond;
+		double ticksPerSecondPerCore;  // ticks over the time the threads spent evaluating, summed
+	};
+
+	/*
+	Offline grading of recorded sessions (SessionRecorder files), without replaying them through the device.
+
+	The files are mapped into memory, and every block of every session is a work item: threads take the next item,
+	decode it straight from the mapping, rebuild the scope position from the recorded angles with the batch kinematics
+	(UsartKinematicsBatch.h, the same position as UsartDevice::updateDevice() with the given parameters) and reduce the
+	block to partial metrics. The partials of a session are then joined in order, with the ticks across block boundaries
+	(a step of the path, a contact that started in the previous block) accounted for at the join.
+
+		SessionAnalytics analytics(profile.getDeviceConfig());
+		analytics.run(filenames);
+		analytics.printMetrics();
+		analytics.printStatistics();
+	*/
+	class SessionAnalytics {
+	private:
+		RuntimeConfig config;
+		std::vector<SessionMetrics> metrics;
+		AnalyticsStatistics statistics;
+
+	public:
+		explicit SessionAnalytics(const RuntimeConfig& a_config);
+
+		/* Evaluate the sessions on the given number of threads (0: one per hardware thread) */
+		void run(const std::vector<std::string>& filenames, unsigned int threads = 0);
+
+		/* In the order of the file names given to run() */
+		const std::vector<SessionMetrics>& getMetrics() const { return this->metrics; }
+		AnalyticsStatistics getStatistics() const { return this->statistics; }
+
+		/* One CSV line per session, after a header line */
+		void printMetrics() const;
+		void printStatistics() const;
+	};
+}
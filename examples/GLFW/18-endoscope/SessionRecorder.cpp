@@ -0,0 +1,565 @@
+#include "SessionRecorder.h"
+#include "Trace.h"
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace chai3d {
+
+	/* the recorder is created with new, which gives only the default alignment before C++17 (C4316): its queue keeps the
+	counters apart with padding rather than alignas (see CommandChannel.h), and nothing else may ask for more */
+	static_assert(alignof(SessionRecorder) <= alignof(std::max_align_t), "SessionRecorder must not need more than the alignment of new");
+
+	/* The columns of a session, their resolution and order of difference. A resolution of 0 is the raw contact bits */
+	struct SessionColumn {
+		const char* name;
+		size_t offset;
+		double resolution;
+		int order;
+	};
+
+	static const SessionColumn columns[] = {
+		{ "time",       offsetof(SessionRecord, time),                             1.0e-6, 2 },
+		{ "angle_x",    offsetof(SessionRecord, angle) + 0 * sizeof(double),       1.0e-6, 1 },
+		{ "angle_y",    offsetof(SessionRecord, angle) + 1 * sizeof(double),       1.0e-6, 1 },
+		{ "angle_z",    offsetof(SessionRecord, angle) + 2 * sizeof(double),       1.0e-6, 1 },
+		{ "origin_x",   offsetof(SessionRecord, origin) + 0 * sizeof(double),      1.0e-7, 1 },
+		{ "origin_y",   offsetof(SessionRecord, origin) + 1 * sizeof(double),      1.0e-7, 1 },
+		{ "origin_z",   offsetof(SessionRecord, origin) + 2 * sizeof(double),      1.0e-7, 1 },
+		{ "rotation_w", offsetof(SessionRecord, rotation) + 0 * sizeof(double),    1.0e-7, 1 },
+		{ "rotation_x", offsetof(SessionRecord, rotation) + 1 * sizeof(double),    1.0e-7, 1 },
+		{ "rotation_y", offsetof(SessionRecord, rotation) + 2 * sizeof(double),    1.0e-7, 1 },
+		{ "rotation_z", offsetof(SessionRecord, rotation) + 3 * sizeof(double),    1.0e-7, 1 },
+		{ "proxy_x",    offsetof(SessionRecord, proxy) + 0 * sizeof(double),       1.0e-7, 1 },
+		{ "proxy_y",    offsetof(SessionRecord, proxy) + 1 * sizeof(double),       1.0e-7, 1 },
+		{ "proxy_z",    offsetof(SessionRecord, proxy) + 2 * sizeof(double),       1.0e-7, 1 },
+		{ "force_x",    offsetof(SessionRecord, force) + 0 * sizeof(double),       1.0e-5, 1 },
+		{ "force_y",    offsetof(SessionRecord, force) + 1 * sizeof(double),       1.0e-5, 1 },
+		{ "force_z",    offsetof(SessionRecord, force) + 2 * sizeof(double),       1.0e-5, 1 },
+		{ "contacts",   offsetof(SessionRecord, contacts),                         0.0,    1 },
+	};
+
+	static const int numColumns = sizeof(columns) / sizeof(columns[0]);
+
+	static const char FILE_MAGIC[4] = { 'E', 'S', 'R', '1' };
+	static const char INDEX_MAGIC[4] = { 'E', 'S', 'R', 'I' };
+	static const int TAIL_SIZE = 4 + 8 + 4;  // block count, index offset, magic
+
+	/* fseek() takes a long, 32 bits on Windows: the 64 bit variant, for sessions past 2 GB */
+	static bool seekFile(FILE* file, long long offset, int origin) {
+#if defined(_WIN32)
+		return _fseeki64(file, offset, origin) == 0;
+#else
+		return fseeko(file, (off_t)offset, origin) == 0;
+#endif
+	}
+
+	/*==================================================================*/
+	/* Value of a column, as an integer number of its resolution */
+	static long long getValue(const SessionRecord& record, const SessionColumn& column) {
+		const char* field = (const char*)&record + column.offset;
+		if (column.resolution == 0.0) {
+			return *(const unsigned int*)field;
+		}
+		double value = *(const double*)field / column.resolution;
+		return (std::fabs(value) < 9.0e18) ? (long long)std::floor(value + 0.5) : 0;  // NaN and overflows are stored as 0
+	}
+
+	static void setValue(SessionRecord& record, const SessionColumn& column, long long value) {
+		char* field = (char*)&record + column.offset;
+		if (column.resolution == 0.0) {
+			*(unsigned int*)field = (unsigned int)value;
+		}
+		else {
+			*(double*)field = value * column.resolution;
+		}
+	}
+
+	/* Zigzag varint: small values of either sign in few bytes, 7 bits a byte */
+	static void putVarint(std::vector<unsigned char>& bytes, long long value) {
+		unsigned long long zigzag = ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+		while (zigzag >= 0x80) {
+			bytes.push_back((unsigned char)(zigzag | 0x80));
+			zigzag >>= 7;
+		}
+		bytes.push_back((unsigned char)zigzag);
+	}
+
+	static bool getVarint(const unsigned char*& p, const unsigned char* end, long long& value) {
+		unsigned long long zigzag = 0;
+		for (int shift = 0; (p < end) && (shift < 64); shift += 7) {
+			unsigned char byte = *p++;
+			zigzag |= (unsigned long long)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) {
+				value = (long long)(zigzag >> 1) ^ -(long long)(zigzag & 1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template <class T>
+	static size_t writeValue(FILE* file, const T& value) {
+		return fwrite(&value, 1, sizeof(T), file);
+	}
+
+	template <class T>
+	static bool readValue(FILE* file, T& value) {
+		return fread(&value, 1, sizeof(T), file) == sizeof(T);
+	}
+
+	/* The same from memory, advancing p */
+	static bool readBytes(const unsigned char*& p, const unsigned char* end, void* bytes, size_t count) {
+		if ((size_t)(end - p) < count) {
+			return false;
+		}
+		memcpy(bytes, p, count);
+		p += count;
+		return true;
+	}
+
+	template <class T>
+	static bool readValue(const unsigned char*& p, const unsigned char* end, T& value) {
+		return readBytes(p, end, &value, sizeof(T));
+	}
+
+	/* Whether a column of a file header is the one this build decodes at that place */
+	static bool matchColumn(int c, const std::string& name, double resolution, unsigned char order) {
+		return (name == columns[c].name) && (resolution == columns[c].resolution) && (order == columns[c].order);
+	}
+
+	/*==================================================================*/
+	SessionRecorder::SessionRecorder()
+		: file(NULL),
+		recording(false),
+		writing(false),
+		lossless(false),
+		recordsWritten(0),
+		recordsDropped(0),
+		blocksWritten(0),
+		bytesWritten(0)
+	{
+	}
+
+	/*==================================================================*/
+	SessionRecorder::~SessionRecorder() {
+		this->stop();
+	}
+
+	/*==================================================================*/
+	bool SessionRecorder::start(const std::string& filename) {
+		if (this->isRecording()) {
+			return false;
+		}
+		this->file = fopen(filename.c_str(), "wb");
+		if (this->file == NULL) {
+			return false;
+		}
+
+		/* header: magic, then the name, resolution and order of each column */
+		size_t bytes = fwrite(FILE_MAGIC, 1, 4, this->file);
+		bytes += writeValue(this->file, (unsigned int)numColumns);
+		for (int c = 0; c < numColumns; c++) {
+			unsigned char length = (unsigned char)strlen(columns[c].name);
+			bytes += writeValue(this->file, length);
+			bytes += fwrite(columns[c].name, 1, length, this->file);
+			bytes += writeValue(this->file, columns[c].resolution);
+			bytes += writeValue(this->file, (unsigned char)columns[c].order);
+		}
+
+		this->block.clear();
+		this->block.reserve(BLOCK_ROWS);
+		this->index.clear();
+		this->recordsWritten.store(0, std::memory_order_relaxed);
+		this->recordsDropped.store(0, std::memory_order_relaxed);
+		this->blocksWritten.store(0, std::memory_order_relaxed);
+		this->bytesWritten.store(bytes, std::memory_order_relaxed);
+
+		this->writing.store(true, std::memory_order_release);
+		this->writer = std::thread(&SessionRecorder::write, this);
+		this->recording.store(true, std::memory_order_relaxed);
+		return true;
+	}
+
+	/*==================================================================*/
+	void SessionRecorder::stop() {
+		if (!this->isRecording()) {
+			return;
+		}
+		this->recording.store(false, std::memory_order_relaxed);
+		this->writing.store(false, std::memory_order_release);
+		this->writer.join();
+
+		/* index: one entry per block, then its size and offset */
+		unsigned long long indexOffset = this->bytesWritten.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < this->index.size(); i++) {
+			writeValue(this->file, this->index[i].offset);
+			writeValue(this->file, this->index[i].rows);
+			writeValue(this->file, this->index[i].firstTime);
+			writeValue(this->file, this->index[i].lastTime);
+		}
+		writeValue(this->file, (unsigned int)this->index.size());
+		writeValue(this->file, indexOffset);
+		fwrite(INDEX_MAGIC, 1, 4, this->file);
+		fclose(this->file);
+		this->file = NULL;
+	}
+
+	/*==================================================================*/
+	void SessionRecorder::record(double time, const UsartPose& pose, cGenericTool* tool, const cVector3d& proxy, unsigned int contacts) {
+		SessionRecord record;
+		record.time = time;
+		cQuaternion q;
+		q.fromRotMat(pose.rotation);
+		cVector3d force = tool->getDeviceGlobalForce();
+		const cVector3d* vectors[4] = { &pose.angle, &pose.position, &proxy, &force };
+		double* fields[4] = { record.angle, record.origin, record.proxy, record.force };
+		for (int k = 0; k < 4; k++) {
+			fields[k][0] = vectors[k]->x();
+			fields[k][1] = vectors[k]->y();
+			fields[k][2] = vectors[k]->z();
+		}
+		record.rotation[0] = q.w;
+		record.rotation[1] = q.x;
+		record.rotation[2] = q.y;
+		record.rotation[3] = q.z;
+		record.contacts = contacts;
+		this->record(record);
+	}
+
+	/*==================================================================*/
+	unsigned int SessionRecorder::getContacts(cGenericTool* tool) {
+		const double depth = 1.0e-6;  // [m]
+		unsigned int contacts = 0;
+		int n = (tool->getNumHapticPoints() < 32) ? tool->getNumHapticPoints() : 32;
+		for (int i = 0; i < n; i++) {
+			cHapticPoint* point = tool->getHapticPoint(i);
+			if ((point->getGlobalPosProxy() - point->getGlobalPosGoal()).lengthsq() > depth * depth) {
+				contacts |= 1u << i;
+			}
+		}
+		return contacts;
+	}
+
+	/*==================================================================*/
+	void SessionRecorder::write() {
+		Trace::nameThread("session writer");
+		SessionRecord record;
+		while (true) {
+			bool more = this->writing.load(std::memory_order_acquire);
+			bool any = false;
+			while (this->queue.pop(record)) {
+				any = true;
+				this->block.push_back(record);
+				if ((int)this->block.size() == BLOCK_ROWS) {
+					this->writeBlock();
+				}
+			}
+			if (!any) {
+				if (!more) {
+					break;
+				}
+				cSleepMs(1);
+			}
+		}
+		if (!this->block.empty()) {
+			this->writeBlock();
+		}
+	}
+
+	/*==================================================================*/
+	/* Block: row count, byte length of each column, then the columns */
+	void SessionRecorder::writeBlock() {
+		TRACE_SCOPE("write session block");
+		unsigned int rows = (unsigned int)this->block.size();
+		unsigned int lengths[numColumns];
+		this->columnBytes.clear();
+		for (int c = 0; c < numColumns; c++) {
+			size_t begin = this->columnBytes.size();
+			long long previous = 0;
+			long long previousDelta = 0;
+			for (unsigned int r = 0; r < rows; r++) {
+				long long value = getValue(this->block[r], columns[c]);
+				long long delta = value - previous;
+				putVarint(this->columnBytes, (columns[c].order == 2) ? delta - previousDelta : delta);
+				previous = value;
+				previousDelta = delta;
+			}
+			lengths[c] = (unsigned int)(this->columnBytes.size() - begin);
+		}
+
+		SessionBlock entry;
+		entry.offset = this->bytesWritten.load(std::memory_order_relaxed);
+		entry.rows = rows;
+		entry.firstTime = this->block.front().time;
+		entry.lastTime = this->block.back().time;
+		this->index.push_back(entry);
+
+		size_t bytes = writeValue(this->file, rows);
+		bytes += fwrite(lengths, 1, sizeof(lengths), this->file);
+		bytes += fwrite(this->columnBytes.data(), 1, this->columnBytes.size(), this->file);
+		this->bytesWritten.store(entry.offset + bytes, std::memory_order_relaxed);
+		this->recordsWritten.store(this->recordsWritten.load(std::memory_order_relaxed) + rows, std::memory_order_relaxed);
+		this->blocksWritten.store(this->index.size(), std::memory_order_relaxed);
+		this->block.clear();
+	}
+
+	/*==================================================================*/
+	SessionStatistics SessionRecorder::getStatistics() const {
+		SessionStatistics statistics;
+		statistics.recordsWritten = this->recordsWritten.load(std::memory_order_relaxed);
+		statistics.recordsDropped = this->recordsDropped.load(std::memory_order_relaxed);
+		statistics.blocksWritten = this->blocksWritten.load(std::memory_order_relaxed);
+		statistics.bytesWritten = this->bytesWritten.load(std::memory_order_relaxed);
+		return statistics;
+	}
+
+	/*==================================================================*/
+	void SessionRecorder::printStatistics() const {
+		SessionStatistics statistics = this->getStatistics();
+		double perRecord = (statistics.recordsWritten > 0) ? (double)statistics.bytesWritten / statistics.recordsWritten : 0.0;
+		std::cout << "Session: " << statistics.recordsWritten << " records in " << statistics.blocksWritten << " blocks, "
+			<< perRecord << " bytes/record (" << sizeof(SessionRecord) << " in memory), " << statistics.recordsDropped
+			<< " dropped" << std::endl;
+	}
+
+	/*==================================================================*/
+	bool SessionReader::open(const std::string& filename) {
+		this->close();
+		this->file = fopen(filename.c_str(), "rb");
+		if (this->file == NULL) {
+			std::cout << "Error - failed to open session " << filename << std::endl;
+			return false;
+		}
+
+		/* the columns must be the ones this build decodes */
+		char magic[4];
+		unsigned int n = 0;
+		bool valid = (fread(magic, 1, 4, this->file) == 4) && (memcmp(magic, FILE_MAGIC, 4) == 0) &&
+			readValue(this->file, n) && (n == (unsigned int)numColumns);
+		for (int c = 0; valid && (c < numColumns); c++) {
+			unsigned char length = 0;
+			char name[256];
+			double resolution = 0.0;
+			unsigned char order = 0;
+			valid = readValue(this->file, length) && (fread(name, 1, length, this->file) == length) &&
+				readValue(this->file, resolution) && readValue(this->file, order) && matchColumn(c, std::string(name, length), resolution, order);
+		}
+		if (!valid) {
+			std::cout << "Error - " << filename << " is not a session of this version" << std::endl;
+			this->close();
+			return false;
+		}
+
+		/* index at the end */
+		unsigned int count = 0;
+		unsigned long long indexOffset = 0;
+		valid = seekFile(this->file, -TAIL_SIZE, SEEK_END) && readValue(this->file, count) && readValue(this->file, indexOffset) &&
+			(fread(magic, 1, 4, this->file) == 4) && (memcmp(magic, INDEX_MAGIC, 4) == 0) &&
+			seekFile(this->file, (long long)indexOffset, SEEK_SET);
+		this->blocks.resize(valid ? count : 0);
+		for (unsigned int i = 0; valid && (i < count); i++) {
+			SessionBlock& block = this->blocks[i];
+			valid = readValue(this->file, block.offset) && readValue(this->file, block.rows) &&
+				readValue(this->file, block.firstTime) && readValue(this->file, block.lastTime);
+		}
+		if (!valid) {
+			std::cout << "Error - " << filename << " has no index (the session was not stopped)" << std::endl;
+			this->close();
+			return false;
+		}
+
+		/* room for the largest block, so that a replay reads its blocks in the haptic thread without allocating */
+		size_t largest = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			unsigned long long end = (i + 1 < count) ? this->blocks[i + 1].offset : indexOffset;
+			if ((end > this->blocks[i].offset) && (end - this->blocks[i].offset > largest)) {
+				largest = (size_t)(end - this->blocks[i].offset);
+			}
+		}
+		this->columnBytes.reserve(largest);
+		return true;
+	}
+
+	/*==================================================================*/
+	void SessionReader::close() {
+		if (this->file != NULL) {
+			fclose(this->file);
+			this->file = NULL;
+		}
+		this->blocks.clear();
+	}
+
+	/*==================================================================*/
+	unsigned long long SessionReader::getNumRecords() const {
+		unsigned long long count = 0;
+		for (size_t i = 0; i < this->blocks.size(); i++) {
+			count += this->blocks[i].rows;
+		}
+		return count;
+	}
+
+	/*==================================================================*/
+	int SessionReader::findBlock(double time) const {
+		int lo = 0;
+		int hi = (int)this->blocks.size() - 1;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (this->blocks[mid].lastTime < time) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		return lo;
+	}
+
+	/*==================================================================*/
+	bool SessionReader::readBlock(int i, std::vector<SessionRecord>& records) {
+		if ((this->file == NULL) || (i < 0) || (i >= (int)this->blocks.size())) {
+			return false;
+		}
+		/* row count and column lengths, then the columns they add up to, decoded from memory */
+		const size_t head = sizeof(unsigned int) * (1 + numColumns);
+		this->columnBytes.resize(head);
+		if (!seekFile(this->file, (long long)this->blocks[i].offset, SEEK_SET) ||
+			(fread(this->columnBytes.data(), 1, head, this->file) != head)) {
+			return false;
+		}
+		const unsigned int* lengths = (const unsigned int*)this->columnBytes.data() + 1;
+		size_t total = 0;
+		for (int c = 0; c < numColumns; c++) {
+			total += lengths[c];
+		}
+		this->columnBytes.resize(head + total);
+		if (fread(this->columnBytes.data() + head, 1, total, this->file) != total) {
+			return false;
+		}
+		return decodeBlock(this->columnBytes.data(), this->columnBytes.size(), records);
+	}
+
+	/*==================================================================*/
+	bool SessionReplay::open(const std::string& filename) {
+		this->finished.store(true, std::memory_order_relaxed);
+		if (!this->reader.open(filename)) {
+			return false;
+		}
+		this->block = 0;
+		this->row = 0;
+		unsigned int rows = 0;
+		for (int i = 0; i < this->reader.getNumBlocks(); i++) {
+			if (this->reader.getBlock(i).rows > rows) {
+				rows = this->reader.getBlock(i).rows;
+			}
+		}
+		this->records.reserve(rows);
+		if ((this->reader.getNumBlocks() == 0) || !this->reader.readBlock(0, this->records) || this->records.empty()) {
+			std::cout << "Error - " << filename << " holds no records" << std::endl;
+			return false;
+		}
+		this->firstTime = this->records.front().time;
+		this->finished.store(false, std::memory_order_relaxed);
+		return true;
+	}
+
+	/*==================================================================*/
+	double SessionReplay::getDuration() const {
+		int n = this->reader.getNumBlocks();
+		return (n > 0) ? this->reader.getBlock(n - 1).lastTime - this->reader.getBlock(0).firstTime : 0.0;
+	}
+
+	/*==================================================================*/
+	bool SessionReplay::next(double elapsed, cVector3d& angle) {
+		bool due = false;
+		while (!this->isFinished()) {
+			if (this->row == this->records.size()) {
+				/* next block; a block that can't be read ends the replay */
+				this->block++;
+				this->row = 0;
+				if ((this->block >= this->reader.getNumBlocks()) || !this->reader.readBlock(this->block, this->records)) {
+					this->finished.store(true, std::memory_order_relaxed);
+				}
+				continue;
+			}
+			const SessionRecord& record = this->records[this->row];
+			if (record.time - this->firstTime > elapsed) {
+				break;
+			}
+			angle.set(record.angle[0], record.angle[1], record.angle[2]);
+			this->row++;
+			due = true;
+		}
+		return due;
+	}
+
+	/*==================================================================*/
+	bool SessionReader::readIndex(const unsigned char* data, size_t size, std::vector<SessionBlock>& blocks) {
+		const unsigned char* p = data;
+		const unsigned char* end = data + size;
+		char magic[4];
+		unsigned int n = 0;
+		bool valid = readBytes(p, end, magic, 4) && (memcmp(magic, FILE_MAGIC, 4) == 0) && readValue(p, end, n) && (n == (unsigned int)numColumns);
+		for (int c = 0; valid && (c < numColumns); c++) {
+			unsigned char length = 0;
+			char name[256];
+			double resolution = 0.0;
+			unsigned char order = 0;
+			valid = readValue(p, end, length) && readBytes(p, end, name, length) && readValue(p, end, resolution) && readValue(p, end, order) &&
+				matchColumn(c, std::string(name, length), resolution, order);
+		}
+		if (!valid || (size < (size_t)TAIL_SIZE)) {
+			return false;
+		}
+
+		unsigned int count = 0;
+		unsigned long long indexOffset = 0;
+		p = end - TAIL_SIZE;
+		valid = readValue(p, end, count) && readValue(p, end, indexOffset) && readBytes(p, end, magic, 4) &&
+			(memcmp(magic, INDEX_MAGIC, 4) == 0) && (indexOffset <= size);
+		blocks.resize(valid ? count : 0);
+		p = data + (valid ? indexOffset : 0);
+		for (unsigned int i = 0; valid && (i < count); i++) {
+			SessionBlock& block = blocks[i];
+			valid = readValue(p, end, block.offset) && readValue(p, end, block.rows) &&
+				readValue(p, end, block.firstTime) && readValue(p, end, block.lastTime) && (block.offset < indexOffset);
+		}
+		if (!valid) {
+			blocks.clear();
+		}
+		return valid;
+	}
+
+	/*==================================================================*/
+	bool SessionReader::decodeBlock(const unsigned char* data, size_t size, std::vector<SessionRecord>& records) {
+		const unsigned char* p = data;
+		const unsigned char* limit = data + size;
+		unsigned int rows = 0;
+		unsigned int lengths[numColumns];
+		if (!readValue(p, limit, rows) || !readBytes(p, limit, lengths, sizeof(lengths))) {
+			return false;
+		}
+
+		records.resize(rows);
+		for (int c = 0; c < numColumns; c++) {
+			if ((size_t)(limit - p) < lengths[c]) {
+				return false;
+			}
+			const unsigned char* end = p + lengths[c];
+			long long previous = 0;
+			long long previousDelta = 0;
+			for (unsigned int r = 0; r < rows; r++) {
+				long long stored;
+				if (!getVarint(p, end, stored)) {
+					return false;
+				}
+				long long delta = (columns[c].order == 2) ? previousDelta + stored : stored;
+				previous += delta;
+				previousDelta = delta;
+				setValue(records[r], columns[c], previous);
+			}
+			p = end;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include "chai3d.h"
+#include "CommandChannel.h"
+#include "PoseHistory.h"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace chai3d {
+	/* The processed state of one haptic tick */
+	struct SessionRecord {
+		double time;  // [s], time of the device's SimulationClock
+		double angle[3];  // accumulated gyro angles (UsartPose::angle)
+		double origin[3];  // position of the device [m]
+		double rotation[4];  // orientation of the device, quaternion w, x, y, z
+		double proxy[3];  // proxy of the tip [m]
+		double force[3];  // force on the device [N]
+		unsigned int contacts;  // bit i: haptic point i in contact
+	};
+
+	/* One block of the file, as listed in its index */
+	struct SessionBlock {
+		unsigned long long offset;
+		unsigned int rows;
+		double firstTime;
+		double lastTime;
+	};
+
+	struct SessionStatistics {
+		unsigned long long recordsWritten;
+		unsigned long long recordsDropped;  // the queue was full: the writer lagged
+		unsigned long long blocksWritten;
+		unsigned long long bytesWritten;
+	};
+
+	/*
+	Records the processed state of every haptic tick (SessionRecord) for hour-long sessions.
+
+	The haptic thread pushes each record into a lock-free queue (SpscQueue, see CommandChannel.h) and goes on; that push
+	is all it pays. A writer thread gathers BLOCK_ROWS records into a block and writes it by columns: each value is
+	quantized to the resolution of its column (1 us, 0.1 um, 1e-7 of a quaternion...), and stored as the zigzag varint of
+	its difference with the previous row (of the difference of differences for the time, which is regular). Values that
+	change slowly from one tick to the next take a byte or two instead of eight, about 20 to 30 bytes a tick.
+
+	File: header (the columns and their resolution), the blocks, then an index of the blocks (offset, rows, time range)
+	and its offset at the very end, so that SessionReader reaches any time of the session with a seek and one block.
+	A session that was not stopped (crash) has no index.
+	*/
+	class SessionRecorder {
+	public:
+		static const int BLOCK_ROWS = 4096;
+		static const unsigned int QUEUE_CAPACITY = 8192;  // records, 8 s at 1 kHz
+
+	private:
+		FILE* file;
+		SpscQueue<SessionRecord, QUEUE_CAPACITY> queue;
+		std::thread writer;
+		std::atomic<bool> recording;
+		std::atomic<bool> writing;
+		bool lossless;  // record() waits for the writer instead of dropping
+
+		/* writer thread */
+		std::vector<SessionRecord> block;
+		std::vector<unsigned char> columnBytes;
+		std::vector<SessionBlock> index;
+
+		std::atomic<unsigned long long> recordsWritten;
+		std::atomic<unsigned long long> recordsDropped;
+		std::atomic<unsigned long long> blocksWritten;
+		std::atomic<unsigned long long> bytesWritten;
+
+		void write();
+		void writeBlock();
+
+	public:
+		SessionRecorder();
+		~SessionRecorder();
+
+		/* Create the file and start the writer thread. Returns false if the file can't be created */
+		bool start(const std::string& filename);
+		/* Write the records still queued, the index, and close the file */
+		void stop();
+		bool isRecording() const { return this->recording.load(std::memory_order_relaxed); }
+		/* When the queue is full, wait for the writer rather than drop the record: for runs that are not paced by the
+		wall clock (headless replays), where every tick must be in the file. Set before start() */
+		void setLossless(bool value) { this->lossless = value; }
+
+		/* Haptic thread (a single one): queue a record; dropped if the queue is full, unless lossless */
+		void record(const SessionRecord& record) {
+			while (!this->queue.push(record)) {
+				if (!this->lossless) {
+					this->recordsDropped.store(this->recordsDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+					return;
+				}
+				std::this_thread::yield();
+			}
+		}
+		/* Haptic thread: queue the state of a tool at the end of a tick, with the pose of its device and the proxy of its
+		first point (the tool's, or the contact model's when one renders the tool) */
+		void record(double time, const UsartPose& pose, cGenericTool* tool, const cVector3d& proxy, unsigned int contacts);
+
+		/* Haptic points of the tool whose proxy is held back from the device (in contact), as bits */
+		static unsigned int getContacts(cGenericTool* tool);
+
+		SessionStatistics getStatistics() const;
+		void printStatistics() const;
+	};
+
+	/* Random access to a session file written by SessionRecorder */
+	class SessionReader {
+	private:
+		FILE* file;
+		std::vector<SessionBlock> blocks;
+		std::vector<unsigned char> columnBytes;
+
+	public:
+		SessionReader() : file(NULL) {}
+		~SessionReader() { this->close(); }
+
+		/* Open a session and read its index. Returns false (and prints why) if it can't be read */
+		bool open(const std::string& filename);
+		void close();
+
+		int getNumBlocks() const { return (int)this->blocks.size(); }
+		const SessionBlock& getBlock(int i) const { return this->blocks[i]; }
+		unsigned long long getNumRecords() const;
+
+		/* Block holding the given time (the first or last block outside the session) */
+		int findBlock(double time) const;
+		/* Decode block i into records. Returns false if it can't be read */
+		bool readBlock(int i, std::vector<SessionRecord>& records);
+
+		/* The same on a session held in memory (e.g. a mapped file), for readers that share it between threads:
+		read the index of the whole file, and decode a block from its offset to the end of the file */
+		static bool readIndex(const unsigned char* data, size_t size, std::vector<SessionBlock>& blocks);
+		static bool decodeBlock(const unsigned char* data, size_t size, std::vector<SessionRecord>& records);
+	};
+
+	/*
+	Plays the device input of a recorded session back, in the time of the simulation: next(elapsed) gives the angles of
+	the last record at most 'elapsed' seconds after the first one. Blocks are decoded one at a time as the replay reaches
+	them, so an hour-long session does not have to fit in memory. See UsartDevice::setReplay().
+	*/
+	class SessionReplay {
+	private:
+		SessionReader reader;
+		std::vector<SessionRecord> records;  // the current block
+		int block;
+		size_t row;  // next record of the block
+		double firstTime;
+		std::atomic<bool> finished;  // read by the graphics thread
+
+	public:
+		SessionReplay() : block(0), row(0), firstTime(0.0), finished(true) {}
+
+		/* Open a session and position the replay at its start. Returns false (and prints why) if it can't be read */
+		bool open(const std::string& filename);
+		/* Duration of the session [s] */
+		double getDuration() const;
+		unsigned long long getNumRecords() const { return this->reader.getNumRecords(); }
+
+		/* Haptic thread: the accumulated angles of the newest record due at 'elapsed' seconds into the replay.
+		Returns false if no record became due since the last call */
+		bool next(double elapsed, cVector3d& angle);
+		/* Any thread: all the records were played */
+		bool isFinished() const { return this->finished.load(std::memory_order_relaxed); }
+	};
+}
@@ -0,0 +1,198 @@
+#include "ShaftTool.h"
+
+namespace chai3d {
+
+	/*==================================================================*/
+	ShaftTool::ShaftTool(cWorld* a_parentWorld, int numPoints, double length)
+		: cGenericTool(a_parentWorld),
+		length(length),
+		pool(NULL),
+		initialized(false),
+		margin(0.03)
+	{
+		if (numPoints < 1) {
+			numPoints = 1;
+		}
+		for (int i = 0; i < numPoints; i++) {
+			m_hapticPoints.push_back(new cHapticPoint(this));
+		}
+		this->px.resize(numPoints);
+		this->py.resize(numPoints);
+		this->pz.resize(numPoints);
+		this->active.resize(numPoints, 0);
+		this->wasActive.resize(numPoints, 0);
+		this->activeIndex.reserve(numPoints);
+		this->forces.resize(numPoints);
+	}
+
+	ShaftTool::~ShaftTool() {
+		for (size_t i = 0; i < m_hapticPoints.size(); i++) {
+			delete m_hapticPoints[i];
+		}
+	}
+
+	/*==================================================================*/
+	/* Global bounding boxes of the contact objects, from their local boxes */
+	void ShaftTool::updateContactBounds() {
+		size_t n = this->contactObjects.size();
+		this->boxMinX.resize(n); this->boxMinY.resize(n); this->boxMinZ.resize(n);
+		this->boxMaxX.resize(n); this->boxMaxY.resize(n); this->boxMaxZ.resize(n);
+
+		for (size_t k = 0; k < n; k++) {
+			cGenericObject* object = this->contactObjects[k];
+			cVector3d localMin = object->getBoundaryMin();
+			cVector3d localMax = object->getBoundaryMax();
+			cVector3d position = object->getGlobalPos();
+			cMatrix3d rotation = object->getGlobalRot();
+
+			cVector3d globalMin(1.0e300, 1.0e300, 1.0e300);
+			cVector3d globalMax(-1.0e300, -1.0e300, -1.0e300);
+			for (int corner = 0; corner < 8; corner++) {
+				cVector3d local((corner & 1) ? localMax.x() : localMin.x(),
+								(corner & 2) ? localMax.y() : localMin.y(),
+								(corner & 4) ? localMax.z() : localMin.z());
+				cVector3d global = position + rotation * local;
+				for (int axis = 0; axis < 3; axis++) {
+					if (global(axis) < globalMin(axis)) globalMin(axis) = global(axis);
+					if (global(axis) > globalMax(axis)) globalMax(axis) = global(axis);
+				}
+			}
+			this->boxMinX[k] = globalMin.x(); this->boxMinY[k] = globalMin.y(); this->boxMinZ[k] = globalMin.z();
+			this->boxMaxX[k] = globalMax.x(); this->boxMaxY[k] = globalMax.y(); this->boxMaxZ[k] = globalMax.z();
+		}
+	}
+
+	/*==================================================================*/
+	/* Positions of the points along the shaft */
+	void ShaftTool::computePointPositions() {
+		int n = (int)this->px.size();
+		double spacing = (n > 1) ? this->length / (n - 1) : 0.0;
+		cVector3d axis = m_deviceGlobalRot.getCol0();
+		double x0 = m_deviceGlobalPos.x(), y0 = m_deviceGlobalPos.y(), z0 = m_deviceGlobalPos.z();
+		double dx = spacing * axis.x(), dy = spacing * axis.y(), dz = spacing * axis.z();
+		for (int i = 0; i < n; i++) {
+			this->px[i] = x0 + i * dx;
+			this->py[i] = y0 + i * dy;
+			this->pz[i] = z0 + i * dz;
+		}
+	}
+
+	/*==================================================================*/
+	/* Select the points close to a contact object, and the ones that were in contact on the last tick
+	so that their proxies get to leave the surface */
+	void ShaftTool::cullPoints() {
+		int n = (int)this->px.size();
+		int numBoxes = (int)this->boxMinX.size();
+
+		for (int i = 0; i < n; i++) {
+			this->active[i] = 0;
+		}
+		for (int k = 0; k < numBoxes; k++) {
+			double minX = this->boxMinX[k] - this->margin, maxX = this->boxMaxX[k] + this->margin;
+			double minY = this->boxMinY[k] - this->margin, maxY = this->boxMaxY[k] + this->margin;
+			double minZ = this->boxMinZ[k] - this->margin, maxZ = this->boxMaxZ[k] + this->margin;
+			for (int i = 0; i < n; i++) {
+				this->active[i] |= (char)((this->px[i] >= minX) & (this->px[i] <= maxX) &
+										  (this->py[i] >= minY) & (this->py[i] <= maxY) &
+										  (this->pz[i] >= minZ) & (this->pz[i] <= maxZ));
+			}
+		}
+
+		this->activeIndex.clear();
+		for (int i = 0; i < n; i++) {
+			if (this->active[i] || this->wasActive[i]) {
+				this->activeIndex.push_back(i);
+			}
+			this->wasActive[i] = this->active[i];
+		}
+	}
+
+	/*==================================================================*/
+	/* One point near a contact object: run its proxy algorithm */
+	void ShaftTool::computePoint(void* context, int index) {
+		ShaftTool* shaft = (ShaftTool*)context;
+		int i = shaft->activeIndex[index];
+		cVector3d position(shaft->px[i], shaft->py[i], shaft->pz[i]);
+		shaft->forces[i] = shaft->m_hapticPoints[i]->computeInteractionForces(position,
+			shaft->m_deviceGlobalRot, shaft->m_deviceGlobalLinVel, shaft->m_deviceGlobalAngVel);
+	}
+
+	/*==================================================================*/
+	void ShaftTool::computeInteractionForces() {
+		int n = (int)this->px.size();
+		this->computePointPositions();
+		if (!this->initialized) {
+			for (int i = 0; i < n; i++) {
+				m_hapticPoints[i]->initialize(cVector3d(this->px[i], this->py[i], this->pz[i]));
+			}
+			this->initialized = true;
+		}
+
+		if (this->contactObjects.empty()) {
+			// nothing to cull against: every point runs the proxy algorithm
+			this->activeIndex.clear();
+			for (int i = 0; i < n; i++) {
+				this->activeIndex.push_back(i);
+			}
+		}
+		else {
+			this->cullPoints();
+		}
+
+		for (int i = 0; i < n; i++) {
+			this->forces[i].zero();
+		}
+
+		int numActive = (int)this->activeIndex.size();
+		if (this->pool != NULL) {
+			this->pool->run(numActive, &ShaftTool::computePoint, this);
+		}
+		else {
+			for (int k = 0; k < numActive; k++) {
+				computePoint(this, k);
+			}
+		}
+
+		/* the points away from the tissue follow the shaft; their proxies are where the points are */
+		int k = 0;
+		for (int i = 0; i < n; i++) {
+			if (k < numActive && this->activeIndex[k] == i) {
+				k++;
+				continue;
+			}
+			m_hapticPoints[i]->initialize(cVector3d(this->px[i], this->py[i], this->pz[i]));
+		}
+
+		/* sum of the forces, and their moment about the tip */
+		cVector3d force(0.0, 0.0, 0.0);
+		cVector3d torque(0.0, 0.0, 0.0);
+		for (int i = 0; i < n; i++) {
+			force += this->forces[i];
+			cVector3d arm(this->px[i] - this->px[0], this->py[i] - this->py[0], this->pz[i] - this->pz[0]);
+			torque += arm.cross(this->forces[i]);
+		}
+		setDeviceGlobalForce(force);
+		setDeviceGlobalTorque(torque);
+	}
+
+	/*==================================================================*/
+	/* Reset the proxies onto the shaft */
+	void ShaftTool::initialize(const bool a_resetPosition) {
+		if (m_hapticDevice != nullptr) {
+			updateFromDevice();
+		}
+		this->computePointPositions();
+		for (size_t i = 0; i < m_hapticPoints.size(); i++) {
+			m_hapticPoints[i]->initialize(cVector3d(this->px[i], this->py[i], this->pz[i]));
+			this->wasActive[i] = 0;
+		}
+		this->initialized = true;
+	}
+
+	/*==================================================================*/
+	void ShaftTool::setDeviceGlobalPose(const cVector3d& position, const cMatrix3d& rotation, const cVector3d& velocity) {
+		m_deviceGlobalPos = position;
+		m_deviceGlobalRot = rotation;
+		m_deviceGlobalLinVel = velocity;
+	}
+}
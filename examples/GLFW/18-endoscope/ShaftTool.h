@@ -0,0 +1,68 @@
+#pragma once
+#include "chai3d.h"
+#include "SpinWorkerPool.h"
+#include <vector>
+
+namespace chai3d {
+	/*
+	The endoscope as a shaft instead of a single sphere at its tip: haptic points spread along the scope axis,
+	so the tissue is also felt where it touches the side of the scope.
+
+	Point 0 is the tip (the device position), point i is at  tip + i * length / (n - 1) * R * (1, 0, 0):
+	the shaft runs from the tip back through the pivot (see pivotPosition()). Every point has its own finger-proxy;
+	the force on the device is the sum of their forces, the torque their moment about the tip.
+
+	Most points are usually far from any tissue. Each tick the point positions are tested, all at once, against the
+	bounding boxes of the contact objects (addContactObject()); only the points near an object run the proxy algorithm,
+	the others just follow the shaft. The points that need it are spread over the worker threads of a SpinWorkerPool,
+	when one is given: the collision trees are only read during the tick, each point writes only its own proxy.
+	CHAI3D stores the interaction of a point in the objects while it computes their haptic effects, so with a pool the
+	shaft must be in a GuardedWorld, which runs those passes one at a time.
+	*/
+	class ShaftTool : public cGenericTool {
+	private:
+		double length;
+		SpinWorkerPool* pool;
+		bool initialized;
+
+		/* point positions of this tick, structure of arrays so the box test vectorizes */
+		std::vector<double> px, py, pz;
+		std::vector<char> active;  // the point ran the proxy algorithm this tick
+		std::vector<char> wasActive;
+		std::vector<int> activeIndex;  // points that run the proxy algorithm this tick
+		std::vector<cVector3d> forces;
+
+		/* global bounding boxes of the contact objects */
+		std::vector<cGenericObject*> contactObjects;
+		std::vector<double> boxMinX, boxMinY, boxMinZ, boxMaxX, boxMaxY, boxMaxZ;
+		double margin;
+
+		void computePointPositions();
+		void cullPoints();
+		static void computePoint(void* context, int index);
+
+	public:
+		/* numPoints >= 1 haptic points over a shaft of the given length [m] */
+		ShaftTool(cWorld* a_parentWorld, int numPoints, double length);
+		virtual ~ShaftTool();
+
+		/* Spread the proxy computations over these workers (NULL: all in the calling thread) */
+		void setWorkerPool(SpinWorkerPool* _pool) { this->pool = _pool; }
+
+		/* Objects the shaft can touch; call updateContactBounds() after adding them and whenever they move */
+		void addContactObject(cGenericObject* object) { this->contactObjects.push_back(object); }
+		void updateContactBounds();
+		/* How close to a contact box a point must come to run the proxy algorithm: at least the radius of the points
+		plus the farthest a point moves in one tick [m] */
+		void setContactMargin(double _margin) { this->margin = _margin; }
+
+		virtual void computeInteractionForces();
+		virtual void initialize(const bool a_resetPosition = true);
+
+		/* Pose (and velocity) of the device without a device, for replays and benchmarks */
+		void setDeviceGlobalPose(const cVector3d& position, const cMatrix3d& rotation, const cVector3d& velocity = cVector3d(0.0, 0.0, 0.0));
+
+		int getNumActivePoints() const { return (int)this->activeIndex.size(); }
+		double getLength() const { return this->length; }
+	};
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "timers/CPrecisionClock.h"
+#include <atomic>
+
+namespace chai3d {
+	/*
+	Time of the simulation, as the haptic loop and the devices see it.
+
+	By default it is the wall clock (cPrecisionClock::getCPUTimeSeconds()). In fixed-step mode it only moves when the
+	haptic loop calls tick(), by exactly one step: a tick is then one step of simulated time however long it took to
+	compute, and a run fed from a file (see SessionReplay) gives the same results, bit for bit, at any speed.
+
+		SimulationClock clock;
+		clock.setFixedStep(0.001);
+		...haptic thread, at the end of each tick:  clock.tick();
+		...device, tools:  double now = clock.now();
+	*/
+	class SimulationClock {
+	private:
+		double step;  // [s], 0 for the wall clock
+		double start;  // time of tick 0 in fixed-step mode [s]
+		std::atomic<unsigned long long> ticks;  // written by the haptic thread only
+
+	public:
+		SimulationClock() : step(0.0), start(0.0), ticks(0) {}
+
+		/* Fixed steps of the given length [s] from the given time; call before the haptic thread starts */
+		void setFixedStep(double a_step, double a_start = 0.0) {
+			this->step = a_step;
+			this->start = a_start;
+			this->ticks.store(0, std::memory_order_relaxed);
+		}
+		bool isFixedStep() const { return this->step > 0.0; }
+		double getStep() const { return this->step; }
+
+		/* Any thread: current time [s] */
+		double now() const {
+			if (this->step > 0.0) {
+				/* a product rather than a sum of steps, so that the time of a tick does not depend on rounding history */
+				return this->start + this->ticks.load(std::memory_order_acquire) * this->step;
+			}
+			return cPrecisionClock::getCPUTimeSeconds();
+		}
+
+		/* Haptic thread: a tick is done */
+		void tick() { this->ticks.store(this->ticks.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+		unsigned long long getTicks() const { return this->ticks.load(std::memory_order_relaxed); }
+
+		/* The wall clock, for objects that were not given a clock of their own */
+		static const SimulationClock& wallClock() {
+			static const SimulationClock clock;
+			return clock;
+		}
+	};
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include "Trace.h"
+#include <atomic>
+#include <climits>
+#include <thread>
+#include <vector>
+
+namespace chai3d {
+	/*
+	Persistent worker threads for splitting the work of one haptic tick: run(count, task, context) calls
+	task(context, i) for i = 0..count-1, spread over the workers and the calling thread, and returns when all are done.
+
+	The workers spin between runs, like the haptic loop itself, so a run starts without any scheduler latency. That only
+	pays when each worker has a core of its own, so start() never starts more workers than there are other cores.
+	run() must be called from one thread (the haptic thread), and a task must not call run() on the same pool.
+	*/
+	class SpinWorkerPool {
+	public:
+		typedef void(*Task)(void* context, int index);
+
+	private:
+		static const int IDLE = INT_MAX / 2;  // 'next' between runs: no worker can take an index
+
+		std::vector<std::thread> workers;
+		std::atomic<bool> running;
+		std::atomic<unsigned int> generation;  // incremented by run() to wake the workers
+		std::atomic<int> next;  // next index to take
+		std::atomic<int> done;  // indices finished
+		std::atomic<int> count;
+		std::atomic<Task> task;
+		std::atomic<void*> context;
+
+		/* Take indices until none is left */
+		void take() {
+			int index;
+			while ((index = this->next.fetch_add(1, std::memory_order_acq_rel)) < this->count.load(std::memory_order_relaxed)) {
+				this->task.load(std::memory_order_relaxed)(this->context.load(std::memory_order_relaxed), index);
+				this->done.fetch_add(1, std::memory_order_acq_rel);
+			}
+		}
+
+		void work() {
+			Trace::nameThread("worker");  // setEnabled() then gives it its trace buffer, rather than a tick
+			unsigned int seen = this->generation.load(std::memory_order_acquire);
+			while (this->running.load(std::memory_order_relaxed)) {
+				unsigned int current = this->generation.load(std::memory_order_acquire);
+				if (current == seen) {
+					std::this_thread::yield();
+					continue;
+				}
+				seen = current;
+				this->take();
+			}
+		}
+
+	public:
+		SpinWorkerPool() : running(false), generation(0), next(IDLE), done(0), count(0), task(nullptr), context(nullptr) {}
+		~SpinWorkerPool() { this->stop(); }
+
+		/* Start up to numWorkers threads (fewer if the machine has fewer spare cores) */
+		void start(int numWorkers) {
+			if (this->running) {
+				return;
+			}
+			int cores = (int)std::thread::hardware_concurrency();
+			if (cores > 0 && numWorkers > cores - 1) {
+				numWorkers = cores - 1;
+			}
+			if (numWorkers <= 0) {
+				return;
+			}
+			this->running = true;
+			for (int i = 0; i < numWorkers; i++) {
+				this->workers.push_back(std::thread(&SpinWorkerPool::work, this));
+			}
+		}
+
+		void stop() {
+			if (!this->running) {
+				return;
+			}
+			this->running = false;
+			for (size_t i = 0; i < this->workers.size(); i++) {
+				this->workers[i].join();
+			}
+			this->workers.clear();
+		}
+
+		int getNumWorkers() const { return (int)this->workers.size(); }
+
+		/* Call task(context, i) for i = 0..n-1 and wait until all calls returned */
+		void run(int n, Task _task, void* _context) {
+			if (this->workers.empty()) {
+				for (int i = 0; i < n; i++) {
+					_task(_context, i);
+				}
+				return;
+			}
+
+			this->task.store(_task, std::memory_order_relaxed);
+			this->context.store(_context, std::memory_order_relaxed);
+			this->count.store(n, std::memory_order_relaxed);
+			this->done.store(0, std::memory_order_relaxed);
+			this->next.store(0, std::memory_order_release);  // a worker still leaving the previous run may start here
+			this->generation.fetch_add(1, std::memory_order_acq_rel);
+
+			this->take();
+			while (this->done.load(std::memory_order_acquire) < n) {
+			}
+
+			// a worker that is late for this run must not take an index of the next one before it is set up
+			this->next.store(IDLE, std::memory_order_relaxed);
+		}
+	};
+}
@@ -0,0 +1,179 @@
+#include "Trace.h"
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+namespace chai3d {
+
+	struct TraceEvent {
+		const char* name;
+		double begin;
+		double end;
+	};
+
+	/* The events of one thread: a ring written by that thread only. The ring is allocated when the thread first traces
+	with tracing on; when the thread exits, the next new thread takes the buffer over */
+	struct TraceBuffer {
+		std::string name;
+		int id;
+		bool owned;  // its thread is still running
+		std::atomic<TraceEvent*> events;  // TRACE_CAPACITY events, or NULL until tracing is on
+		std::atomic<unsigned long long> head;  // events recorded so far
+	};
+
+	std::atomic<bool> Trace::enabled(false);
+
+	/* every buffer ever created, one per thread running at the same time. They are never freed: the events of a thread
+	outlive it until they are written, or until a new thread takes its buffer */
+	static std::mutex buffersLock;
+	static std::vector<TraceBuffer*> buffers;
+
+	/* The buffer of the calling thread; hands it back when the thread exits */
+	struct TraceOwner {
+		TraceBuffer* buffer;
+
+		TraceOwner() : buffer(NULL) {}
+		~TraceOwner() {
+			if (this->buffer != NULL) {
+				std::lock_guard<std::mutex> lock(buffersLock);
+				this->buffer->owned = false;
+			}
+		}
+	};
+
+	static thread_local TraceOwner owner;
+
+	/* events before this time are not written */
+	static std::atomic<double> since(0.0);
+
+	/*==================================================================*/
+	static void allocateEvents(TraceBuffer* buffer) {
+		if (buffer->events.load(std::memory_order_relaxed) == NULL) {
+			buffer->events.store(new TraceEvent[Trace::TRACE_CAPACITY], std::memory_order_release);
+		}
+	}
+
+	/*==================================================================*/
+	/* The buffer of the calling thread, taken over from a thread that exited (one with events first) or created.
+	Renames it if a name is given, and allocates its events if asked to */
+	static TraceBuffer* threadBuffer(const char* name, bool allocate) {
+		std::lock_guard<std::mutex> lock(buffersLock);
+		TraceBuffer* buffer = owner.buffer;
+		if (buffer == NULL) {
+			for (size_t b = 0; b < buffers.size(); b++) {
+				if (!buffers[b]->owned && ((buffer == NULL) || (buffers[b]->events.load(std::memory_order_relaxed) != NULL))) {
+					buffer = buffers[b];
+				}
+			}
+			if (buffer == NULL) {
+				buffer = new TraceBuffer();
+				buffer->id = (int)buffers.size() + 1;
+				buffer->events.store(NULL, std::memory_order_relaxed);
+				buffers.push_back(buffer);
+			}
+			buffer->owned = true;
+			buffer->head.store(0, std::memory_order_relaxed);  // the events of the thread that exited are dropped
+			buffer->name = "thread " + std::to_string(buffer->id);
+			owner.buffer = buffer;
+		}
+		if (name != NULL) {
+			buffer->name = name;
+		}
+		if (allocate) {
+			allocateEvents(buffer);
+		}
+		return buffer;
+	}
+
+	/*==================================================================*/
+	void Trace::setEnabled(bool enabled) {
+		if (enabled) {
+			/* the threads that named themselves get their buffer now, rather than in their next tick */
+			std::lock_guard<std::mutex> lock(buffersLock);
+			for (size_t b = 0; b < buffers.size(); b++) {
+				if (buffers[b]->owned) {
+					allocateEvents(buffers[b]);
+				}
+			}
+		}
+		Trace::enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	/*==================================================================*/
+	void Trace::nameThread(const char* name) {
+		threadBuffer(name, Trace::isEnabled());
+	}
+
+	/*==================================================================*/
+	void Trace::record(const char* name, double begin, double end) {
+		TraceBuffer* buffer = owner.buffer;
+		TraceEvent* events = (buffer != NULL) ? buffer->events.load(std::memory_order_acquire) : NULL;
+		if (events == NULL) {
+			buffer = threadBuffer(NULL, true);
+			events = buffer->events.load(std::memory_order_relaxed);
+		}
+		unsigned long long index = buffer->head.load(std::memory_order_relaxed);
+		TraceEvent& event = events[index & (TRACE_CAPACITY - 1)];
+		event.name = name;
+		event.begin = begin;
+		event.end = end;
+		buffer->head.store(index + 1, std::memory_order_release);
+	}
+
+	/*==================================================================*/
+	void Trace::clear() {
+		since.store(cPrecisionClock::getCPUTimeSeconds(), std::memory_order_relaxed);
+	}
+
+	/*==================================================================*/
+	int Trace::getNumBuffers() {
+		std::lock_guard<std::mutex> lock(buffersLock);
+		int count = 0;
+		for (size_t b = 0; b < buffers.size(); b++) {
+			if (buffers[b]->events.load(std::memory_order_relaxed) != NULL) {
+				count++;
+			}
+		}
+		return count;
+	}
+
+	/*==================================================================*/
+	bool Trace::write(const std::string& filename) {
+		std::ofstream file(filename.c_str());
+		if (!file) {
+			return false;
+		}
+		double origin = since.load(std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(buffersLock);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+		file << std::fixed << std::setprecision(3);
+		bool first = true;
+		for (size_t b = 0; b < buffers.size(); b++) {
+			const TraceBuffer& buffer = *buffers[b];
+			const TraceEvent* events = buffer.events.load(std::memory_order_acquire);
+			if (events == NULL) {
+				continue;  // never traced
+			}
+			file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.id
+				<< ",\"args\":{\"name\":\"" << buffer.name << "\"}}";
+			first = false;
+
+			/* the events still in the ring, but the oldest eighth that the thread may overwrite while we read */
+			unsigned long long head = buffer.head.load(std::memory_order_acquire);
+			unsigned long long kept = TRACE_CAPACITY - TRACE_CAPACITY / 8;
+			unsigned long long begin = (head > kept) ? head - kept : 0;
+			for (unsigned long long i = begin; i < head; i++) {
+				const TraceEvent& event = events[i & (TRACE_CAPACITY - 1)];
+				if (event.begin < origin) {
+					continue;
+				}
+				file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.id
+					<< ",\"ts\":" << 1.0e6 * (event.begin - origin) << ",\"dur\":" << 1.0e6 * (event.end - event.begin) << "}";
+			}
+		}
+		file << std::endl << "]}" << std::endl;
+		return (bool)file;
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "timers/CPrecisionClock.h"
+#include <atomic>
+#include <string>
+
+namespace chai3d {
+	/*
+	Timeline of what each thread did, for the late frames and ticks that averages can't explain.
+
+	A scope is recorded as one event (name, begin, end) in a buffer of the thread that ran it: two clock reads and a few
+	stores per scope, one relaxed load when tracing is off. Each buffer keeps the last TRACE_CAPACITY events of its thread
+	(a minute of the haptic thread at a few scopes per tick, 6 MB); write() dumps the events of all threads since the last
+	clear() as a Chrome trace-event JSON file, which chrome://tracing and https://ui.perfetto.dev open directly.
+	Until tracing is turned on a thread costs only its name. setEnabled(true) allocates the buffers of the threads that
+	named themselves, a thread without a name gets its buffer with its first event; after that, recording takes no lock and
+	allocates nothing. Threads with a deadline name themselves before their loop. The buffer of a thread that exited goes
+	to the next new thread (its events are then dropped), so recreating a worker pool does not add buffers.
+
+		Trace::nameThread("haptics");
+		while (running) {
+			TRACE_SCOPE("haptic tick");
+			...
+		}
+		...
+		Trace::write("18-endoscope.trace.json");
+
+	Names must be string literals (only the pointer is kept). write() can run while the threads keep tracing: the
+	oldest eighth of a buffer is left out of the dump, so that the events being overwritten meanwhile are not read.
+	*/
+	class Trace {
+	public:
+		static const unsigned int TRACE_CAPACITY = 1 << 18;  // events per thread, a power of 2
+
+		static void setEnabled(bool enabled);
+		static bool isEnabled() { return Trace::enabled.load(std::memory_order_relaxed); }
+
+		/* Name of the calling thread in the trace; threads that record without a name are called 'thread <n>' */
+		static void nameThread(const char* name);
+		/* Record one event of the calling thread; times in seconds, cPrecisionClock::getCPUTimeSeconds() time base */
+		static void record(const char* name, double begin, double end);
+
+		/* Number of event buffers allocated, TRACE_CAPACITY events each */
+		static int getNumBuffers();
+
+		/* Forget the events recorded so far */
+		static void clear();
+		/* Dump the events since the last clear() as a Chrome trace. Returns false if the file can't be written */
+		static bool write(const std::string& filename);
+
+	private:
+		static std::atomic<bool> enabled;
+	};
+
+	/* Records the time from its construction to its destruction */
+	class TraceScope {
+	private:
+		const char* name;
+		double begin;
+
+	public:
+		TraceScope(const char* _name) : name(_name), begin(0.0) {
+			if (Trace::isEnabled()) {
+				this->begin = cPrecisionClock::getCPUTimeSeconds();
+			}
+		}
+		~TraceScope() {
+			if (this->begin != 0.0) {
+				Trace::record(this->name, this->begin, cPrecisionClock::getCPUTimeSeconds());
+			}
+		}
+	};
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+/* Trace the rest of the enclosing block */
+#define TRACE_SCOPE(name) chai3d::TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
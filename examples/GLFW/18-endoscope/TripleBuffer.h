@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+
+namespace chai3d {
+	/*
+	Triple buffer: hands the latest value from one writer thread to one reader thread without locks.
+
+	The writer fills the back buffer and publishes it; the reader picks up the most recently published
+	buffer when it wants to. Neither side ever waits for the other, values are never torn, and the reader
+	always gets the newest complete value (intermediate ones are skipped).
+
+		writer:  T& v = buffer.write(); ...fill v...; buffer.publish();
+		reader:  if (buffer.update()) { use(buffer.read()); }
+	*/
+	template <class T>
+	class TripleBuffer {
+	private:
+		static const unsigned int DIRTY = 4;  // set on 'middle' when it holds a value the reader has not taken yet
+
+		T buffers[3];
+		std::atomic<unsigned int> middle;  // index of the exchange buffer, plus the DIRTY flag
+		unsigned int back;  // owned by the writer
+		unsigned int front;  // owned by the reader
+
+	public:
+		TripleBuffer() : middle(1), back(0), front(2) {}
+
+		/* Initialize all three buffers; call before the threads start */
+		void reset(const T& value) {
+			for (int i = 0; i < 3; i++) {
+				this->buffers[i] = value;
+			}
+			this->middle.store(1, std::memory_order_relaxed);
+			this->back = 0;
+			this->front = 2;
+		}
+
+		/* Writer: buffer to fill */
+		T& write() {
+			return this->buffers[this->back];
+		}
+
+		/* Writer: make the back buffer the newest value */
+		void publish() {
+			unsigned int previous = this->middle.exchange(this->back | DIRTY, std::memory_order_acq_rel);
+			this->back = previous & ~DIRTY;
+		}
+
+		/* Reader: take the newest value if there is one. Returns false if nothing was published since the last call */
+		bool update() {
+			if ((this->middle.load(std::memory_order_relaxed) & DIRTY) == 0) {
+				return false;
+			}
+			unsigned int previous = this->middle.exchange(this->front, std::memory_order_acq_rel);
+			this->front = previous & ~DIRTY;
+			return true;
+		}
+
+		/* Reader: current value */
+		const T& read() const {
+			return this->buffers[this->front];
+		}
+	};
+}
@@ -0,0 +1,516 @@
+#include "UdpTransport.h"
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "timers/CPrecisionClock.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace chai3d {
+
+#if defined(_WIN32)
+	typedef SOCKET SocketHandle;
+	static void closeSocket(SocketHandle handle) { closesocket(handle); }
+#else
+	typedef int SocketHandle;
+	static const SocketHandle INVALID_SOCKET = -1;
+	static void closeSocket(SocketHandle handle) { ::close(handle); }
+#endif
+
+	const double UdpTransport::HOLD = 0.002;
+
+	static const unsigned char PREAMBLE_BYTE = 0xAA;
+	static const int PREAMBLE_LENGTH = 6;
+
+	/*==================================================================*/
+	UdpTransport::UdpTransport(unsigned short a_port)
+		: port(a_port),
+		socket((unsigned long long)INVALID_SOCKET),
+		isOpen(false),
+		deadline(1.0e300),
+		clockBase(0),
+		clockOffset(0.0),
+		peerLength(0),
+		peerSeq(0),
+		expected(0),
+		highest(0),
+		synchronized(false),
+		lateRun(0),
+		streamOffset(0),
+		timestamp(0.0)
+	{
+		memset(this->window, 0, sizeof(this->window));
+	}
+
+	/*==================================================================*/
+	bool UdpTransport::open() {
+		this->close();
+#if defined(_WIN32)
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+			return false;
+		}
+#endif
+		SocketHandle handle = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (handle == INVALID_SOCKET) {
+#if defined(_WIN32)
+			WSACleanup();
+#endif
+			return false;
+		}
+
+		/* room for bursts while the haptic thread is busy, and never block: read() waits with select() */
+		int bufferSize = 1 << 20;
+		setsockopt(handle, SOL_SOCKET, SO_RCVBUF, (const char*)&bufferSize, sizeof(bufferSize));
+#if defined(_WIN32)
+		u_long nonBlocking = 1;
+		ioctlsocket(handle, FIONBIO, &nonBlocking);
+#else
+		fcntl(handle, F_SETFL, fcntl(handle, F_GETFL, 0) | O_NONBLOCK);
+#endif
+#if defined(SO_TIMESTAMPNS)
+		int on = 1;
+		setsockopt(handle, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+		/* kernel timestamps are on the real time clock */
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		this->clockBase = (long long)now.tv_sec;
+		this->clockOffset = cPrecisionClock::getCPUTimeSeconds() - now.tv_nsec * 1.0e-9;
+#endif
+
+		struct sockaddr_in local;
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		local.sin_addr.s_addr = htonl(INADDR_ANY);
+		local.sin_port = htons(this->port);
+		if (bind(handle, (const struct sockaddr*)&local, sizeof(local)) != 0) {
+			std::cout << "Error - UDP port " << this->port << " is not available" << std::endl;
+			closeSocket(handle);
+#if defined(_WIN32)
+			WSACleanup();
+#endif
+			return false;
+		}
+
+		this->socket = (unsigned long long)handle;
+		this->isOpen = true;
+		this->peerLength = 0;
+		this->peerSeq.store(0, std::memory_order_relaxed);
+		memset(this->window, 0, sizeof(this->window));
+		this->synchronized = false;
+		this->lateRun = 0;
+		/* the most one receive can deliver: a burst, and the frames held back before it. The haptic thread reads, it must not allocate */
+		this->stream.clear();
+		this->streamTimes.clear();
+		this->stream.reserve((BURST + WINDOW) * FRAME_SIZE);
+		this->streamTimes.reserve(BURST + WINDOW);
+		this->streamOffset = 0;
+		this->datagrams = this->frames = this->lost = this->reordered = this->late = this->resyncs = this->malformed = this->bursts = 0;
+		this->latencySum = this->latencyMax = this->lastArrival = 0.0;
+		this->intervals = 0;
+		this->intervalMean = this->intervalM2 = 0.0;
+		return true;
+	}
+
+	/*==================================================================*/
+	bool UdpTransport::close() {
+		if (!this->isOpen) {
+			return true;
+		}
+		closeSocket((SocketHandle)this->socket);
+#if defined(_WIN32)
+		WSACleanup();
+#endif
+		this->socket = (unsigned long long)INVALID_SOCKET;
+		this->isOpen = false;
+		return true;
+	}
+
+	/*==================================================================*/
+	/* Drain up to BURST datagrams in one call; returns how many came */
+	int UdpTransport::receive() {
+		SocketHandle handle = (SocketHandle)this->socket;
+		char buffers[BURST][DATAGRAM_SIZE + 1];  // one more byte: a longer datagram shows as such
+		int count = 0;
+#if defined(__linux__)
+		struct mmsghdr messages[BURST];
+		struct iovec vectors[BURST];
+		struct sockaddr_storage senders[BURST];
+		char controls[BURST][CMSG_SPACE(sizeof(struct timespec))];
+		for (int i = 0; i < BURST; i++) {
+			vectors[i].iov_base = buffers[i];
+			vectors[i].iov_len = sizeof(buffers[i]);
+			memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+			messages[i].msg_hdr.msg_iov = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+			messages[i].msg_hdr.msg_name = &senders[i];
+			messages[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+			messages[i].msg_hdr.msg_control = controls[i];
+			messages[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+		}
+		count = recvmmsg(handle, messages, BURST, MSG_DONTWAIT, NULL);
+		if (count <= 0) {
+			return 0;
+		}
+		double now = cPrecisionClock::getCPUTimeSeconds();
+		for (int i = 0; i < count; i++) {
+			double time = now;
+			for (struct cmsghdr* c = CMSG_FIRSTHDR(&messages[i].msg_hdr); c != NULL; c = CMSG_NXTHDR(&messages[i].msg_hdr, c)) {
+				if ((c->cmsg_level == SOL_SOCKET) && (c->cmsg_type == SCM_TIMESTAMPNS)) {
+					struct timespec stamp;
+					memcpy(&stamp, CMSG_DATA(c), sizeof(stamp));
+					time = (double)((long long)stamp.tv_sec - this->clockBase) + stamp.tv_nsec * 1.0e-9 + this->clockOffset;
+				}
+			}
+			if (this->accept(buffers[i], (int)messages[i].msg_len, time)) {
+				this->setPeer(&senders[i], (int)messages[i].msg_hdr.msg_namelen);
+			}
+		}
+#else
+		/* one call per datagram, until the socket is empty */
+		while (count < BURST) {
+			struct sockaddr_storage sender;
+			socklen_t senderLength = sizeof(sender);
+			int size = recvfrom(handle, buffers[count], (int)sizeof(buffers[count]), 0, (struct sockaddr*)&sender, &senderLength);
+			if (size < 0) {
+#if defined(_WIN32)
+				if (WSAGetLastError() == WSAEMSGSIZE) {
+					this->malformed++;
+					continue;
+				}
+#endif
+				break;
+			}
+			double time = cPrecisionClock::getCPUTimeSeconds();
+			if (this->accept(buffers[count], size, time)) {
+				this->setPeer(&sender, (int)senderLength);
+			}
+			count++;
+		}
+		if (count == 0) {
+			return 0;
+		}
+#endif
+		this->bursts++;
+		return count;
+	}
+
+	/*==================================================================*/
+	/* Haptic thread: the sender of a frame taken in, if it moved (seqlock, see PoseHistory.h) */
+	void UdpTransport::setPeer(const void* address, int length) {
+		if ((length <= 0) || (length > (int)sizeof(this->peer))) {
+			return;
+		}
+		unsigned int seq = this->peerSeq.load(std::memory_order_relaxed);
+		if ((seq != 0) && (length == this->peerLength) && (memcmp(address, this->peer, length) == 0)) {
+			return;
+		}
+		this->peerSeq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(this->peer, address, length);
+		this->peerLength = length;
+		this->peerSeq.store(seq + 2, std::memory_order_release);
+	}
+
+	/*==================================================================*/
+	/* One datagram: into its place in the window, then on to the stream with those before it.
+	Returns true if its frame was taken in (not malformed, late or a duplicate) */
+	bool UdpTransport::accept(const char* datagram, int size, double time) {
+		this->datagrams++;
+		if (this->lastArrival > 0.0) {
+			/* running variance of the interval between datagrams (Welford) */
+			double interval = time - this->lastArrival;
+			this->intervals++;
+			double delta = interval - this->intervalMean;
+			this->intervalMean += delta / this->intervals;
+			this->intervalM2 += delta * (interval - this->intervalMean);
+		}
+		this->lastArrival = time;
+
+		if (size != DATAGRAM_SIZE) {
+			this->malformed++;
+			return false;
+		}
+		const unsigned char* bytes = (const unsigned char*)datagram;
+		unsigned int sequence = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+		if (!this->synchronized) {
+			this->expected = sequence;
+			this->highest = sequence;
+			this->synchronized = true;
+		}
+
+		/* differences of sequence numbers as signed integers, so that they wrap around */
+		int ahead = (int)(sequence - this->expected);
+		if ((ahead > (int)RESYNC_JUMP) || (ahead < -(int)RESYNC_JUMP)) {
+			this->resync(sequence);  // far from anything the window could hold: a new numbering
+		}
+		else if (ahead < 0) {
+			if (++this->lateRun < RESYNC_LATE) {
+				this->late++;
+				return false;
+			}
+			this->resync(sequence);  // the old numbering is not coming back
+		}
+		this->lateRun = 0;
+		if ((int)(sequence - this->highest) < 0) {
+			this->reordered++;
+		}
+		else {
+			this->highest = sequence;
+		}
+		while ((int)(sequence - this->expected) >= WINDOW) {
+			this->advance();  // too far ahead: give up on the oldest missing frames
+		}
+		Slot& slot = this->window[sequence % WINDOW];
+		if (slot.full) {
+			this->late++;  // duplicate
+			return false;
+		}
+		slot.full = true;
+		slot.time = time;
+		memcpy(slot.frame, datagram + HEADER_SIZE, FRAME_SIZE);
+		this->deliver();
+		return true;
+	}
+
+	/*==================================================================*/
+	/* The sender restarted its numbering at this sequence number: the frames held back from the old numbering go to
+	the stream first, in their order, and the numbers still missing there are not counted as lost */
+	void UdpTransport::resync(unsigned int sequence) {
+		for (int i = 0; i < WINDOW; i++) {
+			Slot& slot = this->window[(this->expected + i) % WINDOW];
+			if (slot.full) {
+				this->stream.insert(this->stream.end(), slot.frame, slot.frame + FRAME_SIZE);
+				this->streamTimes.push_back(slot.time);
+				this->frames++;
+				slot.full = false;
+			}
+		}
+		this->expected = sequence;
+		this->highest = sequence;
+		this->lateRun = 0;
+		this->resyncs++;
+	}
+
+	/*==================================================================*/
+	/* Move the expected frame to the stream, or count it as lost if it never came */
+	void UdpTransport::advance() {
+		Slot& slot = this->window[this->expected % WINDOW];
+		if (slot.full) {
+			this->stream.insert(this->stream.end(), slot.frame, slot.frame + FRAME_SIZE);
+			this->streamTimes.push_back(slot.time);
+			this->frames++;
+			slot.full = false;
+		}
+		else {
+			this->lost++;
+		}
+		this->expected++;
+	}
+
+	/*==================================================================*/
+	/* Frames that are next in sequence go to the stream */
+	void UdpTransport::deliver() {
+		while (this->window[this->expected % WINDOW].full) {
+			this->advance();
+		}
+	}
+
+	/*==================================================================*/
+	/* Give up on a missing frame once the frames behind it were held for HOLD. Returns true if frames were released */
+	bool UdpTransport::release(double now) {
+		double oldest = 1.0e300;
+		for (int i = 0; i < WINDOW; i++) {
+			if (this->window[i].full && (this->window[i].time < oldest)) {
+				oldest = this->window[i].time;
+			}
+		}
+		if (oldest + HOLD > now) {
+			return false;
+		}
+		while (!this->window[this->expected % WINDOW].full) {
+			this->advance();
+		}
+		this->deliver();
+		return true;
+	}
+
+	/*==================================================================*/
+	/* Wait until a datagram is there, at most the given time; true if one is */
+	bool UdpTransport::wait(double seconds) {
+		SocketHandle handle = (SocketHandle)this->socket;
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(handle, &readable);
+		struct timeval timeout;
+		timeout.tv_sec = (long)seconds;
+		timeout.tv_usec = (long)((seconds - (double)timeout.tv_sec) * 1.0e6);
+		return select((int)handle + 1, &readable, NULL, NULL, &timeout) > 0;
+	}
+
+	/*==================================================================*/
+	int UdpTransport::read(int nBytes, char buffer[]) {
+		while (this->streamOffset == this->stream.size()) {
+			this->stream.clear();
+			this->streamTimes.clear();
+			this->streamOffset = 0;
+			if (!this->isOpen) {
+				return 0;
+			}
+			if (this->receive() > 0) {
+				continue;  // the frames may also all be held back
+			}
+			double now = cPrecisionClock::getCPUTimeSeconds();
+			if (this->release(now)) {
+				continue;
+			}
+			if (now >= this->deadline) {
+				return 0;
+			}
+			/* in slices of HOLD, so that held frames are released on time */
+			this->wait((this->deadline - now < HOLD) ? this->deadline - now : HOLD);
+		}
+
+		/* a new frame reaches the decoder */
+		if (this->streamOffset % FRAME_SIZE == 0) {
+			this->timestamp = this->streamTimes[this->streamOffset / FRAME_SIZE];
+			double latency = cPrecisionClock::getCPUTimeSeconds() - this->timestamp;
+			this->latencySum += latency;
+			if (latency > this->latencyMax) {
+				this->latencyMax = latency;
+			}
+		}
+		int available = (int)(this->stream.size() - this->streamOffset);
+		int n = (nBytes < available) ? nBytes : available;
+		memcpy(buffer, &this->stream[this->streamOffset], n);
+		this->streamOffset += n;
+		return n;
+	}
+
+	/*==================================================================*/
+	int UdpTransport::write(int nBytes, const char buffer[]) {
+		if (!this->isOpen) {
+			return 0;
+		}
+		/* a consistent copy of the peer, retried if the haptic thread changed it meanwhile */
+		unsigned char address[sizeof(this->peer)];
+		int length;
+		while (true) {
+			unsigned int seq = this->peerSeq.load(std::memory_order_acquire);
+			if (seq == 0) {
+				return 0;
+			}
+			if (seq & 1) {
+				continue;
+			}
+			length = this->peerLength;
+			if ((length <= 0) || (length > (int)sizeof(address))) {
+				continue;
+			}
+			memcpy(address, this->peer, length);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (this->peerSeq.load(std::memory_order_relaxed) == seq) {
+				break;
+			}
+		}
+		int sent = sendto((SocketHandle)this->socket, buffer, nBytes, 0, (const struct sockaddr*)address, length);
+		return (sent > 0) ? sent : 0;
+	}
+
+	/*==================================================================*/
+	UdpStatistics UdpTransport::getStatistics() const {
+		UdpStatistics statistics;
+		statistics.datagrams = this->datagrams;
+		statistics.frames = this->frames;
+		statistics.lost = this->lost;
+		statistics.reordered = this->reordered;
+		statistics.late = this->late;
+		statistics.resyncs = this->resyncs;
+		statistics.malformed = this->malformed;
+		statistics.meanBurst = (this->bursts > 0) ? (double)this->datagrams / this->bursts : 0.0;
+		statistics.meanLatency = (this->frames > 0) ? this->latencySum / this->frames : 0.0;
+		statistics.maxLatency = this->latencyMax;
+		statistics.jitter = (this->intervals > 1) ? std::sqrt(this->intervalM2 / (this->intervals - 1)) : 0.0;
+		return statistics;
+	}
+
+	/*==================================================================*/
+	void UdpTransport::printStatistics() const {
+		UdpStatistics statistics = this->getStatistics();
+		std::cout << "UDP " << this->port << ": " << statistics.datagrams << " datagrams (" << statistics.meanBurst << " per receive), "
+			<< statistics.frames << " frames, " << statistics.lost << " lost, " << statistics.reordered << " reordered, "
+			<< statistics.late << " late, " << statistics.resyncs << " resyncs, " << statistics.malformed << " malformed, latency " << statistics.meanLatency * 1.0e6
+			<< " us (max " << statistics.maxLatency * 1.0e6 << " us), jitter " << statistics.jitter * 1.0e6 << " us" << std::endl;
+	}
+
+	/*==================================================================*/
+	int UdpTransport::makeDatagram(unsigned int sequence, const double raw[3], char datagram[DATAGRAM_SIZE]) {
+		for (int i = 0; i < HEADER_SIZE; i++) {
+			datagram[i] = (char)((sequence >> (8 * i)) & 0xFF);
+		}
+		memset(datagram + HEADER_SIZE, PREAMBLE_BYTE, PREAMBLE_LENGTH);
+		memcpy(datagram + HEADER_SIZE + PREAMBLE_LENGTH, raw, 3 * sizeof(double));
+		return DATAGRAM_SIZE;
+	}
+
+	/*==================================================================*/
+	bool UdpSender::open(const std::string& host, unsigned short port) {
+		this->close();
+#if defined(_WIN32)
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+			return false;
+		}
+#endif
+		SocketHandle handle = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		struct sockaddr_in remote;
+		memset(&remote, 0, sizeof(remote));
+		remote.sin_family = AF_INET;
+		remote.sin_port = htons(port);
+		if ((handle == INVALID_SOCKET) || (inet_pton(AF_INET, host.c_str(), &remote.sin_addr) != 1)) {
+			if (handle != INVALID_SOCKET) {
+				closeSocket(handle);
+			}
+#if defined(_WIN32)
+			WSACleanup();
+#endif
+			return false;
+		}
+		memcpy(this->address, &remote, sizeof(remote));
+		this->addressLength = (int)sizeof(remote);
+		this->socket = (unsigned long long)handle;
+		this->isOpen = true;
+		return true;
+	}
+
+	/*==================================================================*/
+	void UdpSender::close() {
+		if (!this->isOpen) {
+			return;
+		}
+		closeSocket((SocketHandle)this->socket);
+#if defined(_WIN32)
+		WSACleanup();
+#endif
+		this->isOpen = false;
+	}
+
+	/*==================================================================*/
+	bool UdpSender::send(const char* datagram, int size) {
+		return this->isOpen &&
+			(sendto((SocketHandle)this->socket, datagram, size, 0, (const struct sockaddr*)this->address, this->addressLength) == size);
+	}
+}
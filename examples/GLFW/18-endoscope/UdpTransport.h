@@ -0,0 +1,150 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace chai3d {
+	/* Receive statistics, since open() */
+	struct UdpStatistics {
+		unsigned long long datagrams;  // received
+		unsigned long long frames;  // handed to the decoder, in sequence order
+		unsigned long long lost;  // sequence numbers given up on
+		unsigned long long reordered;  // arrived out of order and put back in place
+		unsigned long long late;  // duplicates, or arrived after their place was given up
+		unsigned long long resyncs;  // restarts of the numbering followed (e.g. the ring rebooted)
+		unsigned long long malformed;  // not a sequence number and a frame
+		double meanBurst;  // datagrams per receive call that got any
+		double meanLatency;  // from the kernel receiving a datagram to its frame reaching the decoder [s]
+		double maxLatency;  // [s]
+		double jitter;  // standard deviation of the interval between datagrams [s]
+	};
+
+	/*
+	Transport policy (see UsartPipeline.h) for a ring that streams over Wi-Fi: each datagram is a sequence number
+	(4 bytes, little endian) followed by one frame exactly as the ring sends it on the serial link, so the same
+	decoder runs on both.
+
+	Datagrams are drained in bursts, one system call for up to BURST of them (recvmmsg() where the system has it,
+	non-blocking recvfrom() until empty otherwise), and stamped with their receive time: the kernel timestamp where
+	the system gives one (SO_TIMESTAMPNS), the time of the call otherwise. A frame whose predecessors are missing is
+	held back until they come or until WINDOW frames or HOLD seconds later; then the missing ones are counted as lost.
+	Duplicates and frames older than the last one delivered are dropped, unless the sender restarted its numbering (the
+	ring rebooted): after RESYNC_LATE such frames in a row, or at once for a jump of more than RESYNC_JUMP numbers either
+	way, the transport follows the new numbering. Commands (write()) go back to the address the last frame taken in came
+	from; the haptic thread updates it when the ring moves, under a sequence counter, while the command writer reads it.
+
+		UdpTransport transport(9750);
+		transport.open();
+		...transport.setDeadline(now + 0.0005); decoder.decode(transport, raw);
+	*/
+	class UdpTransport {
+	public:
+		static const int HEADER_SIZE = 4;  // sequence number
+		static const int FRAME_SIZE = 6 + 24;  // preamble and payload, see PreambleDecoder
+		static const int DATAGRAM_SIZE = HEADER_SIZE + FRAME_SIZE;
+		static const int BURST = 32;  // datagrams per receive call
+		static const int WINDOW = 8;  // frames held back behind a missing one, at most
+		static const double HOLD;  // time a frame is held back behind a missing one, at most [s]
+		static const int RESYNC_LATE = 16;  // late frames in a row that restart the numbering
+		static const unsigned int RESYNC_JUMP = 1024;  // a jump of more numbers restarts it at once
+
+	private:
+		struct Slot {
+			bool full;
+			double time;  // receive time, cPrecisionClock::getCPUTimeSeconds() time base
+			char frame[FRAME_SIZE];
+		};
+
+		unsigned short port;
+		unsigned long long socket;  // SOCKET / file descriptor, kept opaque so that this header needs no system headers
+		bool isOpen;
+		double deadline;  // reads give up at this time, wall time (cPrecisionClock::getCPUTimeSeconds())
+		long long clockBase;  // kernel timestamps -> cPrecisionClock time base: (seconds - clockBase) + clockOffset
+		double clockOffset;
+		unsigned char peer[128];  // sockaddr of the sender of the last frame taken in; read by the command writer
+		int peerLength;
+		std::atomic<unsigned int> peerSeq;  // 0: no sender yet; odd: the haptic thread is changing the peer
+
+		/* reordering: window[s % WINDOW] holds sequence s, for expected <= s < expected + WINDOW */
+		Slot window[WINDOW];
+		unsigned int expected;
+		unsigned int highest;  // highest sequence number received
+		bool synchronized;  // expected was set by a first datagram
+		int lateRun;  // late frames in a row
+
+		/* frames in order, being handed to the decoder */
+		std::vector<char> stream;
+		std::vector<double> streamTimes;  // receive time of each frame of the stream
+		size_t streamOffset;
+		double timestamp;  // receive time of the frame being read
+
+		/* statistics */
+		unsigned long long datagrams;
+		unsigned long long frames;
+		unsigned long long lost;
+		unsigned long long reordered;
+		unsigned long long late;
+		unsigned long long resyncs;
+		unsigned long long malformed;
+		unsigned long long bursts;
+		double latencySum;
+		double latencyMax;
+		double lastArrival;
+		unsigned long long intervals;
+		double intervalMean;
+		double intervalM2;
+
+		int receive();
+		bool accept(const char* datagram, int size, double time);
+		void setPeer(const void* address, int length);
+		void resync(unsigned int sequence);
+		void advance();
+		void deliver();
+		bool release(double now);
+		bool wait(double seconds);
+
+	public:
+		explicit UdpTransport(unsigned short a_port = 0);
+		~UdpTransport() { this->close(); }
+
+		/* Local port to listen on; set before open() */
+		void setPort(unsigned short a_port) { this->port = a_port; }
+		unsigned short getPort() const { return this->port; }
+
+		bool open();
+		bool close();
+		/* Up to nBytes of the frames received in order, 0 if none came before the deadline */
+		int read(int nBytes, char buffer[]);
+		/* To the sender of the last frame taken in; nothing is sent before a first one came. Command writer thread */
+		int write(int nBytes, const char buffer[]);
+		/* Bound the time spent in read() until the given time; by default reads wait forever */
+		void setDeadline(double time) { this->deadline = time; }
+
+		/* Receive time of the frame being read [s], cPrecisionClock::getCPUTimeSeconds() time base */
+		double getTimestamp() const { return this->timestamp; }
+
+		UdpStatistics getStatistics() const;
+		void printStatistics() const;
+
+		/* A datagram as the ring sends it: sequence number and frame of the three raw increments; returns its size */
+		static int makeDatagram(unsigned int sequence, const double raw[3], char datagram[DATAGRAM_SIZE]);
+	};
+
+	/* Sends datagrams to a UdpTransport, e.g. a ring simulator or a loopback test */
+	class UdpSender {
+	private:
+		unsigned long long socket;
+		unsigned char address[128];
+		int addressLength;
+		bool isOpen;
+
+	public:
+		UdpSender() : socket(0), addressLength(0), isOpen(false) {}
+		~UdpSender() { this->close(); }
+
+		/* host is a numeric IPv4 address, e.g. "127.0.0.1" */
+		bool open(const std::string& host, unsigned short port);
+		void close();
+		bool send(const char* datagram, int size);
+	};
+}
@@ -1,21 +1,42 @@
 ﻿#include "devices/CGenericHapticDevice.h"
 #include "math/CMaths.h"
 #include "UsartDevice.h"
+#include "DeviceManager.h"
 #include "libraries\Serial.h"
+#include "timers/CPrecisionClock.h"
+#include "Trace.h"
 #include <iostream>
+#include <sstream>
 
 namespace chai3d {
 
+	/* the velocity is the mean over this much of the pose history: a few packets, so one packet of noise does not make it jump [s] */
+	static const double VELOCITY_WINDOW = 0.01;
+
 	/*==================================================================*/
 	/* Constructor */
 	UsartDevice::UsartDevice(int device_port)
 		: cGenericHapticDevice(0),
+		pipeline(device_port),
 		port{ device_port },
-		serial{ Serial(device_port) },
-		origin(0.0065, 0.0, 0.0), 
-		angle(0.0, 0.0, 0.0)
+		timestamp(0.0),
+		commands(pipeline.transport),
+		clock(&SimulationClock::wallClock()),
+		replay(NULL),
+		replayStart(0.0),
+		broadcaster(NULL),
+		manager(NULL),
+		managedIndex(0),
+		managedTime(0.0)
 	{
+		/* the haptic thread reads the port while the command writer writes it: on a port opened for synchronous I/O
+		Windows runs one call at a time, and a write of up to 28 ms would hold up the next read */
+		this->pipeline.transport.getSerial().setOverlapped(true);
+		this->pipeline.position.set(0.0065, 0.0, 0.0);
 		this->rotation.identity();
+		this->velocity.zero();
+		this->requestedConfig = this->pipeline.config;
+		this->configBuffer.reset(this->pipeline.config);
 	}
 
 	/*==================================================================*/
@@ -28,140 +49,121 @@ namespace chai3d {
 	Our custom defined functions 
 	-----------------------------------**/
 	/*==================================================================*/
-	/* Smooth the given X, Y, Z values to a finite floating point precision */
-	static cVector3d filter_xyz(Eigen::Vector4d &xyz, const double resolution) {
-		int x = xyz.x() * resolution;
-		int y = xyz.y() * resolution;
-		int z = xyz.z() * resolution;
-
-		cVector3d output;
-		output.x((double)x / (resolution));
-		output.y((double)y / (resolution));
-		output.z((double)z / (resolution));
-		return output;
+	/* Set the configurable parameters */
+	void UsartDevice::config(double _angle_limit, double _zoom_limit, double _angle_scale, double _zoom_scale, double _filter_resolution, int _polarity_angle, int _polarity_zoom) {
+		RuntimeConfig config = this->requestedConfig;
+		config.angle_limit = _angle_limit;
+		config.zoom_limit = _zoom_limit;  //#TODO: set an appropriate zoom limit 
+		config.angle_scale = _angle_scale;
+		config.zoom_scale = _zoom_scale;
+		config.filter_resolution = _filter_resolution;
+		config.polarity_angle = _polarity_angle;
+		config.polarity_zoom = _polarity_zoom;
+
+		this->setConfig(config);
 	}
 
 	/*==================================================================*/
-	/* Set the configurable parameters */
-	void UsartDevice::config(double _angle_limit, double _zoom_limit, double _angle_scale, double _zoom_scale, double _filter_resolution, int _polarity_angle, int _polarity_zoom) {
-		this->angle_limit = _angle_limit;
-		this->zoom_limit = _zoom_limit;  //#TODO: set an appropriate zoom limit 
-		this->angle_scale = _angle_scale;
-		this->zoom_scale = _zoom_scale;
-		this->filter_resolution = _filter_resolution;
-		this->polarity_angle = _polarity_angle;
-		this->polarity_zoom = _polarity_zoom;
+	void UsartDevice::setManager(DeviceManager* a_manager, int index) {
+		this->manager = a_manager;
+		this->managedIndex = index;
+		if (a_manager != NULL) {
+			this->commands.setTransport(a_manager->getTransport(index));
+		}
+		else {
+			this->commands.setTransport(this->pipeline.transport);
+		}
+	}
+
+	/*==================================================================*/
+	/* Hand new parameters to the haptic thread */
+	void UsartDevice::setConfig(const RuntimeConfig& config) {
+		this->requestedConfig = config;
+		this->configBuffer.write() = config;
+		this->configBuffer.publish();
+	}
+
+	/*==================================================================*/
+	/* Haptic thread: switch to the newest parameters, if any were set since the last tick */
+	void UsartDevice::applyConfig() {
+		if (this->configBuffer.update()) {
+			// the polarity may have changed; the pipeline rebuilds the orientation from the accumulated angles
+			this->pipeline.configure(this->configBuffer.read());
+			this->updateDevice();
+		}
 	}
 	/*==================================================================*/
 	/* Updates device's position and orientation */
 	void UsartDevice::updateDevice() {
-		// reset origin
-		double zoom = this->angle.y()/this->zoom_scale;
-		this->origin.x(0.0); //s3 = s* + s; this is s.
-		this->origin.y(0.0);
-		this->origin.z(0.0);
-		
-		double theta1, theta2, s3;
-		theta1 = (this->angle.x())*this->polarity_angle;
-		theta2 = -this->angle.z()*this->polarity_angle;
-		s3 = zoom*this->polarity_zoom + this->pivotOffset;
-
-		if (abs(s3) > zoom_limit) {
-			if (s3 < -zoom_limit)
-				s3 = -zoom_limit;
-			else
-				s3 = zoom_limit;
-		}
-
-		this->origin.x(s3 - this->pivotOffset);
-		//s3 = 0.01;
-
-		/* Create Homogenous Transformation Matrix */
-		//Update Rotation Matrix
-		this->rotation.setExtrinsicEulerRotationDeg(0.0, theta2, theta1, C_EULER_ORDER_XZY);
-
-		Eigen::Matrix4d R(Eigen::Matrix4d::Identity());
-		R.block<3, 3>(0, 0) << this->rotation.eigen();
-		//HTM.block<4, 1>(0, 3) << s3*cos(theta2)*sin(theta1), s3*sin(theta1)*sin(theta2), s3*cos(theta2), 1.0;
-
-		Eigen::Matrix4d T(Eigen::Matrix4d::Identity());
-		T.block<4, 1>(0, 3) << s3, 0.0, 0.0, 1.0;
-
-		Eigen::Matrix4d invT(Eigen::Matrix4d::Identity());
-		invT.block<4, 1>(0, 3) << -s3, 0.0, 0.0, 1.0;
-		
-		Eigen::Matrix4d TRinvT(T * R * invT);
-	
-		//Update Position
-		Eigen::Vector4d originHomogenous(this->origin.x(), this->origin.y(), this->origin.z(), 1.0);
-		Eigen::Vector4d resultV4d(TRinvT * originHomogenous);
-		this->origin = filter_xyz(resultV4d, this->filter_resolution);
-		//std::cout << this->origin << std::endl;
+		TRACE_SCOPE("UsartDevice::updateDevice");
+		/* The orientation is integrated in getData(); here we only convert it to a rotation matrix.
+		The position is T * R * invT * (s3 - pivotOffset, 0, 0, 1) with T a translation of s3 along X,
+		see pivotPosition() for the closed form */
+		this->pipeline.update();
+		this->pipeline.getRotation(this->rotation);
+		//std::cout << this->pipeline.position << std::endl;
 	}
 
 	/*==================================================================*/
 	/* Read raw data via USART-USB interface and extracts the values from it and saves them so they can be used by other functions */
-	void UsartDevice::getData() {
-		if (m_deviceReady) {
-			/* read preamble (header) which is 0xAA 0xAA 0xAA 0xAA 0xAA 0xAA */
-			int count = 0;
-			while (count < 6) {
-				UINT8 byte = (UINT8)this->serial.readByte();
-				// printf("0x%X\n", byte);
-				if (byte == 0xAA) {
-					count++;
-				}
+	bool UsartDevice::getData() {
+		TRACE_SCOPE("UsartDevice::getData");
+		if (m_deviceReady && (this->replay != NULL)) {
+			/* the increments that take the device to the recorded angles, as the ring would have sent them */
+			double now = this->clock->now();
+			cVector3d angle;
+			if (!this->replay->next(now - this->replayStart, angle)) {
+				this->watchdog.check(now);
+				return false;
 			}
-
-			/* read 24 bytes (6 bytes per axis); Each 6 bytes represents one double; three axises X, Y, Z */
-			const int bytes_per_packet = 24;
-			UINT8 buffer[bytes_per_packet];
-			this->serial.read(bytes_per_packet, (char*)buffer);
-			/* extract X, Y, Z angles, and convert them to double */
-			double angle_x, angle_y, angle_z;
-			memcpy(&angle_x, buffer, 8);
-			memcpy(&angle_y, buffer + 8, 8);
-			memcpy(&angle_z, buffer + 16, 8);
-			/* scale angles */
-			angle_x /= this->angle_scale;
-			angle_y /= this->angle_scale;
-			angle_z /= this->angle_scale;
-
-			/* Save them to this object's member variables */
-			double temp_angle_x, temp_angle_y, temp_angle_z;
-			temp_angle_x = this->angle.x() + angle_x;
-			temp_angle_y = this->angle.y() + angle_y;
-			temp_angle_z = this->angle.z() + angle_z;
-
-			// clamping the incoming data in between angle limits
-			if (abs(temp_angle_x) > angle_limit) {
-				if (temp_angle_x < -angle_limit)
-					temp_angle_x = -angle_limit;
-				else
-					temp_angle_x = angle_limit;
+			double increments[3];
+			for (int k = 0; k < 3; k++) {
+				increments[k] = (angle(k) - this->pipeline.angle(k)) * this->pipeline.config.angle_scale;
 			}
-
-			if (abs(temp_angle_z) > angle_limit) {
-				if (temp_angle_z < -angle_limit)
-					temp_angle_z = -angle_limit;
-				else
-					temp_angle_z = angle_limit;
+			this->pipeline.feed(increments);
+			this->timestamp = now;
+			this->watchdog.feed(now);
+			return true;
+		}
+		if (m_deviceReady && (this->manager != NULL)) {
+			/* the manager thread decoded the packets; take the newest pose, if there is a new one, the way a replay does */
+			UsartPose pose;
+			if (!this->manager->getLatestPose(this->managedIndex, pose) || (pose.time <= this->managedTime)) {
+				this->watchdog.check(this->clock->now());
+				return false;
 			}
-
-			if (abs(temp_angle_y) > angle_limit) { // for zoom angle_y (x_axis in Chai3d)
-				if (temp_angle_y < -angle_limit)
-					temp_angle_y = -angle_limit;
-				else
-					temp_angle_y = angle_limit;
+			this->managedTime = pose.time;
+			double increments[3];
+			for (int k = 0; k < 3; k++) {
+				increments[k] = (pose.angle(k) - this->pipeline.angle(k)) * this->pipeline.config.angle_scale;
 			}
-
-			//this->angle.set(this->angle.x() + angle_x, this->angle.y() + angle_y, this->angle.z() + angle_z);
-			this->angle.set(temp_angle_x, temp_angle_y, temp_angle_z);
-
-			//this->angle.set(angle_x, angle_y, angle_z);
-			std::cout << this->angle << std::endl;  // print clamped and scaled angles
-			printf("%.2f, %.2f, %.2f\n\n", angle_x, angle_y, angle_z);  // print raw received angles
+			this->pipeline.feed(increments);
+			/* the manager stamps the poses in wall time */
+			this->timestamp = this->clock->isFixedStep() ? this->clock->now() : pose.time;
+			this->watchdog.feed(this->timestamp);
+			return true;
+		}
+		if (m_deviceReady) {
+			/* read the 0xAA preamble and the three doubles, then scale, clamp and accumulate them.
+			We never wait longer than the watchdog read timeout: a packet that is not complete yet is finished on a later tick.
+			The deadline is wall time, whatever the clock of the simulation */
+			double now = cPrecisionClock::getCPUTimeSeconds();
+			this->pipeline.transport.setDeadline(now + this->watchdog.getReadTimeout());
+			if (!this->pipeline.read()) {
+				this->watchdog.check(this->clock->now());
+				return false;
+			}
+			/* over UDP, the time the datagram was received rather than the time it was decoded */
+			if (this->pipeline.transport.isUdp() && !this->clock->isFixedStep()) {
+				this->timestamp = this->pipeline.transport.getUdp().getTimestamp();
+			}
+			else {
+				this->timestamp = this->clock->now();
+			}
+			this->watchdog.feed(this->timestamp);
+			return true;
 		}
+		return false;
 	}
 
 
@@ -173,12 +175,36 @@ namespace chai3d {
 	/*==================================================================*/
 	/* Open USART Connection */
 	bool UsartDevice::open() {
-		this->m_deviceReady = this->serial.open();
+		if (this->replay != NULL) {
+			this->replayStart = this->clock->now();
+			this->watchdog.start(this->replayStart);
+			this->m_deviceReady = true;
+			std::cout << std::endl << "Replaying a session instead of COM" << this->port << std::endl;
+			return true;
+		}
+		if (this->manager != NULL) {
+			this->m_deviceReady = this->manager->isServed(this->managedIndex);
+		}
+		else {
+			this->m_deviceReady = this->pipeline.transport.open();
+		}
+		std::ostringstream link;
+		if (this->manager != NULL) {
+			link << "COM" << this->port << " (device manager)";
+		}
+		else if (this->pipeline.transport.isUdp()) {
+			link << "UDP port " << this->pipeline.transport.getUdp().getPort();
+		}
+		else {
+			link << "COM" << this->port;
+		}
 		if (this->m_deviceReady) {
-			std::cout << std::endl << "Successfully opened device on COM" << this->port << std::endl;
+			this->watchdog.start(this->clock->now());
+			this->commands.start();
+			std::cout << std::endl << "Successfully opened device on " << link.str() << std::endl;
 		}
 		else {
-			std::cout << std::endl << "Failed to open device on COM" << this->port << "!" << std::endl;
+			std::cout << std::endl << "Failed to open device on " << link.str() << "!" << std::endl;
 		}
 		return this->m_deviceReady;
 	}
@@ -187,7 +213,29 @@ namespace chai3d {
 	/*==================================================================*/
 	/* Close USART Connection */
 	bool UsartDevice::close() {
-		if (this->serial.close()) {
+		if (this->replay != NULL) {
+			this->m_deviceReady = false;
+			return true;
+		}
+		/* release the scope and let the writer send what is queued. The haptic loop has ended by now,
+		so this thread is the only one sending commands */
+		if (this->m_deviceReady) {
+			this->commands.send(COMMAND_FORCE, 0.0, 0.0, 0.0);
+		}
+		this->commands.stop();
+
+		CommandStatistics statistics = this->commands.getStatistics();
+		std::cout << "Commands: " << statistics.queued << " queued, " << statistics.sent << " sent, "
+			<< statistics.coalesced << " coalesced, " << statistics.dropped << " dropped" << std::endl;
+		if (this->pipeline.transport.isUdp()) {
+			this->pipeline.transport.getUdp().printStatistics();
+		}
+
+		if (this->manager != NULL) {
+			this->m_deviceReady = false;  // the manager closes the port
+			return true;
+		}
+		if (this->pipeline.transport.close()) {
 			this->m_deviceReady = false;  // reset status to closed
 			return true;
 		}
@@ -219,18 +267,67 @@ namespace chai3d {
 		/* We call this function only here because cGenericTool::updateFromDevice calls getPosition first
 		so we read data from our USART device once, save the read values, and the other functions like getRotation just use those values */
 
-		this->getData();
-		this->updateDevice();
+		this->applyConfig();
+
+		/* Without a new packet (or while the device is stalled) we hold the last pose */
+		if (this->getData()) {
+			this->updateDevice();
+
+			/* save the new pose so other threads can look it up by time */
+			UsartPose pose;
+			pose.time = this->timestamp;
+			pose.angle = this->pipeline.angle;
+			pose.position = this->pipeline.position;
+			pose.rotation = this->rotation;
+			this->history.push(pose);
+			if (this->broadcaster != NULL) {
+				this->broadcaster->publish(pose);
+			}
+
+			/* difference with the pose a window earlier, in packet time; the first packets have no earlier pose yet */
+			UsartPose before;
+			if (this->history.sample(pose.time - VELOCITY_WINDOW, before) && (pose.time > before.time)) {
+				this->velocity = (pose.position - before.position) / (pose.time - before.time);
+			}
+			else {
+				this->velocity.zero();
+			}
+		}
+		else if (this->clock->now() - this->timestamp > VELOCITY_WINDOW) {
+			this->velocity.zero();  // no packet for a while: the scope is held still, or the device stalled
+		}
+
+		a_position.x(this->pipeline.position.x());
+		a_position.y(this->pipeline.position.y());
+		a_position.z(this->pipeline.position.z());
 
+		return m_deviceReady;
+	}
 
-		a_position.x(this->origin.x());
-		a_position.y(this->origin.y());
-		a_position.z(this->origin.z());
 
+	/*==================================================================*/
+	/* Velocity of the scope tip, estimated from the poses in getPosition(); cGenericTool::updateFromDevice calls this after getPosition */
+	bool UsartDevice::getLinearVelocity(cVector3d& a_linearVelocity) {
+		a_linearVelocity = this->velocity;
 		return m_deviceReady;
 	}
 
 
+	/*==================================================================*/
+	/* Send the force of the tool to the device; cGenericTool::applyToDevice calls this every haptic tick */
+	bool UsartDevice::setForceAndTorqueAndGripperForce(const cVector3d& a_force, const cVector3d& a_torque, double a_gripperForce) {
+		if (!m_deviceReady) {
+			return false;
+		}
+		if (this->replay != NULL) {
+			return true;  // nobody holds the scope
+		}
+		/* the queue never blocks; if the writer is behind, the command is counted as dropped and the next tick sends a newer one */
+		this->commands.send(COMMAND_FORCE, a_force.x(), a_force.y(), a_force.z());
+		return true;
+	}
+
+
 	/*==================================================================*/
 	/* Returns a structure containing information about our device and its capabilities */
 	cHapticDeviceInfo UsartDevice::getSpecifications() {
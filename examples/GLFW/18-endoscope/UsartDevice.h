@@ -1,7 +1,14 @@
 #pragma once
 #include "devices/CGenericHapticDevice.h"
 #include "math/CMaths.h"
-#include "libraries\Serial.h"
+#include "CommandChannel.h"
+#include "DeviceWatchdog.h"
+#include "PoseBroadcast.h"
+#include "PoseHistory.h"
+#include "SessionRecorder.h"
+#include "SimulationClock.h"
+#include "TripleBuffer.h"
+#include "UsartPipeline.h"
 
 namespace chai3d {
 	/*
@@ -29,29 +36,45 @@ namespace chai3d {
 
 	class UsartDevice;
 	typedef std::shared_ptr<UsartDevice> UsartDevicePtr;
+	class DeviceManager;
 
 	class UsartDevice : public cGenericHapticDevice {
 	private:
-		/* Calculation Parameters */
-		double pivotOffset = 0.01;  //#TODO: set the correct pivot offset
-		double angle_limit = 45.0;
-		double zoom_limit = 0.04;  //#TODO: set an appropriate zoom limit
-		double angle_scale = 15.0;
-		double zoom_scale = 750.0;
-		double filter_resolution = 10000.0;
-		int polarity_angle = 1;
-		int polarity_zoom = 1;
-		/* Variables related to our Serial communication over USART */
-		Serial serial;  // This class provides our USART-USB functionality
+		/* Serial transport, frame decoder, kinematics and filter (see UsartPipeline.h).
+		The pipeline also holds the calculation parameters (pipeline.config) and the device state:
+		pipeline.angle are the Gyroscope Rotation values received from our USART device,
+		pipeline.position is the position of the endoscope 3D model in the simulation (these values are very sensitive to small changes) */
+		RuntimeUsartPipeline pipeline;
+		/* New parameters on their way to the haptic thread. config()/setConfig() may be called from the UI while
+		the haptic loop runs: the haptic thread picks up the newest complete set at the start of a tick, without locks */
+		TripleBuffer<RuntimeConfig> configBuffer;
+		RuntimeConfig requestedConfig;  // last parameters passed to setConfig(); only used by the thread that sets them
 		int port;  // The port of our USART-USB device
-		/* Position and Rotation variables */
-		cVector3d angle;  // Gyroscope Rotation values. These are received from our USART device
-		cVector3d origin;  // position of the endoscope 3D model in the simulation (these values are very sensitive to small changes)
 		cMatrix3d rotation;  // Rotation Matrix
+		double timestamp;  // time at which the last packet was received [s]
+		cVector3d velocity;  // of the scope tip, over the last VELOCITY_WINDOW of poses [m/s]
+		/* Bounds the time the haptic thread waits for the device, and detects when the ring stops transmitting */
+		DeviceWatchdog watchdog;
+		/* Poses computed so far, so that other threads can ask where the scope was at a given time */
+		PoseHistory<> history;
+		/* Force, vibration and LED commands to the microcontroller, written by their own thread so the haptic loop never waits for the link */
+		CommandChannel<LinkTransport> commands;
+		/* Time of the packets and of the watchdog; the wall clock unless setClock() gave another */
+		const SimulationClock* clock;
+		/* When set, the angles come from this recorded session instead of the COM port */
+		SessionReplay* replay;
+		double replayStart;  // time open() started the replay [s]
+		/* When set, every pose also goes to the observer processes */
+		PoseBroadcaster* broadcaster;
+		/* When set, the manager reads the port and the device takes the newest pose from it */
+		DeviceManager* manager;
+		int managedIndex;  // of the device in the manager
+		double managedTime;  // manager time of the last pose taken [s]
 
 		/* Our own custom defined functions */
-		void getData();
+		bool getData();
 		void updateDevice();
+		void applyConfig();
 	
 	public:
 		UsartDevice(int port);
@@ -62,10 +85,43 @@ namespace chai3d {
 		bool close();
 		bool getRotation(cMatrix3d& a_rotation);
 		bool getPosition(cVector3d& a_position);
+		bool getLinearVelocity(cVector3d& a_linearVelocity);
+		bool setForceAndTorqueAndGripperForce(const cVector3d& a_force, const cVector3d& a_torque, double a_gripperForce);
 		cHapticDeviceInfo getSpecifications();
 		// this functions is used to create an instance of this class and return a shared pointer to that instance
 		static UsartDevicePtr create(int port = 0) { return (std::make_shared<UsartDevice>(port)); }
+		/* Pose history; time is in seconds, time of the device's SimulationClock (see setClock()) */
+		bool getPoseAt(double time, UsartPose& pose) const { return this->history.sample(time, pose); }
+		bool getLatestPose(UsartPose& pose) const { return this->history.latest(pose); }
+		/* The clock of the simulation (see SimulationClock.h), for the pose times and the watchdog. Set before open() */
+		void setClock(const SimulationClock* a_clock) { this->clock = a_clock; }
+		/* Play a recorded session back instead of reading the COM port: the device follows the recorded angles, in the
+		time of its clock, through the same kinematics and filter, and sends no commands. Set before open() */
+		void setReplay(SessionReplay* a_replay) { this->replay = a_replay; }
+		/* Publish the poses to other processes as well (see PoseBroadcast.h); the broadcaster must be open. Set before open() */
+		void setBroadcaster(PoseBroadcaster* a_broadcaster) { this->broadcaster = a_broadcaster; }
+		/* Let the manager read the port (see DeviceManager.h): index is what DeviceManager::add() returned for this port.
+		The haptic tick then takes the newest pose instead of reading, and the commands go out on the manager's port.
+		The angles come scaled and clamped with the manager's parameters. Set before open(); the manager opens the port */
+		void setManager(DeviceManager* a_manager, int index);
+		/* Receive the ring's datagrams on this UDP port instead of reading the COM port (0: the COM port). Set before open() */
+		void setUdpPort(unsigned short a_port) { this->pipeline.transport.setUdpPort(a_port); }
+		UdpStatistics getUdpStatistics() const { return this->pipeline.transport.getUdp().getStatistics(); }
 		void config(double angle_limit, double zoom_limit, double angle_scale, double zoom_scale, double filter_resolution, int polarity_angle, int polarity_zoom);
+		/* Change the parameters, also while the simulation runs. Call from one thread only (e.g. the main/UI thread) */
+		void setConfig(const RuntimeConfig& config);
+		RuntimeConfig getConfig() const { return this->requestedConfig; }
+		/* Haptic thread: the parameters the ticks use, the newest set picked up by the last tick */
+		RuntimeConfig getActiveConfig() const { return this->pipeline.config; }
+		/* Watchdog: readTimeout is the longest the haptic thread may wait for data per tick, stallTimeout the time
+		without any packet after which the device is reported stalled (seconds). Set before the simulation starts */
+		void setTimeouts(double readTimeout, double stallTimeout) { this->watchdog.setTimeouts(readTimeout, stallTimeout); }
+		bool isStalled() const { return this->watchdog.isStalled(); }
+		const DeviceWatchdog& getWatchdog() const { return this->watchdog; }
+		/* Commands to the device. Like the force, call them from the haptic thread: the command queue has a single producer */
+		bool setVibration(double amplitude, double frequency) { return this->m_deviceReady && (this->replay == NULL) && this->commands.send(COMMAND_VIBRATION, amplitude, frequency, 0.0); }
+		bool setLed(double red, double green, double blue) { return this->m_deviceReady && (this->replay == NULL) && this->commands.send(COMMAND_LED, red, green, blue); }
+		CommandStatistics getCommandStatistics() const { return this->commands.getStatistics(); }
 
 	};
 }
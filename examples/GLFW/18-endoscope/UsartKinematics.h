@@ -0,0 +1,91 @@
+#pragma once
+#include "math/CMaths.h"
+#include "math/CQuaternion.h"
+
+namespace chai3d {
+	/*
+	Kinematics of the endoscope around its pivot point.
+
+	The scope orientation is R = Ry(theta1) * Rz(theta2), which is what
+	setExtrinsicEulerRotationDeg(0.0, theta2, theta1, C_EULER_ORDER_XZY) builds.
+	Instead of rebuilding R from the accumulated angles at every tick, we keep it as a unit quaternion
+	and integrate the angle increments directly:
+		theta1 += d1  ->  q = qy(d1) * q   (extrinsic, about the fixed Y axis)
+		theta2 += d2  ->  q = q * qz(d2)   (intrinsic, about the rotated Z axis)
+	Both products are exact, so the quaternion stays equal to the Euler rotation (up to rounding).
+	*/
+
+	/* q = qy(angle) * q; angle in degrees */
+	inline void rotateExtrinsicY(cQuaternion& q, double angleDeg) {
+		if (angleDeg == 0.0) return;
+		double half = 0.5 * cDegToRad(angleDeg);
+		double c = cos(half), s = sin(half);
+		double w = c * q.w - s * q.y;
+		double x = c * q.x + s * q.z;
+		double y = c * q.y + s * q.w;
+		double z = c * q.z - s * q.x;
+		q.w = w; q.x = x; q.y = y; q.z = z;
+	}
+
+	/* q = q * qz(angle); angle in degrees */
+	inline void rotateIntrinsicZ(cQuaternion& q, double angleDeg) {
+		if (angleDeg == 0.0) return;
+		double half = 0.5 * cDegToRad(angleDeg);
+		double c = cos(half), s = sin(half);
+		double w = c * q.w - s * q.z;
+		double x = c * q.x + s * q.y;
+		double y = c * q.y - s * q.x;
+		double z = c * q.z + s * q.w;
+		q.w = w; q.x = x; q.y = y; q.z = z;
+	}
+
+	/* Orientation for absolute pivot angles (degrees). Used to (re)seed the incremental quaternion */
+	inline cQuaternion pivotOrientation(double theta1Deg, double theta2Deg) {
+		cQuaternion q(1.0, 0.0, 0.0, 0.0);
+		rotateIntrinsicZ(q, theta2Deg);
+		rotateExtrinsicY(q, theta1Deg);
+		return q;
+	}
+
+	/* Rotation matrix of a unit quaternion */
+	inline void pivotRotation(const cQuaternion& q, cMatrix3d& R) {
+		double xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		double xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		double wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+		R.set(1.0 - 2.0 * (yy + zz), 2.0 * (xy - wz), 2.0 * (xz + wy),
+			  2.0 * (xy + wz), 1.0 - 2.0 * (xx + zz), 2.0 * (yz - wx),
+			  2.0 * (xz - wy), 2.0 * (yz + wx), 1.0 - 2.0 * (xx + yy));
+	}
+
+	/* Closed form of T * R * invT * (s3 - pivotOffset, 0, 0, 1), T being a translation of s3 along X:
+	only the first column of R is needed */
+	inline cVector3d pivotPosition(const cQuaternion& q, double s3, double pivotOffset) {
+		double r00 = 1.0 - 2.0 * (q.y * q.y + q.z * q.z);
+		double r10 = 2.0 * (q.x * q.y + q.w * q.z);
+		double r20 = 2.0 * (q.x * q.z - q.w * q.y);
+		return cVector3d(s3 - pivotOffset * r00, -pivotOffset * r10, -pivotOffset * r20);
+	}
+
+	/* Pivot extension s3 = zoom + pivotOffset, clamped to +/- zoomLimit; zoom already includes the zoom polarity */
+	inline double pivotExtension(double zoom, double pivotOffset, double zoomLimit) {
+		double s3 = zoom + pivotOffset;
+		if (s3 < -zoomLimit) return -zoomLimit;
+		if (s3 > zoomLimit) return zoomLimit;
+		return s3;
+	}
+
+	/* Truncate a value to the filter resolution (same as the int conversion of filter_xyz) */
+	inline double quantize(double value, double resolution) {
+		int v = value * resolution;
+		return (double)v / resolution;
+	}
+
+	/* Keep q a unit quaternion despite rounding errors of the incremental updates */
+	inline void renormalize(cQuaternion& q) {
+		double n = q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z;
+		if (n > 0.0) {
+			n = 1.0 / sqrt(n);
+			q.w *= n; q.x *= n; q.y *= n; q.z *= n;
+		}
+	}
+}
@@ -0,0 +1,188 @@
+#include "UsartKinematicsBatch.h"
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define BATCH_SIMD_WIDTH 4
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define BATCH_SIMD_WIDTH 2
+#endif
+
+namespace chai3d {
+
+	static const double DEG2RAD = 0.017453292519943295;
+
+	/* below this many samples per thread, starting threads costs more than it saves */
+	static const size_t MIN_SAMPLES_PER_THREAD = 8192;
+
+	/*==================================================================*/
+	/* One sample, scalar */
+	static inline void pivotSample(const PivotParams& params, double theta1, double theta2, double zoom, double& x, double& y, double& z) {
+		double s3 = zoom + params.pivotOffset;
+		if (s3 < -params.zoomLimit) s3 = -params.zoomLimit;
+		if (s3 > params.zoomLimit) s3 = params.zoomLimit;
+
+		double a1 = theta1 * DEG2RAD;
+		double a2 = theta2 * DEG2RAD;
+		double c1 = cos(a1), s1 = sin(a1);
+		double c2 = cos(a2), s2 = sin(a2);
+
+		int qx = (s3 - params.pivotOffset * (c1 * c2)) * params.filterResolution;
+		int qy = (-params.pivotOffset * s2) * params.filterResolution;
+		int qz = (params.pivotOffset * (s1 * c2)) * params.filterResolution;
+		x = (double)qx / params.filterResolution;
+		y = (double)qy / params.filterResolution;
+		z = (double)qz / params.filterResolution;
+	}
+
+	/*==================================================================*/
+	/* Scalar reference path */
+	void computePivotPositionsScalar(const PivotParams& params, const double* theta1, const double* theta2, const double* zoom,
+		double* x, double* y, double* z, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			pivotSample(params, theta1[i], theta2[i], zoom[i], x[i], y[i], z[i]);
+		}
+	}
+
+#if defined(BATCH_SIMD_WIDTH)
+	/*==================================================================*/
+	/* Thin wrappers so the kernel reads the same for AVX and SSE2 */
+#if BATCH_SIMD_WIDTH == 4
+	typedef __m256d vdouble;
+	static inline vdouble vset(double a) { return _mm256_set1_pd(a); }
+	static inline vdouble vload(const double* p) { return _mm256_loadu_pd(p); }
+	static inline void vstore(double* p, vdouble a) { _mm256_storeu_pd(p, a); }
+	static inline vdouble vadd(vdouble a, vdouble b) { return _mm256_add_pd(a, b); }
+	static inline vdouble vsub(vdouble a, vdouble b) { return _mm256_sub_pd(a, b); }
+	static inline vdouble vmul(vdouble a, vdouble b) { return _mm256_mul_pd(a, b); }
+	static inline vdouble vdiv(vdouble a, vdouble b) { return _mm256_div_pd(a, b); }
+	static inline vdouble vmin(vdouble a, vdouble b) { return _mm256_min_pd(a, b); }
+	static inline vdouble vmax(vdouble a, vdouble b) { return _mm256_max_pd(a, b); }
+	static inline vdouble vabs(vdouble a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+	static inline vdouble vtrunc(vdouble a) { return _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(a)); }  // same as the int conversion
+	static inline bool vanygreater(vdouble a, vdouble b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ)) != 0; }
+#else
+	typedef __m128d vdouble;
+	static inline vdouble vset(double a) { return _mm_set1_pd(a); }
+	static inline vdouble vload(const double* p) { return _mm_loadu_pd(p); }
+	static inline void vstore(double* p, vdouble a) { _mm_storeu_pd(p, a); }
+	static inline vdouble vadd(vdouble a, vdouble b) { return _mm_add_pd(a, b); }
+	static inline vdouble vsub(vdouble a, vdouble b) { return _mm_sub_pd(a, b); }
+	static inline vdouble vmul(vdouble a, vdouble b) { return _mm_mul_pd(a, b); }
+	static inline vdouble vdiv(vdouble a, vdouble b) { return _mm_div_pd(a, b); }
+	static inline vdouble vmin(vdouble a, vdouble b) { return _mm_min_pd(a, b); }
+	static inline vdouble vmax(vdouble a, vdouble b) { return _mm_max_pd(a, b); }
+	static inline vdouble vabs(vdouble a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+	static inline vdouble vtrunc(vdouble a) { return _mm_cvtepi32_pd(_mm_cvttpd_epi32(a)); }  // same as the int conversion
+	static inline bool vanygreater(vdouble a, vdouble b) { return _mm_movemask_pd(_mm_cmpgt_pd(a, b)) != 0; }
+#endif
+
+	/*==================================================================*/
+	/* sin and cos for |a| <= pi/4 (Taylor series, truncation error below 1e-16 on that range) */
+	static inline void vsincos(vdouble a, vdouble& s, vdouble& c) {
+		vdouble a2 = vmul(a, a);
+
+		vdouble ps = vset(-1.0 / 1307674368000.0);
+		ps = vadd(vmul(ps, a2), vset(1.0 / 6227020800.0));
+		ps = vadd(vmul(ps, a2), vset(-1.0 / 39916800.0));
+		ps = vadd(vmul(ps, a2), vset(1.0 / 362880.0));
+		ps = vadd(vmul(ps, a2), vset(-1.0 / 5040.0));
+		ps = vadd(vmul(ps, a2), vset(1.0 / 120.0));
+		ps = vadd(vmul(ps, a2), vset(-1.0 / 6.0));
+		s = vadd(a, vmul(vmul(ps, a2), a));
+
+		vdouble pc = vset(1.0 / 20922789888000.0);
+		pc = vadd(vmul(pc, a2), vset(-1.0 / 87178291200.0));
+		pc = vadd(vmul(pc, a2), vset(1.0 / 479001600.0));
+		pc = vadd(vmul(pc, a2), vset(-1.0 / 3628800.0));
+		pc = vadd(vmul(pc, a2), vset(1.0 / 40320.0));
+		pc = vadd(vmul(pc, a2), vset(-1.0 / 720.0));
+		pc = vadd(vmul(pc, a2), vset(1.0 / 24.0));
+		pc = vadd(vmul(pc, a2), vset(-0.5));
+		c = vadd(vset(1.0), vmul(pc, a2));
+	}
+
+	/*==================================================================*/
+	/* Vectorised path on one contiguous range */
+	static void computeRange(const PivotParams& params, const double* theta1, const double* theta2, const double* zoom,
+		double* x, double* y, double* z, size_t count) {
+		const vdouble deg2rad = vset(DEG2RAD);
+		const vdouble offset = vset(params.pivotOffset);
+		const vdouble negOffset = vset(-params.pivotOffset);
+		const vdouble lo = vset(-params.zoomLimit);
+		const vdouble hi = vset(params.zoomLimit);
+		const vdouble resolution = vset(params.filterResolution);
+		const vdouble domain = vset(0.25 * 3.14159265358979323846);
+
+		size_t i = 0;
+		for (; i + BATCH_SIMD_WIDTH <= count; i += BATCH_SIMD_WIDTH) {
+			vdouble a1 = vmul(vload(theta1 + i), deg2rad);
+			vdouble a2 = vmul(vload(theta2 + i), deg2rad);
+			if (vanygreater(vmax(vabs(a1), vabs(a2)), domain)) {
+				/* outside of the polynomial range */
+				computePivotPositionsScalar(params, theta1 + i, theta2 + i, zoom + i, x + i, y + i, z + i, BATCH_SIMD_WIDTH);
+				continue;
+			}
+
+			vdouble s3 = vmin(vmax(vadd(vload(zoom + i), offset), lo), hi);
+
+			vdouble s1, c1, s2, c2;
+			vsincos(a1, s1, c1);
+			vsincos(a2, s2, c2);
+
+			vdouble px = vsub(s3, vmul(offset, vmul(c1, c2)));
+			vdouble py = vmul(negOffset, s2);
+			vdouble pz = vmul(offset, vmul(s1, c2));
+
+			vstore(x + i, vdiv(vtrunc(vmul(px, resolution)), resolution));
+			vstore(y + i, vdiv(vtrunc(vmul(py, resolution)), resolution));
+			vstore(z + i, vdiv(vtrunc(vmul(pz, resolution)), resolution));
+		}
+
+		/* remaining samples */
+		computePivotPositionsScalar(params, theta1 + i, theta2 + i, zoom + i, x + i, y + i, z + i, count - i);
+	}
+#else
+	static void computeRange(const PivotParams& params, const double* theta1, const double* theta2, const double* zoom,
+		double* x, double* y, double* z, size_t count) {
+		computePivotPositionsScalar(params, theta1, theta2, zoom, x, y, z, count);
+	}
+#endif
+
+	/*==================================================================*/
+	/* Vectorised path, split over several threads */
+	void computePivotPositions(const PivotParams& params, const double* theta1, const double* theta2, const double* zoom,
+		double* x, double* y, double* z, size_t count, unsigned int threads) {
+		if (threads == 0) {
+			threads = std::thread::hardware_concurrency();
+		}
+		size_t maxThreads = count / MIN_SAMPLES_PER_THREAD;
+		if (threads > maxThreads) {
+			threads = (unsigned int)maxThreads;
+		}
+		if (threads <= 1) {
+			computeRange(params, theta1, theta2, zoom, x, y, z, count);
+			return;
+		}
+
+		/* contiguous chunks, the calling thread takes the last one */
+		size_t chunk = (count + threads - 1) / threads;
+		std::vector<std::thread> workers;
+		workers.reserve(threads - 1);
+		for (unsigned int t = 0; t + 1 < threads; t++) {
+			size_t begin = t * chunk;
+			workers.push_back(std::thread(computeRange, std::cref(params), theta1 + begin, theta2 + begin, zoom + begin,
+				x + begin, y + begin, z + begin, chunk));
+		}
+		size_t begin = (threads - 1) * chunk;
+		computeRange(params, theta1 + begin, theta2 + begin, zoom + begin, x + begin, y + begin, z + begin, count - begin);
+
+		for (size_t t = 0; t < workers.size(); t++) {
+			workers[t].join();
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+
+namespace chai3d {
+	/*
+	Stateless batch version of the UsartDevice kinematics, for offline replays and analytics.
+
+	Samples are given as a structure of arrays:
+		theta1[i]  rotation about Y in degrees (angle.x * polarity_angle)
+		theta2[i]  rotation about Z in degrees (-angle.z * polarity_angle)
+		zoom[i]    signed zoom in meters (angle.y / zoom_scale * polarity_zoom)
+	and produce the quantised position of the scope, like UsartDevice::updateDevice():
+		s3 = clamp(zoom + pivotOffset, +/- zoomLimit)
+		p  = (s3 - pivotOffset * cos(theta1) * cos(theta2), -pivotOffset * sin(theta2), pivotOffset * sin(theta1) * cos(theta2))
+
+	The vectorised path (AVX or SSE2, whatever the compiler targets) evaluates sin/cos with a polynomial
+	that is accurate to ~1e-16 for |theta| <= 45 degrees, which is the default angle limit. Blocks with larger
+	angles go through the scalar path. Results match the scalar path to within one filter quantum
+	(the truncation can flip on a rounding difference), and most of the time bit for bit.
+	*/
+
+	struct PivotParams {
+		double pivotOffset;
+		double zoomLimit;
+		double filterResolution;
+	};
+
+	/* Scalar reference path */
+	void computePivotPositionsScalar(const PivotParams& params, const double* theta1, const double* theta2, const double* zoom,
+		double* x, double* y, double* z, size_t count);
+
+	/* Vectorised path, split over 'threads' worker threads (0 = one per hardware thread) */
+	void computePivotPositions(const PivotParams& params, const double* theta1, const double* theta2, const double* zoom,
+		double* x, double* y, double* z, size_t count, unsigned int threads = 0);
+}
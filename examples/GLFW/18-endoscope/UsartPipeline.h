@@ -0,0 +1,302 @@
+#pragma once
+#include "math/CMaths.h"
+#include "libraries\Serial.h"
+#include "UdpTransport.h"
+#include "UsartKinematics.h"
+#include <cstring>
+
+namespace chai3d {
+	/*
+	Device pipeline of the USART endoscope, split in stages that are chosen at compile time:
+
+		Transport   where the bytes come from            bool open(); bool close(); int read(int nBytes, char buffer[]);
+		                                                  (read returns up to nBytes, 0 if no data is available now)
+		            and go to                             int write(int nBytes, const char buffer[]); (see CommandChannel.h)
+		Decoder     bytes -> raw gyro increments          template <class T> bool decode(T& transport, double raw[3]);
+		                                                  (resumable: a packet may arrive over several calls)
+		Kinematics  increments -> angles, pose            integrate(config, raw, angle, orientation); position(config, angle, orientation)
+		Filter      smoothing of the position             template <class C> static cVector3d apply(const C& config, const cVector3d& position);
+		Config      the calculation parameters            pivotOffset, angle_limit, zoom_limit, angle_scale, zoom_scale,
+		                                                  filter_resolution, polarity_angle, polarity_zoom
+
+	Config can be RuntimeConfig (plain members, what UsartDevice uses so the parameters can be entered at startup)
+	or a StaticConfig<...>, whose parameters are compile-time constants: then the clamps, polarities and
+	scales of the hot path are folded by the compiler instead of being branched on at every tick.
+	*/
+
+	/*==================================================================*/
+	/* Transport policies */
+
+	/* USART-USB link (Windows COM port) */
+	class SerialTransport {
+	private:
+		Serial serial;
+		int port;
+		double deadline;  // reads give up at this time, wall time (cPrecisionClock::getCPUTimeSeconds())
+	public:
+		explicit SerialTransport(int port) : serial(port), port(port), deadline(1.0e300) {}
+		bool open() { return this->serial.open(); }
+		bool close() { return this->serial.close(); }
+		int read(int nBytes, char buffer[]) { return this->serial.readSome(nBytes, buffer, this->deadline); }
+		int write(int nBytes, const char buffer[]) { return this->serial.write(nBytes, buffer); }
+		int getPort() const { return this->port; }
+		Serial& getSerial() { return this->serial; }
+		/* Bound the time spent in read() until the given time; by default reads wait forever */
+		void setDeadline(double time) { this->deadline = time; }
+	};
+
+	/* Bytes already in memory, e.g. a capture of the serial stream being replayed. The buffer is not owned */
+	class BufferTransport {
+	private:
+		const char* data;
+		size_t size;
+		size_t offset;
+	public:
+		BufferTransport(const char* data, size_t size) : data(data), size(size), offset(0) {}
+		bool open() { this->offset = 0; return true; }
+		bool close() { return true; }
+		int read(int nBytes, char buffer[]) {
+			if (this->offset + nBytes > this->size) {
+				nBytes = (int)(this->size - this->offset);  // end of the capture
+			}
+			memcpy(buffer, this->data + this->offset, nBytes);
+			this->offset += nBytes;
+			return nBytes;
+		}
+		/* commands to the device are discarded */
+		int write(int nBytes, const char buffer[]) { return nBytes; }
+	};
+
+	/* The COM port, or UDP datagrams when a UDP port was given (the ring streaming over Wi-Fi, see UdpTransport.h).
+	Chosen at startup, so a branch per call rather than a template parameter */
+	class LinkTransport {
+	private:
+		SerialTransport serial;
+		UdpTransport udp;
+		bool useUdp;
+	public:
+		explicit LinkTransport(int port) : serial(port), udp(0), useUdp(false) {}
+		/* Receive on this UDP port instead of the COM port; 0 goes back to the COM port. Set before open() */
+		void setUdpPort(unsigned short port) { this->udp.setPort(port); this->useUdp = (port != 0); }
+		bool isUdp() const { return this->useUdp; }
+		bool open() { return this->useUdp ? this->udp.open() : this->serial.open(); }
+		bool close() { return this->useUdp ? this->udp.close() : this->serial.close(); }
+		int read(int nBytes, char buffer[]) { return this->useUdp ? this->udp.read(nBytes, buffer) : this->serial.read(nBytes, buffer); }
+		int write(int nBytes, const char buffer[]) { return this->useUdp ? this->udp.write(nBytes, buffer) : this->serial.write(nBytes, buffer); }
+		void setDeadline(double time) { this->serial.setDeadline(time); this->udp.setDeadline(time); }
+		int getPort() const { return this->serial.getPort(); }
+		Serial& getSerial() { return this->serial.getSerial(); }
+		UdpTransport& getUdp() { return this->udp; }
+		const UdpTransport& getUdp() const { return this->udp; }
+	};
+
+	/*==================================================================*/
+	/* Decoder policies */
+
+	/* Preamble 0xAA 0xAA 0xAA 0xAA 0xAA 0xAA, then 24 bytes: three doubles, the X, Y, Z gyro increments.
+	When the transport runs out of data in the middle of a packet, the decoder keeps what it has and continues on the next call */
+	class PreambleDecoder {
+	public:
+		static const int preamble_length = 6;
+		static const int payload_length = 24;
+
+	private:
+		int count;  // preamble bytes seen
+		int received;  // payload bytes received
+		UINT8 buffer[payload_length];
+
+	public:
+		PreambleDecoder() : count(0), received(0) {}
+
+		template <class Transport>
+		bool decode(Transport& transport, double raw[3]) {
+			/* read preamble (header) */
+			while (this->count < preamble_length) {
+				char byte;
+				if (transport.read(1, &byte) <= 0) {
+					return false;
+				}
+				if ((UINT8)byte == 0xAA) {
+					this->count++;
+				}
+			}
+
+			/* read 24 bytes (8 bytes per axis); Each 8 bytes represents one double; three axises X, Y, Z */
+			while (this->received < payload_length) {
+				int n = transport.read(payload_length - this->received, (char*)this->buffer + this->received);
+				if (n <= 0) {
+					return false;
+				}
+				this->received += n;
+			}
+			memcpy(&raw[0], this->buffer, 8);
+			memcpy(&raw[1], this->buffer + 8, 8);
+			memcpy(&raw[2], this->buffer + 16, 8);
+
+			this->count = 0;
+			this->received = 0;
+			return true;
+		}
+	};
+
+	/*==================================================================*/
+	/* Config policies */
+
+	/* Parameters set at runtime (UsartDevice::config) */
+	struct RuntimeConfig {
+		double pivotOffset = 0.01;  //#TODO: set the correct pivot offset
+		double angle_limit = 45.0;
+		double zoom_limit = 0.04;  //#TODO: set an appropriate zoom limit
+		double angle_scale = 15.0;
+		double zoom_scale = 750.0;
+		double filter_resolution = 10000.0;
+		int polarity_angle = 1;
+		int polarity_zoom = 1;
+	};
+
+	/* Parameters fixed at compile time. Lengths are given in micrometers since template arguments must be integers */
+	template <int ANGLE_LIMIT, int ZOOM_LIMIT_UM, int ANGLE_SCALE, int ZOOM_SCALE, int FILTER_RESOLUTION,
+		int POLARITY_ANGLE, int POLARITY_ZOOM, int PIVOT_OFFSET_UM = 10000>
+	struct StaticConfig {
+		static constexpr double pivotOffset = PIVOT_OFFSET_UM * 1.0e-6;
+		static constexpr double angle_limit = ANGLE_LIMIT;
+		static constexpr double zoom_limit = ZOOM_LIMIT_UM * 1.0e-6;
+		static constexpr double angle_scale = ANGLE_SCALE;
+		static constexpr double zoom_scale = ZOOM_SCALE;
+		static constexpr double filter_resolution = FILTER_RESOLUTION;
+		static constexpr int polarity_angle = POLARITY_ANGLE;
+		static constexpr int polarity_zoom = POLARITY_ZOOM;
+	};
+
+	/* The parameters 18-endoscope uses with the default answers at startup */
+	typedef StaticConfig<45, 40000, 15, 10000, 20000, -1, -1> DefaultStaticConfig;
+
+	/*==================================================================*/
+	/* Kinematics policies */
+
+	/* Endoscope rotating around a pivot point, zoom along its axis (see UsartKinematics.h) */
+	struct PivotKinematics {
+		/* takes the limit by value so that constexpr limits are never bound to a reference */
+		static double clampAngle(double value, double limit) {
+			if (value < -limit) return -limit;
+			if (value > limit) return limit;
+			return value;
+		}
+
+		/* Scale the raw increments, accumulate and clamp them, and integrate the orientation */
+		template <class Config>
+		static void integrate(const Config& config, const double raw[3], cVector3d& angle, cQuaternion& orientation) {
+			double angle_x = raw[0] / config.angle_scale;
+			double angle_y = raw[1] / config.angle_scale;
+			double angle_z = raw[2] / config.angle_scale;
+
+			// clamping the incoming data in between angle limits (angle_y is the zoom, x axis in Chai3d)
+			double temp_angle_x = clampAngle(angle.x() + angle_x, config.angle_limit);
+			double temp_angle_y = clampAngle(angle.y() + angle_y, config.angle_limit);
+			double temp_angle_z = clampAngle(angle.z() + angle_z, config.angle_limit);
+
+			/* integrate the (clamped) increments into the orientation: theta1 = angle.x, theta2 = -angle.z (times polarity) */
+			rotateExtrinsicY(orientation, (temp_angle_x - angle.x())*config.polarity_angle);
+			rotateIntrinsicZ(orientation, -(temp_angle_z - angle.z())*config.polarity_angle);
+			renormalize(orientation);
+
+			angle.set(temp_angle_x, temp_angle_y, temp_angle_z);
+		}
+
+		/* Orientation matching the accumulated angles, used when the polarity changes */
+		template <class Config>
+		static cQuaternion orientation(const Config& config, const cVector3d& angle) {
+			return pivotOrientation(angle.x()*config.polarity_angle, -angle.z()*config.polarity_angle);
+		}
+
+		/* Position of the scope, T * R * invT * (s3 - pivotOffset, 0, 0, 1) */
+		template <class Config>
+		static cVector3d position(const Config& config, const cVector3d& angle, const cQuaternion& orientation) {
+			double zoom = angle.y() / config.zoom_scale;
+			double s3 = pivotExtension(zoom*config.polarity_zoom, config.pivotOffset, config.zoom_limit);
+			return pivotPosition(orientation, s3, config.pivotOffset);
+		}
+	};
+
+	/*==================================================================*/
+	/* Filter policies */
+
+	/* Smooth the given X, Y, Z values to a finite floating point precision */
+	struct QuantizeFilter {
+		template <class Config>
+		static cVector3d apply(const Config& config, const cVector3d& position) {
+			return cVector3d(quantize(position.x(), config.filter_resolution),
+							 quantize(position.y(), config.filter_resolution),
+							 quantize(position.z(), config.filter_resolution));
+		}
+	};
+
+	/* No smoothing */
+	struct NoFilter {
+		template <class Config>
+		static cVector3d apply(const Config& config, const cVector3d& position) {
+			return position;
+		}
+	};
+
+	/*==================================================================*/
+	/* The pipeline: owns the transport and the device state */
+	template <class Transport, class Decoder, class Kinematics, class Filter, class Config>
+	class UsartPipeline {
+	public:
+		Transport transport;
+		Decoder decoder;
+		Config config;
+		cVector3d angle;  // accumulated, scaled and clamped gyro angles
+		cQuaternion orientation;  // orientation integrated from the angle increments
+		cVector3d position;  // filtered position of the scope
+		double raw[3];  // last raw increments received
+
+		template <class TransportArg>
+		explicit UsartPipeline(TransportArg transportArg)
+			: transport(transportArg),
+			angle(0.0, 0.0, 0.0),
+			orientation(1.0, 0.0, 0.0, 0.0),
+			position(0.0, 0.0, 0.0)
+		{
+			raw[0] = raw[1] = raw[2] = 0.0;
+		}
+
+		/* Set the parameters and rebuild the orientation, since the polarity may have changed */
+		void configure(const Config& _config) {
+			this->config = _config;
+			this->orientation = Kinematics::orientation(this->config, this->angle);
+		}
+
+		/* Read and decode one packet, and integrate it. Returns false if no complete packet is available yet */
+		bool read() {
+			if (!this->decoder.decode(this->transport, this->raw)) {
+				return false;
+			}
+			Kinematics::integrate(this->config, this->raw, this->angle, this->orientation);
+			return true;
+		}
+
+		/* Integrate increments that did not come through the transport (e.g. a replayed session) */
+		void feed(const double increments[3]) {
+			memcpy(this->raw, increments, sizeof(this->raw));
+			Kinematics::integrate(this->config, this->raw, this->angle, this->orientation);
+		}
+
+		/* Update the position from the current state */
+		void update() {
+			this->position = Filter::apply(this->config, Kinematics::position(this->config, this->angle, this->orientation));
+		}
+
+		/* Orientation as a rotation matrix */
+		void getRotation(cMatrix3d& rotation) const {
+			pivotRotation(this->orientation, rotation);
+		}
+	};
+
+	/* What UsartDevice runs: link and parameters chosen at startup */
+	typedef UsartPipeline<LinkTransport, PreambleDecoder, PivotKinematics, QuantizeFilter, RuntimeConfig> RuntimeUsartPipeline;
+
+	/* Same stages with the default parameters fixed at compile time */
+	typedef UsartPipeline<SerialTransport, PreambleDecoder, PivotKinematics, QuantizeFilter, DefaultStaticConfig> DefaultUsartPipeline;
+}
@@ -0,0 +1,341 @@
+#include "VideoTexture.h"
+#include "Trace.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace chai3d {
+
+	/*==================================================================*/
+	VideoTexture::VideoTexture()
+		: file(NULL),
+		dataStart(0),
+		width(0),
+		height(0),
+		rate(0.0),
+		fullRange(false),
+		running(false),
+		playStart(0.0),
+		decoded(0),
+		consumed(0),
+		nextIndex(0),
+		framesDecoded(0),
+		framesSkipped(0),
+		decodeTimeSum(0.0),
+		stage(0),
+		staged(false),
+		shownIndex(-1),
+		framesShown(0),
+		framesReplaced(0),
+		framesLate(0),
+		uploadTimeSum(0.0),
+		updates(0)
+	{
+		this->buffers[0] = 0;
+		this->buffers[1] = 0;
+	}
+
+	/*==================================================================*/
+	VideoTexture::~VideoTexture() {
+		this->close();
+	}
+
+	/*==================================================================*/
+	bool VideoTexture::open(const std::string& filename) {
+		this->close();
+		this->file = fopen(filename.c_str(), "rb");
+		if (this->file == NULL) {
+			std::cout << "Error - failed to open video " << filename << std::endl;
+			return false;
+		}
+
+		/* stream header: 'YUV4MPEG2 W<width> H<height> F<num>:<den> [C<colorspace>] [X<extension>] ...' */
+		std::string header;
+		int c;
+		while (((c = getc(this->file)) != '\n') && (c != EOF) && (header.size() < 1024)) {
+			header += (char)c;
+		}
+		if (header.compare(0, 10, "YUV4MPEG2 ") != 0) {
+			std::cout << "Error - " << filename << " is not a YUV4MPEG2 video" << std::endl;
+			this->close();
+			return false;
+		}
+		int w = 0, h = 0;
+		double framesPerSecond = 0.0;
+		std::string colorspace = "420jpeg";
+		bool full = false;
+		size_t begin = 10;
+		while (begin < header.size()) {
+			size_t end = header.find(' ', begin);
+			if (end == std::string::npos) {
+				end = header.size();
+			}
+			std::string token = header.substr(begin, end - begin);
+			begin = end + 1;
+			if (token.empty()) {
+				continue;
+			}
+			switch (token[0]) {
+			case 'W': w = atoi(token.c_str() + 1); break;
+			case 'H': h = atoi(token.c_str() + 1); break;
+			case 'F': {
+				int numerator = 0, denominator = 0;
+				if ((sscanf(token.c_str() + 1, "%d:%d", &numerator, &denominator) == 2) && (numerator > 0) && (denominator > 0)) {
+					framesPerSecond = (double)numerator / denominator;
+				}
+				break;
+			}
+			case 'C': colorspace = token.substr(1); break;
+			case 'X':
+				if (token.compare(0, 12, "XCOLORRANGE=") == 0) {
+					full = (token == "XCOLORRANGE=FULL");
+				}
+				break;
+			}
+		}
+		if ((w <= 0) || (h <= 0) || (framesPerSecond <= 0.0)) {
+			std::cout << "Error - " << filename << ": no frame size or rate in the header" << std::endl;
+			this->close();
+			return false;
+		}
+		if ((colorspace.compare(0, 3, "420") != 0) || (w % 2 != 0) || (h % 2 != 0)) {
+			std::cout << "Error - " << filename << ": only 4:2:0 videos of even size are played (got C" << colorspace << ", " << w << "x" << h << ")" << std::endl;
+			this->close();
+			return false;
+		}
+
+		this->dataStart = ftell(this->file);
+		this->width = w;
+		this->height = h;
+		this->rate = framesPerSecond;
+		this->fullRange = full;  // the C tag only gives the chroma siting (420jpeg is ffmpeg's yuv420p); untagged 4:2:0 is limited range
+		this->yuv.resize((size_t)w * h * 3 / 2);
+		for (int i = 0; i < SLOTS; i++) {
+			this->frames[i].index = -1;
+			this->frames[i].pixels.resize((size_t)w * h * 4);
+		}
+
+		/* the texture is created in the GL context at its first rendering, at the size of its image */
+		this->texture = cTexture2d::create();
+		this->texture->m_image->allocate(w, h, GL_RGBA);
+
+		this->playStart.store(0.0, std::memory_order_relaxed);
+		this->decoded.store(0, std::memory_order_relaxed);
+		this->consumed.store(0, std::memory_order_relaxed);
+		this->nextIndex = 0;
+		this->framesDecoded.store(0, std::memory_order_relaxed);
+		this->framesSkipped.store(0, std::memory_order_relaxed);
+		this->decodeTimeSum.store(0.0, std::memory_order_relaxed);
+		this->staged = false;
+		this->shownIndex = -1;
+		this->framesShown = 0;
+		this->framesReplaced = 0;
+		this->framesLate = 0;
+		this->uploadTimeSum = 0.0;
+		this->updates = 0;
+
+		this->running.store(true, std::memory_order_relaxed);
+		this->decoder = std::thread(&VideoTexture::decode, this);
+		return true;
+	}
+
+	/*==================================================================*/
+	void VideoTexture::close() {
+		this->running.store(false, std::memory_order_relaxed);
+		if (this->decoder.joinable()) {
+			this->decoder.join();
+		}
+		if (this->file != NULL) {
+			fclose(this->file);
+			this->file = NULL;
+		}
+	}
+
+	/*==================================================================*/
+	/* Read the 'FRAME [<parameters>]' line before the planes of a frame. Returns false at the end of the file */
+	bool VideoTexture::readFrameHeader() {
+		char tag[5];
+		if ((fread(tag, 1, 5, this->file) != 5) || (memcmp(tag, "FRAME", 5) != 0)) {
+			return false;
+		}
+		int c;
+		while ((c = getc(this->file)) != '\n') {
+			if (c == EOF) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*==================================================================*/
+	void VideoTexture::decode() {
+		Trace::nameThread("video decoder");
+		bool framesInPass = false;
+		while (this->running.load(std::memory_order_relaxed)) {
+			unsigned long long next = this->decoded.load(std::memory_order_relaxed);
+			if (next - this->consumed.load(std::memory_order_acquire) == SLOTS) {
+				cSleepMs(1);
+				continue;
+			}
+
+			/* loop at the end of the video */
+			if (!this->readFrameHeader()) {
+				if (!framesInPass) {
+					break;  // no frame at all
+				}
+				framesInPass = false;
+				fseek(this->file, this->dataStart, SEEK_SET);
+				continue;
+			}
+			framesInPass = true;
+			long long index = this->nextIndex++;
+
+			/* a frame more than a period late is not worth decoding */
+			double start = this->playStart.load(std::memory_order_relaxed);
+			if ((start > 0.0) && ((double)(index + 1) < (cPrecisionClock::getCPUTimeSeconds() - start) * this->rate)) {
+				fseek(this->file, (long)this->yuv.size(), SEEK_CUR);
+				this->framesSkipped.store(this->framesSkipped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				continue;
+			}
+
+			TRACE_SCOPE("decode video frame");
+			double begin = cPrecisionClock::getCPUTimeSeconds();
+			if (fread(this->yuv.data(), 1, this->yuv.size(), this->file) != this->yuv.size()) {
+				continue;  // truncated last frame; the next header read fails and the video loops
+			}
+			Frame& frame = this->frames[next % SLOTS];
+			convertFrame(this->yuv.data(), this->width, this->height, this->fullRange, frame.pixels.data());
+			frame.index = index;
+			this->decoded.store(next + 1, std::memory_order_release);
+
+			this->decodeTimeSum.store(this->decodeTimeSum.load(std::memory_order_relaxed) + cPrecisionClock::getCPUTimeSeconds() - begin, std::memory_order_relaxed);
+			this->framesDecoded.store(this->framesDecoded.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+	}
+
+	/*==================================================================*/
+	void VideoTexture::update() {
+		if (!this->isOpen() || (this->texture->getTextureId() == 0)) {
+			return;
+		}
+		TRACE_SCOPE("video upload");
+		double now = cPrecisionClock::getCPUTimeSeconds();
+		double start = this->playStart.load(std::memory_order_relaxed);
+		if (start == 0.0) {
+			start = now;
+			this->playStart.store(start, std::memory_order_relaxed);
+		}
+		long long due = (long long)((now - start) * this->rate);
+		size_t size = (size_t)this->width * this->height * 4;
+
+		if (this->buffers[0] == 0) {
+			glGenBuffers(2, this->buffers);
+			for (int i = 0; i < 2; i++) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->buffers[i]);
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+
+		/* the frame staged at the previous update has had a frame to reach the GPU */
+		if (this->staged) {
+			glBindTexture(GL_TEXTURE_2D, this->texture->getTextureId());
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->buffers[this->stage]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, this->width, this->height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			this->staged = false;
+		}
+
+		/* stage the newest decoded frame that is due into the other buffer */
+		unsigned long long first = this->consumed.load(std::memory_order_relaxed);
+		unsigned long long available = this->decoded.load(std::memory_order_acquire);
+		unsigned long long last = first;
+		while ((last < available) && (this->frames[last % SLOTS].index <= due)) {
+			last++;
+		}
+		if (last > first) {
+			const Frame& frame = this->frames[(last - 1) % SLOTS];
+			this->stage ^= 1;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->buffers[this->stage]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);  // a fresh buffer, never waits on the GPU
+			void* data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			if (data != NULL) {
+				memcpy(data, frame.pixels.data(), size);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				this->staged = true;
+				this->framesShown++;
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			this->shownIndex = frame.index;
+			this->framesReplaced += last - first - 1;
+			this->consumed.store(last, std::memory_order_release);
+		}
+		else if (due > this->shownIndex) {
+			this->framesLate++;
+		}
+
+		this->uploadTimeSum += cPrecisionClock::getCPUTimeSeconds() - now;
+		this->updates++;
+	}
+
+	/*==================================================================*/
+	static inline unsigned char clampByte(int value) {
+		return (unsigned char)((value < 0) ? 0 : ((value > 255) ? 255 : value));
+	}
+
+	/*==================================================================*/
+	void VideoTexture::convertFrame(const unsigned char* yuv, int a_width, int a_height, bool a_fullRange, unsigned char* bgra) {
+		int w = a_width;
+		int h = a_height;
+		const unsigned char* yPlane = yuv;
+		const unsigned char* uPlane = yuv + (size_t)w * h;
+		const unsigned char* vPlane = uPlane + (size_t)(w / 2) * (h / 2);
+
+		/* BT.601, coefficients scaled by 1024; video range luma is 16..235, chroma 16..240 */
+		int yOffset = a_fullRange ? 0 : 16;
+		int yScale = a_fullRange ? 1024 : 1192;
+		int rv = a_fullRange ? 1436 : 1634;
+		int gu = a_fullRange ? 352 : 401;
+		int gv = a_fullRange ? 731 : 833;
+		int bu = a_fullRange ? 1815 : 2066;
+
+		for (int j = 0; j < h; j++) {
+			const unsigned char* y = yPlane + (size_t)j * w;
+			const unsigned char* u = uPlane + (size_t)(j / 2) * (w / 2);
+			const unsigned char* v = vPlane + (size_t)(j / 2) * (w / 2);
+			unsigned char* pixel = bgra + (size_t)(h - 1 - j) * w * 4;
+			for (int i = 0; i < w; i++) {
+				int luma = (y[i] - yOffset) * yScale + 512;
+				int cb = u[i / 2] - 128;
+				int cr = v[i / 2] - 128;
+				pixel[0] = clampByte((luma + bu * cb) >> 10);
+				pixel[1] = clampByte((luma - gu * cb - gv * cr) >> 10);
+				pixel[2] = clampByte((luma + rv * cr) >> 10);
+				pixel[3] = 255;
+				pixel += 4;
+			}
+		}
+	}
+
+	/*==================================================================*/
+	VideoStatistics VideoTexture::getStatistics() const {
+		VideoStatistics statistics;
+		unsigned long long decodedFrames = this->framesDecoded.load(std::memory_order_relaxed);
+		statistics.framesShown = this->framesShown;
+		statistics.framesDropped = this->framesSkipped.load(std::memory_order_relaxed) + this->framesReplaced;
+		statistics.framesLate = this->framesLate;
+		statistics.meanDecodeTime = (decodedFrames > 0) ? this->decodeTimeSum.load(std::memory_order_relaxed) / decodedFrames : 0.0;
+		statistics.decodeThroughput = (statistics.meanDecodeTime > 0.0) ? 1.0 / statistics.meanDecodeTime : 0.0;
+		statistics.meanUploadTime = (this->updates > 0) ? this->uploadTimeSum / this->updates : 0.0;
+		return statistics;
+	}
+
+	/*==================================================================*/
+	void VideoTexture::printStatistics() const {
+		VideoStatistics statistics = this->getStatistics();
+		std::cout << "Video: " << this->width << "x" << this->height << " at " << this->rate << " Hz, " << statistics.framesShown
+			<< " frames shown, " << statistics.framesDropped << " dropped, " << statistics.framesLate << " late renders; decode "
+			<< statistics.meanDecodeTime * 1000.0 << " ms (" << statistics.decodeThroughput << " frames/s), upload "
+			<< statistics.meanUploadTime * 1000.0 << " ms" << std::endl;
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "chai3d.h"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace chai3d {
+	/* Playback statistics, since open() */
+	struct VideoStatistics {
+		unsigned long long framesShown;  // uploaded to the texture
+		unsigned long long framesDropped;  // decoded too late, or replaced by a newer frame before they were shown
+		unsigned long long framesLate;  // rendered frames that showed an older video frame than was due
+		double meanDecodeTime;  // read and conversion of a frame, decoder thread [s]
+		double decodeThroughput;  // frames the decoder can deliver per second, 1 / meanDecodeTime
+		double meanUploadTime;  // graphics thread time spent in update() [s]
+	};
+
+	/*
+	A texture that plays a video (e.g. endoscopy footage on the heart), without the graphics waiting on decode or upload.
+
+	A decoder thread reads the frames ahead into a small ring of BGRA frames. Once per rendered frame, the graphics thread
+	takes the newest frame that is due, copies it into one of two pixel buffer objects, and has the texture updated from
+	the other one, filled at the previous frame: the transfer to the GPU overlaps a frame of rendering, and the texture
+	shows the video one frame late. A frame that is already a frame period late when its turn to be decoded comes is
+	skipped; the video keeps its pace and loops at the end.
+
+		VideoTexture video;
+		video.open("footage.y4m");
+		heart->m_texture = video.getTexture();
+		...graphics thread, before rendering, a GL context current:  video.update();
+
+	The file is YUV4MPEG2 4:2:0 (the format ViewRecorder writes), e.g. 'ffmpeg -i footage.mp4 -pix_fmt yuv420p footage.y4m'.
+	The samples are limited range (16..235), as in most footage, unless the header says XCOLORRANGE=FULL.
+	*/
+	class VideoTexture {
+	public:
+		static const int SLOTS = 4;  // decoded frames ahead of the graphics
+
+	private:
+		struct Frame {
+			long long index;  // frame number since playback started, counting the loops
+			std::vector<unsigned char> pixels;  // BGRA, bottom-up
+		};
+
+		FILE* file;
+		long dataStart;  // offset of the first frame in the file
+		int width;
+		int height;
+		double rate;  // frames per second
+		bool fullRange;
+		cTexture2dPtr texture;
+		std::thread decoder;
+		std::atomic<bool> running;
+		std::atomic<double> playStart;  // time of the first update(), 0 before
+
+		/* Frames go through the ring in order: decoded by the decoder thread, consumed by the graphics thread */
+		Frame frames[SLOTS];
+		std::atomic<unsigned long long> decoded;
+		std::atomic<unsigned long long> consumed;
+
+		/* decoder thread */
+		std::vector<unsigned char> yuv;
+		long long nextIndex;
+		std::atomic<unsigned long long> framesDecoded;
+		std::atomic<unsigned long long> framesSkipped;
+		std::atomic<double> decodeTimeSum;
+
+		/* graphics thread */
+		GLuint buffers[2];  // pixel buffers, 0 until the first update()
+		int stage;  // buffer holding the frame to upload next
+		bool staged;
+		long long shownIndex;
+		unsigned long long framesShown;
+		unsigned long long framesReplaced;
+		unsigned long long framesLate;
+		double uploadTimeSum;
+		unsigned long long updates;
+
+		bool readFrameHeader();
+		void decode();
+
+	public:
+		VideoTexture();
+		~VideoTexture();
+
+		/* Open a video and start decoding it. Returns false (and prints why) if it can't be played */
+		bool open(const std::string& filename);
+		void close();
+		bool isOpen() const { return this->file != NULL; }
+
+		/* The texture the video plays in, of the size of the video */
+		cTexture2dPtr getTexture() const { return this->texture; }
+		int getWidth() const { return this->width; }
+		int getHeight() const { return this->height; }
+		bool isFullRange() const { return this->fullRange; }
+
+		/* Graphics thread, once per rendered frame: upload the frame staged at the previous update(), and stage the
+		newest frame that is due. Playback time starts at the first call; nothing happens until the texture was rendered once */
+		void update();
+
+		/* Convert a top-down 4:2:0 frame (Y, then U and V of a quarter the size) to a bottom-up BGRA image */
+		static void convertFrame(const unsigned char* yuv, int a_width, int a_height, bool a_fullRange, unsigned char* bgra);
+
+		VideoStatistics getStatistics() const;
+		void printStatistics() const;
+	};
+}
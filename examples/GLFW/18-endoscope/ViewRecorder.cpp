@@ -0,0 +1,304 @@
+#include "ViewRecorder.h"
+#include "Trace.h"
+#include <algorithm>
+
+namespace chai3d {
+
+	/*==================================================================*/
+	ViewRecorder::ViewRecorder()
+		: file(NULL),
+		width(0),
+		height(0),
+		period(0.0),
+		recording(false),
+		encoding(false),
+		issued(0),
+		released(0),
+		collected(0),
+		encoded(0),
+		bufferSize(0),
+		nextFrameTime(0.0),
+		lastCallTime(0.0),
+		frameTimeSum(0.0),
+		frameCount(0),
+		idleFrameTimeSum(0.0),
+		idleFrameCount(0),
+		captureTimeSum(0.0),
+		captureTimeMax(0.0),
+		captureCount(0),
+		framesDropped(0),
+		framesSkipped(0),
+		encodeTimeSum(0.0),
+		framesWritten(0)
+	{
+		for (int i = 0; i < READBACKS; i++) {
+			this->readbacks[i].buffer = 0;
+			this->readbacks[i].fence = NULL;
+			this->readbacks[i].data = NULL;
+		}
+	}
+
+	/*==================================================================*/
+	ViewRecorder::~ViewRecorder() {
+		/* the GL objects go with the context; stop() should have written the last frames */
+		if (this->encoder.joinable()) {
+			this->encoding.store(false, std::memory_order_release);
+			this->encoder.join();
+		}
+		if (this->file != NULL) {
+			fclose(this->file);
+		}
+	}
+
+	/*==================================================================*/
+	bool ViewRecorder::start(const std::string& filename, int a_width, int a_height, double rate) {
+		if (this->isRecording()) {
+			return false;
+		}
+		int w = a_width & ~1;
+		int h = a_height & ~1;
+		if ((w < 2) || (h < 2) || (rate <= 0.0)) {
+			return false;
+		}
+		this->file = fopen(filename.c_str(), "wb");
+		if (this->file == NULL) {
+			return false;
+		}
+		/* C420jpeg is only the chroma siting; the range needs its own tag, players take 4:2:0 as limited range without it */
+		fprintf(this->file, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", w, h, (int)(1000.0 * rate + 0.5));
+
+		this->width = w;
+		this->height = h;
+		this->period = 1.0 / rate;
+		this->yuv.resize((size_t)w * h * 3 / 2);
+		this->issued = 0;
+		this->released = 0;
+		this->collected.store(0, std::memory_order_relaxed);
+		this->encoded.store(0, std::memory_order_relaxed);
+		this->nextFrameTime = 0.0;
+		this->frameTimeSum = 0.0;
+		this->frameCount = 0;
+		this->captureTimeSum = 0.0;
+		this->captureTimeMax = 0.0;
+		this->captureCount = 0;
+		this->framesDropped = 0;
+		this->framesSkipped = 0;
+		this->encodeTimeSum.store(0.0, std::memory_order_relaxed);
+		this->framesWritten.store(0, std::memory_order_relaxed);
+
+		this->encoding.store(true, std::memory_order_release);
+		this->encoder = std::thread(&ViewRecorder::encode, this);
+		this->recording.store(true, std::memory_order_relaxed);
+		return true;
+	}
+
+	/*==================================================================*/
+	void ViewRecorder::stop() {
+		if (!this->isRecording()) {
+			return;
+		}
+		this->recording.store(false, std::memory_order_relaxed);
+
+		/* the frames still on the GPU are worth the wait now */
+		this->collect(true);
+		this->encoding.store(false, std::memory_order_release);
+		this->encoder.join();
+		this->releaseEncoded();
+
+		fclose(this->file);
+		this->file = NULL;
+	}
+
+	/*==================================================================*/
+	/* (Re)size the pixel buffers to the recording; they are kept for the next recording of the same size */
+	void ViewRecorder::allocate() {
+		size_t size = (size_t)this->width * this->height * 4;
+		if (size == this->bufferSize) {
+			return;
+		}
+		for (int i = 0; i < READBACKS; i++) {
+			if (this->readbacks[i].buffer == 0) {
+				glGenBuffers(1, &this->readbacks[i].buffer);
+			}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, this->readbacks[i].buffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		this->bufferSize = size;
+	}
+
+	/*==================================================================*/
+	/* Unmap the buffers the encoder is done with */
+	void ViewRecorder::releaseEncoded() {
+		unsigned long long done = this->encoded.load(std::memory_order_acquire);
+		for (; this->released < done; this->released++) {
+			Readback& readback = this->readbacks[this->released % READBACKS];
+			if (readback.data != NULL) {
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				readback.data = NULL;
+			}
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	/*==================================================================*/
+	/* Map the readbacks the GPU has finished, oldest first, and hand them to the encoder. Without wait, stops at the
+	first one still in flight */
+	void ViewRecorder::collect(bool wait) {
+		unsigned long long next = this->collected.load(std::memory_order_relaxed);
+		while (next < this->issued) {
+			Readback& readback = this->readbacks[next % READBACKS];
+			GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 100000000 : 0);
+			if (status == GL_TIMEOUT_EXPIRED) {
+				if (wait) {
+					continue;
+				}
+				break;
+			}
+			glDeleteSync(readback.fence);
+			readback.fence = NULL;
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+			readback.data = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)this->bufferSize, GL_MAP_READ_BIT);
+			next++;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		this->collected.store(next, std::memory_order_release);
+	}
+
+	/*==================================================================*/
+	void ViewRecorder::capture(int a_width, int a_height) {
+		double now = cPrecisionClock::getCPUTimeSeconds();
+		bool isRecording = this->isRecording();
+		if (this->lastCallTime > 0.0) {
+			if (isRecording) {
+				this->frameTimeSum += now - this->lastCallTime;
+				this->frameCount++;
+			}
+			else {
+				this->idleFrameTimeSum += now - this->lastCallTime;
+				this->idleFrameCount++;
+			}
+		}
+		this->lastCallTime = now;
+		if (!isRecording) {
+			return;
+		}
+		TRACE_SCOPE("record frame");
+
+		this->allocate();
+		this->releaseEncoded();
+		this->collect(false);
+
+		/* at most one frame per period, catching up by one period at most */
+		if (now >= this->nextFrameTime) {
+			this->nextFrameTime = (now - this->nextFrameTime > this->period) ? now + this->period : this->nextFrameTime + this->period;
+
+			if (((a_width & ~1) != this->width) || ((a_height & ~1) != this->height)) {
+				this->framesSkipped++;
+			}
+			else if (this->issued - this->released == READBACKS) {
+				this->framesDropped++;
+			}
+			else {
+				Readback& readback = this->readbacks[this->issued % READBACKS];
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+				glReadBuffer(GL_BACK);
+				glReadPixels(0, 0, this->width, this->height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+				readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				this->issued++;
+			}
+		}
+
+		double time = cPrecisionClock::getCPUTimeSeconds() - now;
+		this->captureTimeSum += time;
+		this->captureTimeMax = std::max(this->captureTimeMax, time);
+		this->captureCount++;
+	}
+
+	/*==================================================================*/
+	void ViewRecorder::encode() {
+		Trace::nameThread("recorder");
+		while (true) {
+			bool more = this->encoding.load(std::memory_order_acquire);
+			unsigned long long next = this->encoded.load(std::memory_order_relaxed);
+			if (next == this->collected.load(std::memory_order_acquire)) {
+				if (!more) {
+					break;
+				}
+				cSleepMs(1);
+				continue;
+			}
+
+			const Readback& readback = this->readbacks[next % READBACKS];
+			if (readback.data != NULL) {
+				TRACE_SCOPE("encode frame");
+				double begin = cPrecisionClock::getCPUTimeSeconds();
+				convertFrame(readback.data, this->width, this->height, this->yuv.data());
+				fputs("FRAME\n", this->file);
+				fwrite(this->yuv.data(), 1, this->yuv.size(), this->file);
+				this->encodeTimeSum.store(this->encodeTimeSum.load(std::memory_order_relaxed) + cPrecisionClock::getCPUTimeSeconds() - begin, std::memory_order_relaxed);
+				this->framesWritten.store(this->framesWritten.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			}
+			this->encoded.store(next + 1, std::memory_order_release);
+		}
+	}
+
+	/*==================================================================*/
+	void ViewRecorder::convertFrame(const unsigned char* bgra, int a_width, int a_height, unsigned char* yuv) {
+		int w = a_width;
+		int h = a_height;
+		unsigned char* yPlane = yuv;
+		unsigned char* uPlane = yuv + (size_t)w * h;
+		unsigned char* vPlane = uPlane + (size_t)(w / 2) * (h / 2);
+		for (int j = 0; j < h; j += 2) {
+			/* rows j and j + 1 of the frame, from the bottom of the image */
+			const unsigned char* rows[2];
+			rows[0] = bgra + (size_t)(h - 1 - j) * w * 4;
+			rows[1] = rows[0] - (size_t)w * 4;
+			unsigned char* y[2];
+			y[0] = yPlane + (size_t)j * w;
+			y[1] = y[0] + w;
+			unsigned char* u = uPlane + (size_t)(j / 2) * (w / 2);
+			unsigned char* v = vPlane + (size_t)(j / 2) * (w / 2);
+			for (int i = 0; i < w; i += 2) {
+				/* BT.601 full range; chroma of the 2x2 block, from the sums of its pixels */
+				int sumB = 0, sumG = 0, sumR = 0;
+				for (int k = 0; k < 4; k++) {
+					const unsigned char* pixel = rows[k >> 1] + 4 * (i + (k & 1));
+					int b = pixel[0], g = pixel[1], r = pixel[2];
+					y[k >> 1][i + (k & 1)] = (unsigned char)((77 * r + 150 * g + 29 * b + 128) >> 8);
+					sumB += b;
+					sumG += g;
+					sumR += r;
+				}
+				u[i / 2] = (unsigned char)((-43 * sumR - 85 * sumG + 128 * sumB + 131072) >> 10);
+				v[i / 2] = (unsigned char)((128 * sumR - 107 * sumG - 21 * sumB + 131072) >> 10);
+			}
+		}
+	}
+
+	/*==================================================================*/
+	RecordingStatistics ViewRecorder::getStatistics() const {
+		RecordingStatistics statistics;
+		statistics.framesWritten = this->framesWritten.load(std::memory_order_relaxed);
+		statistics.framesDropped = this->framesDropped;
+		statistics.framesSkipped = this->framesSkipped;
+		statistics.meanCaptureTime = (this->captureCount > 0) ? this->captureTimeSum / this->captureCount : 0.0;
+		statistics.maxCaptureTime = this->captureTimeMax;
+		statistics.meanEncodeTime = (statistics.framesWritten > 0) ? this->encodeTimeSum.load(std::memory_order_relaxed) / statistics.framesWritten : 0.0;
+		statistics.meanFrameTime = (this->frameCount > 0) ? this->frameTimeSum / this->frameCount : 0.0;
+		statistics.meanFrameTimeIdle = (this->idleFrameCount > 0) ? this->idleFrameTimeSum / this->idleFrameCount : 0.0;
+		return statistics;
+	}
+
+	/*==================================================================*/
+	void ViewRecorder::printStatistics() const {
+		RecordingStatistics statistics = this->getStatistics();
+		std::cout << "Recording: " << statistics.framesWritten << " frames written, " << statistics.framesDropped << " dropped, "
+			<< statistics.framesSkipped << " skipped (window resized); frame time " << statistics.meanFrameTime * 1000.0
+			<< " ms (not recording " << statistics.meanFrameTimeIdle * 1000.0 << " ms), capture " << statistics.meanCaptureTime * 1000.0
+			<< " ms (max " << statistics.maxCaptureTime * 1000.0 << " ms), encode " << statistics.meanEncodeTime * 1000.0 << " ms" << std::endl;
+	}
+}
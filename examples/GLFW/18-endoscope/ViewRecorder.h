@@ -0,0 +1,112 @@
+#pragma once
+#include "chai3d.h"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace chai3d {
+	/* Recording statistics, since start() */
+	struct RecordingStatistics {
+		unsigned long long framesWritten;
+		unsigned long long framesDropped;  // no free readback buffer: the encoder (or the GPU) lagged
+		unsigned long long framesSkipped;  // the window was not of the size of the recording
+		double meanCaptureTime;  // graphics thread time spent in capture() per recorded frame [s]
+		double maxCaptureTime;  // [s]
+		double meanEncodeTime;  // encoder thread time per frame [s]
+		double meanFrameTime;  // graphics frame period while recording [s]
+		double meanFrameTimeIdle;  // graphics frame period while not recording, since construction [s]
+	};
+
+	/*
+	Records a view (the endoscope camera) to a video file without stalling the graphics thread.
+
+	glReadPixels() into client memory waits until the GPU has drawn the frame, the same stall as glFinish(). Here each
+	recorded frame is read back into one of a ring of pixel buffer objects: the copy is queued behind the rendering, and
+	a fence tells when it is done. The graphics thread maps the finished buffers (a frame or two later, never waiting)
+	and hands the mapped memory to an encoder thread, which converts it and writes it to the file; the buffer is unmapped
+	and reused once the encoder is done with it. When no buffer is free (the encoder lags) the frame is dropped, rather
+	than the graphics waiting.
+
+		recorder.start("session.y4m", width, height, 30.0);
+		...graphics thread, after rendering the view, its context current:  recorder.capture(width, height);
+		recorder.stop();
+
+	The file is YUV4MPEG2 (4:2:0, full range, tagged XCOLORRANGE=FULL): uncompressed, written at disk speed, read by ffmpeg, VLC and mpv, e.g.
+	'ffmpeg -i session.y4m session.mp4'. Frames are taken at most at the given rate; a slower graphics loop gives a
+	video that plays faster than real time.
+	*/
+	class ViewRecorder {
+	public:
+		static const int READBACKS = 4;  // pixel buffers: in flight on the GPU, or mapped for the encoder
+
+	private:
+		struct Readback {
+			GLuint buffer;
+			GLsync fence;
+			const unsigned char* data;  // mapped, while the encoder has it
+		};
+
+		FILE* file;
+		int width;  // of the recording, even
+		int height;
+		double period;  // between recorded frames [s]
+		std::thread encoder;
+		std::atomic<bool> recording;
+		std::atomic<bool> encoding;
+
+		/* Readbacks go through the ring in order: issued (GPU copy queued) -> collected (mapped, to the encoder)
+		-> encoded -> released (unmapped, free) */
+		Readback readbacks[READBACKS];
+		unsigned long long issued;  // graphics thread
+		unsigned long long released;  // graphics thread
+		std::atomic<unsigned long long> collected;  // written by the graphics thread
+		std::atomic<unsigned long long> encoded;  // written by the encoder thread
+		size_t bufferSize;  // of the pixel buffers, 0 until allocated
+
+		/* graphics thread */
+		double nextFrameTime;
+		double lastCallTime;
+		double frameTimeSum;
+		unsigned long long frameCount;
+		double idleFrameTimeSum;
+		unsigned long long idleFrameCount;
+		double captureTimeSum;
+		double captureTimeMax;
+		unsigned long long captureCount;
+		unsigned long long framesDropped;
+		unsigned long long framesSkipped;
+
+		/* encoder thread */
+		std::vector<unsigned char> yuv;
+		std::atomic<double> encodeTimeSum;
+		std::atomic<unsigned long long> framesWritten;
+
+		void allocate();
+		void releaseEncoded();
+		void collect(bool wait);
+		void encode();
+
+	public:
+		ViewRecorder();
+		~ViewRecorder();
+
+		/* Start recording frames of the given size [pixels] (rounded down to even) at most at the given rate [Hz].
+		Returns false if the file can't be created */
+		bool start(const std::string& filename, int a_width, int a_height, double rate);
+		/* Write the frames still in flight and close the file; graphics thread, GL context current */
+		void stop();
+		bool isRecording() const { return this->recording.load(std::memory_order_relaxed); }
+
+		/* Graphics thread, once per frame after rendering the view (recording or not: it also times the frames),
+		with its GL context current. Queues the readback of the back buffer and hands the finished ones to the encoder */
+		void capture(int a_width, int a_height);
+
+		/* Convert a bottom-up BGRA image to the planes of a top-down 4:2:0 frame (Y, then U and V of a quarter the size) */
+		static void convertFrame(const unsigned char* bgra, int a_width, int a_height, unsigned char* yuv);
+
+		RecordingStatistics getStatistics() const;
+		void printStatistics() const;
+	};
+}
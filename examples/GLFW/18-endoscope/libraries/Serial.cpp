@@ -11,6 +11,9 @@ https://github.com/xanthium-enterprises/Serial-Programming-Win32API-C/blob/maste
 
 using namespace std;
 
+/* longest time a read waits in the driver for a first character [ms] (see the timeouts in open()) */
+static const DWORD READ_WAIT_MS = 1;
+
 Serial::Serial(int portNumber, int baudRate, int byteSize, int stopBits, int parity)
 {
 	this->comPortName = "\\\\.\\COM" + to_string(portNumber); // Name of the Serial port(May Change) to be opened,  "\\\\.\\COM7"
@@ -19,6 +22,7 @@ Serial::Serial(int portNumber, int baudRate, int byteSize, int stopBits, int par
 	this->byteSize = byteSize;
 	this->stopBits = stopBits;
 	this->parity = parity;
+	memset(&this->receiveWait, 0, sizeof(this->receiveWait));
 }
 
 Serial::~Serial()
@@ -36,7 +40,7 @@ bool Serial::open()
 		0,                            // No Sharing, ports cant be shared
 		NULL,                         // No Security
 		OPEN_EXISTING,                // Open existing port only
-		0,                            // Non Overlapped I/O
+		this->overlapped ? FILE_FLAG_OVERLAPPED : 0,  // Overlapped I/O when multiplexed
 		NULL);                        // Null for Comm Devices
 
 	if (hComm == INVALID_HANDLE_VALUE) {
@@ -46,6 +50,12 @@ bool Serial::open()
 	else
 		printf("\n    Port %s Opened\n ", this->comPortName.c_str());
 
+	if (this->overlapped && this->readEvent == NULL)
+	{
+		this->readEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		this->writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	}
+
 	/*------------------------------- Setting the Parameters for the SerialPort ------------------------------*/
 
 	DCB dcbSerialParams = { 0 };                         // Initializing DCB structure
@@ -74,9 +84,9 @@ bool Serial::open()
 	/*------------------------------------ Setting Timeouts --------------------------------------------------*/
 
 	COMMTIMEOUTS timeouts = { 0 };
-	timeouts.ReadIntervalTimeout = 50;
-	timeouts.ReadTotalTimeoutConstant = 50;
-	timeouts.ReadTotalTimeoutMultiplier = 10;
+	timeouts.ReadIntervalTimeout = MAXDWORD;       // ReadFile returns at once with whatever has been received,
+	timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;  // or, if nothing has, waits in the driver for the first character
+	timeouts.ReadTotalTimeoutConstant = READ_WAIT_MS;  // for at most READ_WAIT_MS, so readSome() can stop at its deadline
 	timeouts.WriteTotalTimeoutConstant = 50;
 	timeouts.WriteTotalTimeoutMultiplier = 10;
 
@@ -98,30 +108,118 @@ bool Serial::open()
 	else
 		printf("\n\n    Setting CommMask successfull");
 
-	/*------------------------------------ Setting WaitComm() Event   ----------------------------------------*/
+	/*------------------------------------ Waiting for Data Reception ---------------------------------------*/
 
+	// Poll for the first character for at most openTimeout ms instead of blocking in WaitCommEvent():
+	// a ring that does not transmit yet is reported by the device watchdog, and open() can't hang the program
 	printf("\n\n    Waiting for Data Reception");
-	DWORD dwEventMask;                     // Event mask to trigger
-	Status = WaitCommEvent(hComm, &dwEventMask, NULL); //Wait for the character to be received
-	printf("\n Data Received\n");
-
-	/*-------------------------- Program will Wait here till a Character is received ------------------------*/
-
-	if (Status == FALSE)
+	DWORD start = GetTickCount();
+	do
 	{
-		printf("\n    Error! in Setting WaitCommEvent()");
-		return false;
-	}
+		DWORD errors;
+		COMSTAT stat = { 0 };
+		if (ClearCommError(this->hComm, &errors, &stat) == FALSE)
+		{
+			printf("\n    Error! in ClearCommError()");
+			return false;
+		}
+		if (stat.cbInQue > 0)
+		{
+			printf("\n Data Received\n");
+			return true;
+		}
+		Sleep(1);
+	} while (GetTickCount() - start < this->openTimeout);
 
+	printf("\n No Data Received yet\n");
 	return true;
 }
 
 bool Serial::close()
 {
-	CloseHandle(this->hComm);//Closing the Serial Port
+	CloseHandle(this->hComm);//Closing the Serial Port (cancels a pending WaitCommEvent)
+	if (this->receiveWait.hEvent != NULL)
+	{
+		CloseHandle(this->receiveWait.hEvent);
+		this->receiveWait.hEvent = NULL;
+	}
+	if (this->readEvent != NULL)
+	{
+		CloseHandle(this->readEvent);
+		CloseHandle(this->writeEvent);
+		this->readEvent = NULL;
+		this->writeEvent = NULL;
+	}
 	return false;
 }
 
+/* ReadFile()/WriteFile() for both port modes: an overlapped transfer is waited for, which takes at most READ_WAIT_MS
+for reads since ReadFile returns at once with what has been received (see the timeouts in open()). The events are the
+port's own: ReadFile/WriteFile reset them when they start */
+BOOL Serial::transfer(bool isRead, void* buffer, DWORD nBytes, DWORD* bytesDone)
+{
+	*bytesDone = 0;
+	if (!this->overlapped)
+	{
+		return isRead ? ReadFile(this->hComm, buffer, nBytes, bytesDone, NULL) : WriteFile(this->hComm, buffer, nBytes, bytesDone, NULL);
+	}
+
+	OVERLAPPED ov = { 0 };
+	ov.hEvent = isRead ? this->readEvent : this->writeEvent;
+	BOOL Status = isRead ? ReadFile(this->hComm, buffer, nBytes, NULL, &ov) : WriteFile(this->hComm, buffer, nBytes, NULL, &ov);
+	if (Status == FALSE && GetLastError() == ERROR_IO_PENDING)
+	{
+		Status = TRUE;
+	}
+	if (Status == TRUE)
+	{
+		Status = GetOverlappedResult(this->hComm, &ov, bytesDone, TRUE);
+	}
+	return Status;
+}
+
+/* Overlapped ports: start waiting for received characters; getReceiveEvent() is signaled when some arrive.
+A port takes one WaitCommEvent() at a time: arm again only after the event was signaled, or after RECEIVE_READY */
+Serial::ReceiveState Serial::armReceiveEvent()
+{
+	if (this->receiveWait.hEvent == NULL)
+	{
+		this->receiveWait.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	}
+	ResetEvent(this->receiveWait.hEvent);
+	if (WaitCommEvent(this->hComm, &this->receiveMask, &this->receiveWait) == TRUE)
+	{
+		return RECEIVE_READY;  // completed at once
+	}
+	if (GetLastError() != ERROR_IO_PENDING)
+	{
+		return RECEIVE_FAILED;
+	}
+
+	// characters received between the last read and the wait above don't signal the event
+	DWORD errors;
+	COMSTAT stat = { 0 };
+	if (ClearCommError(this->hComm, &errors, &stat) == FALSE)
+	{
+		this->cancelReceiveWait();
+		return RECEIVE_FAILED;
+	}
+	if (stat.cbInQue == 0)
+	{
+		return RECEIVE_WAITING;
+	}
+	this->cancelReceiveWait();  // the caller reads them now and arms again
+	return RECEIVE_READY;
+}
+
+/* End the pending WaitCommEvent(): cancel it and wait until it has completed or been cancelled */
+void Serial::cancelReceiveWait()
+{
+	CancelIoEx(this->hComm, &this->receiveWait);
+	DWORD ignored;
+	GetOverlappedResult(this->hComm, &this->receiveWait, &ignored, TRUE);
+}
+
 bool Serial::read(int nBytes, char buffer[])
 {
 	DWORD totalBytesRead = 0;
@@ -129,12 +227,56 @@ bool Serial::read(int nBytes, char buffer[])
 	do
 	{
 		DWORD bytesRead;
-		Status = ReadFile(this->hComm, &(buffer[totalBytesRead]), nBytes - totalBytesRead, &bytesRead, NULL);
+		Status = this->transfer(true, &(buffer[totalBytesRead]), nBytes - totalBytesRead, &bytesRead);
 		totalBytesRead += bytesRead;
 	} while (totalBytesRead < nBytes);
 	return false;
 }
 
+/* Read up to nBytes; returns as soon as some bytes are received, or 0 if none arrived before the deadline or if the
+port failed. The deadline is wall time, cPrecisionClock::getCPUTimeSeconds(), also in a fixed-step simulation: it
+bounds how long the caller really waits */
+int Serial::readSome(int nBytes, char buffer[], double deadline)
+{
+	while (true)
+	{
+		// with less than READ_WAIT_MS left, only take what has been received: ReadFile would wait past the deadline
+		bool last = (deadline - chai3d::cPrecisionClock::getCPUTimeSeconds() < 0.001 * READ_WAIT_MS);
+		if (last)
+		{
+			DWORD errors;
+			COMSTAT stat = { 0 };
+			if (ClearCommError(this->hComm, &errors, &stat) == FALSE || stat.cbInQue == 0) {
+				return 0;
+			}
+		}
+		// otherwise the thread sleeps in the driver until a character comes, instead of spinning on ReadFile
+		DWORD bytesRead = 0;
+		BOOL Status = this->transfer(true, buffer, nBytes, &bytesRead);
+		if (Status == FALSE) {
+			return 0;
+		}
+		if (bytesRead > 0) {
+			return (int)bytesRead;
+		}
+		if (last) {
+			return 0;
+		}
+	}
+}
+
+/* Write up to nBytes; returns the number of bytes the port took within the write timeouts set in open(),
+0 if the port failed. Called from a single writer thread, while the haptic thread reads */
+int Serial::write(int nBytes, const char buffer[])
+{
+	DWORD bytesWritten = 0;
+	BOOL Status = this->transfer(false, (void*)buffer, nBytes, &bytesWritten);
+	if (Status == FALSE) {
+		return 0;
+	}
+	return (int)bytesWritten;
+}
+
 char Serial::readByte()
 {
 	const int nBytes = 1;
@@ -143,7 +285,7 @@ char Serial::readByte()
 	DWORD bytesRead;
 	do
 	{
-		Status = ReadFile(this->hComm, &buffer, nBytes, &bytesRead, NULL);
+		Status = this->transfer(true, &buffer, nBytes, &bytesRead);
 	} while (bytesRead != nBytes);
 	return buffer;
 }
@@ -14,13 +14,37 @@ private:
 	int byteSize;
 	int stopBits;
 	int parity;
+	DWORD openTimeout = 2000;  // longest time open() waits for the first character [ms]
+	bool overlapped = false;  // port opened for overlapped I/O: one thread can wait on several ports, and a read does not wait for a write
+	OVERLAPPED receiveWait;  // pending WaitCommEvent() of an overlapped port
+	HANDLE readEvent = NULL;  // completion events of the overlapped reads and writes, one per direction
+	HANDLE writeEvent = NULL;  // since a read and a write may be pending at the same time
+	DWORD receiveMask = 0;
+
+	BOOL transfer(bool isRead, void* buffer, DWORD nBytes, DWORD* bytesDone);
+	void cancelReceiveWait();
 
 public:
+	enum ReceiveState {
+		RECEIVE_WAITING,  // a wait is pending: getReceiveEvent() is signaled when characters arrive
+		RECEIVE_READY,  // characters are waiting and no wait is pending: read them, then arm again
+		RECEIVE_FAILED  // the port failed; no wait is pending
+	};
+
 	Serial(int portNumber, int baudRate = CBR_9600, int byteSize = 8, int stopBits = ONESTOPBIT, int parity = NOPARITY);
 	~Serial();
 
+	/* Open the port for overlapped I/O (call before open()). The port can then be multiplexed with
+	armReceiveEvent() and getReceiveEvent(), and read on one thread while another writes it; reads and writes
+	keep working as before */
+	void setOverlapped(bool overlapped) { this->overlapped = overlapped; }
+	ReceiveState armReceiveEvent();
+	HANDLE getReceiveEvent() const { return this->receiveWait.hEvent; }
+
 	bool open();
 	bool close();
 	bool read(int nBytes, char buffer[]);
+	int readSome(int nBytes, char buffer[], double deadline);
+	int write(int nBytes, const char buffer[]);
 	char Serial::readByte();
 };
\ No newline at end of file
@@ -54,9 +54,49 @@
 #include <Windows.h>
 #include <stdio.h>
 #include "libraries\Serial.h"
+#include "UsartKinematics.h"
+#include "UsartKinematicsBatch.h"
+#include "UsartPipeline.h"
+#include "ShaftTool.h"
+#include "GuardedWorld.h"
+#include "LocalContactModel.h"
+#include "BroadphaseGroup.h"
+#include "DeformableTissue.h"
+#include "ViewRecorder.h"
+#include "VideoTexture.h"
+#include "SessionRecorder.h"
+#include "SessionAnalytics.h"
+#include "SimulationClock.h"
+#include "UdpTransport.h"
+#include "PoseBroadcast.h"
+#include "UsartDevice.h"
+#include "DeviceManager.h"
+#include "HapticToolPool.h"
+#include "LaunchProfile.h"
+#include "AllocationGuard.h"
+#include "Trace.h"
+#include "TripleBuffer.h"
+#include "SceneSnapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 
 
+/* Checks of the self test (profile key self_test): a failed one is printed and counted */
+static int selfTestFailures = 0;
+
+static bool expect(bool condition, const char* what)
+{
+	if (!condition) {
+		printf("FAIL: %s\n", what);
+		selfTestFailures++;
+	}
+	return condition;
+}
+
+
 
 void main_bak(void)
 {
@@ -217,4 +257,1917 @@ void main_bak2(void)
 	CloseHandle(hComm);//Closing the Serial Port
 	printf("\n +==========================================+\n");
 	_getch();
-}//End of Main()
\ No newline at end of file
+}//End of Main()
+
+
+
+/* Microbenchmark: orientation/position update of UsartDevice, Euler + 4x4 matrices vs. incremental quaternion */
+void bench_orientation(void)
+{
+	using namespace chai3d;
+	const int n = 1000000;
+	const double pivotOffset = 0.01, s3 = 0.02, resolution = 20000.0;
+	cPrecisionClock clock;
+	double checksum = 0.0;
+
+	/* previous path: rebuild the rotation from the accumulated Euler angles and compose T * R * invT */
+	double theta1 = 0.0, theta2 = 0.0;
+	clock.start(true);
+	for (int i = 0; i < n; i++) {
+		theta1 += 0.001 * ((i % 7) - 3);
+		theta2 -= 0.001 * ((i % 5) - 2);
+		cMatrix3d rotation;
+		rotation.setExtrinsicEulerRotationDeg(0.0, theta2, theta1, C_EULER_ORDER_XZY);
+		Eigen::Matrix4d R(Eigen::Matrix4d::Identity());
+		R.block<3, 3>(0, 0) << rotation.eigen();
+		Eigen::Matrix4d T(Eigen::Matrix4d::Identity());
+		T.block<4, 1>(0, 3) << s3, 0.0, 0.0, 1.0;
+		Eigen::Matrix4d invT(Eigen::Matrix4d::Identity());
+		invT.block<4, 1>(0, 3) << -s3, 0.0, 0.0, 1.0;
+		Eigen::Vector4d result(T * R * invT * Eigen::Vector4d(s3 - pivotOffset, 0.0, 0.0, 1.0));
+		checksum += (int)(result.x() * resolution) / resolution;
+	}
+	double timeEuler = clock.stop();
+
+	/* quaternion path: integrate the increments, closed form position */
+	cQuaternion q(1.0, 0.0, 0.0, 0.0);
+	clock.start(true);
+	for (int i = 0; i < n; i++) {
+		rotateExtrinsicY(q, 0.001 * ((i % 7) - 3));
+		rotateIntrinsicZ(q, -0.001 * ((i % 5) - 2));
+		renormalize(q);
+		cMatrix3d rotation;
+		pivotRotation(q, rotation);
+		cVector3d position = pivotPosition(q, s3, pivotOffset);
+		checksum -= (int)(position.x() * resolution) / resolution;
+	}
+	double timeQuaternion = clock.stop();
+
+	/* both paths in step, untimed: the integrated quaternion must stay on the Euler rotation */
+	theta1 = theta2 = 0.0;
+	q = cQuaternion(1.0, 0.0, 0.0, 0.0);
+	double maxError = 0.0;
+	for (int i = 0; i < n; i++) {
+		theta1 += 0.001 * ((i % 7) - 3);
+		theta2 -= 0.001 * ((i % 5) - 2);
+		rotateExtrinsicY(q, 0.001 * ((i % 7) - 3));
+		rotateIntrinsicZ(q, -0.001 * ((i % 5) - 2));
+		renormalize(q);
+		cMatrix3d euler, quaternion;
+		euler.setExtrinsicEulerRotationDeg(0.0, theta2, theta1, C_EULER_ORDER_XZY);
+		pivotRotation(q, quaternion);
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 3; c++) {
+				maxError = cMax(maxError, cAbs(euler(r, c) - quaternion(r, c)));
+			}
+		}
+	}
+
+	printf("euler + 4x4:  %.1f ns/update\n", 1.0e9 * timeEuler / n);
+	printf("quaternion:   %.1f ns/update\n", 1.0e9 * timeQuaternion / n);
+	printf("speedup:      %.2fx (checksum %g)\n", timeEuler / timeQuaternion, checksum);
+	printf("max rotation difference: %g\n", maxError);
+	expect(maxError < 1.0e-9, "orientation: the quaternion follows the Euler rotation");
+}
+
+
+
+
+/* Batch kinematics: check the scalar and vectorised kernels against the kinematics of the device pipeline
+(PivotKinematics and QuantizeFilter, as UsartDevice runs them) and measure the throughput */
+void bench_kinematics_batch(void)
+{
+	using namespace chai3d;
+	const size_t n = 4000000;
+	RuntimeConfig config;
+	PivotParams params = { config.pivotOffset, config.zoom_limit, config.filter_resolution };
+	std::vector<double> theta1(n), theta2(n), zoom(n);
+	std::vector<double> xd(n), yd(n), zd(n), xs(n), ys(n), zs(n), xv(n), yv(n), zv(n);
+	for (size_t i = 0; i < n; i++) {
+		theta1[i] = 90.0 * rand() / RAND_MAX - 45.0;
+		theta2[i] = 90.0 * rand() / RAND_MAX - 45.0;
+		zoom[i] = 0.1 * rand() / RAND_MAX - 0.05;
+	}
+
+	/* the device pipeline, from the accumulated angles these samples stand for */
+	cPrecisionClock clock;
+	clock.start(true);
+	for (size_t i = 0; i < n; i++) {
+		cVector3d angle(theta1[i] * config.polarity_angle, zoom[i] * config.zoom_scale * config.polarity_zoom, -theta2[i] * config.polarity_angle);
+		cQuaternion orientation = PivotKinematics::orientation(config, angle);
+		cVector3d position = QuantizeFilter::apply(config, PivotKinematics::position(config, angle, orientation));
+		xd[i] = position.x();
+		yd[i] = position.y();
+		zd[i] = position.z();
+	}
+	double timeDevice = clock.stop();
+
+	clock.start(true);
+	computePivotPositionsScalar(params, &theta1[0], &theta2[0], &zoom[0], &xs[0], &ys[0], &zs[0], n);
+	double timeScalar = clock.stop();
+
+	clock.start(true);
+	computePivotPositions(params, &theta1[0], &theta2[0], &zoom[0], &xv[0], &yv[0], &zv[0], n, 1);
+	double timeSimd = clock.stop();
+
+	clock.start(true);
+	computePivotPositions(params, &theta1[0], &theta2[0], &zoom[0], &xv[0], &yv[0], &zv[0], n);
+	double timeThreads = clock.stop();
+
+	/* the truncation to the filter resolution can flip on a rounding difference: at most one quantum apart */
+	const double quantum = 1.0 / params.filterResolution;
+	size_t identical[2] = { 0, 0 };
+	double maxError[2] = { 0.0, 0.0 };
+	for (size_t i = 0; i < n; i++) {
+		double e[2] = {
+			cMax(cAbs(xd[i] - xs[i]), cMax(cAbs(yd[i] - ys[i]), cAbs(zd[i] - zs[i]))),
+			cMax(cAbs(xd[i] - xv[i]), cMax(cAbs(yd[i] - yv[i]), cAbs(zd[i] - zv[i]))) };
+		for (int k = 0; k < 2; k++) {
+			maxError[k] = cMax(maxError[k], e[k]);
+			if (e[k] == 0.0) identical[k]++;
+		}
+	}
+
+	printf("device pipeline: %.1f Msamples/s\n", 1.0e-6 * n / timeDevice);
+	printf("scalar:          %.1f Msamples/s\n", 1.0e-6 * n / timeScalar);
+	printf("simd:            %.1f Msamples/s\n", 1.0e-6 * n / timeSimd);
+	printf("simd + threads:  %.1f Msamples/s\n", 1.0e-6 * n / timeThreads);
+	printf("same as the device: scalar %.4f%%, max error %g; simd %.4f%%, max error %g (quantum %g)\n",
+		100.0 * identical[0] / n, maxError[0], 100.0 * identical[1] / n, maxError[1], quantum);
+	expect(maxError[0] <= 1.000001 * quantum, "kinematics batch: scalar kernel within a quantum of the device pipeline");
+	expect(maxError[1] <= 1.000001 * quantum, "kinematics batch: vectorised kernel within a quantum of the device pipeline");
+	expect(identical[1] > n * 99 / 100, "kinematics batch: vectorised kernel mostly bit identical to the device pipeline");
+}
+
+
+
+
+/* Device pipeline: runtime parameters vs. parameters fixed at compile time, on a synthetic capture */
+void bench_pipeline(void)
+{
+	using namespace chai3d;
+	const int n = 1000000;
+	const int frame = PreambleDecoder::preamble_length + PreambleDecoder::payload_length;
+	std::vector<char> capture(n * frame);
+	for (int i = 0; i < n; i++) {
+		char* p = &capture[i * frame];
+		memset(p, 0xAA, PreambleDecoder::preamble_length);
+		double raw[3] = { 0.01 * ((i % 7) - 3), 0.01 * ((i % 3) - 1), -0.01 * ((i % 5) - 2) };
+		memcpy(p + PreambleDecoder::preamble_length, raw, sizeof(raw));
+	}
+
+	typedef UsartPipeline<BufferTransport, PreambleDecoder, PivotKinematics, QuantizeFilter, RuntimeConfig> RuntimeReplay;
+	typedef UsartPipeline<BufferTransport, PreambleDecoder, PivotKinematics, QuantizeFilter, DefaultStaticConfig> StaticReplay;
+
+	RuntimeConfig config;
+	config.angle_limit = DefaultStaticConfig::angle_limit;
+	config.zoom_limit = DefaultStaticConfig::zoom_limit;
+	config.angle_scale = DefaultStaticConfig::angle_scale;
+	config.zoom_scale = DefaultStaticConfig::zoom_scale;
+	config.filter_resolution = DefaultStaticConfig::filter_resolution;
+	config.polarity_angle = DefaultStaticConfig::polarity_angle;
+	config.polarity_zoom = DefaultStaticConfig::polarity_zoom;
+
+	cPrecisionClock clock;
+	RuntimeReplay runtimePipeline(BufferTransport(&capture[0], capture.size()));
+	runtimePipeline.configure(config);
+	clock.start(true);
+	while (runtimePipeline.read()) {
+		runtimePipeline.update();
+	}
+	double timeRuntime = clock.stop();
+
+	StaticReplay staticPipeline(BufferTransport(&capture[0], capture.size()));
+	clock.start(true);
+	while (staticPipeline.read()) {
+		staticPipeline.update();
+	}
+	double timeStatic = clock.stop();
+
+	printf("runtime config:  %.1f ns/packet\n", 1.0e9 * timeRuntime / n);
+	printf("static config:   %.1f ns/packet\n", 1.0e9 * timeStatic / n);
+	printf("same result:     %s\n", (runtimePipeline.position == staticPipeline.position) ? "yes" : "no");
+	expect(runtimePipeline.position == staticPipeline.position, "pipeline: runtime and static parameters give the same position");
+	expect(runtimePipeline.angle == staticPipeline.angle, "pipeline: runtime and static parameters give the same angles");
+}
+
+
+/* Microbenchmark: cost of the shaft contact model per haptic tick as the number of points grows,
+all points in the calling thread vs. spread over the worker threads */
+void bench_shaft(void)
+{
+	using namespace chai3d;
+	cWorld* world = new GuardedWorld();
+	cMesh* tissue = new cMesh();
+	cCreatePlane(tissue, 0.3, 0.3);  // in the XY plane, like the heart before it is placed
+	world->addChild(tissue);
+	tissue->createAABBCollisionDetector(0.01);
+	tissue->setStiffness(100.0, true);
+	world->computeGlobalPositions(true);
+
+	SpinWorkerPool workers;
+	workers.start(3);
+	printf("%d worker threads\n", workers.getNumWorkers());
+
+	/* the shaft goes down at 20 degrees from its tip, the tip moves up and down through the tissue */
+	cMatrix3d rotation;
+	rotation.setAxisAngleRotationDeg(cVector3d(0.0, 1.0, 0.0), 20.0);
+
+	const int ticks = 5000;
+	const int counts[] = { 1, 8, 16, 32, 64 };
+	cPrecisionClock clock;
+	for (int c = 0; c < 5; c++) {
+		double time[2];
+		double active = 0.0;
+		std::vector<cVector3d> forces[2];
+		for (int parallel = 0; parallel < 2; parallel++) {
+			forces[parallel].reserve(ticks);
+			ShaftTool* shaft = new ShaftTool(world, counts[c], 0.1);
+			shaft->setRadius(0.002);
+			shaft->addContactObject(tissue);
+			shaft->updateContactBounds();
+			shaft->setWorkerPool(parallel ? &workers : NULL);
+			shaft->setDeviceGlobalPose(cVector3d(-0.05, 0.0, 0.05), rotation);
+			shaft->initialize();
+
+			active = 0.0;
+			clock.start(true);
+			for (int i = 0; i < ticks; i++) {
+				shaft->setDeviceGlobalPose(cVector3d(-0.05, 0.0, 0.02 + 0.03 * sin(0.002 * i)), rotation);
+				shaft->computeInteractionForces();
+				active += shaft->getNumActivePoints();
+				forces[parallel].push_back(shaft->getDeviceGlobalForce());
+			}
+			time[parallel] = clock.stop();
+			delete shaft;
+		}
+		printf("%2d points: %7.1f us/tick serial, %7.1f us/tick parallel, %.1f points near the tissue\n",
+			counts[c], 1.0e6 * time[0] / ticks, 1.0e6 * time[1] / ticks, active / ticks);
+
+		/* every point is computed on its own, and the forces are summed in the same order */
+		bool touched = false;
+		for (int i = 0; i < ticks; i++) {
+			touched = touched || (forces[0][i].length() > 0.0);
+		}
+		expect(touched, "shaft: the shaft pushes on the tissue");
+		expect(forces[0] == forces[1], "shaft: parallel points give the same forces as serial ones");
+		expect(active / ticks < counts[c], "shaft: the points far from the tissue are culled");
+	}
+	workers.stop();
+	delete world;
+}
+
+
+
+/* Two-rate rendering of a shaft standing on a plane: a tip coming down gets the plane before it touches it, a tip in
+the plane is pushed out by the model, and the model leaves the haptic points of the rendered tool where they were */
+void test_contact_model(void)
+{
+	using namespace chai3d;
+	cWorld* world = new GuardedWorld();
+	cMesh* tissue = new cMesh();
+	cCreatePlane(tissue, 0.3, 0.3);  // z = 0
+	world->addChild(tissue);
+	tissue->createAABBCollisionDetector(0.01);
+	tissue->setStiffness(100.0, true);
+	world->computeGlobalPositions(true);
+
+	/* the shaft goes straight up from its tip */
+	const int numPoints = 4;
+	const double radius = 0.002;
+	cMatrix3d rotation;
+	rotation.setAxisAngleRotationDeg(cVector3d(0.0, 1.0, 0.0), -90.0);
+	ShaftTool* tool = new ShaftTool(world, numPoints, 0.1);
+	tool->setRadius(radius);
+	tool->setDeviceGlobalPose(cVector3d(0.0, 0.0, 0.004), rotation, cVector3d(0.0, 0.0, -1.0));
+	tool->initialize();
+	std::vector<cVector3d> toolProxies;
+	for (int i = 0; i < numPoints; i++) {
+		toolProxies.push_back(tool->getHapticPoint(i)->getGlobalPosProxy());
+	}
+
+	LocalContactModel model(world, numPoints, 0.1, radius);
+	model.addContactObject(tissue);
+	model.start(tool);
+
+	/* 2 mm above the surface at 1 m/s: reached within the look-ahead of a model per millisecond */
+	for (int i = 0; (i < 1000) && (model.getStatistics().predictedPlanes == 0); i++) {
+		model.render(tool);
+		cSleepMs(1);
+	}
+	expect(model.getStatistics().predictedPlanes > 0, "contact model: a free point heading for the surface gets its plane");
+
+	/* 1 mm into the surface, at rest */
+	tool->setDeviceGlobalPose(cVector3d(0.0, 0.0, -0.001), rotation);
+	for (int i = 0; (i < 1000) && ((model.getContacts() & 1) == 0); i++) {
+		model.render(tool);
+		cSleepMs(1);
+	}
+	expect((model.getContacts() & 1) != 0, "contact model: the tip in the surface is in contact");
+	expect(model.getProxy(0).z() > -0.0005, "contact model: the local proxy of the tip stays on the surface");
+	expect(tool->getDeviceGlobalForce().z() > 0.0, "contact model: the surface pushes the tip out");
+	model.stop();
+
+	bool untouched = true;
+	for (int i = 0; i < numPoints; i++) {
+		untouched = untouched && (tool->getHapticPoint(i)->getGlobalPosProxy() == toolProxies[i]);
+	}
+	expect(untouched, "contact model: the haptic points of the tool are not moved by the model");
+	delete tool;
+	delete world;
+}
+
+
+
+/* Collision query of one proxy segment against N meshes, tested one by one by the world (as CHAI3D does)
+or through a BroadphaseGroup */
+void bench_broadphase(void)
+{
+	using namespace chai3d;
+	const int queries = 20000;
+	const int counts[] = { 10, 50, 200 };
+	cPrecisionClock clock;
+	for (int c = 0; c < 3; c++) {
+		double time[2];
+		std::vector<cVector3d> hits[2];
+		for (int indexed = 0; indexed < 2; indexed++) {
+			hits[indexed].reserve(queries);
+			cWorld* world = new cWorld();
+			BroadphaseGroup* group = new BroadphaseGroup();
+			world->addChild(group);
+
+			/* small patches of tissue on a grid, 5 cm apart */
+			int side = (int)ceil(sqrt((double)counts[c]));
+			for (int i = 0; i < counts[c]; i++) {
+				cMesh* patch = new cMesh();
+				cCreatePlane(patch, 0.04, 0.04);
+				patch->createAABBCollisionDetector(0.002);
+				patch->setLocalPos(0.05 * (i % side), 0.05 * (i / side), 0.0);
+				if (indexed) {
+					group->addChild(patch);
+				}
+				else {
+					world->addChild(patch);
+				}
+			}
+			group->rebuild();
+			world->computeGlobalPositions(true);
+
+			cCollisionRecorder recorder;
+			cCollisionSettings settings;
+			settings.m_collisionRadius = 0.002;
+			clock.start(true);
+			for (int i = 0; i < queries; i++) {
+				/* a proxy crossing the surface above one of the patches */
+				int k = i % counts[c];
+				cVector3d a(0.05 * (k % side), 0.05 * (k / side), 0.001);
+				recorder.clear();
+				bool hit = world->computeCollisionDetection(a, a - cVector3d(0.0, 0.0, 0.002), recorder, settings);
+				hits[indexed].push_back(hit ? recorder.m_nearestCollision.m_globalPos : cVector3d(1.0e300, 0.0, 0.0));
+			}
+			time[indexed] = clock.stop();
+			delete world;
+		}
+		printf("%3d objects: %6.2f us/query without index, %6.2f us/query with index\n",
+			counts[c], 1.0e6 * time[0] / queries, 1.0e6 * time[1] / queries);
+
+		bool allHit = true;
+		for (int i = 0; i < queries; i++) {
+			allHit = allHit && (hits[0][i].x() < 1.0e300);
+		}
+		expect(allHit, "broadphase: every query crosses a patch");
+		expect(hits[0] == hits[1], "broadphase: the index finds the same contacts as the world");
+	}
+}
+
+
+
+/* Step time of the tissue solver against the number of vertices and of threads, with a tool pressing the middle */
+void bench_tissue(void)
+{
+	using namespace chai3d;
+	const int steps = 200;
+	const int resolutions[] = { 16, 32, 64, 128 };
+	const int threads[] = { 0, 1, 3 };
+	cPrecisionClock clock;
+	for (int r = 0; r < 4; r++) {
+		cMesh* mesh = new cMesh();
+		createTissueGrid(mesh, 0.3, 0.3, resolutions[r]);
+		DeformableTissue tissue(mesh);
+		printf("%6d vertices, %6d edges, %d colors:", tissue.getNumVertices(), tissue.getNumEdges(), tissue.getNumColors());
+		for (int t = 0; t < 3; t++) {
+			tissue.setNumWorkers(threads[t]);
+			clock.start(true);
+			for (int i = 0; i < steps; i++) {
+				tissue.step(0.002);
+			}
+			printf("  %7.3f ms/step with %d workers", 1000.0 * clock.stop() / steps, tissue.getNumWorkers());
+		}
+		printf("\n");
+		delete mesh;
+	}
+
+	/* a shaft standing on the middle of the tissue, its tip 3 mm above the rest surface with 5 mm spheres: the spheres
+	come from the device pose, and the tissue gives way under the tip the same way with and without workers */
+	cWorld* world = new cWorld();
+	ShaftTool* shaft = new ShaftTool(world, 4, 0.1);
+	cMatrix3d rotation;
+	rotation.setAxisAngleRotationDeg(cVector3d(0.0, 1.0, 0.0), -90.0);  // the shaft goes straight up
+	shaft->setDeviceGlobalPose(cVector3d(0.0, 0.0, 0.003), rotation);
+	std::vector<cVector3d> shapes[2];
+	for (int parallel = 0; parallel < 2; parallel++) {
+		cMesh* mesh = new cMesh();
+		createTissueGrid(mesh, 0.3, 0.3, 32);
+		world->addChild(mesh);
+		world->computeGlobalPositions(true);
+		DeformableTissue tissue(mesh);
+		tissue.start(500.0, parallel ? 3 : 0, false);
+		for (int i = 0; i < steps; i++) {
+			tissue.setContactSpheres(shaft, 0.005, shaft->getLength());
+			tissue.advance();
+		}
+		tissue.apply();
+		for (int i = 0; i < tissue.getNumVertices(); i++) {
+			shapes[parallel].push_back(mesh->m_vertices->getLocalPos(i));
+		}
+		world->removeChild(mesh);
+		delete mesh;
+	}
+	double deepest = 0.0;
+	bool finite = true;
+	for (size_t i = 0; i < shapes[0].size(); i++) {
+		deepest = std::min(deepest, shapes[0][i].z());
+		finite = finite && (shapes[0][i].length() < 1.0);
+	}
+	printf("tissue under the tip: %.2f mm\n", 1000.0 * deepest);
+	expect(finite, "tissue: the vertices stay in place");
+	expect(deepest < -0.001, "tissue: the tissue gives way under the tip of the shaft");
+	expect(shapes[0] == shapes[1], "tissue: the workers give the same shape as the solver alone");
+	delete shaft;
+	delete world;
+}
+
+
+/* Encoder thread time per recorded frame of the endoscope view: conversion to 4:2:0, against the frame period */
+void bench_view_convert(void)
+{
+	using namespace chai3d;
+	const int frames = 50;
+	const int widths[] = { 640, 1280, 1920 };
+	const int heights[] = { 480, 720, 1080 };
+	cPrecisionClock clock;
+	for (int r = 0; r < 3; r++) {
+		std::vector<unsigned char> bgra((size_t)widths[r] * heights[r] * 4);
+		std::vector<unsigned char> yuv((size_t)widths[r] * heights[r] * 3 / 2);
+		for (size_t i = 0; i < bgra.size(); i++) {
+			bgra[i] = (unsigned char)(i * 7);
+		}
+		clock.start(true);
+		for (int i = 0; i < frames; i++) {
+			ViewRecorder::convertFrame(bgra.data(), widths[r], heights[r], yuv.data());
+		}
+		double time = clock.stop() / frames;
+		printf("%4dx%4d: %6.2f ms/frame, %5.1f%% of a 30 Hz recording\n", widths[r], heights[r], 1000.0 * time, 100.0 * time * 30.0);
+	}
+
+	/* a recorded frame plays back as it was rendered: colors of 2x2 blocks (one chroma sample each) through the
+	recorder and back through the full range conversion of the player */
+	const int w = 64, h = 64;
+	std::vector<unsigned char> bgra((size_t)w * h * 4), yuv((size_t)w * h * 3 / 2), back((size_t)w * h * 4);
+	for (int j = 0; j < h; j++) {
+		for (int i = 0; i < w; i++) {
+			unsigned char* pixel = &bgra[((size_t)j * w + i) * 4];
+			pixel[0] = (unsigned char)(8 * (i / 2));
+			pixel[1] = (unsigned char)(8 * (j / 2));
+			pixel[2] = (unsigned char)(255 - 4 * (i / 2) - 4 * (j / 2));
+			pixel[3] = 255;
+		}
+	}
+	ViewRecorder::convertFrame(bgra.data(), w, h, yuv.data());
+	VideoTexture::convertFrame(yuv.data(), w, h, true, back.data());
+	int maxError = 0;
+	for (size_t i = 0; i < bgra.size(); i++) {
+		if (i % 4 != 3) {
+			maxError = std::max(maxError, abs((int)bgra[i] - (int)back[i]));
+		}
+	}
+	printf("recorded and played back: %d levels off at most\n", maxError);
+	expect(maxError <= 3, "view convert: a recorded frame plays back in its colors");
+}
+
+
+/* Decoder thread time per frame of the footage played on the heart: conversion from 4:2:0, as frames per second */
+void bench_video_convert(void)
+{
+	using namespace chai3d;
+	const int frames = 50;
+	const int widths[] = { 640, 1280, 1920 };
+	const int heights[] = { 480, 720, 1080 };
+	cPrecisionClock clock;
+	for (int r = 0; r < 3; r++) {
+		std::vector<unsigned char> yuv((size_t)widths[r] * heights[r] * 3 / 2);
+		std::vector<unsigned char> bgra((size_t)widths[r] * heights[r] * 4);
+		for (size_t i = 0; i < yuv.size(); i++) {
+			yuv[i] = (unsigned char)(i * 7);
+		}
+		clock.start(true);
+		for (int i = 0; i < frames; i++) {
+			VideoTexture::convertFrame(yuv.data(), widths[r], heights[r], true, bgra.data());
+		}
+		double time = clock.stop() / frames;
+		printf("%4dx%4d: %6.2f ms/frame, %6.1f frames/s\n", widths[r], heights[r], 1000.0 * time, 1.0 / time);
+	}
+
+	/* black and white of each range, without chroma, come out black and white */
+	const unsigned char levels[2][2] = { { 16, 235 }, { 0, 255 } };  // limited, full
+	for (int full = 0; full < 2; full++) {
+		for (int k = 0; k < 2; k++) {
+			unsigned char yuv[6] = { levels[full][k], levels[full][k], levels[full][k], levels[full][k], 128, 128 };
+			unsigned char bgra[16];
+			VideoTexture::convertFrame(yuv, 2, 2, full != 0, bgra);
+			int expected = (k == 0) ? 0 : 255;
+			expect((abs(bgra[0] - expected) <= 1) && (abs(bgra[1] - expected) <= 1) && (abs(bgra[2] - expected) <= 1),
+				full ? "video convert: full range black and white" : "video convert: limited range black and white");
+		}
+	}
+
+	/* the range comes from the XCOLORRANGE tag only: 4:2:0 without it is limited, whatever the chroma siting */
+	const char* headers[] = { "C420jpeg", "C420mpeg2", "C420jpeg XCOLORRANGE=FULL", "C420jpeg XCOLORRANGE=LIMITED" };
+	const bool fullRanges[] = { false, false, true, false };
+	for (int i = 0; i < 4; i++) {
+		const char* filename = "video_range_test.y4m";
+		FILE* file = fopen(filename, "wb");
+		if (!expect(file != NULL, "video convert: a test video can be written")) {
+			return;
+		}
+		fprintf(file, "YUV4MPEG2 W2 H2 F30:1 Ip A1:1 %s\nFRAME\n", headers[i]);
+		const unsigned char frame[6] = { 128, 128, 128, 128, 128, 128 };
+		fwrite(frame, 1, sizeof(frame), file);
+		fclose(file);
+
+		VideoTexture video;
+		bool opened = video.open(filename);
+		printf("%-30s %s\n", headers[i], !opened ? "not opened" : (video.isFullRange() ? "full range" : "limited range"));
+		expect(opened && (video.isFullRange() == fullRanges[i]), "video convert: the range of the header");
+		video.close();
+		remove(filename);
+	}
+}
+
+
+/* Size of a recorded session per tick, and time to reach a given second of it, for a minute of smooth motion at 1 kHz */
+void bench_session(void)
+{
+	using namespace chai3d;
+	const int ticks = 60000;
+	SessionRecorder recorder;
+	recorder.setLossless(true);  // every record is checked below
+	std::vector<SessionRecord> written;
+	written.reserve(ticks);
+	if (!recorder.start("bench.session")) {
+		printf("failed to create bench.session\n");
+		return;
+	}
+	cPrecisionClock clock;
+	clock.start(true);
+	for (int i = 0; i < ticks; i++) {
+		SessionRecord record;
+		double t = 0.001 * i;
+		record.time = t;
+		for (int k = 0; k < 3; k++) {
+			record.angle[k] = 10.0 * sin(t + k);
+			record.origin[k] = 0.05 * sin(0.3 * t + k);
+			record.proxy[k] = record.origin[k] + 0.001 * cos(t);
+			record.force[k] = 0.5 * sin(2.0 * t + k);
+		}
+		record.rotation[0] = cos(0.25 * sin(0.1 * t));
+		record.rotation[1] = sin(0.25 * sin(0.1 * t));
+		record.rotation[2] = 0.0;
+		record.rotation[3] = 0.0;
+		record.contacts = ((i / 500) % 2) ? 1u : 0u;
+		while (recorder.getStatistics().recordsWritten + SessionRecorder::QUEUE_CAPACITY / 2 < (unsigned long long)i) {
+			cSleepMs(1);
+		}
+		recorder.record(record);
+		written.push_back(record);
+	}
+	double pushTime = clock.stop();
+	recorder.stop();
+	SessionStatistics statistics = recorder.getStatistics();
+	printf("%llu records, %.1f bytes/record (%d in memory), %.3f us/push\n", statistics.recordsWritten,
+		(double)statistics.bytesWritten / statistics.recordsWritten, (int)sizeof(SessionRecord), 1.0e6 * pushTime / ticks);
+
+	SessionReader reader;
+	if (!expect(reader.open("bench.session"), "session: the recorded session opens")) {
+		return;
+	}
+	std::vector<SessionRecord> records;
+	clock.start(true);
+	for (int s = 0; s < 60; s++) {
+		reader.readBlock(reader.findBlock((double)s), records);
+	}
+	printf("%d blocks, %.3f ms to reach a second of the session\n", reader.getNumBlocks(), 1000.0 * clock.stop() / 60);
+
+	/* every record comes back, within the resolution of its columns (half a step, and the rounding of the sum) */
+	expect(reader.getNumRecords() == (unsigned long long)ticks, "session: every record is in the file");
+	size_t next = 0;
+	double maxError[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };  // time, angle, origin, rotation, proxy, force
+	bool contacts = true;
+	bool found = true;
+	for (int b = 0; b < reader.getNumBlocks(); b++) {
+		if (!expect(reader.readBlock(b, records), "session: every block can be read")) {
+			return;
+		}
+		for (size_t r = 0; (r < records.size()) && (next < written.size()); r++, next++) {
+			const SessionRecord& a = written[next];
+			const SessionRecord& c = records[r];
+			maxError[0] = std::max(maxError[0], fabs(a.time - c.time));
+			for (int k = 0; k < 3; k++) {
+				maxError[1] = std::max(maxError[1], fabs(a.angle[k] - c.angle[k]));
+				maxError[2] = std::max(maxError[2], fabs(a.origin[k] - c.origin[k]));
+				maxError[4] = std::max(maxError[4], fabs(a.proxy[k] - c.proxy[k]));
+				maxError[5] = std::max(maxError[5], fabs(a.force[k] - c.force[k]));
+			}
+			for (int k = 0; k < 4; k++) {
+				maxError[3] = std::max(maxError[3], fabs(a.rotation[k] - c.rotation[k]));
+			}
+			contacts = contacts && (a.contacts == c.contacts);
+		}
+	}
+	for (int s = 0; s < 60; s++) {
+		int b = reader.findBlock((double)s);
+		found = found && (reader.getBlock(b).lastTime >= s) && ((b == 0) || (reader.getBlock(b - 1).lastTime < s));
+	}
+	const double resolutions[6] = { 1.0e-6, 1.0e-6, 1.0e-7, 1.0e-7, 1.0e-7, 1.0e-5 };
+	bool withinResolution = true;
+	for (int k = 0; k < 6; k++) {
+		withinResolution = withinResolution && (maxError[k] <= 0.51 * resolutions[k]);
+	}
+	expect(next == written.size(), "session: the blocks hold every record");
+	expect(withinResolution, "session: the values come back within the resolution of their columns");
+	expect(contacts, "session: the contacts come back as they were");
+	expect(found, "session: findBlock() gives the block of a time");
+}
+
+
+/* Offline grading: throughput of SessionAnalytics on one thread and on all of them, for 8 sessions of 2 minutes at 1 kHz */
+void bench_analytics(void)
+{
+	using namespace chai3d;
+	const int sessions = 8;
+	const int ticks = 120000;
+	RuntimeConfig config;
+	std::vector<std::string> filenames;
+	for (int s = 0; s < sessions; s++) {
+		char filename[64];
+		sprintf(filename, "bench%d.session", s);
+		SessionRecorder recorder;
+		if (!recorder.start(filename)) {
+			printf("failed to create %s\n", filename);
+			return;
+		}
+		for (int i = 0; i < ticks; i++) {
+			SessionRecord record;
+			memset(&record, 0, sizeof(record));
+			double t = 0.001 * i;
+			record.time = t;
+			record.angle[0] = 20.0 * sin(t + s);
+			record.angle[1] = 500.0 * sin(0.5 * t);
+			record.angle[2] = 15.0 * cos(0.7 * t);
+			record.rotation[0] = 1.0;
+			record.force[0] = 0.5 * sin(2.0 * t);
+			record.contacts = ((i / 700) % 3 == 0) ? 1u : 0u;
+			while (recorder.getStatistics().recordsWritten + SessionRecorder::QUEUE_CAPACITY / 2 < (unsigned long long)i) {
+				cSleepMs(1);
+			}
+			recorder.record(record);
+		}
+		recorder.stop();
+		filenames.push_back(filename);
+	}
+
+	unsigned int threads[2] = { 1, 0 };
+	std::vector<SessionMetrics> metrics[2];
+	for (int k = 0; k < 2; k++) {
+		SessionAnalytics analytics(config);
+		analytics.run(filenames, threads[k]);
+		analytics.printStatistics();
+		metrics[k] = analytics.getMetrics();
+	}
+
+	/* contact for 700 ticks out of 2100 from the first tick (40.2 s, 57 onsets after it); the blocks are joined in order
+	whatever the threads */
+	bool same = (metrics[0].size() == metrics[1].size());
+	for (size_t s = 0; same && (s < metrics[0].size()); s++) {
+		const SessionMetrics& a = metrics[0][s];
+		const SessionMetrics& b = metrics[1][s];
+		same = (a.valid == b.valid) && (a.ticks == b.ticks) && (a.duration == b.duration) && (a.pathLength == b.pathLength) &&
+			(a.contactTime == b.contactTime) && (a.peakForce == b.peakForce) && (a.collisions == b.collisions) &&
+			(a.maxPositionError == b.maxPositionError);
+	}
+	expect(same, "analytics: one thread and all threads give the same metrics");
+	bool expected = (metrics[0].size() == (size_t)sessions);
+	for (size_t s = 0; expected && (s < metrics[0].size()); s++) {
+		const SessionMetrics& m = metrics[0][s];
+		expected = m.valid && (m.ticks == (unsigned long long)ticks) && (m.collisions == 57) &&
+			(fabs(m.contactTime - 40.2) < 0.01) && (fabs(m.peakForce - 0.5) < 1.0e-4) && (m.pathLength > 0.0);
+	}
+	expect(expected, "analytics: the metrics of the recorded motion");
+}
+
+
+/* Fixed-step replay: a minute of session played back through the device kinematics twice, as fast as possible; both runs must agree bit for bit */
+void bench_replay(void)
+{
+	using namespace chai3d;
+	typedef UsartPipeline<BufferTransport, PreambleDecoder, PivotKinematics, QuantizeFilter, RuntimeConfig> ReplayPipeline;
+	const int ticks = 60000;
+	RuntimeConfig config;
+	cVector3d recorded;  // last position of the recording
+	{
+		ReplayPipeline pipeline(BufferTransport(NULL, 0));
+		pipeline.configure(config);
+		SessionRecorder recorder;
+		recorder.setLossless(true);
+		if (!recorder.start("bench.session")) {
+			printf("failed to create bench.session\n");
+			return;
+		}
+		for (int i = 0; i < ticks; i++) {
+			double increments[3] = { 3.0 * sin(0.001 * i), 20.0 * cos(0.0013 * i), 2.0 * sin(0.0007 * i) };
+			pipeline.feed(increments);
+			pipeline.update();
+			SessionRecord record;
+			memset(&record, 0, sizeof(record));
+			record.time = 0.001 * i;
+			for (int k = 0; k < 3; k++) {
+				record.angle[k] = pipeline.angle(k);
+				record.origin[k] = pipeline.position(k);
+			}
+			recorder.record(record);
+		}
+		recorder.stop();
+		recorded = pipeline.position;
+	}
+
+	std::vector<double> positions[2];
+	for (int run = 0; run < 2; run++) {
+		SimulationClock clock;
+		clock.setFixedStep(0.001);
+		SessionReplay replay;
+		if (!replay.open("bench.session")) {
+			return;
+		}
+		ReplayPipeline pipeline(BufferTransport(NULL, 0));
+		pipeline.configure(config);
+		cPrecisionClock timer;
+		timer.start(true);
+		while (!replay.isFinished()) {
+			cVector3d angle;
+			if (replay.next(clock.now(), angle)) {
+				double increments[3];
+				for (int k = 0; k < 3; k++) {
+					increments[k] = (angle(k) - pipeline.angle(k)) * config.angle_scale;
+				}
+				pipeline.feed(increments);
+				pipeline.update();
+			}
+			positions[run].push_back(pipeline.position.x());
+			positions[run].push_back(pipeline.position.y());
+			positions[run].push_back(pipeline.position.z());
+			clock.tick();
+		}
+		double time = timer.stop();
+		printf("run %d: %llu ticks (%.1f s simulated) in %.3f s, %.0f times real time\n", run, clock.getTicks(), clock.now(), time, clock.now() / time);
+	}
+	printf("bit identical: %s\n", (positions[0] == positions[1]) ? "yes" : "no");
+	expect(positions[0].size() >= 3 * (size_t)ticks, "replay: the whole session is played");
+	expect(positions[0] == positions[1], "replay: two runs give the same positions, bit for bit");
+	if (positions[0].size() >= 3) {
+		size_t last = positions[0].size() - 3;
+		cVector3d replayed(positions[0][last], positions[0][last + 1], positions[0][last + 2]);
+		printf("end of the replay: %.3g m from the recording\n", (replayed - recorded).length());
+		expect((replayed - recorded).length() < 1.0e-4, "replay: the replay ends where the recording did");
+	}
+}
+
+
+
+/* Latency and jitter of the ring's frames from the sender to the decoder output: over UDP on the loopback (a sender thread
+at 1 kHz that swaps and drops a few datagrams, as Wi-Fi does), and over a COM port pair joined by a null-modem cable
+(or a virtual pair). Each frame carries its send time in raw[0] */
+static void print_latencies(const char* name, std::vector<double>& latencies)
+{
+	if (latencies.empty()) {
+		printf("%-6s no frames\n", name);
+		return;
+	}
+	double sum = 0.0, sum2 = 0.0;
+	for (size_t i = 0; i < latencies.size(); i++) {
+		sum += latencies[i];
+		sum2 += latencies[i] * latencies[i];
+	}
+	double mean = sum / latencies.size();
+	double jitter = sqrt(fmax(0.0, sum2 / latencies.size() - mean * mean));
+	std::sort(latencies.begin(), latencies.end());
+	printf("%-6s %zu frames, latency mean %.1f us, p99 %.1f us, max %.1f us, jitter %.1f us\n", name, latencies.size(),
+		1.0e6 * mean, 1.0e6 * latencies[latencies.size() * 99 / 100], 1.0e6 * latencies.back(), 1.0e6 * jitter);
+}
+
+/* Datagrams of the given sequence numbers through the loopback into a newly opened transport (raw[0] of each is its
+number); returns the numbers of the frames read, in order */
+static std::vector<unsigned int> udp_exchange(chai3d::UdpTransport& transport, const std::vector<unsigned int>& sequences)
+{
+	using namespace chai3d;
+	std::vector<unsigned int> received;
+	if (!transport.open()) {
+		expect(false, "UDP: open the transport");
+		return received;
+	}
+	UdpSender link;
+	link.open("127.0.0.1", transport.getPort());
+	for (size_t i = 0; i < sequences.size(); i++) {
+		double raw[3] = { (double)sequences[i], 0.0, 0.0 };
+		char datagram[UdpTransport::DATAGRAM_SIZE];
+		UdpTransport::makeDatagram(sequences[i], raw, datagram);
+		link.send(datagram, sizeof(datagram));
+	}
+	char frame[UdpTransport::FRAME_SIZE];
+	int filled = 0;
+	transport.setDeadline(cPrecisionClock::getCPUTimeSeconds() + 0.1);
+	while (true) {
+		int n = transport.read(UdpTransport::FRAME_SIZE - filled, frame + filled);
+		if (n <= 0) {
+			break;
+		}
+		filled += n;
+		if (filled == UdpTransport::FRAME_SIZE) {
+			double raw[3];
+			memcpy(raw, frame + UdpTransport::FRAME_SIZE - sizeof(raw), sizeof(raw));
+			received.push_back((unsigned int)raw[0]);
+			filled = 0;
+		}
+	}
+	/* commands go back to the sender */
+	char command = 0;
+	expect(transport.write(1, &command) == 1, "UDP: command to the sender");
+	link.close();
+	transport.close();
+	return received;
+}
+
+static std::vector<unsigned int> udp_range(unsigned int first, unsigned int count)
+{
+	std::vector<unsigned int> sequences;
+	for (unsigned int i = 0; i < count; i++) {
+		sequences.push_back(first + i);
+	}
+	return sequences;
+}
+
+/* Reordering, loss, duplicates, wraparound and restarts of the numbering, through the loopback */
+void test_udp_transport(void)
+{
+	using namespace chai3d;
+	UdpTransport transport(9751);
+	const unsigned int swapped[] = { 0, 1, 3, 2, 4, 5, 5, 6, 8, 9 };  // 3/2 swapped, 5 twice, 7 lost
+	std::vector<unsigned int> sequences(swapped, swapped + sizeof(swapped) / sizeof(swapped[0]));
+	const unsigned int ordered[] = { 0, 1, 2, 3, 4, 5, 6, 8, 9 };
+	std::vector<unsigned int> received = udp_exchange(transport, sequences);
+	UdpStatistics statistics = transport.getStatistics();
+	expect(received == std::vector<unsigned int>(ordered, ordered + sizeof(ordered) / sizeof(ordered[0])), "UDP: frames in order");
+	expect(statistics.reordered == 1, "UDP: one swapped frame");
+	expect(statistics.late == 1, "UDP: one duplicate");
+	expect(statistics.lost == 1, "UDP: one lost frame");
+
+	/* the 32 bit numbering wraps around */
+	sequences = udp_range(0xFFFFFFFAu, 12);
+	std::swap(sequences[5], sequences[6]);
+	received = udp_exchange(transport, sequences);
+	statistics = transport.getStatistics();
+	expect(received == udp_range(0xFFFFFFFAu, 12), "UDP: in order across the wraparound");
+	expect((statistics.lost == 0) && (statistics.late == 0) && (statistics.resyncs == 0), "UDP: nothing dropped at the wraparound");
+
+	/* the ring reboots and numbers from 0 again: followed after RESYNC_LATE late frames */
+	sequences = udp_range(100, 10);
+	std::vector<unsigned int> restart = udp_range(0, 30);
+	sequences.insert(sequences.end(), restart.begin(), restart.end());
+	received = udp_exchange(transport, sequences);
+	statistics = transport.getStatistics();
+	std::vector<unsigned int> expected = udp_range(100, 10);
+	restart = udp_range(UdpTransport::RESYNC_LATE - 1, 30 - (UdpTransport::RESYNC_LATE - 1));
+	expected.insert(expected.end(), restart.begin(), restart.end());
+	expect(received == expected, "UDP: new numbering followed after a restart");
+	expect((statistics.resyncs == 1) && (statistics.late == UdpTransport::RESYNC_LATE - 1), "UDP: one resync after a restart");
+
+	/* a restart from far away is followed at once */
+	sequences = udp_range(5000, 5);
+	restart = udp_range(0, 5);
+	sequences.insert(sequences.end(), restart.begin(), restart.end());
+	received = udp_exchange(transport, sequences);
+	statistics = transport.getStatistics();
+	expect(received == sequences, "UDP: new numbering followed at once after a jump");
+	expect((statistics.resyncs == 1) && (statistics.late == 0) && (statistics.lost == 0), "UDP: one resync after a jump");
+}
+
+void bench_udp_latency(void)
+{
+	using namespace chai3d;
+	const int frames = 5000;
+	const unsigned short udpPort = 9750;
+	const int comSend = 10, comReceive = 11;
+
+	/* UDP, loopback */
+	{
+		typedef UsartPipeline<UdpTransport, PreambleDecoder, PivotKinematics, QuantizeFilter, RuntimeConfig> UdpPipeline;
+		UdpPipeline pipeline(udpPort);
+		if (!pipeline.transport.open()) {
+			return;
+		}
+		std::thread sender([&]() {
+			UdpSender link;
+			link.open("127.0.0.1", udpPort);
+			char held[UdpTransport::DATAGRAM_SIZE];
+			double next = cPrecisionClock::getCPUTimeSeconds();
+			for (int i = 0; i < frames; i++) {
+				while (cPrecisionClock::getCPUTimeSeconds() < next) {}
+				next += 0.001;
+				double raw[3] = { cPrecisionClock::getCPUTimeSeconds(), 0.0, 0.0 };
+				char datagram[UdpTransport::DATAGRAM_SIZE];
+				UdpTransport::makeDatagram(i, raw, datagram);
+				if (i % 200 == 199) {
+					continue;  // lost
+				}
+				if (i % 50 == 10) {
+					memcpy(held, datagram, sizeof(held));  // sent after the next one
+					continue;
+				}
+				link.send(datagram, sizeof(datagram));
+				if (i % 50 == 11) {
+					link.send(held, sizeof(held));
+				}
+			}
+		});
+		std::vector<double> latencies;
+		pipeline.transport.setDeadline(cPrecisionClock::getCPUTimeSeconds() + 0.001 * frames + 1.0);
+		while (pipeline.read()) {
+			latencies.push_back(cPrecisionClock::getCPUTimeSeconds() - pipeline.raw[0]);
+		}
+		sender.join();
+		print_latencies("UDP", latencies);
+		pipeline.transport.printStatistics();
+		UdpStatistics statistics = pipeline.transport.getStatistics();
+		expect(statistics.frames + statistics.lost == (unsigned long long)frames - 1, "UDP: every frame delivered or lost");
+		expect(statistics.reordered > 0, "UDP: swapped frames put back in place");
+		expect(statistics.resyncs == 0, "UDP: no resync");
+	}
+
+	/* serial, COM port pair */
+	{
+		typedef UsartPipeline<SerialTransport, PreambleDecoder, PivotKinematics, QuantizeFilter, RuntimeConfig> SerialPipeline;
+		SerialPipeline pipeline(comReceive);
+		Serial link(comSend);
+		if (!link.open() || !pipeline.transport.open()) {
+			printf("serial: no port pair COM%d - COM%d\n", comSend, comReceive);
+			return;
+		}
+		std::thread sender([&]() {
+			double next = cPrecisionClock::getCPUTimeSeconds();
+			for (int i = 0; i < frames; i++) {
+				while (cPrecisionClock::getCPUTimeSeconds() < next) {}
+				next += 0.001;
+				double raw[3] = { cPrecisionClock::getCPUTimeSeconds(), 0.0, 0.0 };
+				char datagram[UdpTransport::DATAGRAM_SIZE];
+				UdpTransport::makeDatagram(i, raw, datagram);
+				link.write(UdpTransport::FRAME_SIZE, datagram + UdpTransport::HEADER_SIZE);
+			}
+		});
+		std::vector<double> latencies;
+		pipeline.transport.setDeadline(cPrecisionClock::getCPUTimeSeconds() + 0.001 * frames + 1.0);
+		while (pipeline.read()) {
+			latencies.push_back(cPrecisionClock::getCPUTimeSeconds() - pipeline.raw[0]);
+		}
+		sender.join();
+		print_latencies("serial", latencies);
+		link.close();
+		pipeline.transport.close();
+	}
+}
+
+
+
+/* Device manager: CPU time of its thread while 1 to 4 devices send at 1 kHz, over COM port pairs (COM10 sends to COM11,
+COM12 to COM13, ...). Each device should add a small and constant share; waiting costs nothing */
+void bench_device_manager(void)
+{
+	using namespace chai3d;
+	const int maxDevices = 4;
+	const int frames = 2000;  // 2 s at 1 kHz for each number of devices
+	std::vector<Serial*> links;
+
+	for (int n = 1; n <= maxDevices; n++) {
+		int comSend = 8 + 2 * n, comReceive = comSend + 1;
+		Serial* link = new Serial(comSend);
+		if (!link->open()) {
+			printf("device manager: no port pair COM%d - COM%d\n", comSend, comReceive);
+			delete link;
+			break;
+		}
+		links.push_back(link);
+
+		DeviceManager manager;
+		for (int k = 0; k < n; k++) {
+			manager.add(11 + 2 * k);
+		}
+		if (!manager.start()) {
+			printf("device manager: no port pair COM%d - COM%d\n", comSend, comReceive);
+			manager.stop();
+			break;
+		}
+
+		double start = cPrecisionClock::getCPUTimeSeconds();
+		std::thread sender([&]() {
+			double next = cPrecisionClock::getCPUTimeSeconds();
+			for (int i = 0; i < frames; i++) {
+				while (cPrecisionClock::getCPUTimeSeconds() < next) {}
+				next += 0.001;
+				double raw[3] = { 1.0, 0.0, -1.0 };
+				char datagram[UdpTransport::DATAGRAM_SIZE];
+				UdpTransport::makeDatagram(i, raw, datagram);
+				for (size_t k = 0; k < links.size(); k++) {
+					links[k]->write(UdpTransport::FRAME_SIZE, datagram + UdpTransport::HEADER_SIZE);
+				}
+			}
+		});
+		sender.join();
+		Sleep(100);  // the last frames are in flight
+		double wall = cPrecisionClock::getCPUTimeSeconds() - start;
+		double cpu = manager.getCpuTime();
+
+		printf("device manager: %d devices, %.2f %% of a core (%.3f s CPU in %.3f s)\n", n, 100.0 * cpu / wall, cpu, wall);
+		manager.printStatistics();
+		bool served = true;
+		for (int k = 0; k < n; k++) {
+			DeviceStatistics statistics = manager.getStatistics(k);
+			served = served && (statistics.packets > 0) && !statistics.failed;
+		}
+		expect(served, "device manager: every device served");
+		manager.stop();
+	}
+
+	for (size_t k = 0; k < links.size(); k++) {
+		links[k]->close();
+		delete links[k];
+	}
+}
+
+
+
+/* Pose broadcast: cost of publishing a pose at the haptic rate while 0, 1, 4 and 16 observers (threads here, through
+their own read-only mapping, as another process would) poll for every new pose. On a machine with fewer cores than
+observers the maximum includes the writer being preempted */
+void bench_pose_broadcast(void)
+{
+	using namespace chai3d;
+	const int poses = 5000;  // 5 s at 1 kHz for each number of observers
+	const int observers[] = { 0, 1, 4, 16 };
+	PoseBroadcaster broadcaster;
+
+	/* an observer that opens late starts with the next pose, and does not count the ones before as skipped */
+	if (!expect(broadcaster.open("18-endoscope.bench.pose"), "pose broadcast: open the broadcaster")) {
+		return;
+	}
+	UsartPose pose;
+	pose.rotation.identity();
+	for (int i = 0; i < 3000; i++) {
+		pose.time = 0.001 * i;
+		broadcaster.publish(pose);
+	}
+	{
+		PoseObserver observer;
+		unsigned long long skipped = 0;
+		expect(observer.open("18-endoscope.bench.pose"), "pose broadcast: open an observer");
+		expect(!observer.next(pose, skipped), "pose broadcast: no pose from before the observer opened");
+		pose.time = 3.0;
+		broadcaster.publish(pose);
+		expect(observer.next(pose, skipped) && (pose.time == 3.0) && (skipped == 0), "pose broadcast: the next pose, none skipped");
+		expect(observer.latest(pose) && (pose.time == 3.0), "pose broadcast: latest pose");
+	}
+	broadcaster.close();
+
+	for (int k = 0; k < 4; k++) {
+		if (!broadcaster.open("18-endoscope.bench.pose")) {
+			return;
+		}
+		std::atomic<bool> running(true);
+		std::atomic<int> ready(0);
+		std::vector<unsigned long long> read(observers[k], 0), skipped(observers[k], 0);
+		std::vector<std::thread> threads;
+		for (int j = 0; j < observers[k]; j++) {
+			threads.push_back(std::thread([&, j]() {
+				PoseObserver observer;
+				bool opened = observer.open("18-endoscope.bench.pose");
+				ready++;
+				if (!opened) {
+					return;
+				}
+				UsartPose pose;
+				while (running.load()) {
+					while (observer.next(pose, skipped[j])) {
+						read[j]++;
+					}
+					std::this_thread::yield();
+				}
+				while (observer.next(pose, skipped[j])) {
+					read[j]++;
+				}
+			}));
+		}
+		while (ready.load() < observers[k]) {
+			std::this_thread::yield();
+		}
+		std::vector<double> times(poses);
+		double next = cPrecisionClock::getCPUTimeSeconds();
+		for (int i = 0; i < poses; i++) {
+			while (cPrecisionClock::getCPUTimeSeconds() < next) {}
+			next += 0.001;
+			pose.time = 0.001 * i;
+			pose.angle.set(0.01 * i, 0.0, 0.0);
+			pose.position.set(0.0, 0.001 * (i % 100), 0.0);
+			double start = cPrecisionClock::getCPUTimeSeconds();
+			broadcaster.publish(pose);
+			times[i] = cPrecisionClock::getCPUTimeSeconds() - start;
+		}
+		running = false;
+		for (size_t j = 0; j < threads.size(); j++) {
+			threads[j].join();
+		}
+		broadcaster.close();
+		double sum = 0.0;
+		for (int i = 0; i < poses; i++) {
+			sum += times[i];
+		}
+		std::sort(times.begin(), times.end());
+		unsigned long long totalRead = 0, totalSkipped = 0;
+		for (int j = 0; j < observers[k]; j++) {
+			totalRead += read[j];
+			totalSkipped += skipped[j];
+			expect(read[j] + skipped[j] == (unsigned long long)poses, "pose broadcast: every pose read or skipped, once");
+		}
+		printf("%2d observers: publish mean %.0f ns, p99 %.0f ns, max %.0f ns; %llu poses read, %llu skipped\n", observers[k],
+			1.0e9 * sum / poses, 1.0e9 * times[poses * 99 / 100], 1.0e9 * times.back(), totalRead, totalSkipped);
+	}
+}
+
+
+
+
+/* Pose history: lookups by time interpolate between the two closest poses, hold the newest one and refuse times
+that were overwritten */
+void test_pose_history(void)
+{
+	using namespace chai3d;
+	PoseHistory<16> history;
+	UsartPose pose;
+	expect(!history.latest(pose) && !history.sample(0.0, pose), "pose history: an empty history has no pose");
+
+	/* 40 poses a second apart, turning 1 degree about z each */
+	for (int i = 0; i < 40; i++) {
+		pose.time = i;
+		pose.angle.set(i, 0.0, 0.0);
+		pose.position.set(0.0, 2.0 * i, 0.0);
+		pose.rotation.setAxisAngleRotationDeg(cVector3d(0.0, 0.0, 1.0), i);
+		history.push(pose);
+	}
+	expect(history.size() == 16, "pose history: keeps its capacity");
+	expect(history.latest(pose) && (pose.time == 39.0) && (pose.angle.x() == 39.0), "pose history: latest pose");
+
+	expect(history.sample(30.0, pose) && (pose.angle.x() == 30.0) && (pose.position.y() == 60.0), "pose history: exact time");
+	bool found = history.sample(35.5, pose);
+	expect(found && (pose.time == 35.5) && (cAbs(pose.angle.x() - 35.5) < 1.0e-9) &&
+		(cAbs(pose.position.y() - 71.0) < 1.0e-9), "pose history: linear between two poses");
+	expect(found && (cAbs(pose.rotation(0, 0) - cos(cDegToRad(35.5))) < 1.0e-9) &&
+		(cAbs(pose.rotation(1, 0) - sin(cDegToRad(35.5))) < 1.0e-9), "pose history: slerp between two poses");
+	expect(history.sample(100.0, pose) && (pose.time == 39.0) && (pose.angle.x() == 39.0), "pose history: holds the newest pose");
+	expect(history.sample(24.0, pose) && (pose.angle.x() == 24.0), "pose history: oldest pose still stored");
+	expect(!history.sample(23.5, pose), "pose history: overwritten time");
+}
+
+
+
+/* A tool that pushes with a constant force, whatever it touches */
+class ConstantForceTool : public chai3d::cGenericTool
+{
+public:
+	ConstantForceTool(chai3d::cWorld* world) : chai3d::cGenericTool(world) {}
+	void computeInteractionForces() { this->setDeviceGlobalForce(1.0, 0.0, 0.0); }
+};
+
+/* Device watchdog, in fixed steps: a ring that stops sending is reported stalled once it was silent for stallTimeout,
+and from then on its tool sends no force */
+void test_device_stall(void)
+{
+	using namespace chai3d;
+	const double step = 0.001, stallTimeout = 0.05;
+	const int recorded = 100, ticks = 300;
+
+	/* 0.1 s of packets, then silence */
+	{
+		SessionRecorder recorder;
+		recorder.setLossless(true);
+		if (!expect(recorder.start("stall_test.session"), "device stall: write the session")) {
+			return;
+		}
+		for (int i = 0; i < recorded; i++) {
+			SessionRecord record;
+			memset(&record, 0, sizeof(record));
+			record.time = step * i;
+			record.angle[0] = 0.01 * i;
+			recorder.record(record);
+		}
+		recorder.stop();
+	}
+	SimulationClock clock;
+	clock.setFixedStep(step);
+	SessionReplay replay;
+	if (!expect(replay.open("stall_test.session"), "device stall: open the session")) {
+		return;
+	}
+	UsartDevicePtr device = UsartDevice::create(0);
+	device->setClock(&clock);
+	device->setReplay(&replay);
+	device->setTimeouts(0.0005, stallTimeout);
+	device->open();
+
+	cWorld* world = new cWorld();
+	ConstantForceTool* tool = new ConstantForceTool(world);
+	tool->setHapticDevice(device);
+	HapticToolPool pool;
+	pool.add(tool, device);
+	pool.start(false);
+
+	int firstStalled = -1, forceWhileStalled = 0, noForceBefore = 0;
+	for (int i = 0; i < ticks; i++) {
+		pool.update();
+		bool stalled = device->isStalled();
+		bool force = tool->getDeviceGlobalForce().length() > 0.0;
+		if (stalled && (firstStalled < 0)) {
+			firstStalled = i;
+		}
+		if (stalled && force) {
+			forceWhileStalled++;
+		}
+		if (!stalled && !force) {
+			noForceBefore++;
+		}
+		clock.tick();
+	}
+	const DeviceWatchdog& watchdog = device->getWatchdog();
+	double lastPacket = step * (recorded - 1);
+	int expected = recorded - 1 + (int)(stallTimeout / step) + 1;  // first tick more than stallTimeout after the last packet
+	printf("stalled at tick %d (expected %d), current stall %.3f s\n", firstStalled, expected, watchdog.getCurrentStall(clock.now()));
+	expect(cAbs(firstStalled - expected) <= 1, "device stall: reported stalled after stallTimeout");
+	expect(noForceBefore == 0, "device stall: force sent until the stall");
+	expect(forceWhileStalled == 0, "device stall: no force while stalled");
+	expect(watchdog.getStallCount() == 1, "device stall: one stall");
+	expect(cAbs(watchdog.getCurrentStall(clock.now()) - (clock.now() - lastPacket)) < 1.0e-9, "device stall: stall measured from the last packet");
+
+	pool.stop();
+	device->close();
+	delete tool;
+	delete world;
+	remove("stall_test.session");
+}
+
+
+
+/* Parameter sets all made from one number, so that a mix of two sets shows */
+static chai3d::RuntimeConfig numbered_config(int k)
+{
+	chai3d::RuntimeConfig config;
+	config.pivotOffset = 1.0e-4 * k;
+	config.angle_limit = k;
+	config.zoom_limit = 1.0e-3 * k;
+	config.angle_scale = k + 1.0;
+	config.zoom_scale = 2.0 * k;
+	config.filter_resolution = k + 100.0;
+	config.polarity_angle = (k % 2) ? 1 : -1;
+	config.polarity_zoom = (k % 2) ? -1 : 1;
+	return config;
+}
+
+static bool is_numbered_config(const chai3d::RuntimeConfig& config, int k)
+{
+	chai3d::RuntimeConfig expected = numbered_config(k);
+	return (config.pivotOffset == expected.pivotOffset) && (config.angle_limit == expected.angle_limit) &&
+		(config.zoom_limit == expected.zoom_limit) && (config.angle_scale == expected.angle_scale) &&
+		(config.zoom_scale == expected.zoom_scale) && (config.filter_resolution == expected.filter_resolution) &&
+		(config.polarity_angle == expected.polarity_angle) && (config.polarity_zoom == expected.polarity_zoom);
+}
+
+/* Device parameters set from the UI thread while the haptic thread ticks: each tick uses one whole set, never a mix
+of two, never an older set than the tick before, and the last set is picked up */
+void test_device_config(void)
+{
+	using namespace chai3d;
+	const int sets = 20000;
+	UsartDevicePtr device = UsartDevice::create(0);  // not opened: the ticks only pick up the parameters
+	device->setConfig(numbered_config(0));
+	cVector3d position;
+	device->getPosition(position);
+
+	std::atomic<bool> done(false);
+	int torn = 0, older = 0, ticks = 0;
+	std::thread haptics([&]() {
+		int previous = 0;
+		while (!done.load(std::memory_order_acquire)) {
+			cVector3d p;
+			device->getPosition(p);
+			RuntimeConfig config = device->getActiveConfig();
+			int k = (int)config.angle_limit;
+			if (!is_numbered_config(config, k)) {
+				torn++;
+			}
+			if (k < previous) {
+				older++;
+			}
+			previous = k;
+			ticks++;
+		}
+	});
+	for (int k = 1; k <= sets; k++) {
+		device->setConfig(numbered_config(k));
+	}
+	done.store(true, std::memory_order_release);
+	haptics.join();
+	device->getPosition(position);
+	printf("%d sets, %d ticks\n", sets, ticks);
+	expect(torn == 0, "device config: every tick uses one whole set");
+	expect(older == 0, "device config: never an older set than the tick before");
+	expect(is_numbered_config(device->getActiveConfig(), sets), "device config: the last set is picked up");
+	expect(is_numbered_config(device->getConfig(), sets), "device config: getConfig() is the last set");
+}
+
+
+
+/* Launch profile: invalid keys and values are refused and leave the setting as it was; the command line overrides
+the profile file */
+void test_launch_profile(void)
+{
+	using namespace chai3d;
+	LaunchProfile profile;
+	expect(profile.set("com_port", "4") && (profile.com_port == 4), "profile: integer setting");
+	expect(profile.set("zoom_scale", "80.5") && (profile.zoom_scale == 80.5), "profile: real setting");
+	expect(profile.set("two_rate", "yes") && profile.two_rate, "profile: boolean setting");
+	expect(profile.set("replay", "monday.session") && (profile.replay == "monday.session"), "profile: text setting");
+
+	expect(!profile.set("com_prot", "4"), "profile: unknown key");
+	expect(!profile.set("com_port", "four") && !profile.set("com_port", "4x") && !profile.set("com_port", ""), "profile: not a number");
+	expect(!profile.set("com_port", "4.5"), "profile: not an integer");
+	expect(!profile.set("com_port", "256") && !profile.set("com_port", "0"), "profile: integer out of range");
+	expect(!profile.set("com_port", "1e300") && !profile.set("com_port", "-1e300"), "profile: integer far out of range");
+	expect(!profile.set("angle_limit", "90.5"), "profile: real out of range");
+	expect(!profile.set("polarity_zoom", "0"), "profile: polarity 0");
+	expect(!profile.set("angle_limit", "nan") && !profile.set("angle_limit", "NAN") && !profile.set("com_port", "nan"), "profile: NaN");
+	expect(!profile.set("angle_limit", "inf") && !profile.set("run_time", "-infinity"), "profile: infinity");
+	expect(!profile.set("two_rate", "maybe"), "profile: not a boolean");
+	expect((profile.com_port == 4) && (profile.angle_limit == 45.0) && (profile.polarity_zoom == -1) && profile.two_rate,
+		"profile: refused values leave the settings as they were");
+
+	/* a profile file, then the command line over it */
+	FILE* file = fopen("test.profile", "w");
+	if (!expect(file != NULL, "profile: write a profile file")) {
+		return;
+	}
+	fprintf(file, "# station 2\ncom_port = 5   # left\n\nzoom_scale = 70\nrun_time = 600\n");
+	fclose(file);
+	LaunchProfile loaded;
+	char program[] = "18-endoscope", profileArgument[] = "--zoom_scale=90", fileArgument[] = "--profile=test.profile";
+	char* arguments[] = { program, profileArgument, fileArgument };
+	expect(loaded.parseArguments(3, arguments), "profile: parse a valid command line");
+	expect((loaded.com_port == 5) && (loaded.run_time == 600.0), "profile: settings from the file");
+	expect(loaded.zoom_scale == 90.0, "profile: the command line overrides the file, wherever the file is given");
+
+	char unknown[] = "--nokey=1", bare[] = "com_port=6", nan[] = "--angle_limit=nan", valid[] = "--com_port=7";
+	char* invalid[] = { program, unknown, bare, nan, valid };
+	expect(!loaded.parseArguments(5, invalid), "profile: invalid command line");
+	expect((loaded.com_port == 7) && (loaded.angle_limit == 45.0), "profile: the valid arguments still apply, the invalid ones don't");
+
+	file = fopen("test.profile", "w");
+	fprintf(file, "com_port = 8\nno value here\ntissue_threads = 1.5\n");
+	fclose(file);
+	LaunchProfile broken;
+	expect(!broken.load("test.profile"), "profile: invalid profile file");
+	expect((broken.com_port == 8) && (broken.tissue_threads == 2), "profile: every line checked, invalid ones ignored");
+	expect(!broken.load("missing.profile"), "profile: missing profile file");
+	remove("test.profile");
+}
+
+
+
+/* Link of the command tests: keeps the frames it is given, or takes none */
+struct RecordingTransport
+{
+	std::vector<char> bytes;
+	bool failing;
+	RecordingTransport() : failing(false) {}
+	int write(int nBytes, const char buffer[]) {
+		if (this->failing) {
+			return 0;
+		}
+		this->bytes.insert(this->bytes.end(), buffer, buffer + nBytes);
+		return nBytes;
+	}
+};
+
+/* Wait (at most a second) until the writer thread counted this many frames sent */
+template <class Transport>
+static bool wait_sent(const chai3d::CommandChannel<Transport>& channel, unsigned long long sent)
+{
+	for (int i = 0; (i < 1000) && (channel.getStatistics().sent < sent); i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return channel.getStatistics().sent >= sent;
+}
+
+/* Command queue and channel: the queue keeps its order and refuses items when full, also between two threads; the
+channel sends the newest command of each channel, skips the values the device already has, and counts what it drops */
+void test_command_channel(void)
+{
+	using namespace chai3d;
+
+	/* one thread */
+	SpscQueue<int, 8> queue;
+	int value = 0;
+	bool accepted = true;
+	for (int i = 0; i < 8; i++) {
+		accepted = queue.push(i) && accepted;
+	}
+	expect(accepted && !queue.push(8) && (queue.size() == 8), "command queue: holds its capacity, refuses more");
+	bool ordered = true;
+	for (int i = 0; i < 8; i++) {
+		ordered = queue.pop(value) && (value == i) && ordered;
+	}
+	expect(ordered && !queue.pop(value) && (queue.size() == 0), "command queue: first in, first out");
+
+	/* two threads, many times around the ring */
+	const int items = 200000;
+	SpscQueue<int, 64>* shared = new SpscQueue<int, 64>();
+	int outOfOrder = 0, received = 0;
+	std::thread consumer([&]() {
+		int item;
+		while (received < items) {
+			if (shared->pop(item)) {
+				if (item != received) {
+					outOfOrder++;
+				}
+				received++;
+			}
+		}
+	});
+	for (int i = 0; i < items; i++) {
+		while (!shared->push(i)) {
+			std::this_thread::yield();
+		}
+	}
+	consumer.join();
+	delete shared;
+	expect((received == items) && (outOfOrder == 0), "command queue: every item once and in order between two threads");
+
+	/* commands queued while the writer is stopped: the queue fills up, then only the newest force is sent */
+	RecordingTransport link;
+	CommandChannel<RecordingTransport>* channel = new CommandChannel<RecordingTransport>(link);
+	for (int i = 0; i < 300; i++) {
+		channel->send(COMMAND_FORCE, i, 0.0, 0.0);
+	}
+	CommandStatistics statistics = channel->getStatistics();
+	expect((statistics.depth == 256) && (statistics.queued == 256) && (statistics.dropped == 44), "command channel: depth and drops of a full queue");
+	channel->start();
+	channel->stop();
+	statistics = channel->getStatistics();
+	double force = 0.0;
+	if (link.bytes.size() == (size_t)CommandChannel<RecordingTransport>::frame_length) {
+		memcpy(&force, &link.bytes[3], sizeof(force));
+	}
+	expect((statistics.depth == 0) && (statistics.sent == 1) && (statistics.coalesced == 255), "command channel: repeated forces coalesced");
+	expect((link.bytes.size() == 27) && (link.bytes[0] == 0x55) && (link.bytes[2] == COMMAND_FORCE) && (force == 255.0), "command channel: the newest force is sent");
+
+	/* a value the device already has is not sent again; other channels are */
+	channel->start();
+	channel->send(COMMAND_FORCE, 5.0, 0.0, 0.0);
+	expect(wait_sent(*channel, 2), "command channel: a new force is sent");
+	channel->send(COMMAND_FORCE, 5.0, 0.0, 0.0);
+	channel->send(COMMAND_LED, 1.0, 0.0, 0.0);
+	expect(wait_sent(*channel, 3), "command channel: the LED is sent");
+	channel->stop();
+	statistics = channel->getStatistics();
+	expect((statistics.sent == 3) && (statistics.coalesced == 256) && (link.bytes.size() == 3 * 27) && (link.bytes[2 * 27 + 2] == COMMAND_LED),
+		"command channel: the force the device already has is skipped");
+	delete channel;
+
+	/* a link that takes nothing: the frames are counted as dropped */
+	RecordingTransport dead;
+	dead.failing = true;
+	CommandChannel<RecordingTransport> deadChannel(dead);
+	deadChannel.send(COMMAND_FORCE, 1.0, 0.0, 0.0);
+	deadChannel.send(COMMAND_VIBRATION, 0.5, 100.0, 0.0);
+	deadChannel.start();
+	deadChannel.stop();
+	statistics = deadChannel.getStatistics();
+	expect((statistics.sent == 0) && (statistics.dropped == 2), "command channel: frames the link refuses are dropped");
+}
+
+
+
+/* A device that follows a position set by the test, for tools driven without hardware */
+class ScriptedDevice : public chai3d::cGenericHapticDevice
+{
+public:
+	chai3d::cVector3d position;
+
+	ScriptedDevice() : chai3d::cGenericHapticDevice(0) { this->m_specifications.m_workspaceRadius = 1.0; }
+	bool open() { this->m_deviceReady = true; return true; }
+	bool close() { this->m_deviceReady = false; return true; }
+	bool getPosition(chai3d::cVector3d& a_position) { a_position = this->position; return this->m_deviceReady; }
+};
+
+/* Where tool k of the tool pool bench is at tick i: side by side, going up and down through the tissue */
+static chai3d::cVector3d pool_tool_position(int k, int i)
+{
+	return chai3d::cVector3d(-0.1 + 0.06 * k, 0.0, 0.005 * sin(0.002 * i + k));
+}
+
+/* Tool pool: tick time with 1 to 4 tools pressing the tissue, one after another and in parallel. In parallel the tick
+should stay close to the cost of one tool as long as each worker has a core, and the forces must be those of the
+serial run */
+void bench_tool_pool(void)
+{
+	using namespace chai3d;
+	cWorld* world = new GuardedWorld();
+	cMesh* tissue = new cMesh();
+	cCreatePlane(tissue, 0.3, 0.3);  // z = 0
+	world->addChild(tissue);
+	tissue->createAABBCollisionDetector(0.01);
+	tissue->setStiffness(100.0, true);
+	world->computeGlobalPositions(true);
+
+	const int ticks = 5000;
+	const int maxTools = 4;
+	cPrecisionClock clock;
+	double single = 0.0;
+	for (int n = 1; n <= maxTools; n++) {
+		double time[2];
+		bool parallelRun = false;
+		std::vector<cVector3d> forces[2];
+		for (int parallel = 0; parallel < 2; parallel++) {
+			forces[parallel].reserve(ticks * n);
+			std::vector<std::shared_ptr<ScriptedDevice> > devices;
+			std::vector<cToolCursor*> tools;
+			HapticToolPool pool;
+			for (int k = 0; k < n; k++) {
+				std::shared_ptr<ScriptedDevice> device = std::make_shared<ScriptedDevice>();
+				device->position = pool_tool_position(k, 0);
+				cToolCursor* tool = new cToolCursor(world);
+				world->addChild(tool);
+				tool->setHapticDevice(device);
+				tool->setRadius(0.002);
+				tool->setWorkspaceRadius(1.0);
+				tool->setWaitForSmallForce(false);
+				tool->start();
+				devices.push_back(device);
+				tools.push_back(tool);
+				pool.add(tool, nullptr);
+			}
+			pool.start(parallel != 0);
+			parallelRun = parallelRun || pool.isParallel();
+
+			clock.start(true);
+			for (int i = 0; i < ticks; i++) {
+				for (int k = 0; k < n; k++) {
+					devices[k]->position = pool_tool_position(k, i);
+				}
+				world->computeGlobalPositions(true);
+				pool.update();
+				for (int k = 0; k < n; k++) {
+					forces[parallel].push_back(tools[k]->getDeviceGlobalForce());
+				}
+			}
+			time[parallel] = clock.stop();
+
+			pool.stop();
+			for (int k = 0; k < n; k++) {
+				tools[k]->stop();
+				world->removeChild(tools[k]);
+				delete tools[k];
+			}
+		}
+		if (n == 1) {
+			single = time[0];
+		}
+		printf("%d tools: %7.1f us/tick serial, %7.1f us/tick %s (%.2f x one tool)\n", n, 1.0e6 * time[0] / ticks,
+			1.0e6 * time[1] / ticks, parallelRun ? "parallel" : "serial, no core for a worker", time[1] / single);
+
+		bool touched = false;
+		for (size_t i = 0; i < forces[0].size(); i++) {
+			touched = touched || (forces[0][i].length() > 0.0);
+		}
+		expect(touched, "tool pool: the tools push on the tissue");
+		expect(forces[0] == forces[1], "tool pool: parallel tools give the same forces as serial ones");
+	}
+	delete world;
+}
+
+
+
+/* A field of the first event with the given name in a Chrome trace, or -1 */
+static double trace_field(const std::string& json, const char* name, const char* field)
+{
+	size_t event = json.find(std::string("{\"name\":\"") + name + "\",\"ph\":\"X\"");
+	if (event == std::string::npos) {
+		return -1.0;
+	}
+	std::string key = std::string("\"") + field + "\":";
+	size_t value = json.find(key, event);
+	if ((value == std::string::npos) || (value > json.find('}', event))) {
+		return -1.0;
+	}
+	return atof(json.c_str() + value + key.size());
+}
+
+/* Trace: the scopes of a named thread are written as a Chrome trace under its name, nested as they ran, and only since
+clear(); a thread costs no buffer while tracing is off, and a new thread takes the buffer of one that exited */
+void test_trace(void)
+{
+	using namespace chai3d;
+	const char* filename = "test.trace.json";
+	bool wasEnabled = Trace::isEnabled();
+
+	std::thread([]() {
+		Trace::nameThread("trace off");
+		TRACE_SCOPE("not traced");
+	}).join();
+
+	Trace::setEnabled(true);
+	double old = cPrecisionClock::getCPUTimeSeconds();
+	cSleepMs(1);
+	Trace::clear();
+	std::thread([old]() {
+		Trace::nameThread("trace test");
+		Trace::record("before clear", old - 0.001, old);
+		TRACE_SCOPE("outer");
+		{
+			TRACE_SCOPE("inner");
+			cSleepMs(2);
+		}
+	}).join();
+	int numBuffers = Trace::getNumBuffers();
+
+	if (!expect(Trace::write(filename), "trace: write the trace")) {
+		Trace::setEnabled(wasEnabled);
+		return;
+	}
+	std::string json;
+	FILE* file = fopen(filename, "rb");
+	if (file != NULL) {
+		char block[4096];
+		size_t n;
+		while ((n = fread(block, 1, sizeof(block), file)) > 0) {
+			json.append(block, n);
+		}
+		fclose(file);
+	}
+	remove(filename);
+
+	expect(json.compare(0, 39, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") == 0, "trace: Chrome trace header");
+	expect((json.size() > 3) && (json.compare(json.size() - 3, 3, "]}\n") == 0), "trace: the event list is closed");
+	expect(json.find("\"args\":{\"name\":\"trace test\"}") != std::string::npos, "trace: the thread has its name");
+	double outerBegin = trace_field(json, "outer", "ts"), outerDuration = trace_field(json, "outer", "dur");
+	double innerBegin = trace_field(json, "inner", "ts"), innerDuration = trace_field(json, "inner", "dur");
+	expect((outerBegin >= 0.0) && (innerBegin >= 0.0), "trace: the scopes are written");
+	expect((innerBegin >= outerBegin) && (innerBegin + innerDuration <= outerBegin + outerDuration + 0.002),
+		"trace: the inner scope is within the outer one");
+	expect(innerDuration >= 1000.0, "trace: durations in microseconds");
+	expect(json.find("before clear") == std::string::npos, "trace: the events before clear() are left out");
+	expect((json.find("trace off") == std::string::npos) && (json.find("not traced") == std::string::npos),
+		"trace: nothing recorded while tracing is off");
+
+	std::thread([]() {
+		TRACE_SCOPE("next thread");
+	}).join();
+	expect(Trace::getNumBuffers() == numBuffers, "trace: a new thread takes the buffer of one that exited");
+
+	Trace::setEnabled(wasEnabled);
+}
+
+
+
+/* A value of the triple buffer test, big enough that a torn or reused buffer shows: every value is the sequence number */
+struct HandoffFrame {
+	unsigned int sequence;
+	unsigned int values[256];
+};
+
+/* Triple buffer and scene snapshot: the reader gets the newest complete value, and the writer never touches the buffer
+being read, however long the reader holds it */
+void test_scene_handoff(void)
+{
+	using namespace chai3d;
+
+	/* one thread */
+	{
+		TripleBuffer<int> buffer;
+		buffer.reset(0);
+		expect(!buffer.update() && (buffer.read() == 0), "handoff: nothing new before the first publish");
+		for (int i = 1; i <= 3; i++) {
+			buffer.write() = i;
+			buffer.publish();
+		}
+		expect(buffer.update() && (buffer.read() == 3), "handoff: the newest value wins");
+		expect(!buffer.update() && (buffer.read() == 3), "handoff: nothing new since");
+		bool reused = false;
+		for (int i = 4; i < 100; i++) {
+			reused = reused || (&buffer.write() == &buffer.read());
+			buffer.write() = i;
+			buffer.publish();
+		}
+		expect(!reused && (buffer.read() == 3), "handoff: the writer never gets the buffer being read");
+	}
+
+	/* two threads: the reader holds each value a while and checks that it did not change meanwhile */
+	{
+		const unsigned int frames = 200000;
+		TripleBuffer<HandoffFrame> buffer;
+		HandoffFrame zero;
+		memset(&zero, 0, sizeof(zero));
+		buffer.reset(zero);
+		std::atomic<bool> done(false);
+		std::thread writer([&]() {
+			for (unsigned int s = 1; s <= frames; s++) {
+				HandoffFrame& frame = buffer.write();
+				frame.sequence = s;
+				for (int k = 0; k < 256; k++) {
+					frame.values[k] = s;
+				}
+				buffer.publish();
+				if (s % 16 == 0) {
+					std::this_thread::yield();  // the reader gets its turns on a machine with few cores
+				}
+			}
+			done.store(true, std::memory_order_release);
+		});
+
+		int torn = 0, older = 0, changed = 0, updates = 0;
+		unsigned int previous = 0;
+		while (true) {
+			bool finished = done.load(std::memory_order_acquire);
+			if (buffer.update()) {
+				const HandoffFrame& frame = buffer.read();
+				unsigned int s = frame.sequence;
+				bool whole = true;
+				for (int k = 0; k < 256; k++) {
+					whole = whole && (frame.values[k] == s);
+				}
+				torn += whole ? 0 : 1;
+				older += (s <= previous) ? 1 : 0;
+				previous = s;
+
+				std::this_thread::yield();  // hold it while the writer goes on
+				bool same = (frame.sequence == s);
+				for (int k = 0; k < 256; k++) {
+					same = same && (frame.values[k] == s);
+				}
+				changed += same ? 0 : 1;
+				updates++;
+			}
+			if (finished) {
+				break;
+			}
+		}
+		writer.join();
+		printf("%u values published, %d taken\n", frames, updates);
+		expect(torn == 0, "handoff: every value taken is complete");
+		expect(older == 0, "handoff: every value taken is newer than the one before");
+		expect(changed == 0, "handoff: the value being read is never written");
+		expect(previous == frames, "handoff: the last value is picked up");
+	}
+
+	/* the scene snapshot: the image of the tool shows the newest captured tick */
+	{
+		cWorld* world = new cWorld();
+		ShaftTool* tool = new ShaftTool(world, 4, 0.1);
+		cMatrix3d rotation;
+		rotation.identity();
+		tool->setDeviceGlobalPose(cVector3d(0.0, 0.0, 0.0), rotation);
+		tool->initialize();
+		cShapeSphere* image = new cShapeSphere(0.01);
+		SceneSnapshot view(world);
+		view.addTool(tool, image, 0.002);
+		expect(!view.update(), "handoff: no snapshot before the first capture");
+		for (int i = 1; i <= 3; i++) {
+			tool->setDeviceGlobalPose(cVector3d(0.01 * i, 0.0, 0.0), rotation);
+			view.capture();
+		}
+		expect(view.update() && (image->getLocalPos().x() == 0.03), "handoff: the view shows the newest captured tick");
+		expect(!view.update(), "handoff: no new snapshot since");
+		delete tool;
+		delete world;
+	}
+}
+
+
+
+/* Allocation guard, in builds with HAPTIC_ALLOCATION_CHECK: once warmed up, a tick that allocates on the heap is one
+violation, whether the haptic thread or a worker allocated, and a tick that does not allocate is none. Run last: the
+ticks of the warm-up stay counted */
+void test_allocation_guard(void)
+{
+	using namespace chai3d;
+	if (!AllocationGuard::isEnabled()) {
+		printf("allocation guard: HAPTIC_ALLOCATION_CHECK is not defined, skipped\n");
+		return;
+	}
+	while (AllocationGuard::getTicks() < AllocationGuard::WARM_UP_TICKS) {
+		HAPTIC_TICK_SCOPE();
+	}
+	unsigned long long violations = AllocationGuard::getViolations();
+	unsigned long long allocations = AllocationGuard::getAllocations();
+
+	int sum = 0;
+	{
+		HAPTIC_TICK_SCOPE();
+		for (int i = 0; i < 100; i++) {
+			sum += i;
+		}
+	}
+	expect((sum == 4950) && (AllocationGuard::getViolations() == violations), "allocation guard: a clean tick is no violation");
+
+	printf("allocation guard: a tick and a worker allocate on purpose below\n");
+	std::vector<int> values;
+	{
+		HAPTIC_TICK_SCOPE();
+		values.resize(100);
+		{
+			HAPTIC_ALLOCATION_SCOPE();  // a part of the tick run by the haptic thread itself
+			values.resize(1000);
+		}
+	}
+	expect((values.size() == 1000) && (AllocationGuard::getViolations() == violations + 1),
+		"allocation guard: a tick that allocates is one violation");
+	expect(AllocationGuard::getAllocations() >= allocations + 2, "allocation guard: its allocations are counted");
+
+	std::vector<int>* shared = new std::vector<int>();
+	std::thread worker([shared]() {
+		HAPTIC_ALLOCATION_SCOPE();
+		shared->resize(100);
+	});
+	worker.join();
+	expect((shared->size() == 100) && (AllocationGuard::getViolations() == violations + 2),
+		"allocation guard: a worker that allocates is a violation");
+	delete shared;
+	AllocationGuard::printStatistics();
+}
+
+
+
+/* Run every check; returns the number that failed */
+int runSelfTests(void)
+{
+	struct SelfTest {
+		const char* name;
+		void(*run)(void);
+	};
+	const SelfTest tests[] = {
+		{ "orientation", bench_orientation },
+		{ "kinematics batch", bench_kinematics_batch },
+		{ "pipeline", bench_pipeline },
+		{ "shaft", bench_shaft },
+		{ "broadphase", bench_broadphase },
+		{ "contact model", test_contact_model },
+		{ "tissue", bench_tissue },
+		{ "view convert", bench_view_convert },
+		{ "video convert", bench_video_convert },
+		{ "session", bench_session },
+		{ "analytics", bench_analytics },
+		{ "replay", bench_replay },
+		{ "udp transport", test_udp_transport },
+		{ "pose broadcast", bench_pose_broadcast },
+		{ "pose history", test_pose_history },
+		{ "device config", test_device_config },
+		{ "device stall", test_device_stall },
+		{ "launch profile", test_launch_profile },
+		{ "command channel", test_command_channel },
+		{ "tool pool", bench_tool_pool },
+		{ "trace", test_trace },
+		{ "scene handoff", test_scene_handoff },
+		{ "allocation guard", test_allocation_guard },
+	};
+	selfTestFailures = 0;
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		printf("%s...\n", tests[i].name);
+		int failures = selfTestFailures;
+		tests[i].run();
+		printf("%s: %s\n", tests[i].name, (selfTestFailures == failures) ? "ok" : "FAILED");
+	}
+	printf("Self test: %d failed checks\n", selfTestFailures);
+	return selfTestFailures;
+}